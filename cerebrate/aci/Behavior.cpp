@@ -19,7 +19,7 @@
 
 
 #include "Behavior.hpp"
-#include "Scanalyzer.hpp"
+#include "Tracker.hpp"
 #include "MotionManager.hpp"
 #include "Effects.hpp"
 #include "gfx/wrap_gl.hpp"
@@ -41,7 +41,9 @@ Behavior(double home_x, double home_y,
   _green(green), _red(red),
   _mode(WAIT),
   _potential_target_dist(-1),
+  _potential_target_id(-1),
   _active_target_dist(-1),
+  _active_target_id(-1),
   _target_timeout(0)
 {
 }
@@ -55,6 +57,7 @@ FakeUpdate(double target_x, double target_y)
   
   _potential_target_x = target_x;
   _potential_target_y = target_y;
+  _potential_target_id = -1;
   _potential_target_dist = sqrt(sqr(_home_x - target_x)
 				+ sqr(_home_y - target_y));
   
@@ -63,9 +66,9 @@ FakeUpdate(double target_x, double target_y)
 
 
 void Behavior::
-Update(const Scanalysis & scanalysis, const Frame & pose, double deadzone)
+Update(const Tracker & tracker, const Frame & pose, double deadzone)
 {
-  FindTarget(scanalysis, pose, deadzone);
+  FindTarget(tracker, pose, deadzone);
   DoUpdate();
 }
 
@@ -79,6 +82,7 @@ DoUpdate()
   
   if(_potential_target_dist < 0){
     _active_target_dist = -1;
+    _active_target_id = -1;
     _target_timeout.Set(0);
     _mode = WAIT;
     return;
@@ -89,6 +93,7 @@ DoUpdate()
   _active_target_x = _potential_target_x;
   _active_target_y = _potential_target_y;
   _active_target_dist = _potential_target_dist;
+  _active_target_id = _potential_target_id;
   
   if(_active_target_dist >= _green)
     _mode = WAIT;
@@ -178,29 +183,35 @@ DrawTarget() const
 
 
 void Behavior::
-FindTarget(const Scanalysis & scanalysis, const Frame & pose, double deadzone)
+FindTarget(const Tracker & tracker, const Frame & pose, double deadzone)
 {
+  // don't extrapolate tracks by more than this if scans stall
+  static const double max_lookahead(0.5);
+  const Timestamp now(Timestamp::Now());
+  
   _potential_target_dist = numeric_limits<double>::max();
+  _potential_target_id = -1;
   
-  for(size_t ic(0); ic < scanalysis.circle.size(); ++ic){
-    if(0 == scanalysis.circle[ic])
+  for(size_t it(0); it < tracker.GetCapacity(); ++it){
+    const Track * track(tracker.GetTrack(it));
+    if((0 == track) || ( ! track->confirmed))
+      continue;
+    double x, y;
+    track->Predict(minval(max_lookahead,
+			  (now - track->stamp).ConvertToSeconds()), x, y);
+    if(sqrt(sqr(pose.X() - x) + sqr(pose.Y() - y)) < deadzone)
       continue;
-    for(size_t ip(scanalysis.startindex[ic]);
-	ip <= scanalysis.endindex[ic];
-	++ip){
-      double dx(pose.X() - scanalysis.x[ip]);
-      double dy(pose.Y() - scanalysis.y[ip]);
-      double ds(sqrt(sqr(dx) + sqr(dy)));
-      if(ds < deadzone)
-	continue;
-      dx = _home_x - scanalysis.x[ip];
-      dy = _home_y - scanalysis.y[ip];
-      ds = sqrt(sqr(dx) + sqr(dy));
-      if(ds < _potential_target_dist){
-	_potential_target_dist = ds;
-	_potential_target_x = scanalysis.x[ip];
-	_potential_target_y = scanalysis.y[ip];
-      }
+    const double ds(sqrt(sqr(_home_x - x) + sqr(_home_y - y)));
+    if(ds < _potential_target_dist){
+      _potential_target_dist = ds;
+      _potential_target_x = x;
+      _potential_target_y = y;
+      _potential_target_id = track->id;
+    }
+    if((track->id == _active_target_id) && (_active_target_dist >= 0)){
+      _active_target_x = x;
+      _active_target_y = y;
+      _active_target_dist = ds;
     }
   }
 
@@ -25,7 +25,7 @@
 #include <aci/Timeout.hpp>
 
 
-class Scanalysis;
+class Tracker;
 class MotionManager;
 class Effects;
 
@@ -42,7 +42,12 @@ public:
   Behavior(double home_x, double home_y,
 	   double green, double red);
   
-  void Update(const Scanalysis & scanalysis, const sfl::Frame & pose,
+  /**
+     Choose the confirmed track closest to home, ignoring the deadzone
+     around the robot. Tracks are extrapolated to the current time, and
+     the active target keeps following its track between decisions.
+  */
+  void Update(const Tracker & tracker, const sfl::Frame & pose,
 	      double deadzone);
   void FakeUpdate(double target_x, double target_y);
   void Perform(const sfl::Frame & pose,
@@ -53,7 +58,7 @@ public:
 
   
 private:
-  void FindTarget(const Scanalysis & scanalysis, const sfl::Frame & pose,
+  void FindTarget(const Tracker & tracker, const sfl::Frame & pose,
 		  double deadzone);
   void DoUpdate();
   void DoWait(MotionManager & mm, Effects & effects);
@@ -69,9 +74,11 @@ private:
   double _potential_target_dist; // use -1 to signal "no target"
   double _potential_target_x;
   double _potential_target_y;
+  int _potential_target_id;	// -1 if not tracked
   double _active_target_dist;	// use -1 to signal "no target"
   double _active_target_x;
   double _active_target_y;
+  int _active_target_id;
   Timeout _target_timeout;
 };
 
@@ -31,8 +31,10 @@
 #include <gfx/Mousehandler.hpp>
 #include <drivers/FModIPDCMOT.hpp>
 #include <drivers/FModTCP.hpp>
+#include <drivers/periodic.h>
 #include <sfl/numeric.hpp>
 #include <iostream>
+#include <vector>
 
 
 using namespace std;
@@ -98,8 +100,8 @@ Cactus():
   static const double cluster_thresh(0.05);
   static const double rhomax(8);
   static const string comport("/dev/tts/0");
-  static const unsigned long baudrate(38400L);
-  static const unsigned int usec_cycle(100000);
+  static const unsigned long baudrate(500000L);
+  static const unsigned int usec_cycle(0); // continuous output
   _scanalyzer = auto_ptr<Scanalyzer>(new Scanalyzer(cluster_thresh,
 						    rhomax,
 						    "bgmap",
@@ -213,6 +215,14 @@ Command(std::istream & is, std::ostream & os, std::ostream * dbg)
        << " sscan    <filename>     Save current scan to file.\n"
        << " sbg      <filename>     Save current background map to file.\n"
        << " lbg      <filename>     Load background map from file.\n"
+       << " lzone    <filename>     Load valid zone (x y pairs) from file.\n"
+       << " ngrid <x0> <y0> <nx> <ny> <res>\n"
+       << "                         Start a new occupancy grid.\n"
+       << " sgrid    <filename>     Save occupancy grid to file.\n"
+       << " lgrid    <filename>     Load occupancy grid from file.\n"
+       << " rec      [<basename>]   Record scans and encoders for odocal\n"
+       << "                         to basename.scan and .enc, or stop.\n"
+       << " lodo     <filename>     Load odometry calibration from file.\n"
        << " ixy                     Init (x, y).\n"
        << " itheta                  Init theta (only after ixy!!).\n"
        << " loc                     Localization heuristic.\n"
@@ -223,7 +233,8 @@ Command(std::istream & is, std::ostream & os, std::ostream * dbg)
        << " start                   Start using behavior.\n"
        << " stop                    Stop using behavior.\n"
        << " alon                    Enable automatic (re)localizing.\n"
-       << " aloff                   Disable automatic (re)localizing.\n";
+       << " aloff                   Disable automatic (re)localizing.\n"
+       << " timing                  Show periodic task overruns and jitter.\n";
   
   else if((cmd == "b") || (cmd == "brake"))
     _motion_manager->Wait();
@@ -298,6 +309,54 @@ Command(std::istream & is, std::ostream & os, std::ostream * dbg)
     else if( ! _localizer->LoadBackground(fname))
       os << "ERROR in LoadBackground(" << fname << ").\n";
   }
+  else if(cmd == "lzone"){
+    string fname;
+    if( ! (is >> fname))
+      os << "ERROR reading filename.\n";
+    else if( ! _scanalyzer->LoadValidZone(fname))
+      os << "ERROR in LoadValidZone(" << fname << ").\n";
+  }
+  else if(cmd == "ngrid"){
+    double x0, y0, res;
+    int nx, ny;
+    if( ! (is >> x0 >> y0 >> nx >> ny >> res) || (nx < 1) || (ny < 1)
+       || (res <= 0))
+      os << "ERROR reading grid parameters.\n";
+    else
+      _localizer->CreateGrid(x0, y0, nx, ny, res);
+  }
+  else if(cmd == "sgrid"){
+    string fname;
+    if( ! (is >> fname))
+      os << "ERROR reading filename.\n";
+    else if( ! _localizer->SaveGrid(fname))
+      os << "ERROR in SaveGrid(" << fname << ").\n";
+  }
+  else if(cmd == "lgrid"){
+    string fname;
+    if( ! (is >> fname))
+      os << "ERROR reading filename.\n";
+    else if( ! _localizer->LoadGrid(fname))
+      os << "ERROR in LoadGrid(" << fname << ").\n";
+  }
+  else if(cmd == "rec"){
+    string base;
+    if( ! (is >> base))
+      base.clear();
+    const string scan_fname(base.empty() ? "" : base + ".scan");
+    const string enc_fname(base.empty() ? "" : base + ".enc");
+    if( ! _scanalyzer->Record(scan_fname))
+      os << "ERROR in Scanalyzer::Record(" << scan_fname << ").\n";
+    else if( ! _odometry->Record(enc_fname))
+      os << "ERROR in Odometry::Record(" << enc_fname << ").\n";
+  }
+  else if(cmd == "lodo"){
+    string fname;
+    if( ! (is >> fname))
+      os << "ERROR reading filename.\n";
+    else if( ! _odometry->LoadCalibration(fname))
+      os << "ERROR in LoadCalibration(" << fname << ").\n";
+  }
   else if(cmd == "ixy"){
     if( ! InitOdometryXY(anchor_x, anchor_y, dbg))
       os << "ERROR in InitOdometryXY().\n";
@@ -345,6 +404,11 @@ Command(std::istream & is, std::ostream & os, std::ostream * dbg)
   else if(cmd == "aloff"){
     SetEnableAutoLocalize(false);
   }
+  else if(cmd == "timing"){
+    vector<char> report(periodic_sprint(0, 0) + 1);
+    periodic_sprint(& report[0], report.size());
+    os << & report[0];
+  }
   else
     os << "ERROR: unknown command \"" << cmd << "\"\n";
   return true;
@@ -500,6 +564,13 @@ AutoLocalize(std::ostream * dbg)
 }
 
 
+bool Cactus::
+WaitScan(unsigned int usec_timeout) const
+{
+  return _scanalyzer->WaitScan(usec_timeout);
+}
+
+
 /** \todo scanalyzer is updated through localizer, same for drawing... */
 void Cactus::
 Update()
@@ -512,7 +583,7 @@ Update()
   switch(_state){
   case MANUAL_SPEED:
   case MANUAL_GOAL:
-    _behavior->Update(_localizer->GetScanalysis(), pose, deadzone);
+    _behavior->Update(_localizer->GetTracker(), pose, deadzone);
     _effects->SetLightshow(5, 6,
 			   5, 6,
 			   5, 6,
@@ -524,7 +595,7 @@ Update()
     _behavior->Perform(pose, * _motion_manager, * _effects);
     break;
   case AUTO:
-    _behavior->Update(_localizer->GetScanalysis(), pose, deadzone);
+    _behavior->Update(_localizer->GetTracker(), pose, deadzone);
     _behavior->Perform(pose, * _motion_manager, * _effects);
     break;
   default:
@@ -561,8 +632,10 @@ UpdateWatchdog()
     exit(EXIT_FAILURE);
   }
   
+  // The particle filter recovers the pose without moving the robot,
+  // retried on each call until its particles have converged.
   if(_enable_auto_localize && (Watchdog::OK != _watchdog->GetLocalizerState()))
-    AutoLocalize(0);
+    _localizer->Recover();
   
   //   if( ! _watchdog->MotorsOk()){
   //     cerr << ":o( motors blocked!\n";
@@ -49,6 +49,13 @@ public:
   ~Cactus();
   
   void Update();
+  
+  /**
+     Block until the scanner has a new scan for Update(), or at most
+     usec_timeout. Does not touch the Cactus state, so it can be called
+     without holding whatever lock serializes Update().
+  */
+  bool WaitScan(unsigned int usec_timeout) const;
 
   bool InitOdometryXY(double & anchor_x, double & anchor_y,
 		      std::ostream * dbg);
@@ -22,18 +22,32 @@
 #include "gfx/wrap_glu.hpp"
 #include "Scanalyzer.hpp"
 #include <sfl/numeric.hpp>
+#include <sfl/Frame.hpp>
 #include <iostream>		// dbg
+#include <cstring>
+#include <cmath>
 
 
 using namespace sfl;
 
 
+CircleLSQ::
+CircleLSQ():
+  xc(0), yc(0), radius(0), npoints(0), label(-1), maxdist(0), ninliers(0),
+  rms(0)
+{
+  memset(cov, 0, sizeof(cov));
+}
+
+
 CircleLSQ::
 CircleLSQ(double _xc, double _yc, double _radius, int _npoints, int _label,
-	  double _maxdist):
+	  double _maxdist, int _ninliers, double _rms,
+	  const double _cov[3][3]):
   xc(_xc), yc(_yc), radius(_radius), npoints(_npoints), label(_label),
-  maxdist(_maxdist)
+  maxdist(_maxdist), ninliers(_ninliers), rms(_rms)
 {
+  memcpy(cov, _cov, sizeof(cov));
 }
 
 
@@ -41,33 +55,206 @@ CircleLSQ::
 CircleLSQ(const CircleLSQ & original):
   xc(original.xc), yc(original.yc), radius(original.radius),
   npoints(original.npoints), label(original.label),
-  maxdist(original.maxdist)
+  maxdist(original.maxdist), ninliers(original.ninliers),
+  rms(original.rms)
+{
+  memcpy(cov, original.cov, sizeof(cov));
+}
+
+
+/**
+   Geometric residuals of the points flagged in inlier (all points if
+   inlier is 0), with the normal equations of the Gauss-Newton step
+   for (xc, yc, radius).
+   \return The number of points taken into account.
+*/
+static int geometric(const Scanalysis & scanalysis,
+		     int startindex, int endindex, const bool * inlier,
+		     double xc, double yc, double radius,
+		     double jtj[3][3], double jtd[3],
+		     double & ssq, double & maxdist)
+{
+  memset(jtj, 0, 9 * sizeof(double));
+  memset(jtd, 0, 3 * sizeof(double));
+  ssq = 0;
+  maxdist = 0;
+  int count(0);
+  for(int i(startindex); i <= endindex; ++i){
+    if((0 != inlier) && ( ! inlier[i - startindex]))
+      continue;
+    const double dx(scanalysis.x[i] - xc);
+    const double dy(scanalysis.y[i] - yc);
+    const double rho(sqrt(sqr(dx) + sqr(dy)));
+    const double dist(rho - radius);
+    // d(dist) / d(xc, yc, radius)
+    double jj[3] = { 0, 0, -1 };
+    if(rho > 0){
+      jj[0] = - dx / rho;
+      jj[1] = - dy / rho;
+    }
+    for(int k(0); k < 3; ++k){
+      for(int l(0); l < 3; ++l)
+	jtj[k][l] += jj[k] * jj[l];
+      jtd[k] += jj[k] * dist;
+    }
+    ssq += sqr(dist);
+    if(absval(dist) > maxdist)
+      maxdist = absval(dist);
+    ++count;
+  }
+  return count;
+}
+
+
+/** \return false if aa is (close to) singular. */
+static bool invert3(const double aa[3][3], double inv[3][3])
+{
+  inv[0][0] = aa[1][1] * aa[2][2] - aa[1][2] * aa[2][1];
+  inv[0][1] = aa[0][2] * aa[2][1] - aa[0][1] * aa[2][2];
+  inv[0][2] = aa[0][1] * aa[1][2] - aa[0][2] * aa[1][1];
+  inv[1][0] = aa[1][2] * aa[2][0] - aa[1][0] * aa[2][2];
+  inv[1][1] = aa[0][0] * aa[2][2] - aa[0][2] * aa[2][0];
+  inv[1][2] = aa[0][2] * aa[1][0] - aa[0][0] * aa[1][2];
+  inv[2][0] = aa[1][0] * aa[2][1] - aa[1][1] * aa[2][0];
+  inv[2][1] = aa[0][1] * aa[2][0] - aa[0][0] * aa[2][1];
+  inv[2][2] = aa[0][0] * aa[1][1] - aa[0][1] * aa[1][0];
+  const double det(aa[0][0] * inv[0][0] + aa[0][1] * inv[1][0]
+		   + aa[0][2] * inv[2][0]);
+  if(absval(det) < 1e-12)
+    return false;
+  for(int k(0); k < 3; ++k)
+    for(int l(0); l < 3; ++l)
+      inv[k][l] /= det;
+  return true;
+}
+
+
+/** Circle through three points, false if they are (nearly) collinear. */
+static bool circle3(double x0, double y0, double x1, double y1,
+		    double x2, double y2,
+		    double & xc, double & yc, double & radius)
+{
+  const double dd(2 * (x0 * (y1 - y2) + x1 * (y2 - y0) + x2 * (y0 - y1)));
+  if(absval(dd) < 1e-9)
+    return false;
+  const double s0(sqr(x0) + sqr(y0));
+  const double s1(sqr(x1) + sqr(y1));
+  const double s2(sqr(x2) + sqr(y2));
+  xc = (s0 * (y1 - y2) + s1 * (y2 - y0) + s2 * (y0 - y1)) / dd;
+  yc = (s0 * (x2 - x1) + s1 * (x0 - x2) + s2 * (x1 - x0)) / dd;
+  radius = sqrt(sqr(x0 - xc) + sqr(y0 - yc));
+  return true;
+}
+
+
+/**
+   Flag the points within thresh of the circle.
+   \return The number of inliers, with their sum of squared distances.
+*/
+static int consensus(const Scanalysis & scanalysis,
+		     int startindex, int endindex, double thresh,
+		     double xc, double yc, double radius,
+		     bool * inlier, double & ssq)
+{
+  int count(0);
+  ssq = 0;
+  for(int i(startindex); i <= endindex; ++i){
+    const double dist(absval(sqrt(sqr(scanalysis.x[i] - xc)
+				  + sqr(scanalysis.y[i] - yc)) - radius));
+    inlier[i - startindex] = dist <= thresh;
+    if(dist <= thresh){
+      ++count;
+      ssq += sqr(dist);
+    }
+  }
+  return count;
+}
+
+
+/** Covariance of the fit from the normal equations at the solution. */
+static void covariance(const double jtj[3][3], double ssq, int count,
+		       double cov[3][3])
 {
+  double inv[3][3];
+  if((count <= 3) || ( ! invert3(jtj, inv))){
+    memset(cov, 0, 9 * sizeof(double));
+    return;
+  }
+  const double var(ssq / (count - 3));
+  for(int k(0); k < 3; ++k)
+    for(int l(0); l < 3; ++l)
+      cov[k][l] = var * inv[k][l];
 }
 
 
 CircleLSQ * CircleLSQ::
 Create(const Scanalysis & scanalysis, int startindex, int endindex, int label)
+{
+  CircleLSQ result;
+  if( ! Fit(scanalysis, startindex, endindex, label, result))
+    return 0;
+  return new CircleLSQ(result);
+}
+
+
+CircleLSQ * CircleLSQ::
+Create(const Moments & moments, const Scanalysis & scanalysis,
+       int startindex, int endindex, int label)
+{
+  CircleLSQ result;
+  if( ! Fit(moments, scanalysis, startindex, endindex, label, result))
+    return 0;
+  return new CircleLSQ(result);
+}
+
+
+CircleLSQ * CircleLSQ::
+CreateRobust(const Scanalysis & scanalysis, int startindex, int endindex,
+	     int label, double inlier_thresh, int budget)
+{
+  CircleLSQ result;
+  if( ! FitRobust(scanalysis, startindex, endindex, label, inlier_thresh,
+		  budget, result))
+    return 0;
+  return new CircleLSQ(result);
+}
+
+
+bool CircleLSQ::
+Fit(const Scanalysis & scanalysis, int startindex, int endindex, int label,
+    CircleLSQ & result)
+{
+  if(endindex - startindex + 1 < 3)
+    return false;
+  Moments moments;
+  moments.Accumulate(scanalysis, startindex, endindex);
+  return Fit(moments, scanalysis, startindex, endindex, label, result);
+}
+
+
+bool CircleLSQ::
+Fit(const Moments & moments, const Scanalysis & scanalysis,
+    int startindex, int endindex, int label, CircleLSQ & result)
 {
   const int I(endindex - startindex + 1);
   if(I < 3)
-    return 0;
+    return false;
   
-  const double Sx( CalculateSxn(1, scanalysis, startindex, endindex));
-  const double Sx2(CalculateSxn(2, scanalysis, startindex, endindex));
-  const double Sx3(CalculateSxn(3, scanalysis, startindex, endindex));
+  const double Sx(moments.Sx);
+  const double Sx2(moments.Sx2);
+  const double Sx3(moments.Sx3);
   const double S2x(sqr(Sx));
   const double S2x2(sqr(Sx2));
   
-  const double Sy( CalculateSym(1, scanalysis, startindex, endindex));
-  const double Sy2(CalculateSym(2, scanalysis, startindex, endindex));
-  const double Sy3(CalculateSym(3, scanalysis, startindex, endindex));
+  const double Sy(moments.Sy);
+  const double Sy2(moments.Sy2);
+  const double Sy3(moments.Sy3);
   const double S2y(sqr(Sy));
   const double S2y2(sqr(Sy2));
 
-  const double Sxy( CalculateSxnym(1, 1, scanalysis, startindex, endindex));
-  const double Sx2y(CalculateSxnym(2, 1, scanalysis, startindex, endindex));
-  const double Sxy2(CalculateSxnym(1, 2, scanalysis, startindex, endindex));
+  const double Sxy(moments.Sxy);
+  const double Sx2y(moments.Sx2y);
+  const double Sxy2(moments.Sxy2);
   const double S2xy(sqr(Sxy));
   
   const double
@@ -86,15 +273,178 @@ Create(const Scanalysis & scanalysis, int startindex, int endindex, int label)
   const double
     radius(sqrt(xc*xc + yc*yc + (Sx2 + Sy2 - 2*Sx*xc - 2*Sy*yc) / I));
   
-  double maxdist(0);
-  for(int i(startindex); i <= endindex; ++i){
-    const double dist(absval(sqrt(sqr(scanalysis.x[i] - xc)
-				  + sqr(scanalysis.y[i] - yc)) - radius));
-    if(dist > maxdist)
-      maxdist = dist;
+  double jtj[3][3], jtd[3], ssq, maxdist, cov[3][3];
+  geometric(scanalysis, startindex, endindex, 0, xc, yc, radius,
+	    jtj, jtd, ssq, maxdist);
+  covariance(jtj, ssq, I, cov);
+  
+  result = CircleLSQ(xc, yc, radius, I, label, maxdist, I, sqrt(ssq / I), cov);
+  return true;
+}
+
+
+bool CircleLSQ::
+FitRobust(const Scanalysis & scanalysis, int startindex, int endindex,
+	  int label, double inlier_thresh, int budget, CircleLSQ & result)
+{
+  if( ! Fit(scanalysis, startindex, endindex, label, result))
+    return false;
+  
+  // Fit() made two passes, the first trim and the final evaluation
+  // below make two more.
+  budget -= 4;
+  
+  const int I(endindex - startindex + 1);
+  bool inlier[Scanalysis::scansize];
+  double xc(result.xc);
+  double yc(result.yc);
+  double radius(result.radius);
+  double ssq;
+  int count(0);
+  if(finite(xc) && finite(yc) && finite(radius))
+    count = consensus(scanalysis, startindex, endindex, inlier_thresh,
+		      xc, yc, radius, inlier, ssq);
+  
+  // RANSAC, only needed if the algebraic fit left outliers. Half of
+  // the budget is reserved for refinement. The sampling is seeded by
+  // the cluster position so that results are reproducible.
+  if(count < I){
+    bool candidate[Scanalysis::scansize];
+    unsigned int seed(2654435761U * (startindex + 1));
+    const int nsamples(budget / 2);
+    budget -= nsamples;
+    for(int is(0); is < nsamples; ++is){
+      int ii[3];
+      for(int k(0); k < 3; ++k){
+	seed = 1664525U * seed + 1013904223U;
+	ii[k] = startindex + (seed >> 8) % I;
+      }
+      if((ii[0] == ii[1]) || (ii[1] == ii[2]) || (ii[0] == ii[2]))
+	continue;
+      double cx, cy, cr;
+      if( ! circle3(scanalysis.x[ii[0]], scanalysis.y[ii[0]],
+		    scanalysis.x[ii[1]], scanalysis.y[ii[1]],
+		    scanalysis.x[ii[2]], scanalysis.y[ii[2]], cx, cy, cr))
+	continue;
+      double cssq;
+      const int cc(consensus(scanalysis, startindex, endindex,
+			     inlier_thresh, cx, cy, cr, candidate, cssq));
+      if((cc > count) || ((cc == count) && (cssq < ssq))){
+	count = cc;
+	ssq = cssq;
+	xc = cx;
+	yc = cy;
+	radius = cr;
+	memcpy(inlier, candidate, I * sizeof(bool));
+	if(count == I)
+	  break;
+      }
+    }
   }
+  if(count < 3)
+    return true;		// keep the algebraic fit
   
-  return new CircleLSQ(xc, yc, radius, I, label, maxdist);
+  // Gauss-Newton on the inliers, re-trimmed after each step, which
+  // makes two passes per iteration.
+  double jtj[3][3], jtd[3], inv[3][3], maxdist;
+  for(/**/; budget >= 2; budget -= 2){
+    geometric(scanalysis, startindex, endindex, inlier, xc, yc, radius,
+	      jtj, jtd, ssq, maxdist);
+    if( ! invert3(jtj, inv))
+      break;
+    double step[3];
+    for(int k(0); k < 3; ++k)
+      step[k] = - (inv[k][0] * jtd[0] + inv[k][1] * jtd[1]
+		   + inv[k][2] * jtd[2]);
+    if(( ! finite(step[0])) || ( ! finite(step[1])) || ( ! finite(step[2]))
+       || (radius + step[2] <= 0))
+      break;
+    xc += step[0];
+    yc += step[1];
+    radius += step[2];
+    const int cc(consensus(scanalysis, startindex, endindex, inlier_thresh,
+			   xc, yc, radius, inlier, ssq));
+    if(cc < 3)
+      return true;
+    const bool changed(cc != count);
+    count = cc;
+    if(( ! changed)
+       && (absval(step[0]) + absval(step[1]) + absval(step[2]) < 1e-9))
+      break;
+  }
+  
+  count = geometric(scanalysis, startindex, endindex, inlier, xc, yc, radius,
+		    jtj, jtd, ssq, maxdist);
+  if(count < 3)
+    return true;
+  double cov[3][3];
+  covariance(jtj, ssq, count, cov);
+  result = CircleLSQ(xc, yc, radius, I, label, maxdist, count,
+		     sqrt(ssq / count), cov);
+  return true;
+}
+
+
+void CircleLSQ::
+CalculatePrefix(const Scanalysis & scanalysis, Moments * prefix)
+{
+  prefix[0] = Moments();
+  for(int i(0); i < Scanalysis::scansize; ++i){
+    prefix[i + 1] = prefix[i];
+    // Skipping everything else keeps the running sums small, which
+    // matters because the fit subtracts them from each other.
+    if(Scanalysis::OBJECT == scanalysis.category[i])
+      prefix[i + 1].Add(scanalysis.x[i], scanalysis.y[i]);
+  }
+}
+
+
+CircleLSQ::Moments::
+Moments():
+  Sx(0), Sx2(0), Sx3(0), Sy(0), Sy2(0), Sy3(0), Sxy(0), Sx2y(0), Sxy2(0)
+{
+}
+
+
+void CircleLSQ::Moments::
+Add(double x, double y)
+{
+  const double x2(x * x);
+  const double y2(y * y);
+  Sx   += x;
+  Sx2  += x2;
+  Sx3  += x2 * x;
+  Sy   += y;
+  Sy2  += y2;
+  Sy3  += y2 * y;
+  Sxy  += x * y;
+  Sx2y += x2 * y;
+  Sxy2 += x * y2;
+}
+
+
+void CircleLSQ::Moments::
+Accumulate(const Scanalysis & scanalysis, int startindex, int endindex)
+{
+  for(int i(startindex); i <= endindex; ++i)
+    Add(scanalysis.x[i], scanalysis.y[i]);
+}
+
+
+CircleLSQ::Moments CircleLSQ::Moments::
+operator - (const Moments & rhs) const
+{
+  Moments result;
+  result.Sx   = Sx   - rhs.Sx;
+  result.Sx2  = Sx2  - rhs.Sx2;
+  result.Sx3  = Sx3  - rhs.Sx3;
+  result.Sy   = Sy   - rhs.Sy;
+  result.Sy2  = Sy2  - rhs.Sy2;
+  result.Sy3  = Sy3  - rhs.Sy3;
+  result.Sxy  = Sxy  - rhs.Sxy;
+  result.Sx2y = Sx2y - rhs.Sx2y;
+  result.Sxy2 = Sxy2 - rhs.Sxy2;
+  return result;
 }
 
 
@@ -105,6 +455,28 @@ CalculateDistance(double x, double y) const
 }
 
 
+void CircleLSQ::
+TransformTo(const sfl::Frame & frame)
+{
+  frame.To(xc, yc);
+  
+  // cov = R cov R^T with R rotating (xc, yc) and leaving radius
+  const double c(frame.Costheta());
+  const double s(frame.Sintheta());
+  double tmp[3][3];
+  for(int j(0); j < 3; ++j){
+    tmp[0][j] = c * cov[0][j] - s * cov[1][j];
+    tmp[1][j] = s * cov[0][j] + c * cov[1][j];
+    tmp[2][j] = cov[2][j];
+  }
+  for(int i(0); i < 3; ++i){
+    cov[i][0] = c * tmp[i][0] - s * tmp[i][1];
+    cov[i][1] = s * tmp[i][0] + c * tmp[i][1];
+    cov[i][2] = tmp[i][2];
+  }
+}
+
+
 double CircleLSQ::
 CalculateSxn(double n, const Scanalysis & scanalysis,
 	     int startindex, int endindex)
@@ -24,24 +24,112 @@
 
 class Scanalysis;
 
+namespace sfl {
+  class Frame;
+}
+
 
 class CircleLSQ
 {
+public:
+  /**
+     Sums over scan points of the monomials that enter the
+     least-squares fit. Moments of an index range can be accumulated
+     in a single pass with Accumulate(), or taken as the difference of
+     two entries of the prefix sums built by CalculatePrefix().
+  */
+  class Moments
+  {
+  public:
+    Moments();
+    
+    void Add(double x, double y);
+    void Accumulate(const Scanalysis & scanalysis,
+		    int startindex, int endindex);
+    Moments operator - (const Moments & rhs) const;
+    
+    double Sx, Sx2, Sx3, Sy, Sy2, Sy3, Sxy, Sx2y, Sxy2;
+  };
+  
 private:
   CircleLSQ(double xc, double yc, double radius, int npoints, int label,
-	    double maxdist);
+	    double maxdist, int ninliers, double rms, const double cov[3][3]);
   
 public:
+  /** An empty circle without points, to be filled in by Fit(). */
+  CircleLSQ();
   CircleLSQ(const CircleLSQ & original);
-
+  
+  /**
+     Algebraic least-squares fit, written to result.
+     \return false if the cluster has fewer than three points.
+  */
+  static bool Fit(const Scanalysis & scanalysis,
+		  int startindex, int endindex, int label,
+		  CircleLSQ & result);
+  
+  /** Like Fit(), with moments computed by the caller. */
+  static bool Fit(const Moments & moments, const Scanalysis & scanalysis,
+		  int startindex, int endindex, int label,
+		  CircleLSQ & result);
+  
+  /** Robust version of Fit(), see CreateRobust() for details. */
+  static bool FitRobust(const Scanalysis & scanalysis,
+			int startindex, int endindex, int label,
+			double inlier_thresh, int budget,
+			CircleLSQ & result);
+  
+  /** Like Fit(), but on the heap, returning 0 on failure. */
   static CircleLSQ * Create(const Scanalysis & scanalysis,
 			    int startindex, int endindex,
 			    int label);
   
+  /**
+     Like Create(), but with moments computed by the caller, for
+     instance as prefix[endindex + 1] - prefix[startindex]. The
+     maximum residual still requires a pass over the points, and the
+     differences of prefix sums lose precision to cancellation, so
+     Create() with its own single pass is usually the better choice
+     (see tcircle for a comparison).
+  */
+  static CircleLSQ * Create(const Moments & moments,
+			    const Scanalysis & scanalysis,
+			    int startindex, int endindex,
+			    int label);
+  
+  /**
+     Geometric fit that tolerates stray beams. Starts from the
+     algebraic fit of Create(); if that leaves points further than
+     inlier_thresh from the circle, RANSAC on point triples looks for
+     a better consensus. Gauss-Newton iterations then minimize the
+     geometric distances of the inliers, re-trimming after each
+     iteration. The algebraic fit, the first trim and the final
+     evaluation take four passes over the cluster, each RANSAC sample
+     one, and each Gauss-Newton iteration two. No more than budget
+     passes are made in total, but the first four always happen. Falls
+     back to the algebraic fit if no consensus of three points or more
+     is found.
+  */
+  static CircleLSQ * CreateRobust(const Scanalysis & scanalysis,
+				  int startindex, int endindex,
+				  int label, double inlier_thresh,
+				  int budget);
+  
+  /**
+     Fill prefix[0] to prefix[Scanalysis::scansize] such that
+     prefix[i] holds the moments of all OBJECT points below index i.
+  */
+  static void CalculatePrefix(const Scanalysis & scanalysis,
+			      Moments * prefix);
+  
   double CalculateDistance(double x, double y) const;
   
+  /** Move the circle from the given frame to its enclosing frame. */
+  void TransformTo(const sfl::Frame & frame);
+  
   void Draw(bool filled) const;
   
+  /** Reference implementations, one pass per moment using pow(). */
   static double CalculateSxn(double n, const Scanalysis & scanalysis,
 			     int startindex, int endindex);
   static double CalculateSym(double m, const Scanalysis & scanalysis,
@@ -50,10 +138,21 @@ public:
 			       const Scanalysis & scanalysis,
 			       int startindex, int endindex);
   
-  const double xc, yc, radius;
-  const int npoints;
-  const int label;
-  const double maxdist;
+  double xc, yc, radius;
+  int npoints;
+  int label;
+  
+  /** Largest geometric distance of an inlier from the circle. */
+  double maxdist;
+  
+  /** Points used for the fit, equal to npoints unless robust. */
+  int ninliers;
+  
+  /** Root mean square geometric distance of the inliers. */
+  double rms;
+  
+  /** Covariance of (xc, yc, radius), all zero for three inliers. */
+  double cov[3][3];
 };
 
 #endif // CIRCLE_LSQ_HPP
@@ -0,0 +1,382 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "LineSegment.hpp"
+#include "Scanalyzer.hpp"
+#include "gfx/wrap_gl.hpp"
+#include <sfl/numeric.hpp>
+#include <sfl/Frame.hpp>
+#include <cstring>
+#include <cmath>
+
+
+using namespace sfl;
+
+
+LineSegment::Moments::
+Moments()
+{
+  Clear();
+}
+
+
+void LineSegment::Moments::
+Clear()
+{
+  n = 0;
+  Sx = 0;
+  Sy = 0;
+  Sx2 = 0;
+  Sy2 = 0;
+  Sxy = 0;
+}
+
+
+void LineSegment::Moments::
+Add(double x, double y)
+{
+  ++n;
+  Sx += x;
+  Sy += y;
+  Sx2 += x * x;
+  Sy2 += y * y;
+  Sxy += x * y;
+}
+
+
+LineSegment::Moments & LineSegment::Moments::
+operator += (const Moments & rhs)
+{
+  n += rhs.n;
+  Sx += rhs.Sx;
+  Sy += rhs.Sy;
+  Sx2 += rhs.Sx2;
+  Sy2 += rhs.Sy2;
+  Sxy += rhs.Sxy;
+  return * this;
+}
+
+
+bool LineSegment::Moments::
+Estimate(double & alpha, double & r, double & lmin, double & lmax) const
+{
+  if(n < 2)
+    return false;
+  
+  const double mx(Sx / n);
+  const double my(Sy / n);
+  const double sxx(Sx2 / n - mx * mx);
+  const double syy(Sy2 / n - my * my);
+  const double sxy(Sxy / n - mx * my);
+  
+  // The normal is perpendicular to the direction of largest spread.
+  alpha = 0.5 * atan2(2 * sxy, sxx - syy) + M_PI / 2;
+  r = mx * cos(alpha) + my * sin(alpha);
+  if(r < 0){
+    r = - r;
+    alpha += M_PI;
+  }
+  alpha = mod2pi(alpha);
+  
+  const double half((sxx + syy) / 2);
+  const double dev(sqrt(sqr((sxx - syy) / 2) + sqr(sxy)));
+  lmin = maxval(half - dev, 0.0);
+  lmax = half + dev;
+  return true;
+}
+
+
+LineSegment::
+LineSegment():
+  line(0, 0, 0, 0),
+  alpha(0), r(0), startindex(-1), endindex(-1), npoints(0), rms(0)
+{
+  memset(cov, 0, sizeof(cov));
+  memset(cov0, 0, sizeof(cov0));
+  memset(cov1, 0, sizeof(cov1));
+}
+
+
+/**
+   Covariance of a point at abscissa t along the line from the
+   centroid: var_along in the direction (ux, uy) of the line, and
+   var_normal plus the effect of var_alpha perpendicular to it.
+*/
+static void endpoint_cov(double ux, double uy, double t,
+			 double var_along, double var_normal,
+			 double var_alpha, double cov[2][2])
+{
+  const double vn(var_normal + t * t * var_alpha);
+  // the normal is (uy, -ux)
+  cov[0][0] = var_along * ux * ux + vn * uy * uy;
+  cov[1][1] = var_along * uy * uy + vn * ux * ux;
+  cov[0][1] = (var_along - vn) * ux * uy;
+  cov[1][0] = cov[0][1];
+}
+
+
+bool LineSegment::
+Fit(const Moments & moments, const Scanalysis & scanalysis,
+    int startindex, int endindex, double sigma, LineSegment & result)
+{
+  double alpha, r, lmin, lmax;
+  if( ! moments.Estimate(alpha, r, lmin, lmax))
+    return false;
+  
+  const double n(moments.n);
+  const double mx(moments.Sx / n);
+  const double my(moments.Sy / n);
+  const double ux(- sin(alpha));
+  const double uy(cos(alpha));
+  const double t0((scanalysis.x[startindex] - mx) * ux
+		  + (scanalysis.y[startindex] - my) * uy);
+  const double t1((scanalysis.x[endindex] - mx) * ux
+		  + (scanalysis.y[endindex] - my) * uy);
+  
+  result.line = sfl::Line(mx + t0 * ux, my + t0 * uy,
+			  mx + t1 * ux, my + t1 * uy);
+  result.alpha = alpha;
+  result.r = r;
+  result.startindex = startindex;
+  result.endindex = endindex;
+  result.npoints = moments.n;
+  result.rms = sqrt(lmin);
+  
+  // Point noise from the residuals (unbiased for two fitted
+  // parameters), but never below sigma. The offset at the centroid
+  // then has variance s2 / n, and the angle s2 / sum(t^2).
+  double s2(sigma * sigma);
+  if(moments.n > 2)
+    s2 = maxval(s2, lmin * n / (n - 2));
+  const double var_alpha(lmax > 0 ? s2 / (n * lmax) : 0);
+  const double var_offset(s2 / n);
+  
+  // The foot of the normal is at abscissa -tc from the centroid, and
+  // turning the line about the centroid changes r by tc per radian.
+  const double tc(mx * ux + my * uy);
+  result.cov[0][0] = var_alpha;
+  result.cov[0][1] = tc * var_alpha;
+  result.cov[1][0] = tc * var_alpha;
+  result.cov[1][1] = var_offset + tc * tc * var_alpha;
+  
+  endpoint_cov(ux, uy, t0, s2, var_offset, var_alpha, result.cov0);
+  endpoint_cov(ux, uy, t1, s2, var_offset, var_alpha, result.cov1);
+  
+  return true;
+}
+
+
+double LineSegment::
+CalculateDistance(double x, double y) const
+{
+  return x * cos(alpha) + y * sin(alpha) - r;
+}
+
+
+double LineSegment::
+Length() const
+{
+  return sqrt(sqr(line.X1() - line.X0()) + sqr(line.Y1() - line.Y0()));
+}
+
+
+/** cov = R cov R^T for the rotation (c, s). */
+static void rotate_cov(double c, double s, double cov[2][2])
+{
+  const double a(cov[0][0]), b(cov[0][1]), d(cov[1][1]);
+  cov[0][0] = c * c * a - 2 * c * s * b + s * s * d;
+  cov[1][1] = s * s * a + 2 * c * s * b + c * c * d;
+  cov[0][1] = c * s * (a - d) + (c * c - s * s) * b;
+  cov[1][0] = cov[0][1];
+}
+
+
+void LineSegment::
+TransformTo(const sfl::Frame & frame)
+{
+  line.TransformTo(frame);
+  rotate_cov(frame.Costheta(), frame.Sintheta(), cov0);
+  rotate_cov(frame.Costheta(), frame.Sintheta(), cov1);
+  
+  // The normal turns with the frame, and the origin moves by (x, y):
+  // r' = r + x cos(alpha') + y sin(alpha'), which also depends on
+  // alpha' through k = dr' / dalpha'.
+  alpha = mod2pi(alpha + frame.Theta());
+  r += frame.X() * cos(alpha) + frame.Y() * sin(alpha);
+  const double k(frame.Y() * cos(alpha) - frame.X() * sin(alpha));
+  const double var_alpha(cov[0][0]);
+  double cov_ar(cov[0][1] + k * var_alpha);
+  cov[1][1] += 2 * k * cov[0][1] + k * k * var_alpha;
+  if(r < 0){
+    r = - r;
+    cov_ar = - cov_ar;
+    alpha = mod2pi(alpha + M_PI);
+  }
+  cov[0][1] = cov_ar;
+  cov[1][0] = cov_ar;
+}
+
+
+void LineSegment::
+Draw() const
+{
+  glBegin(GL_LINES);
+  glVertex2d(line.X0(), line.Y0());
+  glVertex2d(line.X1(), line.Y1());
+  glEnd();
+}
+
+
+LineExtractor::
+LineExtractor(double thresh, double gap, int min_points,
+	      double min_length, double sigma):
+  _thresh(thresh),
+  _gap(gap),
+  _min_points(maxval(min_points, 3)),
+  _min_length(min_length),
+  _sigma(sigma),
+  _scanalysis(0),
+  _moments(new Moments[Scanalysis::scansize]),
+  _start(-1),
+  _last(-1),
+  _alpha(0),
+  _r(0),
+  _have_line(false),
+  _nsegments(0)
+{
+}
+
+
+LineExtractor::
+~LineExtractor()
+{
+  delete[] _moments;
+}
+
+
+void LineExtractor::
+Begin(Scanalysis & scanalysis)
+{
+  _scanalysis = & scanalysis;
+  _scanalysis->segment.clear();
+  _current.Clear();
+  _have_line = false;
+  _nsegments = 0;
+}
+
+
+void LineExtractor::
+Add(int index)
+{
+  const double x(_scanalysis->x[index]);
+  const double y(_scanalysis->y[index]);
+  
+  if(_current.n > 0){
+    const double dx(x - _scanalysis->x[_last]);
+    const double dy(y - _scanalysis->y[_last]);
+    if(dx * dx + dy * dy > _gap * _gap)
+      Close();
+    else if(_have_line
+	    && (absval(x * cos(_alpha) + y * sin(_alpha) - _r) > _thresh))
+      Close();
+  }
+  
+  if(0 == _current.n)
+    _start = index;
+  _current.Add(x, y);
+  _last = index;
+  
+  if(_current.n >= _min_points){
+    double lmin, lmax;
+    _have_line = _current.Estimate(_alpha, _r, lmin, lmax);
+  }
+}
+
+
+void LineExtractor::
+Break()
+{
+  Close();
+}
+
+
+void LineExtractor::
+End()
+{
+  Close();
+  for(int i(0); i < _nsegments; ++i)
+    _scanalysis->segment.push_back(_scanalysis->segment_pool + i);
+}
+
+
+void LineExtractor::
+Close()
+{
+  if(_current.n >= _min_points){
+    LineSegment & slot(_scanalysis->segment_pool[_nsegments]);
+    if(LineSegment::Fit(_current, * _scanalysis, _start, _last, _sigma, slot)){
+      
+      // Try to merge with the previous segment if they are separated
+      // by at most one beam.
+      if(_nsegments > 0){
+	LineSegment & prev(_scanalysis->segment_pool[_nsegments - 1]);
+	Moments merged(_moments[_nsegments - 1]);
+	merged += _current;
+	if((_start - prev.endindex <= 2)
+	   && Mergeable(prev, slot, merged)){
+	  LineSegment::Fit(merged, * _scanalysis, prev.startindex, _last,
+			   _sigma, prev);
+	  _moments[_nsegments - 1] = merged;
+	  _current.Clear();
+	  _have_line = false;
+	  return;
+	}
+      }
+      
+      if(slot.Length() >= _min_length){
+	_moments[_nsegments] = _current;
+	++_nsegments;
+      }
+    }
+  }
+  _current.Clear();
+  _have_line = false;
+}
+
+
+bool LineExtractor::
+Mergeable(const LineSegment & s0, const LineSegment & s1,
+	  const Moments & merged) const
+{
+  double alpha, r, lmin, lmax;
+  if(( ! merged.Estimate(alpha, r, lmin, lmax))
+     || (lmin > _thresh * _thresh))
+    return false;
+  
+  const double ca(cos(alpha));
+  const double sa(sin(alpha));
+  return (absval(s0.line.X0() * ca + s0.line.Y0() * sa - r) <= _thresh)
+    && (absval(s0.line.X1() * ca + s0.line.Y1() * sa - r) <= _thresh)
+    && (absval(s1.line.X0() * ca + s1.line.Y0() * sa - r) <= _thresh)
+    && (absval(s1.line.X1() * ca + s1.line.Y1() * sa - r) <= _thresh)
+    && (sqr(s1.line.X0() - s0.line.X1()) + sqr(s1.line.Y0() - s0.line.Y1())
+	<= _gap * _gap);
+}
@@ -0,0 +1,153 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifndef LINE_SEGMENT_HPP
+#define LINE_SEGMENT_HPP
+
+
+#include <sfl/Line.hpp>
+
+
+class Scanalysis;
+
+
+/**
+   Line segment fitted to consecutive scan points. It is expressed in
+   the scanner frame until TransformTo() moves it to an enclosing
+   frame. The infinite line is x cos(alpha) + y sin(alpha) = r with
+   r >= 0 in either frame, and the segment is delimited by the
+   projections of its first and last point.
+*/
+class LineSegment
+{
+public:
+  /** Sums over scan points for the total least-squares fit. */
+  class Moments
+  {
+  public:
+    Moments();
+    
+    void Clear();
+    void Add(double x, double y);
+    Moments & operator += (const Moments & rhs);
+    
+    /**
+       Total least-squares line through the points, with the
+       smallest and largest eigenvalue of their scatter matrix
+       (divided by n): the mean squared distance from the line, and
+       the spread along it.
+       \return false if there are fewer than two points.
+    */
+    bool Estimate(double & alpha, double & r,
+		  double & lmin, double & lmax) const;
+    
+    int n;
+    double Sx, Sy, Sx2, Sy2, Sxy;
+  };
+  
+  LineSegment();
+  
+  /**
+     Fit a segment to the points startindex to endindex, whose
+     moments are given. Range noise below sigma is not believed when
+     estimating the covariances.
+     \return false if there are fewer than two points.
+  */
+  static bool Fit(const Moments & moments, const Scanalysis & scanalysis,
+		  int startindex, int endindex, double sigma,
+		  LineSegment & result);
+  
+  /** Signed distance of (x, y) from the infinite line. */
+  double CalculateDistance(double x, double y) const;
+  
+  double Length() const;
+  
+  /** Move the segment from the given frame to its enclosing frame. */
+  void TransformTo(const sfl::Frame & frame);
+  
+  void Draw() const;
+  
+  sfl::Line line;
+  double alpha, r;
+  int startindex, endindex, npoints;
+  
+  /** Root mean square distance of the points from the line. */
+  double rms;
+  
+  /** Covariance of (alpha, r). */
+  double cov[2][2];
+  
+  /** Covariances of the endpoints P0() and P1() of line. */
+  double cov0[2][2], cov1[2][2];
+};
+
+
+/**
+   Incremental line extraction over the ordered beams of a scan: each
+   valid beam either extends the current segment or, if it is further
+   than thresh from the line fitted so far or further than gap from
+   the previous beam, starts a new one. Adjacent segments that fit a
+   common line within thresh are merged when the scan ends. Each beam
+   and each merge costs constant time, so a scan takes linear time.
+   
+   Segments with fewer than min_points points or shorter than
+   min_length get dropped.
+*/
+class LineExtractor
+{
+public:
+  LineExtractor(double thresh, double gap, int min_points,
+		double min_length, double sigma);
+  ~LineExtractor();
+  
+  /** Start a scan, clearing the segments of scanalysis. */
+  void Begin(Scanalysis & scanalysis);
+  
+  /** Feed beam index, whose x and y must be valid. */
+  void Add(int index);
+  
+  /** Feed an invalid beam (out of range), which ends any segment. */
+  void Break();
+  
+  /** Finish the scan and publish the segments into scanalysis. */
+  void End();
+  
+private:
+  typedef LineSegment::Moments Moments;
+  
+  void Close();
+  bool Mergeable(const LineSegment & s0, const LineSegment & s1,
+		 const Moments & merged) const;
+  
+  const double _thresh, _gap;
+  const int _min_points;
+  const double _min_length, _sigma;
+  
+  Scanalysis * _scanalysis;
+  Moments * _moments;		// one per segment in the pool
+  Moments _current;
+  int _start, _last;
+  double _alpha, _r;
+  bool _have_line;
+  int _nsegments;
+};
+
+#endif // LINE_SEGMENT_HPP
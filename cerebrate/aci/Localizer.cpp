@@ -34,6 +34,48 @@ using namespace std;
 using namespace sfl;
 
 
+/** The distance field of the grid gets refreshed every so many scans. */
+static const int grid_distance_period(16);
+
+/** Distances in the field are cut off here, in metres. */
+static const double grid_max_dist(1);
+
+/**
+   Added to the standard deviation of the robot circle's fit, for
+   what the fit cannot see (shape of the robot, timing, deskewing).
+*/
+static const double robot_sigma_xy(0.02);
+
+/**
+   Confirmed tracks faster than this (m/s) are kept out of the
+   background, slower ones get absorbed like any other prop.
+*/
+static const double bg_hold_speed(0.05);
+
+/**
+   A scan match only replaces the scanner pose if its RMS distance
+   (m) is below match_max_rms, if at least match_min_ratio of the
+   background beams took part, and if it moves the scanner by less
+   than match_max_dxy (m) and match_max_dtheta (rad). The scanner
+   sits on a tripod, so anything larger is a bad match.
+*/
+static const double match_max_rms(0.05);
+static const double match_min_ratio(0.5);
+static const double match_max_dxy(0.1);
+static const double match_max_dtheta(0.05);
+
+/**
+   Particle filter parameters: tolerance on the radius of the robot
+   circle, particle capacity and minimum, microseconds per scan, and
+   number of weighting threads.
+*/
+static const double mcl_radius_tolerance(0.03);
+static const size_t mcl_capacity(4096);
+static const size_t mcl_min_particles(100);
+static const double mcl_usec_budget(3000);
+static const int mcl_nthreads(2);
+
+
 Localizer::
 Localizer(Odometry & odometry,
 	  MotionManager & motion_manager,
@@ -44,19 +86,88 @@ Localizer(Odometry & odometry,
   _odometry(odometry),
   _motion_manager(motion_manager),
   _scanalyzer(scanalyzer),
+  _matcher(0.02, 0.2, 10, 50),
+  _grid_count(0),
+  _tracker(32, 9.21, 2, 0.05, 3, 15),
+  _mcl(_cactus_radius, mcl_radius_tolerance, mcl_capacity,
+       mcl_min_particles, mcl_usec_budget, mcl_nthreads),
   _sick_success(Timestamp::First())
 {  
+  pthread_mutex_init(& _grid_mutex, 0);
+  BuildMap();
+}
+
+
+Localizer::
+~Localizer()
+{
+  pthread_mutex_destroy(& _grid_mutex);
+}
+
+
+void Localizer::
+BuildMap()
+{
+  double x[Scanalysis::scansize], y[Scanalysis::scansize];
+  const int npoints(_scanalyzer.GetBackground(x, y));
+  _scanner_pose.Set(0, 0, 0);
+  if( ! _matcher.SetMap(npoints, x, y, 0.2))
+    cerr << "WARNING in Localizer::BuildMap(): only " << npoints
+	 << " background points, no scan matching.\n";
+}
+
+
+bool Localizer::
+MatchScan()
+{
+  Frame pose(_scanner_pose);
+  if( ! _matcher.Match(_scanalysis, pose))
+    return false;
+  int nbackground(0);
+  for(int i(0); i < Scanalysis::scansize; ++i)
+    if(Scanalysis::BACKGROUND == _scanalysis.category[i])
+      ++nbackground;
+  if((_matcher.GetRMS() > match_max_rms)
+     || (_matcher.GetNInliers() < match_min_ratio * nbackground)
+     || (sqr(pose.X() - _scanner_pose.X())
+	 + sqr(pose.Y() - _scanner_pose.Y()) > sqr(match_max_dxy))
+     || (absval(mod2pi(pose.Theta() - _scanner_pose.Theta()))
+	 > match_max_dtheta))
+    return false;
+  _scanner_pose = pose;
+  return true;
 }
 
 
 bool Localizer::
 UpdateScan()
 {
+  // No waiting here, that is done outside of the Cactus lock, see
+  // Cactus::WaitScan().
   if( ! _scanalyzer.Update(0))
     return false;
   
   _sick_success = Timestamp::Now();  
-  _scanalysis = _scanalyzer.GetScanalysis();
+  _scanalyzer.SwapScanalysis(_scanalysis);
+  MatchScan();
+  _scanalysis.TransformTo(_scanner_pose);
+  pthread_mutex_lock(& _grid_mutex);
+  if(0 != _grid.get()){
+    _grid->Update(_scanalysis, _scanner_pose, _scanalyzer.GetRhomax());
+    if(++_grid_count >= grid_distance_period){
+      _grid->UpdateDistance(grid_max_dist);
+      _grid_count = 0;
+    }
+  }
+  pthread_mutex_unlock(& _grid_mutex);
+  _tracker.Update(_scanalysis);
+  for(size_t i(0); i < _tracker.GetCapacity(); ++i){
+    const Track * track(_tracker.GetTrack(i));
+    if((0 != track) && track->confirmed && (0 <= track->label)
+       && (sqr(track->vx) + sqr(track->vy) > sqr(bg_hold_speed)))
+      _scanalyzer.HoldBackground(_scanalysis, track->label);
+  }
+  _mcl.Update(_scanalysis, _odometry.GetDeadReckoning());
   _robot_circle = 0;
   return true;
 }
@@ -69,32 +180,45 @@ UpdateMatch()
   _robot_circle = _FindRobot(extract_thresh);
   if(0 == _robot_circle)
     return false;
+  const Timestamp t_robot(DeskewRobot());
   RelabelRobot();
+  _scanalyzer.HoldBackground(_scanalysis, GetRobotLabel());
+  
+  double cov[3][3] = {
+    { _robot_circle->cov[0][0] + sqr(robot_sigma_xy),
+      _robot_circle->cov[0][1], 0 },
+    { _robot_circle->cov[1][0],
+      _robot_circle->cov[1][1] + sqr(robot_sigma_xy), 0 },
+    { 0, 0, 0 } };
   
+  // The heading is only observed once the robot has driven far
+  // enough from the anchor, each end contributing about the same
+  // uncertainty across the line between them.
   const MotionManager::Anchor & anchor(_motion_manager.GetAnchor());
-  if( ! anchor.IsValid())
-    return false;
+  bool known_theta(false);
+  double theta(0);
+  if(anchor.IsValid()){
+    const double dx(_robot_circle->xc - anchor.GetPose().X());
+    const double dy(_robot_circle->yc - anchor.GetPose().Y());
+    const double ds(sqrt(sqr(dx) + sqr(dy)));
+    static const double correct_theta_ds_threshold(0.5);
+    if(ds >= correct_theta_ds_threshold){
+      known_theta = true;
+      theta = atan2(dy, dx);
+      if( ! anchor.GoingForwards())
+	theta = mod2pi(theta + M_PI);
+      cov[2][2] = (cov[0][0] + cov[1][1]) / sqr(ds);
+    }
+  }
   
-  const double dx(_robot_circle->xc - anchor.GetPose().X());
-  const double dy(_robot_circle->yc - anchor.GetPose().Y());
-  const double ds(sqrt(sqr(dx) + sqr(dy)));
-  static const double correct_theta_ds_threshold(0.5);
-  if(ds < correct_theta_ds_threshold)
+  if( ! _odometry.Correct(t_robot, Odometry::observation(_robot_circle->xc,
+							 _robot_circle->yc,
+							 known_theta,
+							 theta,
+							 cov)))
     return false;
-  
-  const double theta(atan2(dy, dx));
-  if(anchor.GoingForwards())
-    _odometry.Correct(_scanalysis.t0, Odometry::observation(_robot_circle->xc, 
-							    _robot_circle->yc,
-							    true,
-							    theta));
-  else
-    _odometry.Correct(_scanalysis.t0,
-		      Odometry::observation(_robot_circle->xc, 
-					    _robot_circle->yc,
-					    true,
-					    mod2pi(theta + M_PI)));
-  _motion_manager.InvalidateAnchor();
+  if(known_theta)
+    _motion_manager.InvalidateAnchor();
   return true;
 }
 
@@ -114,18 +238,17 @@ SaveScan(const std::string & fname) const
 bool Localizer::
 SaveBackground(const std::string & fname) const
 {
-  ofstream os(fname.c_str());
-  for(int i(0); i < 361; ++i)
-    if( ! (os << _scanalysis.bgrho[i] << "\n"))
-      return false;
-  return true;
+  return _scanalyzer.SaveBackground(fname);
 }
 
 
 bool Localizer::
 LoadBackground(const std::string & fname)
 {
-  return _scanalyzer.LoadBackground(fname);
+  if( ! _scanalyzer.LoadBackground(fname))
+    return false;
+  BuildMap();
+  return true;
 }
 
 
@@ -189,18 +312,47 @@ _FindRobot(double extract_thresh)
 }
 
 
-void Localizer::
+bool Localizer::
 Update()
 {
-  if(UpdateScan())
-    UpdateMatch();
+  // Grids from CreateGrid() and LoadGrid() only take over here, in
+  // the thread that also updates and draws them.
+  pthread_mutex_lock(& _grid_mutex);
+  if(0 != _pending_grid.get()){
+    _grid = _pending_grid;
+    _grid_count = 0;
+  }
+  pthread_mutex_unlock(& _grid_mutex);
+  
+  if( ! UpdateScan())
+    return false;
+  UpdateMatch();
+  return true;
+}
+
+
+bool Localizer::
+Recover()
+{
+  Pose pose;
+  if( ! _mcl.GetEstimate(pose))
+    return false;
+  _odometry.Init(Timestamp::Now(), pose.X(), pose.Y(), pose.Theta(),
+		 &_motion_manager);
+  return true;
 }
 
 
 void Localizer::
 Draw() const
 {
+  pthread_mutex_lock(& _grid_mutex);
+  if(0 != _grid.get())
+    _grid->Draw();
+  pthread_mutex_unlock(& _grid_mutex);
   _scanalysis.Draw();
+  _tracker.Draw();
+  _mcl.Draw();
   
   if(0 != _robot_circle){
     glColor3d(0.5, 1, 0);
@@ -237,6 +389,13 @@ GetScanalysis() const
 }
 
 
+const Tracker & Localizer::
+GetTracker() const
+{
+  return _tracker;
+}
+
+
 int Localizer::
 GetRobotLabel() const
 {
@@ -268,6 +427,95 @@ RelabelRobot()
 }
 
 
+Timestamp Localizer::
+DeskewRobot()
+{
+  static const double inlier_thresh(0.02);
+  static const int fit_budget(24);
+  
+  const int label(_robot_circle->label);
+  const int start(_scanalysis.startindex[label]);
+  const int end(_scanalysis.endindex[label]);
+  // The beams are evenly spaced in time, so their mean time lies
+  // halfway between the first and the last one of the cluster.
+  const Timestamp t_first(_scanalysis.GetBeamTime(end));
+  const Timestamp t_last(_scanalysis.GetBeamTime(start));
+  const Timestamp
+    t_ref(t_first + Timestamp((t_last - t_first).ConvertToSeconds() / 2));
+  const Frame ref(_odometry.GetPoseAt(t_ref));
+  
+  for(int i(start); i <= end; ++i){
+    const Frame beam(_odometry.GetPoseAt(_scanalysis.GetBeamTime(i)));
+    beam.From(_scanalysis.x[i], _scanalysis.y[i]);
+    ref.To(_scanalysis.x[i], _scanalysis.y[i]);
+  }
+  
+  CircleLSQ deskewed;
+  if(CircleLSQ::FitRobust(_scanalysis, start, end, label, inlier_thresh,
+			  fit_budget, deskewed))
+    _scanalysis.circle_pool[label] = deskewed;
+  return t_ref;
+}
+
+
+void Localizer::
+CreateGrid(double x0, double y0, int nx, int ny, double resolution)
+{
+  auto_ptr<OccupancyGrid> grid(new OccupancyGrid(x0, y0, nx, ny,
+						 resolution));
+  pthread_mutex_lock(& _grid_mutex);
+  _pending_grid = grid;
+  pthread_mutex_unlock(& _grid_mutex);
+}
+
+
+bool Localizer::
+LoadGrid(const std::string & fname)
+{
+  auto_ptr<OccupancyGrid> grid(OccupancyGrid::Load(fname));
+  if(0 == grid.get())
+    return false;
+  pthread_mutex_lock(& _grid_mutex);
+  _pending_grid = grid;
+  pthread_mutex_unlock(& _grid_mutex);
+  return true;
+}
+
+
+bool Localizer::
+SaveGrid(const std::string & fname)
+{
+  // a grid that has not been picked up yet is the one to save
+  pthread_mutex_lock(& _grid_mutex);
+  OccupancyGrid * grid(_pending_grid.get());
+  if(0 == grid){
+    grid = _grid.get();
+    _grid_count = 0;
+  }
+  bool ok(false);
+  if(0 != grid){
+    grid->UpdateDistance(grid_max_dist);
+    ok = grid->Save(fname);
+  }
+  pthread_mutex_unlock(& _grid_mutex);
+  return ok;
+}
+
+
+const OccupancyGrid * Localizer::
+GetGrid() const
+{
+  return _grid.get();
+}
+
+
+const sfl::Frame & Localizer::
+GetScannerPose() const
+{
+  return _scanner_pose;
+}
+
+
 const Timestamp & Localizer::
 GetTMatch() const
 {
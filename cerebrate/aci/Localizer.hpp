@@ -24,15 +24,18 @@
 
 #include <util/Timestamp.hpp>
 #include <aci/Scanalyzer.hpp>
+#include <aci/Tracker.hpp>
+#include <aci/ScanMatcher.hpp>
+#include <aci/OccupancyGrid.hpp>
+#include <aci/ParticleLocalizer.hpp>
+#include <sfl/Frame.hpp>
+#include <memory>
+#include <pthread.h>
 
 
 class Odometry;
 class MotionManager;
 
-namespace sfl {
-  class Frame;
-}
-
 
 class Localizer
 {
@@ -40,12 +43,35 @@ public:
   Localizer(Odometry & odometry,
 	    MotionManager & motion_manager,
 	    Scanalyzer & scanalyzer);
+  ~Localizer();
+  
+  /** \return true if a new scan has been processed. */
+  bool Update();
   
-  void Update();
+  /**
+     Re-initialize Odometry from the particle filter, which keeps
+     following the robot independently of it.
+     
+     \return false if the particles have not converged (yet), in
+     which case Odometry is left alone.
+  */
+  bool Recover();
 
   const Scanalysis & GetScanalysis() const;
+  
+  /** Objects tracked over the scans that Update() has seen. */
+  const Tracker & GetTracker() const;
   int GetRobotLabel() const;
   const Timestamp & GetTMatch() const;
+  
+  /**
+     Pose of the scanner in the frame of the background map, as found
+     by registering the latest scan against it. Scans, and thus the
+     robot observations passed to Odometry::Correct(), are expressed
+     in the map frame, so that moving the scanner does not move the
+     world.
+  */
+  const sfl::Frame & GetScannerPose() const;
 
   void Draw() const;
   void DrawPrediction(const sfl::Frame & pose) const;
@@ -54,6 +80,26 @@ public:
   bool SaveBackground(const std::string & fname) const;
   bool LoadBackground(const std::string & fname);
   
+  /**
+     Start accumulating scans into a new occupancy grid, see
+     OccupancyGrid for the parameters. The grid is handed over to the
+     next Update(), so this can be called from any thread.
+  */
+  void CreateGrid(double x0, double y0, int nx, int ny, double resolution);
+  
+  /** Continue with a grid written by SaveGrid(), like CreateGrid(). */
+  bool LoadGrid(const std::string & fname);
+  
+  /** Can be called from any thread, blocks Update() while writing. */
+  bool SaveGrid(const std::string & fname);
+  
+  /**
+     \return 0 unless Update() has picked up a grid from CreateGrid()
+     or LoadGrid(). Only valid in the thread that calls Update(), or
+     one that is serialized with it.
+  */
+  const OccupancyGrid * GetGrid() const;
+  
   // refactoring for Cactus
   const CircleLSQ * FindBest() {
     UpdateScan();
@@ -67,6 +113,27 @@ private:
   bool UpdateScan();
   bool UpdateMatch();
   void RelabelRobot();
+  
+  /**
+     Undo the motion of the robot during the sweep: each beam of the
+     robot's cluster is moved by the odometric displacement between
+     the time of that beam and the mean time of the cluster, after
+     which the robot circle is fitted anew.
+     
+     \return The mean time of the cluster, which is when the refitted
+     circle was observed.
+  */
+  Timestamp DeskewRobot();
+  
+  /**
+     Match the current scan against the map, starting from the
+     previous scanner pose, and keep the result only if it is
+     plausible (see match_max_rms and friends in Localizer.cpp).
+     \return true if the scanner pose was updated.
+  */
+  bool MatchScan();
+  
+  void BuildMap();
 
   const double _cactus_radius;// = 0.14;
   const double _dr_thresh;// = 0.02;
@@ -77,6 +144,18 @@ private:
   Scanalyzer & _scanalyzer;
   
   Scanalysis _scanalysis;
+  ScanMatcher _matcher;
+  sfl::Frame _scanner_pose;
+  std::auto_ptr<OccupancyGrid> _grid;
+  int _grid_count;
+  
+  /** Waits for Update() to replace _grid, protected by _grid_mutex. */
+  std::auto_ptr<OccupancyGrid> _pending_grid;
+  
+  /** Held while _grid is written, and around _pending_grid. */
+  mutable pthread_mutex_t _grid_mutex;
+  Tracker _tracker;
+  ParticleLocalizer _mcl;
   const CircleLSQ * _robot_circle;
   Timestamp _sick_success;
 };
@@ -0,0 +1,374 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "OccupancyGrid.hpp"
+#include "Scanalyzer.hpp"
+#include "gfx/wrap_gl.hpp"
+#include <sfl/numeric.hpp>
+#include <sfl/Frame.hpp>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+using namespace std;
+using namespace sfl;
+
+
+static const char grid_magic[8] = { 'C', 'R', 'B', 'O', 'G', 'R', 'D', '1' };
+
+/** Log-odds added by a hit, by a pass, and their bounds. */
+static const float logodds_occupied(0.85);
+static const float logodds_free(-0.4);
+static const float logodds_min(-4);
+static const float logodds_max(4);
+
+
+size_t OccupancyGrid::
+BlockSize(int nx, int ny)
+{
+  return sizeof(header_s) + 2 * sizeof(float) * nx * ny;
+}
+
+
+OccupancyGrid::
+OccupancyGrid(double x0, double y0, int nx, int ny, double resolution):
+  _block(new char[BlockSize(nx, ny)]),
+  _size(BlockSize(nx, ny)),
+  _mapped(false)
+{
+  memset(_block, 0, _size);
+  _header = reinterpret_cast<header_s *>(_block);
+  memcpy(_header->magic, grid_magic, sizeof(grid_magic));
+  _header->nx = nx;
+  _header->ny = ny;
+  _header->x0 = x0;
+  _header->y0 = y0;
+  _header->resolution = resolution;
+  _logodds = reinterpret_cast<float *>(_header + 1);
+  _distance = _logodds + nx * ny;
+  _sq.resize(nx * ny);
+  _dscratch.resize(ScratchSize(nx, ny));
+  _iscratch.resize(maxval(nx, ny));
+}
+
+
+OccupancyGrid::
+OccupancyGrid(void * block, size_t size, bool mapped):
+  _block(block),
+  _size(size),
+  _mapped(mapped),
+  _header(reinterpret_cast<header_s *>(block)),
+  _logodds(reinterpret_cast<float *>(_header + 1)),
+  _distance(_logodds + _header->nx * _header->ny),
+  _sq(_header->nx * _header->ny),
+  _dscratch(ScratchSize(_header->nx, _header->ny)),
+  _iscratch(maxval(_header->nx, _header->ny))
+{
+}
+
+
+OccupancyGrid::
+~OccupancyGrid()
+{
+  if(_mapped)
+    munmap(_block, _size);
+  else
+    delete[] reinterpret_cast<char *>(_block);
+}
+
+
+OccupancyGrid * OccupancyGrid::
+Load(const std::string & fname)
+{
+  const int fd(open(fname.c_str(), O_RDONLY));
+  if(fd < 0){
+    perror("OccupancyGrid::Load(): open");
+    return 0;
+  }
+  struct stat st;
+  if((0 != fstat(fd, & st)) || (st.st_size < (off_t) sizeof(header_s))){
+    cerr << "OccupancyGrid::Load(): " << fname << " is too short.\n";
+    close(fd);
+    return 0;
+  }
+  
+  // Private mapping: later updates stay in memory until Save().
+  void * block(mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		    fd, 0));
+  close(fd);
+  if(MAP_FAILED == block){
+    perror("OccupancyGrid::Load(): mmap");
+    return 0;
+  }
+  
+  const header_s * header(reinterpret_cast<const header_s *>(block));
+  if((0 != memcmp(header->magic, grid_magic, sizeof(grid_magic)))
+     || (header->nx <= 0) || (header->ny <= 0)
+     || (header->resolution <= 0)
+     || ((size_t) st.st_size != BlockSize(header->nx, header->ny))){
+    cerr << "OccupancyGrid::Load(): " << fname << " is not a grid.\n";
+    munmap(block, st.st_size);
+    return 0;
+  }
+  
+  return new OccupancyGrid(block, st.st_size, true);
+}
+
+
+bool OccupancyGrid::
+Save(const std::string & fname) const
+{
+  ofstream os(fname.c_str(), ios::binary);
+  if( ! os.write(reinterpret_cast<const char *>(_block), _size))
+    return false;
+  return true;
+}
+
+
+void OccupancyGrid::
+Update(const Scanalysis & scan, const sfl::Frame & scanner, double rhomax)
+{
+  static const int scansize(Scanalysis::scansize);
+  const int nx(_header->nx), ny(_header->ny);
+  const double res(_header->resolution);
+  const double sx((scanner.X() - _header->x0) / res);
+  const double sy((scanner.Y() - _header->y0) / res);
+  
+  // Beam ends in cell units, shortening the rays without echo to
+  // rhomax. Kept apart from the tracing so that it vectorizes.
+  int ex[scansize], ey[scansize];
+  bool hit[scansize];
+  for(int i(0); i < scansize; ++i){
+    const double rho(scan.rho[i]);
+    const double scale(rho < rhomax ? 1 : rhomax / rho);
+    ex[i] = (int) rint(sx + scale * ((scan.x[i] - _header->x0) / res - sx));
+    ey[i] = (int) rint(sy + scale * ((scan.y[i] - _header->y0) / res - sy));
+    hit[i] = rho < rhomax;
+  }
+  
+  const int x0((int) rint(sx)), y0((int) rint(sy));
+  for(int i(0); i < scansize; ++i){
+    // Bresenham from (x0, y0) to (ex, ey), the end cell excluded.
+    const int dx(absval(ex[i] - x0)), dy(- absval(ey[i] - y0));
+    const int stepx(x0 < ex[i] ? 1 : -1), stepy(y0 < ey[i] ? 1 : -1);
+    int err(dx + dy);
+    int cx(x0), cy(y0);
+    while((cx != ex[i]) || (cy != ey[i])){
+      if((cx >= 0) && (cx < nx) && (cy >= 0) && (cy < ny)){
+	float & cell(_logodds[cy * nx + cx]);
+	cell = maxval(cell + logodds_free, logodds_min);
+      }
+      const int e2(2 * err);
+      if(e2 >= dy){
+	err += dy;
+	cx += stepx;
+      }
+      if(e2 <= dx){
+	err += dx;
+	cy += stepy;
+      }
+    }
+    if((ex[i] >= 0) && (ex[i] < nx) && (ey[i] >= 0) && (ey[i] < ny)){
+      float & cell(_logodds[ey[i] * nx + ex[i]]);
+      if(hit[i])
+	cell = minval(cell + logodds_occupied, logodds_max);
+      else
+	cell = maxval(cell + logodds_free, logodds_min);
+    }
+  }
+}
+
+
+/**
+   One-dimensional squared Euclidean distance transform of the n
+   samples f, written to d (Felzenszwalb and Huttenlocher). Linear in
+   n; v and z are scratch space of n and n + 1 entries.
+*/
+static void edt1d(const double * f, int n, double * d, int * v, double * z)
+{
+  static const double infinity(1e20);
+  int k(0);
+  v[0] = 0;
+  z[0] = - infinity;
+  z[1] = infinity;
+  for(int q(1); q < n; ++q){
+    double s;
+    for(;;){
+      s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0 * (q - v[k]));
+      if((s > z[k]) || (0 == k))
+	break;
+      --k;
+    }
+    ++k;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = infinity;
+  }
+  k = 0;
+  for(int q(0); q < n; ++q){
+    while(z[k + 1] < q)
+      ++k;
+    d[q] = sqr(q - v[k]) + f[v[k]];
+  }
+}
+
+
+size_t OccupancyGrid::
+ScratchSize(int nx, int ny)
+{
+  // f, d and z of edt1d()
+  return 3 * maxval(nx, ny) + 1;
+}
+
+
+void OccupancyGrid::
+DistanceTransform(int nx, int ny, double * sq)
+{
+  vector<double> dscratch(ScratchSize(nx, ny));
+  vector<int> iscratch(maxval(nx, ny));
+  DistanceTransform(nx, ny, sq, & dscratch[0], & iscratch[0]);
+}
+
+
+void OccupancyGrid::
+DistanceTransform(int nx, int ny, double * sq,
+		  double * dscratch, int * iscratch)
+{
+  const int nmax(maxval(nx, ny));
+  double * f(dscratch);
+  double * d(dscratch + nmax);
+  double * z(dscratch + 2 * nmax);
+  for(int iy(0); iy < ny; ++iy){
+    edt1d(sq + iy * nx, nx, d, iscratch, z);
+    copy(d, d + nx, sq + iy * nx);
+  }
+  for(int ix(0); ix < nx; ++ix){
+    for(int iy(0); iy < ny; ++iy)
+      f[iy] = sq[iy * nx + ix];
+    edt1d(f, ny, d, iscratch, z);
+    for(int iy(0); iy < ny; ++iy)
+      sq[iy * nx + ix] = d[iy];
+  }
+}
+
+
+void OccupancyGrid::
+UpdateDistance(double max_dist)
+{
+  const int ncells(_header->nx * _header->ny);
+  for(int i(0); i < ncells; ++i)
+    _sq[i] = (_logodds[i] > 0) ? 0 : 1e20;
+  DistanceTransform(_header->nx, _header->ny, & _sq[0],
+		    & _dscratch[0], & _iscratch[0]);
+  const double res(_header->resolution);
+  for(int i(0); i < ncells; ++i)
+    _distance[i] = minval(res * sqrt(_sq[i]), max_dist);
+}
+
+
+bool OccupancyGrid::
+GetIndex(double x, double y, int & ix, int & iy) const
+{
+  ix = (int) rint((x - _header->x0) / _header->resolution);
+  iy = (int) rint((y - _header->y0) / _header->resolution);
+  return (ix >= 0) && (ix < _header->nx) && (iy >= 0) && (iy < _header->ny);
+}
+
+
+float OccupancyGrid::
+GetLogOdds(int ix, int iy) const
+{
+  return _logodds[iy * _header->nx + ix];
+}
+
+
+const float * OccupancyGrid::
+GetDistance() const
+{
+  return _distance;
+}
+
+
+int OccupancyGrid::
+GetNX() const
+{
+  return _header->nx;
+}
+
+
+int OccupancyGrid::
+GetNY() const
+{
+  return _header->ny;
+}
+
+
+double OccupancyGrid::
+GetX0() const
+{
+  return _header->x0;
+}
+
+
+double OccupancyGrid::
+GetY0() const
+{
+  return _header->y0;
+}
+
+
+double OccupancyGrid::
+GetResolution() const
+{
+  return _header->resolution;
+}
+
+
+void OccupancyGrid::
+Draw() const
+{
+  const int nx(_header->nx), ny(_header->ny);
+  const double res(_header->resolution);
+  const double half(0.5 * res);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glBegin(GL_QUADS);
+  for(int iy(0); iy < ny; ++iy)
+    for(int ix(0); ix < nx; ++ix){
+      const float lo(_logodds[iy * nx + ix]);
+      if(lo <= 0)
+	continue;
+      const double grey(0.2 + 0.6 * lo / logodds_max);
+      const double x(_header->x0 + ix * res), y(_header->y0 + iy * res);
+      glColor3d(grey, grey, grey);
+      glVertex2d(x - half, y - half);
+      glVertex2d(x + half, y - half);
+      glVertex2d(x + half, y + half);
+      glVertex2d(x - half, y + half);
+    }
+  glEnd();
+}
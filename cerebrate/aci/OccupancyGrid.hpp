@@ -0,0 +1,131 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifndef OCCUPANCY_GRID_HPP
+#define OCCUPANCY_GRID_HPP
+
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+class Scanalysis;
+
+namespace sfl {
+  class Frame;
+}
+
+
+/**
+   Log-odds occupancy grid of the arena, in the map frame, with a
+   distance field for matching and planning. Cells are stored row
+   major (x varies fastest) as floats, followed by the distance
+   field, in a single block that is also the body of the file
+   written by Save(). Load() maps that file instead of reading and
+   rebuilding it.
+*/
+class OccupancyGrid
+{
+public:
+  /**
+     An unknown (all zero log-odds) grid of nx by ny cells of the
+     given resolution, whose cell (0, 0) is centred on (x0, y0).
+  */
+  OccupancyGrid(double x0, double y0, int nx, int ny, double resolution);
+  ~OccupancyGrid();
+  
+  /** Map a file written by Save(). \return 0 on failure. */
+  static OccupancyGrid * Load(const std::string & fname);
+  bool Save(const std::string & fname) const;
+  
+  /**
+     Trace every beam of scan, whose points must already be in the
+     map frame, from the scanner position. Cells along the beam
+     become more likely free, and the cell it ends in more likely
+     occupied unless the range is rhomax or more (no echo).
+  */
+  void Update(const Scanalysis & scan, const sfl::Frame & scanner,
+	      double rhomax);
+  
+  /**
+     Recompute the distance field from the cells that are more likely
+     occupied than not. Cells further than max_dist from any such
+     cell get max_dist. Works in buffers allocated with the grid, so
+     it does not touch the heap.
+  */
+  void UpdateDistance(double max_dist);
+  
+  /** \return false if (x, y) is outside the grid. */
+  bool GetIndex(double x, double y, int & ix, int & iy) const;
+  
+  float GetLogOdds(int ix, int iy) const;
+  
+  /** Distance field, nx * ny values in the order of the cells. */
+  const float * GetDistance() const;
+  
+  int GetNX() const;
+  int GetNY() const;
+  double GetX0() const;
+  double GetY0() const;
+  double GetResolution() const;
+  
+  void Draw() const;
+  
+  /**
+     Two-dimensional squared Euclidean distance transform, in place,
+     of nx * ny row major values that are zero on the features and
+     large elsewhere. Linear in the number of cells.
+  */
+  static void DistanceTransform(int nx, int ny, double * sq);
+  
+  /**
+     Same, in caller-provided scratch space of ScratchSize(nx, ny)
+     doubles and maxval(nx, ny) ints.
+  */
+  static void DistanceTransform(int nx, int ny, double * sq,
+				double * dscratch, int * iscratch);
+  static size_t ScratchSize(int nx, int ny);
+  
+private:
+  /** Layout of the start of the file and of the storage block. */
+  struct header_s {
+    char magic[8];
+    int32_t nx, ny;
+    double x0, y0, resolution;
+  };
+  
+  OccupancyGrid(void * block, size_t size, bool mapped);
+  static size_t BlockSize(int nx, int ny);
+  
+  void * _block;
+  size_t _size;
+  bool _mapped;
+  header_s * _header;
+  float * _logodds;
+  float * _distance;
+  
+  // Scratch space of UpdateDistance(), allocated by the constructors.
+  std::vector<double> _sq, _dscratch;
+  std::vector<int> _iscratch;
+};
+
+#endif // OCCUPANCY_GRID_HPP
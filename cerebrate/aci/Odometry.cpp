@@ -22,7 +22,10 @@
 #include "MotionManager.hpp"
 #include "gfx/wrap_gl.hpp"
 #include "drivers/FModIPDCMOT.hpp"
+#include <drivers/enclog.h>
 #include <sfl/numeric.hpp>
+#include <iostream>
+#include <fstream>
 #include <cmath>
 
 
@@ -30,29 +33,137 @@ using namespace std;
 using namespace sfl;
 
 
+/**
+   Update() appends a pose for each encoder sample that shows motion,
+   each of the two motor threads taking one every 100ms, and each
+   match flushes the recent history. This holds a few minutes between
+   matches.
+*/
+static const size_t recent_capacity(4096);
+
+/** Matched poses kept for drawing, thinned out when full. */
+static const size_t ancient_capacity(256);
+
+/**
+   Standard deviation of the travel of a wheel after one metre, the
+   variance growing linearly with the distance.
+*/
+static const double wheel_sigma(0.02);
+
+/** Encoder position at t, linear between the samples s0 and s1. */
+static double interpolate(const FModIPDCMOT::sample_s & s0,
+			  const FModIPDCMOT::sample_s & s1,
+			  const Timestamp & t)
+{
+  const Timestamp t0(s0.stamp);
+  const double dt((Timestamp(s1.stamp) - t0).ConvertToSeconds());
+  if(dt <= 0)
+    return s1.position;
+  const double alpha((t - t0).ConvertToSeconds() / dt);
+  if(alpha <= 0)
+    return s0.position;
+  if(alpha >= 1)
+    return s1.position;
+  return s0.position + alpha * (s1.position - s0.position);
+}
+
+/** Uncertainty of the pose given to Init(). */
+static const double init_sigma_xy(0.05);
+static const double init_sigma_theta(0.2);
+
+
 Odometry::
 Odometry(FModIPDCMOT & left, FModIPDCMOT & right,
 	 double wheelbase, double wheelradius):
   _wheelbase(wheelbase),
   _wheelradius(wheelradius),
+  _history(recent_capacity, ancient_capacity),
   _left(left),
-  _right(right)
+  _right(right),
+  _left_radius(wheelradius),
+  _right_radius(wheelradius),
+  _calibrated_wheelbase(wheelbase),
+  _record_log(0)
 {
+  pthread_mutex_init(& _record_mutex, 0);
   Init(Timestamp::Now(), 0, 0, 0, 0);
 }
 
 
+Odometry::
+~Odometry()
+{
+  if(0 != _record_log)
+    enc_log_close(_record_log);
+  pthread_mutex_destroy(& _record_mutex);
+}
+
+
+void Odometry::
+SetCalibration(double left_radius, double right_radius, double wheelbase)
+{
+  _left_radius = left_radius;
+  _right_radius = right_radius;
+  _calibrated_wheelbase = wheelbase;
+}
+
+
+bool Odometry::
+LoadCalibration(const std::string & fname)
+{
+  ifstream is(fname.c_str());
+  double left_radius, right_radius, wheelbase;
+  if( ! (is >> left_radius >> right_radius >> wheelbase)
+     || (left_radius <= 0) || (right_radius <= 0) || (wheelbase <= 0))
+    return false;
+  SetCalibration(left_radius, right_radius, wheelbase);
+  return true;
+}
+
+
+bool Odometry::
+Record(const std::string & fname)
+{
+  struct enc_log_s * log(0);
+  if( ! fname.empty()){
+    log = enc_log_create(fname.c_str(), stderr);
+    if(0 == log){
+      cerr << "Odometry::Record(): enc_log_create(" << fname
+	   << ") failed.\n";
+      return false;
+    }
+  }
+  // The old log gets closed once Advance() is done with it.
+  pthread_mutex_lock(& _record_mutex);
+  struct enc_log_s * old(_record_log);
+  _record_log = log;
+  pthread_mutex_unlock(& _record_mutex);
+  if(0 != old)
+    enc_log_close(old);
+  return true;
+}
+
+
 void Odometry::
 Init(const Timestamp & t, double x, double y, double theta, MotionManager * mm)
 {
-  _ql = _left.GetPosition();
-  _qr = _right.GetPosition();
-  _ancient_history.clear();
-  _recent_history.clear();
-  _ancient_history.insert(make_pair(t, posechange(t,
-						  Frame(x, y, theta),
-						  Frame(x, y, theta),
-						  true)));
+  _lindex = _left.GetNSamples();
+  _rindex = _right.GetNSamples();
+  _lpending.clear();
+  _rpending.clear();
+  _lprev.stamp = * t;
+  _lprev.position = _left.GetPosition();
+  _lprev.speed = _left.GetRealSpeed();
+  _rprev.stamp = * t;
+  _rprev.position = _right.GetPosition();
+  _rprev.speed = _right.GetRealSpeed();
+  _ql = _lprev.position;
+  _qr = _rprev.position;
+  const double cov[3][3] = {
+    { sqr(init_sigma_xy), 0, 0 },
+    { 0, sqr(init_sigma_xy), 0 },
+    { 0, 0, sqr(init_sigma_theta) } };
+  _history.Init(t, Pose(x, y, theta, cov));
   if(0 != mm)
     mm->InvalidateAnchor();
 }
@@ -61,21 +172,105 @@ Init(const Timestamp & t, double x, double y, double theta, MotionManager * mm)
 void Odometry::
 Update()
 {
-  const int32_t ql(_left.GetPosition());
-  const int32_t qr(_right.GetPosition());
+  _lpending.drain(_left, _lindex);
+  _rpending.drain(_right, _rindex);
+  
+  for(;;){
+    const bool lready( ! _lpending.empty());
+    const bool rready( ! _rpending.empty());
+    bool left;
+    if(lready && rready)
+      left = (Timestamp(_lpending.front().stamp)
+	      <= Timestamp(_rpending.front().stamp));
+    else if(_lpending.full())
+      left = true;
+    else if(_rpending.full())
+      left = false;
+    else
+      break;
+    
+    if(left){
+      const FModIPDCMOT::sample_s & sample(_lpending.front());
+      const Timestamp t(sample.stamp);
+      Advance(t, sample.position,
+	      rready ? interpolate(_rprev, _rpending.front(), t)
+	      : _rprev.position);
+      _lprev = sample;
+      _lpending.pop_front();
+    }
+    else{
+      const FModIPDCMOT::sample_s & sample(_rpending.front());
+      const Timestamp t(sample.stamp);
+      Advance(t,
+	      lready ? interpolate(_lprev, _lpending.front(), t)
+	      : _lprev.position,
+	      sample.position);
+      _rprev = sample;
+      _rpending.pop_front();
+    }
+  }
+}
+
+
+void Odometry::pending::
+pop_front()
+{
+  _begin = (_begin + 1) % FModIPDCMOT::nsamples;
+  --_size;
+}
+
+
+void Odometry::pending::
+drain(const FModIPDCMOT & motor, uint32_t & index)
+{
+  FModIPDCMOT::sample_s sample[FModIPDCMOT::nsamples];
+  const size_t count(motor.ReadSamples(index, sample,
+				       FModIPDCMOT::nsamples - _size));
+  for(size_t ii(0); ii < count; ++ii)
+    _buf[(_begin + _size + ii) % FModIPDCMOT::nsamples] = sample[ii];
+  _size += count;
+}
+
+
+void Odometry::
+Advance(const Timestamp & t, double ql, double qr)
+{
   if((ql == _ql) && (qr == _qr))
     return;
   
   double dl, dr;
   Enc2Rad(ql - _ql, qr - _qr, dl, dr);
-  dl *= _wheelradius;
-  dr *= _wheelradius;
+  dl *= _left_radius;
+  dr *= _right_radius;
   _ql = ql;
   _qr = qr;
   
-  const double ds     = (dl + dr) / 2;
-  const double dtheta = (dr - dl) / _wheelbase;
-  double dx, dy;
+  // Init() stamps with the time of the call, which can be a little
+  // later than the first samples that follow it.
+  Timestamp stamp(t);
+  if(stamp < GetCurrent().stamp)
+    stamp = GetCurrent().stamp;
+  pthread_mutex_lock(& _record_mutex);
+  if(0 != _record_log){
+    const struct timeval tv(* stamp);
+    enc_log_append(_record_log, & tv, ql, qr);
+  }
+  pthread_mutex_unlock(& _record_mutex);
+  
+  double dx, dy, dtheta, q[3][3];
+  Step(dl, dr, _calibrated_wheelbase, dx, dy, dtheta, q);
+  _history.Append(stamp, dx, dy, dtheta, q);
+  _dead_reckoning.RotateTo(dx, dy);
+  _dead_reckoning.Add(dx, dy, dtheta);
+}
+
+
+void Odometry::
+Step(double dl, double dr, double wheelbase,
+     double & dx, double & dy, double & dtheta, double q[3][3])
+{
+  const double ds = (dl + dr) / 2;
+  dtheta = (dr - dl) / wheelbase;
   if(absval(dtheta) > 1e-9){	// hax: hardcoded epsilon
     // use circular movement
     const double R = ds / dtheta;
@@ -88,81 +283,30 @@ Update()
     dy = ds * sin(0.5 * dtheta);
   }
   
-  AppendPose(Timestamp::Now(), dx, dy, dtheta);
+  // Propagate the wheel noise through the linear approximation
+  // (ds, ds * dtheta / 2, dtheta) of the step.
+  const double J[3][2] = {
+    { 0.5, 0.5 },
+    { 0.25 * dtheta - 0.5 * ds / wheelbase,
+      0.25 * dtheta + 0.5 * ds / wheelbase },
+    { - 1 / wheelbase, 1 / wheelbase } };
+  const double var[2] = { sqr(wheel_sigma) * absval(dl),
+			  sqr(wheel_sigma) * absval(dr) };
+  for(int i(0); i < 3; ++i)
+    for(int j(0); j < 3; ++j)
+      q[i][j] = J[i][0] * var[0] * J[j][0] + J[i][1] * var[1] * J[j][1];
 }
 
 
-void Odometry::
+bool Odometry::
 Correct(const Timestamp & t, const observation & observation)
 {
-//   if(observation.known_theta)
-//     cerr << "{{{ t = " << t
-// 	 << " obs = " << observation.x << ", " << observation.y
-// 	 << ", " << observation.theta << " }}}\n";
-  
-  ichange postmatch(FindClosest(t, _recent_history));
-  ichange prematch(postmatch);
-  if(prematch != _recent_history.begin())
-    --prematch;
-  
-  Frame match_global;
-  if(observation.known_theta)
-    match_global.Set(observation.x, observation.y, observation.theta);
-  else if(prematch != _recent_history.end())
-    match_global.Set(observation.x, observation.y,
-		     prematch->second.global.Theta());
-  else
-    match_global.Set(observation.x, observation.y, 0);
-
-  Timestamp match_stamp(t);
-  if((postmatch != _recent_history.end())
-     && (match_stamp >= postmatch->first))
-    match_stamp = postmatch->first - Timestamp(0, 1);
-  if((prematch != _recent_history.end())
-     && (match_stamp <= prematch->first))
-    match_stamp = prematch->first + Timestamp(0, 1);
-  
-  Frame match_delta;
-  if(postmatch != _recent_history.end())
-    match_delta.Set(postmatch->second.global.X() - match_global.X(),
-		    postmatch->second.global.Y() - match_global.Y(),
-		    postmatch->second.global.Theta() - match_global.Theta());
-  
-  // do Orwellian things with history
-  _ancient_history.insert(make_pair(match_stamp,
-				    posechange(match_stamp,
-					       match_delta,
-					       match_global,
-					       true)));
-  ichange ir(_recent_history.begin());
-  while(ir != postmatch){
-    ichange tmp(ir++);
-    _recent_history.erase(tmp);
-  }
-  Frame retrace(match_global);
-  while(ir != _recent_history.end()){
-    retrace.Add(ir->second.delta.X(), ir->second.delta.Y(),
-		ir->second.delta.Theta());
-    ir->second.global = retrace;
-    ++ir;
-  }
-}
-
-
-void Odometry::
-AppendPose(const Timestamp & t, double dx, double dy, double dtheta)
-{
-  const Frame current(GetCurrentPose());
-  current.RotateTo(dx, dy);
-  posechange change(t, Frame(dx, dy, dtheta), current, false);
-  change.global.Add(dx, dy, dtheta);
-  _recent_history.insert(make_pair(t, change));
-  //  cerr << ":" << _recent_history.size();
+  return _history.Correct(t, observation);
 }
 
 
 void Odometry::
-Enc2Rad(int32_t ql_enc, int32_t qr_enc,
+Enc2Rad(double ql_enc, double qr_enc,
 	double & ql_rad, double & qr_rad)
 {
   static const double ENC2RAD =
@@ -190,32 +334,17 @@ Rad2Enc(double ql_rad, double qr_rad,
 }
 
 
-Odometry::ichange Odometry::
-FindClosest(const Timestamp & t, history & hist)
-{
-  ichange postmatch(hist.begin());
-  while(postmatch != hist.end()){
-    if(postmatch->first > t)
-      break;
-    ++postmatch;
-  }
-  return postmatch;
-}
-
-
 const Odometry::posechange & Odometry::
 GetCurrent() const
 {
-  if(_recent_history.empty())
-    return _ancient_history.rbegin()->second;
-  return _recent_history.rbegin()->second;
+  return _history.GetCurrent();
 }
 
 
 const Odometry::posechange & Odometry::
 GetMatched() const
 {
-  return _ancient_history.rbegin()->second;
+  return _history.GetMatched();
 }
 
 
@@ -226,6 +355,20 @@ GetCurrentPose() const
 }
 
 
+Frame Odometry::
+GetPoseAt(const Timestamp & t) const
+{
+  return _history.GetPoseAt(t);
+}
+
+
+const sfl::Frame & Odometry::
+GetDeadReckoning() const
+{
+  return _dead_reckoning;
+}
+
+
 const sfl::Frame & Odometry::
 GetMatchedPose() const
 {
@@ -262,16 +405,32 @@ Draw() const
 {
   glColor3d(0, 0.4, 0.8);
   glLineWidth(1);
-  for(history::const_iterator ia(_ancient_history.begin());
-      ia != _ancient_history.end(); ++ia)
-    DrawFrame(ia->second.global);
+  for(size_t ia(0); ia < _history.GetNAncient(); ++ia)
+    DrawFrame(_history.GetAncient(ia).global);
   glColor3d(0, 0.5, 1);
   glBegin(GL_LINE_STRIP);
-  for(history::const_iterator ir(_recent_history.begin());
-      ir != _recent_history.end(); ++ir)
-    glVertex2d(ir->second.global.X(), ir->second.global.Y());
+  for(size_t ir(0); ir < _history.GetNRecent(); ++ir){
+    const Frame & pose(_history.GetRecent(ir).global);
+    glVertex2d(pose.X(), pose.Y());
+  }
   glEnd();
   glLineWidth(2);
   DrawFrame(GetCurrentPose());
   glLineWidth(1);
+  
+  // one-sigma ellipse of the position
+  const Pose & current(GetCurrent().global);
+  double major, minor, angle;
+  current.GetEllipse(major, minor, angle);
+  const double ca(cos(angle));
+  const double sa(sin(angle));
+  glBegin(GL_LINE_LOOP);
+  for(int i(0); i < 36; ++i){
+    const double phi(i * M_PI / 18);
+    const double ex(major * cos(phi));
+    const double ey(minor * sin(phi));
+    glVertex2d(current.X() + ca * ex - sa * ey,
+	       current.Y() + sa * ex + ca * ey);
+  }
+  glEnd();
 }
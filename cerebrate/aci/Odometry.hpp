@@ -22,63 +22,82 @@
 #define ODOMETRY_HPP
 
 
-#include <util/Timestamp.hpp>
-#include <sfl/Frame.hpp>
-#include <map>
+#include "PoseHistory.hpp"
+#include <drivers/FModIPDCMOT.hpp>
 #include <stdint.h>
+#include <pthread.h>
+#include <string>
 
 
-class FModIPDCMOT;
 class MotionManager;
+struct enc_log_s;
 
 
 class Odometry
 {
 public:
-  class posechange {
-  public:
-    posechange(const Timestamp & _stamp):
-      stamp(_stamp), is_match(false) {}
-    posechange(const Timestamp & _stamp,
-	       const sfl::Frame & _delta,
-	       const sfl::Frame & _global,
-	       bool _is_match):
-      stamp(_stamp), delta(_delta), global(_global), is_match(_is_match) {}
-    const Timestamp stamp;
-    const sfl::Frame delta;
-    sfl::Frame global;
-    const bool is_match;
-  };
-  
-  class observation {
-  public:
-    observation(//const Timestamp & _stamp,
-		double _x, double _y,
-		bool _known_theta, double _theta):
-      //stamp(_stamp),
-      x(_x), y(_y), known_theta(_known_theta), theta(_theta) {}
-    //const Timestamp stamp;
-    const double x;
-    const double y;
-    const bool known_theta;
-    const double theta;
-  };
+  typedef PoseHistory::posechange posechange;
+  typedef PoseHistory::observation observation;
   
   
   Odometry(FModIPDCMOT & left, FModIPDCMOT & right,
 	   double wheelbase, double wheelradius);
+  ~Odometry();
   
   
   void Init(const Timestamp & t, double x, double y, double theta,
 	    MotionManager * mm);
+  
+  /**
+     Integrate all encoder samples taken since the previous call, in
+     the order and at the time they were read. Each sample of one
+     wheel is paired with the other wheel's position interpolated to
+     its time, so a sample waits until the other wheel has a more
+     recent one.
+  */
   void Update();
-  void Correct(const Timestamp & t, const observation & observation);
+  
+  /**
+     Dead reckoning with the given wheel radii and wheelbase, as
+     estimated by odocal, instead of the nominal _wheelbase and
+     _wheelradius. Motion control keeps using the nominal values.
+  */
+  void SetCalibration(double left_radius, double right_radius,
+		      double wheelbase);
+  
+  /** Read "left_radius right_radius wheelbase" as written by odocal. */
+  bool LoadCalibration(const std::string & fname);
+  
+  /**
+     Append the encoder positions of each step that Update() takes to
+     a binary log (see enclog.h) from now on. An empty filename stops
+     recording. Can be called from another thread than Update().
+  */
+  bool Record(const std::string & fname);
+  
+  /** See PoseHistory::Correct(). */
+  bool Correct(const Timestamp & t, const observation & observation);
   
   /**
      \return Reference of current (most recent) pose in world frame.
   */
   const sfl::Frame & GetCurrentPose() const;
   
+  /**
+     \return Pose at time t in world frame, interpolated between the
+     two history entries around t. Before the recent history this is
+     the most recent matched pose, after it the current pose. Takes
+     logarithmic time in the length of the history.
+  */
+  sfl::Frame GetPoseAt(const Timestamp & t) const;
+  
+  /**
+     \return Pure dead reckoning since construction, never corrected
+     nor reset by Init(). Only differences between two such poses are
+     meaningful, as used by ParticleLocalizer.
+  */
+  const sfl::Frame & GetDeadReckoning() const;
+  
   /**
      \return Reference of current (most recent) pose change.
   */
@@ -93,9 +112,17 @@ public:
   void Draw() const;
   void DrawFrame(const sfl::Frame & frame) const;
   
+  /**
+     Pose change (dx, dy, dtheta), in the frame of the pose before,
+     and its covariance q, for wheel travels dl and dr.
+  */
+  static void Step(double dl, double dr, double wheelbase,
+		   double & dx, double & dy, double & dtheta,
+		   double q[3][3]);
+  
   static void Rad2Enc(double ql_rad, double qr_rad,
 		      int32_t & ql_enc, int32_t & qr_enc);
-  static void Enc2Rad(int32_t ql_enc, int32_t qr_enc,
+  static void Enc2Rad(double ql_enc, double qr_enc,
 		      double & ql_rad, double & qr_rad);
 
 
@@ -103,18 +130,47 @@ public:
   const double _wheelradius;
   
 private:
-  typedef std::map<Timestamp, posechange, Timestamp::less> history;
-  typedef history::iterator ichange;
-
-  void AppendPose(const Timestamp & t, double dx, double dy, double dtheta);
-  static ichange FindClosest(const Timestamp & t, history & hist);
-  
-  history _ancient_history;
-  history _recent_history;
+  PoseHistory _history;
+  sfl::Frame _dead_reckoning;
   
   FModIPDCMOT & _left;
   FModIPDCMOT & _right;
-  int32_t _ql, _qr;
+  
+  void Advance(const Timestamp & t, double ql, double qr);
+  
+  /**
+     Samples of one wheel waiting for the other, oldest first, in a
+     fixed ring. Once it is full, the other wheel is taken to be
+     standing still at its last position.
+  */
+  class pending {
+  public:
+    void clear() { _begin = 0; _size = 0; }
+    bool empty() const { return 0 == _size; }
+    bool full() const { return FModIPDCMOT::nsamples == _size; }
+    const FModIPDCMOT::sample_s & front() const { return _buf[_begin]; }
+    void pop_front();
+    
+    /**
+       Append the samples that motor took since index, as many as
+       fit. The rest stay with the motor until the next call.
+    */
+    void drain(const FModIPDCMOT & motor, uint32_t & index);
+    
+  private:
+    FModIPDCMOT::sample_s _buf[FModIPDCMOT::nsamples];
+    size_t _begin, _size;
+  };
+  
+  pending _lpending, _rpending;
+  FModIPDCMOT::sample_s _lprev, _rprev;
+  uint32_t _lindex, _rindex;
+  double _ql, _qr;
+  double _left_radius, _right_radius, _calibrated_wheelbase;
+  
+  /** Protects _record_log, which Record() swaps under Update(). */
+  pthread_mutex_t _record_mutex;
+  struct enc_log_s * _record_log;
 };
 
 #endif // ODOMETRY_HPP
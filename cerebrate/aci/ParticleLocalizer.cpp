@@ -0,0 +1,730 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "ParticleLocalizer.hpp"
+#include "Scanalyzer.hpp"
+#include "CircleLSQ.hpp"
+#include "gfx/wrap_gl.hpp"
+#include <util/Timestamp.hpp>
+#include <sfl/numeric.hpp>
+#include <pthread.h>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif // __SSE2__
+
+
+using namespace std;
+using namespace sfl;
+
+
+/** Spread of the robot centre around a sighting, in metres. */
+static const double sight_sigma(0.05);
+
+/**
+   Likelihood, relative to a perfect hit, of a particle that is not
+   near any sighting. Keeps the filter alive when the robot is
+   hidden while something else of its size is in view.
+*/
+static const float sight_floor(0.05);
+
+/** The field covers the sightings with at most this many cells a side. */
+static const int field_cells(128);
+static const double field_resolution(0.05);
+static const double field_margin(3 * sight_sigma);
+
+/**
+   Motion noise: the standard deviation of the translation and of
+   the rotation grow with both, with a floor for slipping in place.
+*/
+static const double alpha_trans(0.1);
+static const double alpha_rot(0.1);
+static const double alpha_rot_trans(0.2);
+static const double noise_floor_xy(0.003);
+static const double noise_floor_theta(0.005);
+
+/** KLD-sampling: error bound, 99% quantile, and histogram bins. */
+static const double kld_epsilon(0.05);
+static const double kld_z(2.33);
+static const double bin_xy(0.25);
+static const double bin_theta(M_PI / 9);
+static const uint32_t bin_table_bits(13);
+static const uint32_t bin_table_size(1 << bin_table_bits);
+
+/** Averaging rates of the sighting likelihood, for recovery. */
+static const double alpha_slow(0.01);
+static const double alpha_fast(0.2);
+
+/**
+   The number of particles is sized for budget_share of the time
+   budget, leaving room for the cost per particle to vary. Predict()
+   and Weigh() stop after weigh_share of it, which is about what
+   they take of a whole update, so that resampling what they got
+   through still fits.
+*/
+static const double budget_share(0.8);
+static const double weigh_share(0.6);
+
+/** Number of particles between looks at the clock, a multiple of four. */
+static const size_t deadline_check(64);
+
+/** Particles closer than this count as converged. */
+static const double converged_sigma_xy(0.1);
+static const double converged_sigma_theta(0.2);
+
+
+/**
+   Golden ratio of n, or the next larger number without a common
+   divisor, so that each particle gets visited once.
+*/
+static size_t coprime_stride(size_t n)
+{
+  size_t stride(maxval<size_t>(1, static_cast<size_t>(0.618 * n)));
+  for(/**/; stride < n; ++stride){
+    size_t a(n), b(stride);
+    while(0 != b){
+      const size_t r(a % b);
+      a = b;
+      b = r;
+    }
+    if(1 == a)
+      return stride;
+  }
+  return 1;
+}
+
+
+/**
+   Threads that weigh their share of the particles whenever Weigh()
+   bumps the generation. The caller weighs chunk 0 itself.
+*/
+struct ParticleLocalizer_pool_s {
+  ParticleLocalizer * that;
+  int nthreads;
+  pthread_t * thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned long generation;
+  int pending;
+  bool stop;
+  double sum[64];
+  size_t nweighed[64];
+  
+  struct arg_s {
+    ParticleLocalizer_pool_s * pool;
+    int chunk;
+  } arg[64];
+  
+  static void * Run(void * arg);
+};
+
+
+void * ParticleLocalizer_pool_s::
+Run(void * varg)
+{
+  arg_s * arg((arg_s *) varg);
+  ParticleLocalizer_pool_s * pool(arg->pool);
+  unsigned long seen(0);
+  pthread_mutex_lock( & pool->mutex);
+  for(;;){
+    while(( ! pool->stop) && (seen == pool->generation))
+      pthread_cond_wait( & pool->start, & pool->mutex);
+    if(pool->stop)
+      break;
+    seen = pool->generation;
+    pthread_mutex_unlock( & pool->mutex);
+    size_t nweighed;
+    const double sum(pool->that->WeighChunk(arg->chunk, nweighed));
+    pthread_mutex_lock( & pool->mutex);
+    pool->sum[arg->chunk] = sum;
+    pool->nweighed[arg->chunk] = nweighed;
+    if(0 == --pool->pending)
+      pthread_cond_signal( & pool->done);
+  }
+  pthread_mutex_unlock( & pool->mutex);
+  return 0;
+}
+
+
+ParticleLocalizer::
+ParticleLocalizer(double robot_radius, double radius_tolerance,
+		  size_t capacity, size_t min_particles,
+		  double usec_budget, int nthreads):
+  _robot_radius(robot_radius),
+  _radius_tolerance(radius_tolerance),
+  _capacity(capacity),
+  _min_particles(min_particles < capacity ? min_particles : capacity),
+  _usec_budget(usec_budget),
+  _x(new float[capacity]),
+  _y(new float[capacity]),
+  _theta(new float[capacity]),
+  _w(new float[capacity]),
+  _x2(new float[capacity]),
+  _y2(new float[capacity]),
+  _theta2(new float[capacity]),
+  _n(0),
+  _nmax(_min_particles),
+  _usec_per_particle(0),
+  _cx(new double[Scanalysis::scansize]),
+  _cy(new double[Scanalysis::scansize]),
+  _ncandidates(0),
+  _field(new float[field_cells * field_cells]),
+  _fnx(0),
+  _fny(0),
+  _fx0(0),
+  _fy0(0),
+  _fres(field_resolution),
+  _bin_key(new uint32_t[bin_table_size]),
+  _bin_used(new uint32_t[bin_table_size]),
+  _bin_stamp(0),
+  _have_last_dr(false),
+  _w_slow(0),
+  _w_fast(0),
+  _rng(2463534242UL),
+  _pool(new ParticleLocalizer_pool_s())
+{
+  memset(_bin_used, 0, bin_table_size * sizeof(* _bin_used));
+  
+  if(nthreads < 1)
+    nthreads = 1;
+  if(nthreads > 64)
+    nthreads = 64;
+  _pool->that = this;
+  _pool->nthreads = nthreads;
+  _pool->thread = new pthread_t[nthreads];
+  pthread_mutex_init( & _pool->mutex, 0);
+  pthread_cond_init( & _pool->start, 0);
+  pthread_cond_init( & _pool->done, 0);
+  _pool->generation = 0;
+  _pool->pending = 0;
+  _pool->stop = false;
+  for(int i(1); i < nthreads; ++i){
+    _pool->arg[i].pool = _pool;
+    _pool->arg[i].chunk = i;
+    if(0 != pthread_create(_pool->thread + i, 0,
+			   ParticleLocalizer_pool_s::Run, _pool->arg + i)){
+      perror("WARNING in ParticleLocalizer: pthread_create");
+      _pool->nthreads = i;
+      break;
+    }
+  }
+}
+
+
+ParticleLocalizer::
+~ParticleLocalizer()
+{
+  pthread_mutex_lock( & _pool->mutex);
+  _pool->stop = true;
+  pthread_cond_broadcast( & _pool->start);
+  pthread_mutex_unlock( & _pool->mutex);
+  for(int i(1); i < _pool->nthreads; ++i)
+    pthread_join(_pool->thread[i], 0);
+  pthread_cond_destroy( & _pool->done);
+  pthread_cond_destroy( & _pool->start);
+  pthread_mutex_destroy( & _pool->mutex);
+  delete[] _pool->thread;
+  delete _pool;
+  
+  delete[] _bin_used;
+  delete[] _bin_key;
+  delete[] _field;
+  delete[] _cy;
+  delete[] _cx;
+  delete[] _theta2;
+  delete[] _y2;
+  delete[] _x2;
+  delete[] _w;
+  delete[] _theta;
+  delete[] _y;
+  delete[] _x;
+}
+
+
+void ParticleLocalizer::
+Reset()
+{
+  _n = 0;
+  _w_slow = 0;
+  _w_fast = 0;
+}
+
+
+double ParticleLocalizer::
+Update(const Scanalysis & scan, const Frame & dead_reckoning)
+{
+  const Timestamp t0(Timestamp::Now());
+  _deadline = t0 + Timestamp(weigh_share * _usec_budget * 1e-6);
+  
+  if(_have_last_dr){
+    Frame delta(dead_reckoning);
+    _last_dr.From(delta);
+    Predict(delta.X(), delta.Y(), delta.Theta());
+  }
+  _last_dr = dead_reckoning;
+  _have_last_dr = true;
+  
+  bool weighed(false);
+  if(BuildField(scan)){
+    if(0 == _n){
+      _n = (_nmax > _min_particles) ? _nmax : _min_particles;
+      Seed(_n, 0, _x, _y, _theta);
+      for(size_t i(0); i < _n; ++i)
+	_w[i] = 1.0 / _n;
+    }
+    else{
+      size_t nweighed;
+      const double likelihood(Weigh(nweighed));
+      if(0 == _w_slow){
+	_w_slow = likelihood;
+	_w_fast = likelihood;
+      }
+      else{
+	_w_slow += alpha_slow * (likelihood - _w_slow);
+	_w_fast += alpha_fast * (likelihood - _w_fast);
+      }
+      const double inject(1 - _w_fast / _w_slow);
+      // Out of time, so draw no more than there was time to weigh.
+      size_t nmax(_nmax);
+      if((Timestamp::Now() > _deadline) && (nweighed < nmax))
+	nmax = maxval(nweighed, _min_particles);
+      Resample((inject > 0) ? inject : 0, nmax);
+      weighed = true;
+    }
+  }
+  
+  const double usec(1e6 * (Timestamp::Now() - t0).ConvertToSeconds());
+  // Seeding alone is much cheaper than a full weigh-and-resample
+  // cycle, so only learn the cost from the latter.
+  if(weighed && (_n > 0)){
+    const double cost(usec / _n);
+    if(0 == _usec_per_particle)
+      _usec_per_particle = cost;
+    else
+      _usec_per_particle += 0.1 * (cost - _usec_per_particle);
+    const double nbudget(budget_share * _usec_budget / _usec_per_particle);
+    if(nbudget >= _capacity)
+      _nmax = _capacity;
+    else if(nbudget <= _min_particles)
+      _nmax = _min_particles;
+    else
+      _nmax = static_cast<size_t>(nbudget);
+  }
+  return usec;
+}
+
+
+void ParticleLocalizer::
+Predict(double dx, double dy, double dtheta)
+{
+  const double trans(sqrt(sqr(dx) + sqr(dy)));
+  const double sxy(alpha_trans * trans + noise_floor_xy);
+  const double stheta(alpha_rot * absval(dtheta) + alpha_rot_trans * trans
+		      + noise_floor_theta);
+  for(size_t i(0); i < _n; ++i){
+    if((i >= _min_particles) && (0 == i % deadline_check)
+       && (Timestamp::Now() > _deadline)){
+      _n = i;
+      break;
+    }
+    const double ndx(dx + sxy * Gauss());
+    const double ndy(dy + sxy * Gauss());
+    const double c(cos(_theta[i]));
+    const double s(sin(_theta[i]));
+    _x[i] += c * ndx - s * ndy;
+    _y[i] += s * ndx + c * ndy;
+    _theta[i] = mod2pi(_theta[i] + dtheta + stheta * Gauss());
+  }
+}
+
+
+bool ParticleLocalizer::
+BuildField(const Scanalysis & scan)
+{
+  _ncandidates = 0;
+  double xmin(0), xmax(0), ymin(0), ymax(0);
+  for(size_t i(0); i < scan.circle.size(); ++i){
+    const CircleLSQ * circle(scan.circle[i]);
+    if((0 == circle)
+       || (absval(circle->radius - _robot_radius) > _radius_tolerance))
+      continue;
+    if((0 == _ncandidates) || (circle->xc < xmin))
+      xmin = circle->xc;
+    if((0 == _ncandidates) || (circle->xc > xmax))
+      xmax = circle->xc;
+    if((0 == _ncandidates) || (circle->yc < ymin))
+      ymin = circle->yc;
+    if((0 == _ncandidates) || (circle->yc > ymax))
+      ymax = circle->yc;
+    _cx[_ncandidates] = circle->xc;
+    _cy[_ncandidates] = circle->yc;
+    ++_ncandidates;
+  }
+  if(0 == _ncandidates)
+    return false;
+  
+  const double extent(maxval(xmax - xmin, ymax - ymin) + 2 * field_margin);
+  _fres = maxval(field_resolution, extent / (field_cells - 1));
+  _fx0 = xmin - field_margin;
+  _fy0 = ymin - field_margin;
+  _fnx = minval(field_cells,
+		static_cast<int>((xmax - xmin + 2 * field_margin) / _fres) + 1);
+  _fny = minval(field_cells,
+		static_cast<int>((ymax - ymin + 2 * field_margin) / _fres) + 1);
+  for(int i(0); i < _fnx * _fny; ++i)
+    _field[i] = sight_floor;
+  
+  const int reach(static_cast<int>(ceil(field_margin / _fres)));
+  const double scale(-0.5 / sqr(sight_sigma));
+  for(int k(0); k < _ncandidates; ++k){
+    const int ix(static_cast<int>((_cx[k] - _fx0) / _fres));
+    const int iy(static_cast<int>((_cy[k] - _fy0) / _fres));
+    for(int jy(maxval(0, iy - reach)); jy <= minval(_fny - 1, iy + reach);
+	++jy)
+      for(int jx(maxval(0, ix - reach)); jx <= minval(_fnx - 1, ix + reach);
+	  ++jx){
+	const double dx(_fx0 + (jx + 0.5) * _fres - _cx[k]);
+	const double dy(_fy0 + (jy + 0.5) * _fres - _cy[k]);
+	const float value(sight_floor + (1 - sight_floor)
+			  * exp(scale * (sqr(dx) + sqr(dy))));
+	float & cell(_field[jy * _fnx + jx]);
+	if(value > cell)
+	  cell = value;
+      }
+  }
+  return true;
+}
+
+
+double ParticleLocalizer::
+Weigh(size_t & nweighed)
+{
+  ParticleLocalizer_pool_s & pool( * _pool);
+  if(1 == pool.nthreads)
+    return WeighChunk(0, nweighed);
+  
+  pthread_mutex_lock( & pool.mutex);
+  pool.pending = pool.nthreads - 1;
+  ++pool.generation;
+  pthread_cond_broadcast( & pool.start);
+  pthread_mutex_unlock( & pool.mutex);
+  
+  double sum(WeighChunk(0, nweighed));
+  pthread_mutex_lock( & pool.mutex);
+  while(pool.pending > 0)
+    pthread_cond_wait( & pool.done, & pool.mutex);
+  pthread_mutex_unlock( & pool.mutex);
+  for(int i(1); i < pool.nthreads; ++i){
+    sum += pool.sum[i];
+    nweighed += pool.nweighed[i];
+  }
+  return sum;
+}
+
+
+/**
+   Weigh the particles of one chunk in blocks of deadline_check.
+   Those that the deadline leaves unweighed get zero weight, so that
+   resampling drops them.
+*/
+double ParticleLocalizer::
+WeighChunk(int chunk, size_t & nweighed)
+{
+  const size_t nchunks(_pool->nthreads);
+  const size_t begin(_n * chunk / nchunks);
+  const size_t end(_n * (chunk + 1) / nchunks);
+  double sum(0);
+  size_t i(begin);
+  while(i < end){
+    if((i > begin) && (Timestamp::Now() > _deadline)){
+      for(size_t j(i); j < end; ++j)
+	_w[j] = 0;
+      break;
+    }
+    const size_t stop(minval(end, i + deadline_check));
+    sum += WeighRange(i, stop);
+    i = stop;
+  }
+  nweighed = i - begin;
+  return sum;
+}
+
+
+double ParticleLocalizer::
+WeighRange(size_t i, size_t end)
+{
+  double sum(0);
+  
+#ifdef __SSE2__
+  const __m128 x0(_mm_set1_ps(_fx0));
+  const __m128 y0(_mm_set1_ps(_fy0));
+  const __m128 inv(_mm_set1_ps(1 / _fres));
+  const __m128 nx(_mm_set1_ps(_fnx));
+  const __m128 ny(_mm_set1_ps(_fny));
+  const __m128 zero(_mm_setzero_ps());
+  const __m128 base(_mm_set1_ps(sight_floor));
+  __m128 vsum(zero);
+  for(/**/; i + 4 <= end; i += 4){
+    const __m128 fx(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(_x + i), x0), inv));
+    const __m128 fy(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(_y + i), y0), inv));
+    const __m128 inside(_mm_and_ps(_mm_and_ps(_mm_cmpge_ps(fx, zero),
+					      _mm_cmplt_ps(fx, nx)),
+				   _mm_and_ps(_mm_cmpge_ps(fy, zero),
+					      _mm_cmplt_ps(fy, ny))));
+    // Truncation is flooring for the cells inside, and the index
+    // stays below 2^24 so that floats hold it exactly.
+    const __m128 cell(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(
+						_mm_cvttps_epi32(fy)), nx),
+				 _mm_cvtepi32_ps(_mm_cvttps_epi32(fx))));
+    int index[4];
+    _mm_storeu_si128((__m128i *) index,
+		     _mm_and_si128(_mm_cvttps_epi32(cell),
+				   _mm_castps_si128(inside)));
+    const __m128 hit(_mm_setr_ps(_field[index[0]], _field[index[1]],
+				 _field[index[2]], _field[index[3]]));
+    const __m128 like(_mm_or_ps(_mm_and_ps(inside, hit),
+				_mm_andnot_ps(inside, base)));
+    const __m128 w(_mm_mul_ps(_mm_loadu_ps(_w + i), like));
+    _mm_storeu_ps(_w + i, w);
+    vsum = _mm_add_ps(vsum, w);
+  }
+  float partial[4];
+  _mm_storeu_ps(partial, vsum);
+  sum = (partial[0] + partial[1]) + (partial[2] + partial[3]);
+#endif // __SSE2__
+  
+  for(/**/; i < end; ++i){
+    const double fx((_x[i] - _fx0) / _fres);
+    const double fy((_y[i] - _fy0) / _fres);
+    float like(sight_floor);
+    if((fx >= 0) && (fx < _fnx) && (fy >= 0) && (fy < _fny))
+      like = _field[static_cast<int>(fy) * _fnx + static_cast<int>(fx)];
+    _w[i] *= like;
+    sum += _w[i];
+  }
+  return sum;
+}
+
+
+void ParticleLocalizer::
+Seed(size_t count, size_t offset, float * x, float * y, float * theta)
+{
+  for(size_t i(offset); i < offset + count; ++i){
+    const int k(Roll() % _ncandidates);
+    x[i] = _cx[k] + sight_sigma * Gauss();
+    y[i] = _cy[k] + sight_sigma * Gauss();
+    theta[i] = (2 * Unit() - 1) * M_PI;
+  }
+}
+
+
+/**
+   Low-variance resampling into the second set of arrays, which are
+   then scattered back with a stride coprime to the number of
+   particles. That way, any first few of them are spread over all
+   the survivors, which is what Predict() and Weigh() keep when the
+   deadline cuts them short.
+*/
+void ParticleLocalizer::
+Resample(double inject, size_t nmax)
+{
+  double total(0);
+  for(size_t i(0); i < _n; ++i)
+    total += _w[i];
+  
+  // KLD-sampling bound, for the bins that the survivors occupy
+  const size_t k(CountBins());
+  size_t n(_min_particles);
+  if(k > 1){
+    const double a(2.0 / (9 * (k - 1)));
+    const double b(1 - a + sqrt(a) * kld_z);
+    const double nkld((k - 1) / (2 * kld_epsilon) * b * b * b);
+    if(nkld > n)
+      n = (nkld < nmax) ? static_cast<size_t>(nkld) : nmax;
+  }
+  
+  size_t ninject(static_cast<size_t>(inject * n));
+  if(ninject > n)
+    ninject = n;
+  const size_t ndraw((total > 0) ? n - ninject : 0);
+  ninject = n - ndraw;
+  
+  if(ndraw > 0){
+    const double step(total / ndraw);
+    double u(Unit() * step);
+    double c(_w[0]);
+    size_t i(0);
+    for(size_t m(0); m < ndraw; ++m){
+      while((u > c) && (i + 1 < _n))
+	c += _w[++i];
+      _x2[m] = _x[i];
+      _y2[m] = _y[i];
+      _theta2[m] = _theta[i];
+      u += step;
+    }
+  }
+  Seed(ninject, ndraw, _x2, _y2, _theta2);
+  
+  const size_t stride(coprime_stride(n));
+  size_t j(0);
+  for(size_t m(0); m < n; ++m){
+    _x[j] = _x2[m];
+    _y[j] = _y2[m];
+    _theta[j] = _theta2[m];
+    j += stride;
+    if(j >= n)
+      j -= n;
+  }
+  _n = n;
+  for(size_t i(0); i < _n; ++i)
+    _w[i] = 1.0 / _n;
+}
+
+
+size_t ParticleLocalizer::
+CountBins()
+{
+  if(0 == ++_bin_stamp){
+    memset(_bin_used, 0, bin_table_size * sizeof(* _bin_used));
+    _bin_stamp = 1;
+  }
+  
+  double total(0);
+  for(size_t i(0); i < _n; ++i)
+    total += _w[i];
+  // particles that resampling will most likely drop do not count
+  const double wmin(0.25 * total / _n);
+  
+  size_t count(0);
+  for(size_t i(0); i < _n; ++i){
+    if(_w[i] < wmin)
+      continue;
+    const uint32_t ix(static_cast<int32_t>(floor(_x[i] / bin_xy)));
+    const uint32_t iy(static_cast<int32_t>(floor(_y[i] / bin_xy)));
+    const uint32_t it(static_cast<int32_t>(floor(_theta[i] / bin_theta)));
+    const uint32_t key(((ix & 2047) << 21) | ((iy & 2047) << 10)
+		       | (it & 1023));
+    uint32_t slot((key * 2654435761UL) >> (32 - bin_table_bits));
+    slot &= bin_table_size - 1;
+    while((_bin_used[slot] == _bin_stamp) && (_bin_key[slot] != key))
+      slot = (slot + 1) & (bin_table_size - 1);
+    if(_bin_used[slot] != _bin_stamp){
+      _bin_used[slot] = _bin_stamp;
+      _bin_key[slot] = key;
+      if(++count >= bin_table_size / 2)
+	break;
+    }
+  }
+  return count;
+}
+
+
+bool ParticleLocalizer::
+GetEstimate(Pose & pose) const
+{
+  if(0 == _n)
+    return false;
+  
+  double sw(0), sx(0), sy(0), sc(0), ss(0);
+  for(size_t i(0); i < _n; ++i){
+    sw += _w[i];
+    sx += _w[i] * _x[i];
+    sy += _w[i] * _y[i];
+    sc += _w[i] * cos(_theta[i]);
+    ss += _w[i] * sin(_theta[i]);
+  }
+  if(sw <= 0)
+    return false;
+  const double mx(sx / sw);
+  const double my(sy / sw);
+  const double mtheta(atan2(ss, sc));
+  
+  double cov[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+  for(size_t i(0); i < _n; ++i){
+    const double d[3] = { _x[i] - mx, _y[i] - my, mod2pi(_theta[i] - mtheta) };
+    for(int j(0); j < 3; ++j)
+      for(int k(0); k < 3; ++k)
+	cov[j][k] += _w[i] * d[j] * d[k];
+  }
+  for(int j(0); j < 3; ++j)
+    for(int k(0); k < 3; ++k)
+      cov[j][k] /= sw;
+  pose = Pose(mx, my, mtheta, cov);
+  
+  return (cov[0][0] + cov[1][1] < sqr(converged_sigma_xy))
+    && (cov[2][2] < sqr(converged_sigma_theta));
+}
+
+
+size_t ParticleLocalizer::
+GetNParticles() const
+{
+  return _n;
+}
+
+
+size_t ParticleLocalizer::
+GetMaxParticles() const
+{
+  return _nmax;
+}
+
+
+void ParticleLocalizer::
+Draw() const
+{
+  glColor3d(0.6, 0.3, 0.8);
+  glPointSize(2);
+  glBegin(GL_POINTS);
+  for(size_t i(0); i < _n; ++i)
+    glVertex2d(_x[i], _y[i]);
+  glEnd();
+  glPointSize(1);
+}
+
+
+uint32_t ParticleLocalizer::
+Roll()
+{
+  // xorshift32, plenty for sampling and quick to reproduce
+  _rng ^= _rng << 13;
+  _rng ^= _rng >> 17;
+  _rng ^= _rng << 5;
+  return _rng;
+}
+
+
+double ParticleLocalizer::
+Unit()
+{
+  return Roll() * (1.0 / 4294967296.0);
+}
+
+
+double ParticleLocalizer::
+Gauss()
+{
+  // Irwin-Hall approximation, without transcendentals
+  return (Unit() + Unit() + Unit() + Unit() - 2) * 1.7320508075688772;
+}
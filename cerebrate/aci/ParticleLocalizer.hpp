@@ -0,0 +1,151 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifndef PARTICLE_LOCALIZER_HPP
+#define PARTICLE_LOCALIZER_HPP
+
+
+#include <util/Timestamp.hpp>
+#include <sfl/Pose.hpp>
+#include <stddef.h>
+#include <stdint.h>
+
+
+class Scanalysis;
+
+
+/**
+   Monte Carlo localization of the robot from the circles that the
+   scanner sees and from the robot's own dead reckoning. It runs
+   alongside the Kalman filter of Odometry, and is what the pose gets
+   recovered from once tracking has been lost, without having to
+   drive a manoeuvre.
+   
+   The particles live in fixed arrays, one per coordinate. Each scan
+   turns the circles of about the robot's radius into a likelihood
+   field, and the particles are weighted by looking it up, four at a
+   time where SSE2 is available, split over nthreads threads (the
+   caller being one of them). Low-variance resampling then draws as
+   many particles as KLD-sampling asks for, bounded by min_particles
+   and by what fits into most of usec_budget at the measured cost per
+   particle. That estimate lags behind, so the clock is also checked
+   while moving and weighing the particles: those left over when
+   most of the budget is spent get dropped. Resampling spreads the
+   copies of each particle over the arrays, so that the ones kept
+   are a fair sample of all of them. When the sightings become much
+   less likely than they used to be, some of the particles get drawn
+   from the sightings instead, which recovers from a kidnapped robot.
+*/
+class ParticleLocalizer
+{
+public:
+  ParticleLocalizer(double robot_radius, double radius_tolerance,
+		    size_t capacity, size_t min_particles,
+		    double usec_budget, int nthreads);
+  ~ParticleLocalizer();
+  
+  /** Forget the pose, the next sighting spreads the particles anew. */
+  void Reset();
+  
+  /**
+     Move the particles by the change of dead_reckoning since the
+     previous call, then weight and resample them with the circles of
+     scan, which must be expressed in the map frame.
+     
+     \return Microseconds spent.
+  */
+  double Update(const Scanalysis & scan, const sfl::Frame & dead_reckoning);
+  
+  /**
+     Weighted mean and covariance of the particles.
+     
+     \return true if they have converged to a single pose.
+  */
+  bool GetEstimate(sfl::Pose & pose) const;
+  
+  size_t GetNParticles() const;
+  
+  /** Current bound on the number of particles from the time budget. */
+  size_t GetMaxParticles() const;
+  
+  void Draw() const;
+  
+private:
+  friend struct ParticleLocalizer_pool_s;
+  
+  ParticleLocalizer(const ParticleLocalizer &);
+  ParticleLocalizer & operator = (const ParticleLocalizer &);
+  
+  void Predict(double dx, double dy, double dtheta);
+  bool BuildField(const Scanalysis & scan);
+  
+  /** \param nweighed Set to the number of particles weighed in time. */
+  double Weigh(size_t & nweighed);
+  double WeighChunk(int chunk, size_t & nweighed);
+  double WeighRange(size_t i, size_t end);
+  void Seed(size_t count, size_t offset, float * x, float * y,
+	    float * theta);
+  
+  /** Draws at most nmax particles, but not less than min_particles. */
+  void Resample(double inject, size_t nmax);
+  size_t CountBins();
+  uint32_t Roll();
+  double Unit();
+  double Gauss();
+  
+  const double _robot_radius;
+  const double _radius_tolerance;
+  const size_t _capacity;
+  const size_t _min_particles;
+  const double _usec_budget;
+  
+  // particles, and the arrays that resampling draws into
+  float * _x, * _y, * _theta, * _w;
+  float * _x2, * _y2, * _theta2;
+  size_t _n;
+  size_t _nmax;
+  double _usec_per_particle;
+  
+  /** When Predict() and Weigh() stop, see weigh_share. */
+  Timestamp _deadline;
+  
+  // likelihood field around the current sightings
+  double * _cx, * _cy;
+  int _ncandidates;
+  float * _field;
+  int _fnx, _fny;
+  double _fx0, _fy0, _fres;
+  
+  // KLD-sampling histogram, as an open addressing hash table whose
+  // entries are valid only if their stamp is _bin_stamp
+  uint32_t * _bin_key;
+  uint32_t * _bin_used;
+  uint32_t _bin_stamp;
+  
+  sfl::Frame _last_dr;
+  bool _have_last_dr;
+  double _w_slow, _w_fast;
+  uint32_t _rng;
+  
+  struct ParticleLocalizer_pool_s * _pool;
+};
+
+#endif // PARTICLE_LOCALIZER_HPP
@@ -0,0 +1,246 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "PoseHistory.hpp"
+#include <sfl/numeric.hpp>
+
+
+using namespace sfl;
+
+
+/** 99% quantiles of the chi-square distribution, 2 and 3 DOF. */
+static const double gate_position(9.21);
+static const double gate_pose(11.34);
+
+
+PoseHistory::
+PoseHistory(size_t recent_capacity, size_t ancient_capacity):
+  _ancient(ancient_capacity),
+  _recent(recent_capacity)
+{
+  Init(Timestamp::Now(), Pose());
+}
+
+
+PoseHistory::
+~PoseHistory()
+{
+}
+
+
+void PoseHistory::
+Init(const Timestamp & t, const Pose & pose)
+{
+  _ancient.clear();
+  _recent.clear();
+  _ancient.push_back(posechange(t, Pose(), pose, true));
+}
+
+
+void PoseHistory::
+Append(const Timestamp & t, double dx, double dy, double dtheta,
+       const double q[3][3])
+{
+  posechange change(t, Pose(dx, dy, dtheta, q), GetCurrent().global, false);
+  change.global.Compose(change.delta);
+  _recent.push_back(change);
+}
+
+
+bool PoseHistory::
+Correct(const Timestamp & t, const observation & observation)
+{
+  // post is the first recent pose after t and pre the one before,
+  // either of them being _recent.size() if it does not exist. The
+  // prior is the pose at pre, or the latest match if t lies before
+  // the recent history.
+  const size_t nrecent(_recent.size());
+  const size_t post(_recent.upper_bound(t));
+  const size_t pre((post > 0) ? post - 1 : nrecent);
+  
+  Pose match((pre < nrecent) ? _recent[pre].global : _ancient.back().global);
+  if( ! match.Fuse(observation.x, observation.y,
+		   observation.known_theta, observation.theta,
+		   observation.cov,
+		   observation.known_theta ? gate_pose : gate_position))
+    return false;
+  
+  Timestamp match_stamp(t);
+  if((post < nrecent) && (match_stamp >= _recent[post].stamp))
+    match_stamp = _recent[post].stamp - Timestamp(0, 1);
+  if((pre < nrecent) && (match_stamp <= _recent[pre].stamp))
+    match_stamp = _recent[pre].stamp + Timestamp(0, 1);
+  // the ancient history has to stay in chronological order
+  if(match_stamp <= _ancient.back().stamp)
+    match_stamp = _ancient.back().stamp + Timestamp(0, 1);
+  
+  if(_ancient.full())
+    _ancient.decimate();
+  _ancient.push_back(posechange(match_stamp, Pose(), match, true));
+  _recent.pop_front(post);
+  for(size_t i(0); i < _recent.size(); ++i){
+    match.Compose(_recent[i].delta);
+    _recent[i].global = match;
+  }
+  return true;
+}
+
+
+Frame PoseHistory::
+GetPoseAt(const Timestamp & t) const
+{
+  const size_t post(_recent.upper_bound(t));
+  if(post == _recent.size())
+    return GetCurrent().global;
+  
+  const posechange & pre((post > 0) ? _recent[post - 1] : GetMatched());
+  if(t <= pre.stamp)
+    return pre.global;
+  
+  const double span((_recent[post].stamp - pre.stamp).ConvertToSeconds());
+  if(span <= 0)
+    return _recent[post].global;
+  const double s((t - pre.stamp).ConvertToSeconds() / span);
+  const Frame & p0(pre.global);
+  const Frame & p1(_recent[post].global);
+  return Frame(p0.X() + s * (p1.X() - p0.X()),
+	       p0.Y() + s * (p1.Y() - p0.Y()),
+	       mod2pi(p0.Theta() + s * mod2pi(p1.Theta() - p0.Theta())));
+}
+
+
+const PoseHistory::posechange & PoseHistory::
+GetCurrent() const
+{
+  if(0 == _recent.size())
+    return _ancient.back();
+  return _recent.back();
+}
+
+
+const PoseHistory::posechange & PoseHistory::
+GetMatched() const
+{
+  return _ancient.back();
+}
+
+
+size_t PoseHistory::
+GetNRecent() const
+{
+  return _recent.size();
+}
+
+
+const PoseHistory::posechange & PoseHistory::
+GetRecent(size_t index) const
+{
+  return _recent[index];
+}
+
+
+size_t PoseHistory::
+GetNAncient() const
+{
+  return _ancient.size();
+}
+
+
+const PoseHistory::posechange & PoseHistory::
+GetAncient(size_t index) const
+{
+  return _ancient[index];
+}
+
+
+PoseHistory::ring::
+ring(size_t capacity):
+  _buf(new posechange[capacity > 1 ? capacity : 2]),
+  _capacity(capacity > 1 ? capacity : 2),
+  _begin(0),
+  _size(0)
+{
+}
+
+
+PoseHistory::ring::
+~ring()
+{
+  delete[] _buf;
+}
+
+
+void PoseHistory::ring::
+clear()
+{
+  _begin = 0;
+  _size = 0;
+}
+
+
+void PoseHistory::ring::
+push_back(const posechange & change)
+{
+  if(full())
+    pop_front(1);
+  ++_size;
+  (* this)[_size - 1] = change;
+}
+
+
+void PoseHistory::ring::
+pop_front(size_t count)
+{
+  if(count > _size)
+    count = _size;
+  _begin = (_begin + count) % _capacity;
+  _size -= count;
+}
+
+
+void PoseHistory::ring::
+decimate()
+{
+  // Entries move towards the front, so copying in increasing order
+  // never overwrites one that is still to be read.
+  const size_t older(_size / 2);
+  size_t to(0);
+  for(size_t from(1); from < older; from += 2)
+    (* this)[to++] = (* this)[from];
+  for(size_t from(older); from < _size; ++from)
+    (* this)[to++] = (* this)[from];
+  _size = to;
+}
+
+
+size_t PoseHistory::ring::
+upper_bound(const Timestamp & t) const
+{
+  size_t lo(0), hi(_size);
+  while(lo < hi){
+    const size_t mid(lo + (hi - lo) / 2);
+    if(t < (* this)[mid].stamp)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
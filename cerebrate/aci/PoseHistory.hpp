@@ -0,0 +1,174 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifndef POSE_HISTORY_HPP
+#define POSE_HISTORY_HPP
+
+
+#include <util/Timestamp.hpp>
+#include <sfl/Pose.hpp>
+#include <stddef.h>
+
+
+/**
+   Extended Kalman filter over odometric pose changes, corrected by
+   external observations. The recent history holds every pose change
+   since the latest match, so that a delayed observation can be fused
+   with the pose at its own time, after which the poses since then
+   are predicted anew. The ancient history is a log of matched poses.
+   
+   Both are rings of fixed capacity, allocated by the
+   constructor. When the recent history is full, its oldest entries
+   are dropped, so corrections further back than that are fused with
+   the latest matched pose. When the ancient history is full, its
+   older half gets thinned out to every second entry, so it spans
+   ever longer times at decreasing density.
+*/
+class PoseHistory
+{
+public:
+  /**
+     A pose in world frame, along with the change from the previous
+     one. For odometry, that delta is expressed in the frame of the
+     previous pose, and its covariance is the noise of that step.
+  */
+  class posechange {
+  public:
+    posechange(): is_match(false) {}
+    posechange(const Timestamp & _stamp):
+      stamp(_stamp), is_match(false) {}
+    posechange(const Timestamp & _stamp,
+	       const sfl::Pose & _delta,
+	       const sfl::Pose & _global,
+	       bool _is_match):
+      stamp(_stamp), delta(_delta), global(_global), is_match(_is_match) {}
+    Timestamp stamp;
+    sfl::Pose delta;
+    sfl::Pose global;
+    bool is_match;
+  };
+  
+  /**
+     Observed position, and heading if known_theta, with the
+     covariance of (x, y, theta). The heading row and column of cov
+     are ignored unless known_theta.
+  */
+  class observation {
+  public:
+    observation(double _x, double _y,
+		bool _known_theta, double _theta,
+		const double _cov[3][3]):
+      x(_x), y(_y), known_theta(_known_theta), theta(_theta) {
+      for(int i(0); i < 3; ++i)
+	for(int j(0); j < 3; ++j)
+	  cov[i][j] = _cov[i][j];
+    }
+    const double x;
+    const double y;
+    const bool known_theta;
+    const double theta;
+    double cov[3][3];
+  };
+  
+  
+  PoseHistory(size_t recent_capacity, size_t ancient_capacity);
+  ~PoseHistory();
+  
+  /** Forget everything, starting over as a match at pose. */
+  void Init(const Timestamp & t, const sfl::Pose & pose);
+  
+  /**
+     Prediction with a displacement, expressed in the frame of the
+     current pose, that ended at time t and has covariance q. Stamps
+     must increase from one call to the next.
+  */
+  void Append(const Timestamp & t, double dx, double dy, double dtheta,
+	      const double q[3][3]);
+  
+  /**
+     Fuse the observation with the pose at time t, and predict the
+     recent poses after t from there. Takes logarithmic time to find
+     t, and linear time in the number of recent poses after it.
+     
+     \return false if the observation is too unlikely (beyond the 99%
+     quantile of its Mahalanobis distance), in which case nothing
+     changes.
+  */
+  bool Correct(const Timestamp & t, const observation & observation);
+  
+  /** See Odometry::GetPoseAt(). */
+  sfl::Frame GetPoseAt(const Timestamp & t) const;
+  
+  const posechange & GetCurrent() const;
+  const posechange & GetMatched() const;
+  
+  /** Entries of the recent history, 0 being the oldest. */
+  size_t GetNRecent() const;
+  const posechange & GetRecent(size_t index) const;
+  
+  /** Entries of the ancient history, 0 being the oldest. */
+  size_t GetNAncient() const;
+  const posechange & GetAncient(size_t index) const;
+  
+private:
+  /** Chronological ring of posechange, see PoseHistory. */
+  class ring {
+  public:
+    explicit ring(size_t capacity);
+    ~ring();
+    
+    void clear();
+    size_t size() const { return _size; }
+    bool full() const { return _size == _capacity; }
+    
+    posechange & operator[](size_t index)
+    { return _buf[(_begin + index) % _capacity]; }
+    const posechange & operator[](size_t index) const
+    { return _buf[(_begin + index) % _capacity]; }
+    const posechange & back() const { return (* this)[_size - 1]; }
+    
+    /** Append, dropping the oldest entry if full. */
+    void push_back(const posechange & change);
+    void pop_front(size_t count);
+    
+    /** Keep every second entry of the older half. */
+    void decimate();
+    
+    /** \return index of the first entry later than t, or size(). */
+    size_t upper_bound(const Timestamp & t) const;
+    
+  private:
+    ring(const ring &);
+    ring & operator = (const ring &);
+    
+    posechange * _buf;
+    const size_t _capacity;
+    size_t _begin, _size;
+  };
+  
+  PoseHistory(const PoseHistory &);
+  PoseHistory & operator = (const PoseHistory &);
+  
+  ring _ancient;
+  ring _recent;
+};
+
+#endif // POSE_HISTORY_HPP
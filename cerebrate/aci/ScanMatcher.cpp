@@ -0,0 +1,254 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "ScanMatcher.hpp"
+#include "Scanalyzer.hpp"
+#include "OccupancyGrid.hpp"
+#include <sfl/numeric.hpp>
+#include <vector>
+#include <cstring>
+#include <cmath>
+
+
+using namespace std;
+using namespace sfl;
+
+
+/** Room left around the map for the scanner to have moved, in metres. */
+static const double grid_margin(0.5);
+
+
+ScanMatcher::
+ScanMatcher(double resolution, double max_dist, int max_iter,
+	    int min_inliers):
+  _resolution(resolution),
+  _max_dist(max_dist),
+  _max_iter(max_iter),
+  _min_inliers(min_inliers),
+  _x0(0),
+  _y0(0),
+  _nx(0),
+  _ny(0),
+  _grid(0),
+  _ninliers(0),
+  _rms(0)
+{
+}
+
+
+ScanMatcher::
+~ScanMatcher()
+{
+  delete[] _grid;
+}
+
+
+bool ScanMatcher::
+SetMap(int npoints, const double * x, const double * y, double gap)
+{
+  delete[] _grid;
+  _grid = 0;
+  _nx = 0;
+  _ny = 0;
+  if((npoints < 1) || (npoints < _min_inliers))
+    return false;
+  
+  double xmin(x[0]), xmax(x[0]), ymin(y[0]), ymax(y[0]);
+  for(int i(1); i < npoints; ++i){
+    xmin = minval(xmin, x[i]);
+    xmax = maxval(xmax, x[i]);
+    ymin = minval(ymin, y[i]);
+    ymax = maxval(ymax, y[i]);
+  }
+  const double margin(grid_margin + _max_dist);
+  _x0 = xmin - margin;
+  _y0 = ymin - margin;
+  _nx = (int) ceil((xmax - xmin + 2 * margin) / _resolution) + 1;
+  _ny = (int) ceil((ymax - ymin + 2 * margin) / _resolution) + 1;
+  
+  // Squared distances in cells, zero where the map has a point.
+  static const double infinity(1e20);
+  vector<double> sq(_nx * _ny, infinity);
+  for(int i(0); i < npoints; ++i){
+    int nsteps(0);
+    if(i + 1 < npoints){
+      const double len(sqrt(sqr(x[i + 1] - x[i]) + sqr(y[i + 1] - y[i])));
+      if(len < gap)
+	nsteps = (int) ceil(2 * len / _resolution);
+    }
+    for(int k(0); k <= nsteps; ++k){
+      const double a(0 == nsteps ? 0 : k / (double) nsteps);
+      const double px(x[i] + a * (x[(0 == nsteps) ? i : i + 1] - x[i]));
+      const double py(y[i] + a * (y[(0 == nsteps) ? i : i + 1] - y[i]));
+      const int ix((int) rint((px - _x0) / _resolution));
+      const int iy((int) rint((py - _y0) / _resolution));
+      sq[iy * _nx + ix] = 0;
+    }
+  }
+  
+  OccupancyGrid::DistanceTransform(_nx, _ny, & sq[0]);
+  _grid = new float[_nx * _ny];
+  for(int i(0); i < _nx * _ny; ++i)
+    _grid[i] = _resolution * sqrt(sq[i]);
+  
+  return true;
+}
+
+
+bool ScanMatcher::
+SetMap(const OccupancyGrid & map)
+{
+  delete[] _grid;
+  _resolution = map.GetResolution();
+  _x0 = map.GetX0();
+  _y0 = map.GetY0();
+  _nx = map.GetNX();
+  _ny = map.GetNY();
+  _grid = new float[_nx * _ny];
+  memcpy(_grid, map.GetDistance(), _nx * _ny * sizeof(float));
+  return true;
+}
+
+
+bool ScanMatcher::
+HaveMap() const
+{
+  return 0 != _grid;
+}
+
+
+bool ScanMatcher::
+Lookup(double x, double y, double & dist, double & gx, double & gy) const
+{
+  const double u((x - _x0) / _resolution);
+  const double v((y - _y0) / _resolution);
+  const int ix((int) floor(u));
+  const int iy((int) floor(v));
+  if((0 == _grid) || (ix < 0) || (iy < 0)
+     || (ix + 1 >= _nx) || (iy + 1 >= _ny))
+    return false;
+  
+  const double fu(u - ix);
+  const double fv(v - iy);
+  const float * cell(_grid + iy * _nx + ix);
+  const double d00(cell[0]), d10(cell[1]);
+  const double d01(cell[_nx]), d11(cell[_nx + 1]);
+  dist = (1 - fv) * ((1 - fu) * d00 + fu * d10)
+    + fv * ((1 - fu) * d01 + fu * d11);
+  gx = ((1 - fv) * (d10 - d00) + fv * (d11 - d01)) / _resolution;
+  gy = ((1 - fu) * (d01 - d00) + fu * (d11 - d10)) / _resolution;
+  return true;
+}
+
+
+/** Solve a x = b for a symmetric 3x3 a, by Cramer's rule. */
+static bool solve3(const double a[3][3], const double b[3], double x[3])
+{
+  const double c00(a[1][1] * a[2][2] - a[1][2] * a[2][1]);
+  const double c01(a[1][2] * a[2][0] - a[1][0] * a[2][2]);
+  const double c02(a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+  const double det(a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02);
+  if(absval(det) < 1e-12)
+    return false;
+  for(int k(0); k < 3; ++k){
+    double m[3][3];
+    for(int i(0); i < 3; ++i)
+      for(int j(0); j < 3; ++j)
+	m[i][j] = (j == k) ? b[i] : a[i][j];
+    x[k] = (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+	    + m[0][1] * (m[1][2] * m[2][0] - m[1][0] * m[2][2])
+	    + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])) / det;
+  }
+  return true;
+}
+
+
+bool ScanMatcher::
+Match(const Scanalysis & scan, sfl::Frame & pose)
+{
+  _ninliers = 0;
+  _rms = 0;
+  if(0 == _grid)
+    return false;
+  
+  double tx(pose.X()), ty(pose.Y()), theta(pose.Theta());
+  for(int iter(0); iter < _max_iter; ++iter){
+    const double ct(cos(theta));
+    const double st(sin(theta));
+    double jtj[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+    double jtr[3] = { 0, 0, 0 };
+    double ssq(0);
+    int count(0);
+    for(int i(0); i < Scanalysis::scansize; ++i){
+      const double qx(ct * scan.x[i] - st * scan.y[i] + tx);
+      const double qy(st * scan.x[i] + ct * scan.y[i] + ty);
+      double dist, gx, gy;
+      if(( ! Lookup(qx, qy, dist, gx, gy)) || (dist > _max_dist))
+	continue;
+      const double jac[3] = { gx, gy, gy * (qx - tx) - gx * (qy - ty) };
+      for(int j(0); j < 3; ++j){
+	jtr[j] += jac[j] * dist;
+	for(int k(0); k < 3; ++k)
+	  jtj[j][k] += jac[j] * jac[k];
+      }
+      ssq += dist * dist;
+      ++count;
+    }
+    
+    _ninliers = count;
+    if(count < _min_inliers)
+      return false;
+    _rms = sqrt(ssq / count);
+    
+    // A little damping keeps directions that the scan does not
+    // constrain (a single straight wall) from running off.
+    for(int j(0); j < 3; ++j){
+      jtj[j][j] += 1e-3 * count;
+      jtr[j] = - jtr[j];
+    }
+    double delta[3];
+    if( ! solve3(jtj, jtr, delta))
+      break;
+    tx += delta[0];
+    ty += delta[1];
+    theta = mod2pi(theta + delta[2]);
+    if((absval(delta[0]) + absval(delta[1]) < 1e-4)
+       && (absval(delta[2]) < 1e-4))
+      break;
+  }
+  
+  pose.Set(tx, ty, theta);
+  return true;
+}
+
+
+int ScanMatcher::
+GetNInliers() const
+{
+  return _ninliers;
+}
+
+
+double ScanMatcher::
+GetRMS() const
+{
+  return _rms;
+}
@@ -0,0 +1,101 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifndef SCAN_MATCHER_HPP
+#define SCAN_MATCHER_HPP
+
+
+#include <sfl/Frame.hpp>
+
+
+class Scanalysis;
+class OccupancyGrid;
+
+
+/**
+   Registers scans against a fixed map of points, such as the
+   background recorded when the scanner was set up. SetMap()
+   rasterizes the map once into a grid that holds, for each cell, the
+   distance to the nearest map point. Match() then minimizes the
+   squared grid distances of the scan points by Gauss-Newton on the
+   scanner pose, looking up each point in constant time. Scan points
+   further than max_dist from the map (people, props, max range
+   readings) are ignored, and at most max_iter iterations are made,
+   so a match costs at most max_iter passes over the scan.
+*/
+class ScanMatcher
+{
+public:
+  ScanMatcher(double resolution, double max_dist, int max_iter,
+	      int min_inliers);
+  ~ScanMatcher();
+  
+  /**
+     Build the distance grid from npoints map points given in scan
+     order. Consecutive points closer than gap get joined, because
+     the surface between two beams is usually there as well.
+     \return false if there were fewer than min_inliers points, in
+     which case Match() always fails.
+  */
+  bool SetMap(int npoints, const double * x, const double * y, double gap);
+  
+  /**
+     Use the distance field of an occupancy grid, which has to be
+     up to date (see OccupancyGrid::UpdateDistance()).
+  */
+  bool SetMap(const OccupancyGrid & map);
+  
+  bool HaveMap() const;
+  
+  /**
+     Find the pose of the scanner in the map frame, starting from
+     pose and updating it on success.
+     \return false if fewer than min_inliers points matched.
+  */
+  bool Match(const Scanalysis & scan, sfl::Frame & pose);
+  
+  /** Number of points that took part in the last Match(). */
+  int GetNInliers() const;
+  
+  /** Root mean square distance of those points from the map. */
+  double GetRMS() const;
+  
+  /**
+     Distance from the nearest map point, interpolated within the
+     grid, with its gradient.
+     \return false outside the grid.
+  */
+  bool Lookup(double x, double y, double & dist,
+	      double & gx, double & gy) const;
+  
+private:
+  double _resolution;
+  const double _max_dist;
+  const int _max_iter, _min_inliers;
+  
+  double _x0, _y0;		// centre of cell (0, 0)
+  int _nx, _ny;
+  float * _grid;		// distance, row major in x
+  int _ninliers;
+  double _rms;
+};
+
+#endif // SCAN_MATCHER_HPP
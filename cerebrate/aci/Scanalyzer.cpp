@@ -20,35 +20,77 @@
 
 #include "Scanalyzer.hpp"
 #include "CircleLSQ.hpp"
+#include "LineSegment.hpp"
 #include "gfx/wrap_gl.hpp"
 #include "gfx/Viewport.hpp"
 #include <drivers/util.h>
 #include <drivers/sick.h>
+#include <drivers/sicklog.h>
+#include <drivers/trace.h>
 #include <sfl/numeric.hpp>
 #include <sfl/Polygon.hpp>
+#include <sfl/Frame.hpp>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cstring>
 #include <cmath>
 #include <stdint.h>
+#include <unistd.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif // __SSE2__
+#ifdef __AVX__
+# include <immintrin.h>
+#endif // __AVX__
 
 
 using namespace std;
 using namespace sfl;
 
 
+/** Range noise floor of the scanner, in metres. */
+static const double bg_sigma_min(0.015);
+
+/** Beams within this many sigmas of the background belong to it. */
+static const double bg_nsigma(3);
+
+/** HoldBackground() widens held clusters by this many beams. */
+static const int bg_hold_margin(5);
+
+/**
+   Line extraction: largest distance of a beam from its segment,
+   largest gap between consecutive beams of a segment, and the
+   smallest segments that are kept, in metres and beams.
+*/
+static const double line_thresh(0.02);
+static const double line_gap(0.2);
+static const int line_min_points(5);
+static const double line_min_length(0.1);
+
+/** Clusters lying on a segment at least this long are not fitted. */
+static const double flat_min_length(0.25);
+
+
 Scanalysis::
 Scanalysis():
   t0(Timestamp::Now()),
   t1(t0)
 {
+  Allocate();
+  memset(x, 0, scansize * sizeof(double));
+  memset(y, 0, scansize * sizeof(double));
+  memset(rho, 0, scansize * sizeof(double));
+  memset(bgrho, 0, scansize * sizeof(double));
   memset(category, INVALID, scansize * sizeof(category_t));
+  memset(label, -1, scansize * sizeof(int));
 }
 
 
 Scanalysis::
 Scanalysis(const Scanalysis & original)
 {
+  Allocate();
   * this = original;
 }
 
@@ -56,14 +98,41 @@ Scanalysis(const Scanalysis & original)
 Scanalysis::
 ~Scanalysis()
 {
-  for(size_t i(0); i < circle.size(); ++i)
-    delete circle[i];
+  delete[] x;
+  delete[] y;
+  delete[] rho;
+  delete[] bgrho;
+  delete[] category;
+  delete[] label;
+  delete[] circle_pool;
+  delete[] segment_pool;
+}
+
+
+void Scanalysis::
+Allocate()
+{
+  x = new double[scansize];
+  y = new double[scansize];
+  rho = new double[scansize];
+  bgrho = new double[scansize];
+  category = new category_t[scansize];
+  label = new int[scansize];
+  circle_pool = new CircleLSQ[scansize];
+  startindex.reserve(scansize);
+  endindex.reserve(scansize);
+  circle.reserve(scansize);
+  segment_pool = new LineSegment[scansize];
+  segment.reserve(scansize);
 }
 
 
 Scanalysis & Scanalysis::
 operator = (const Scanalysis & original)
 {
+  if(this == & original)
+    return * this;
+  
   memcpy(x, original.x, scansize * sizeof(double));
   memcpy(y, original.y, scansize * sizeof(double));
   memcpy(rho, original.rho, scansize * sizeof(double));
@@ -73,14 +142,20 @@ operator = (const Scanalysis & original)
   startindex = original.startindex;
   endindex = original.endindex;
   
-  for(size_t i(0); i < circle.size(); ++i)
-    delete circle[i];
   circle.clear();
   for(size_t i(0); i < original.circle.size(); ++i)
     if(original.circle[i] == 0)
       circle.push_back(0);
-    else
-      circle.push_back(new CircleLSQ(* original.circle[i]));
+    else{
+      circle_pool[i] = * original.circle[i];
+      circle.push_back(circle_pool + i);
+    }
+  
+  segment.clear();
+  for(size_t i(0); i < original.segment.size(); ++i){
+    segment_pool[i] = * original.segment[i];
+    segment.push_back(segment_pool + i);
+  }
   
   t0 = original.t0;
   t1 = original.t1;
@@ -89,20 +164,95 @@ operator = (const Scanalysis & original)
 }
 
 
+void Scanalysis::
+Swap(Scanalysis & other)
+{
+  std::swap(x, other.x);
+  std::swap(y, other.y);
+  std::swap(rho, other.rho);
+  std::swap(bgrho, other.bgrho);
+  std::swap(category, other.category);
+  std::swap(label, other.label);
+  startindex.swap(other.startindex);
+  endindex.swap(other.endindex);
+  circle.swap(other.circle);
+  std::swap(circle_pool, other.circle_pool);
+  segment.swap(other.segment);
+  std::swap(segment_pool, other.segment_pool);
+  std::swap(t0, other.t0);
+  std::swap(t1, other.t1);
+}
+
+
+void Scanalysis::
+TransformTo(const sfl::Frame & frame)
+{
+  for(int i(0); i < scansize; ++i)
+    frame.To(x[i], y[i]);
+  for(size_t i(0); i < circle.size(); ++i)
+    if(0 != circle[i])
+      circle_pool[i].TransformTo(frame);
+  for(size_t i(0); i < segment.size(); ++i)
+    segment_pool[i].TransformTo(frame);
+}
+
+
+Timestamp Scanalysis::
+GetBeamTime(int index) const
+{
+  const double sweep((t1 - t0).ConvertToSeconds());
+  return t0 + Timestamp(sweep * (scansize - 1 - index) / (scansize - 1));
+}
+
+
 bool Scanalyzer::
 InitSick(FILE * sick_dbg)
 {
-  const int fd(serial_open(_comport.c_str(), _baudrate));
-  if(fd < 0){
-    cerr << "Scanalyzer::InitSick(): serial_open(" << _comport
-	 << ", " << _baudrate << ") returned " << fd << "\n";
-    return false;
+  _sick_count = 0;
+  if( ! _replay_fname.empty()){
+    if(0 == _replay_log)
+      _replay_log = sick_log_open(_replay_fname.c_str(), stderr);
+    if(0 == _replay_log){
+      cerr << "Scanalyzer::InitSick(): sick_log_open(" << _replay_fname
+	   << ") failed.\n";
+      return false;
+    }
+    _sick_poster = sick_poster_new_replay(_replay_log, _replay_speed,
+					  sick_dbg);
+  }
+  else{
+    const int fd(serial_open(_comport.c_str(), _baudrate));
+    if(fd < 0){
+      cerr << "Scanalyzer::InitSick(): serial_open(" << _comport
+	   << ", " << _baudrate << ") returned " << fd << "\n";
+      return false;
+    }
+    unsigned long baudrate;
+    const int result(sick_negotiate(fd, _baudrate, & baudrate, sick_dbg));
+    if(result < 0){
+      // sick_detect() leaves the line at the last rate it probed.
+      cerr << "WARNING in Scanalyzer::InitSick(): sick_negotiate() returned "
+	   << result << ", trying " << _baudrate << " baud anyway.\n";
+      if(0 != serial_setbaud(fd, _baudrate)){
+	cerr << "Scanalyzer::InitSick(): serial_setbaud(" << _baudrate
+	     << ") failed.\n";
+	serial_close(fd);
+	return false;
+      }
+    }
+    else if(result > 0)
+      cerr << "WARNING in Scanalyzer::InitSick(): could not switch to "
+	   << _baudrate << " baud, falling back to " << baudrate << ".\n";
+    if(0 == _usec_cycle)
+      _sick_poster = sick_poster_new_stream(fd, sick_dbg);
+    else
+      _sick_poster = sick_poster_new(fd, _usec_cycle, sick_dbg);
   }
-  _sick_poster = sick_poster_new(fd, _usec_cycle, sick_dbg);
   if(0 == _sick_poster){
     cerr << "Scanalyzer::InitSick(): sick_poster_new() failed.\n";
     return false;
   }
+  sick_poster_record(_sick_poster, _record_log);
   if(0 != sick_poster_start(_sick_poster)){
     cerr << "Scanalyzer::InitSick(): sick_poster_start() failed.\n";
     return false;
@@ -126,6 +276,11 @@ Init(double cluster_thresh, double rhomax)
   
   const_cast<double &>(_cluster_thresh) = cluster_thresh;
   const_cast<double &>(_rhomax) = rhomax;
+  _stamp = Timestamp::Now();
+  _lines = auto_ptr<LineExtractor>(new LineExtractor(line_thresh, line_gap,
+						     line_min_points,
+						     line_min_length,
+						     bg_sigma_min));
   
   double * cp = const_cast<double *>(_cosphi);
   double * sp = const_cast<double *>(_sinphi);
@@ -136,14 +291,74 @@ Init(double cluster_thresh, double rhomax)
   }
   memset(_bgx, 0, scansize * sizeof(double));
   memset(_bgy, 0, scansize * sizeof(double));
-  memset(_analysis.bgrho, 0, scansize * sizeof(double));
+  memset(_bgrho, 0, scansize * sizeof(double));
+  memset(_bgweight, 0, scansize * sizeof(double));
+  memset(_candweight, 0, scansize * sizeof(double));
+  memset(_bghold, 0, scansize * sizeof(bool));
+  for(int i(0); i < scansize; ++i){
+    _bgvar[i] = sqr(bg_sigma_min);
+    _bgthresh[i] = bg_nsigma * bg_sigma_min;
+  }
+  _bg_alpha = 0.001;
+  _bg_alpha_far = 0.02;
   
   Polygon foo;
   foo.AddPoint(0.1,  3.85);
   foo.AddPoint(3.5,  3.85);
   foo.AddPoint(3.5, -1.0);
   foo.AddPoint(0.1, -1.0);
-  _valid_zone = auto_ptr<Polygon>(foo.CreateConvexHull());
+  SetValidZone(foo);
+}
+
+
+void Scanalyzer::
+SetValidZone(const sfl::Polygon & zone)
+{
+  _valid_zone = auto_ptr<Polygon>(zone.CreateConvexHull());
+  
+  // For a point (r cos, r sin) on a beam, the edge test of
+  // Polygon::Contains() is linear in r, so each edge cuts the beam
+  // at one place, and the beam is inside the ccw hull on an interval.
+  const unsigned int npoints(_valid_zone->GetNLines());
+  for(int i(0); i < scansize; ++i){
+    double rmin(0);
+    double rmax(numeric_limits<double>::max());
+    if(npoints < 3)
+      rmax = -1;
+    for(unsigned int j(0); j < npoints; ++j){
+      const Point * prev(_valid_zone->GetPoint(j));
+      const Point * cur(_valid_zone->GetPoint((j + 1) % npoints));
+      const double aa(cur->X() * prev->Y() - cur->Y() * prev->X());
+      const double bb(_cosphi[i] * (cur->Y() - prev->Y())
+		      - _sinphi[i] * (cur->X() - prev->X()));
+      // inside means aa + bb * r <= 0
+      if(bb > 0)
+	rmax = minval(rmax, - aa / bb);
+      else if(bb < 0)
+	rmin = maxval(rmin, - aa / bb);
+      else if(aa > 0)
+	rmax = -1;
+    }
+    _zone_rmin[i] = rmin;
+    _zone_rmax[i] = rmax;
+  }
+}
+
+
+bool Scanalyzer::
+LoadValidZone(const std::string & fname)
+{
+  ifstream is(fname.c_str());
+  if( ! is)
+    return false;
+  Polygon zone;
+  double x, y;
+  while(is >> x >> y)
+    zone.AddPoint(x, y);
+  if(zone.GetNLines() < 3)
+    return false;
+  SetValidZone(zone);
+  return true;
 }
 
 
@@ -153,7 +368,10 @@ Scanalyzer(double cluster_thresh, double rhomax,
 	   unsigned int usec_cycle):
   _comport(comport),
   _baudrate(baudrate),
-  _usec_cycle(usec_cycle)
+  _usec_cycle(usec_cycle),
+  _replay_speed(0),
+  _replay_log(0),
+  _record_log(0)
 {
   Init(cluster_thresh, rhomax);
 }
@@ -166,7 +384,10 @@ Scanalyzer(double cluster_thresh, double rhomax,
 	   unsigned int usec_cycle):
   _comport(comport),
   _baudrate(baudrate),
-  _usec_cycle(usec_cycle)
+  _usec_cycle(usec_cycle),
+  _replay_speed(0),
+  _replay_log(0),
+  _record_log(0)
 {
   Init(cluster_thresh, rhomax);
   if( ! LoadBackground(fname)){
@@ -177,6 +398,27 @@ Scanalyzer(double cluster_thresh, double rhomax,
 }
 
 
+Scanalyzer::
+Scanalyzer(double cluster_thresh, double rhomax,
+	   const std::string & bgmap_filename,
+	   const std::string & replay_filename,
+	   double replay_speed):
+  _baudrate(0),
+  _usec_cycle(0),
+  _replay_fname(replay_filename),
+  _replay_speed(replay_speed),
+  _replay_log(0),
+  _record_log(0)
+{
+  Init(cluster_thresh, rhomax);
+  if(( ! bgmap_filename.empty()) && ( ! LoadBackground(bgmap_filename))){
+    cerr << "ERROR in Scanalyzer ctor: LoadBackground("
+	 << bgmap_filename << ") failed!\n";
+    exit(EXIT_FAILURE);
+  }
+}
+
+
 Scanalyzer::
 ~Scanalyzer()
 {
@@ -184,75 +426,288 @@ Scanalyzer::
     if(0 != sick_poster_stop(_sick_poster))
       cerr << "WARNING from Scanalyzer::~Scanalyzer():"
 	   << " sick_poster_stop() failed.\n";
-    if(0 != serial_close(_sick_poster->fd))
+    if((0 <= _sick_poster->fd) && (0 != serial_close(_sick_poster->fd)))
       cerr << "WARNING from Scanalyzer::~Scanalyzer():"
 	   << " serial_close() failed.\n";
     sick_poster_delete(_sick_poster);
   }
+  if(0 != _replay_log)
+    sick_log_close(_replay_log);
+  if(0 != _record_log)
+    sick_log_close(_record_log);
+}
+
+
+/**
+   Convert millimetres to metres.
+*/
+static void convert_mm(int n, const uint16_t * mm, double * rho)
+{
+  int i(0);
+#ifdef __SSE2__
+  const __m128d scale(_mm_set1_pd(0.001));
+  const __m128i zero(_mm_setzero_si128());
+  for(/**/; i + 8 <= n; i += 8){
+    const __m128i v16(_mm_loadu_si128((const __m128i *) (mm + i)));
+    const __m128i lo(_mm_unpacklo_epi16(v16, zero));
+    const __m128i hi(_mm_unpackhi_epi16(v16, zero));
+    _mm_storeu_pd(rho + i,     _mm_mul_pd(_mm_cvtepi32_pd(lo), scale));
+    _mm_storeu_pd(rho + i + 2,
+		  _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(lo, 8)), scale));
+    _mm_storeu_pd(rho + i + 4, _mm_mul_pd(_mm_cvtepi32_pd(hi), scale));
+    _mm_storeu_pd(rho + i + 6,
+		  _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(hi, 8)), scale));
+  }
+#endif // __SSE2__
+  for(/**/; i < n; ++i)
+    rho[i] = mm[i] * 0.001;
+}
+
+
+/**
+   Replace single infinity readings by the mean of their two
+   neighbors. A reading that got replaced is always in range, so its
+   right neighbor cannot be a single infinity reading, which means we
+   can look at the raw values only and do without branches.
+*/
+static void patch_infinity(int n, const double * raw, double rhomax,
+			   double * rho)
+{
+  rho[0] = raw[0];
+  for(int i(1); i < n - 1; ++i){
+    const bool single((raw[i] >= rhomax)
+		      & (raw[i - 1] < rhomax)
+		      & (raw[i + 1] < rhomax));
+    const double mean((raw[i - 1] + raw[i + 1]) / 2);
+    rho[i] = single ? mean : raw[i];
+  }
+  rho[n - 1] = raw[n - 1];
+}
+
+
+/**
+   Polar to Cartesian conversion and background classification. Beams
+   that are at least thresh[i] in front of the background and within
+   [rmin, rmax] are objects, and their indices get written to object.
+   
+   \return The number of objects.
+*/
+static int classify(int n, const double * rho,
+		    const double * cosphi, const double * sinphi,
+		    const double * rmin, const double * rmax,
+		    const double * bgrho, const double * thresh,
+		    double * x, double * y, int * object)
+{
+  int i(0), nobjects(0);
+#if defined(__AVX__)
+  for(/**/; i + 4 <= n; i += 4){
+    const __m256d r(_mm256_loadu_pd(rho + i));
+    _mm256_storeu_pd(x + i, _mm256_mul_pd(r, _mm256_loadu_pd(cosphi + i)));
+    _mm256_storeu_pd(y + i, _mm256_mul_pd(r, _mm256_loadu_pd(sinphi + i)));
+    const __m256d closer(_mm256_and_pd(
+      _mm256_cmp_pd(_mm256_sub_pd(_mm256_loadu_pd(bgrho + i), r),
+		    _mm256_loadu_pd(thresh + i), _CMP_GE_OQ),
+      _mm256_and_pd(_mm256_cmp_pd(r, _mm256_loadu_pd(rmin + i), _CMP_GE_OQ),
+		    _mm256_cmp_pd(r, _mm256_loadu_pd(rmax + i), _CMP_LE_OQ))));
+    for(int bits(_mm256_movemask_pd(closer)), j(i); 0 != bits;
+	bits >>= 1, ++j)
+      if(bits & 1)
+	object[nobjects++] = j;
+  }
+#elif defined(__SSE2__)
+  for(/**/; i + 2 <= n; i += 2){
+    const __m128d r(_mm_loadu_pd(rho + i));
+    _mm_storeu_pd(x + i, _mm_mul_pd(r, _mm_loadu_pd(cosphi + i)));
+    _mm_storeu_pd(y + i, _mm_mul_pd(r, _mm_loadu_pd(sinphi + i)));
+    const __m128d closer(_mm_and_pd(
+      _mm_cmpge_pd(_mm_sub_pd(_mm_loadu_pd(bgrho + i), r),
+		   _mm_loadu_pd(thresh + i)),
+      _mm_and_pd(_mm_cmpge_pd(r, _mm_loadu_pd(rmin + i)),
+		 _mm_cmple_pd(r, _mm_loadu_pd(rmax + i)))));
+    const int bits(_mm_movemask_pd(closer));
+    if(bits & 1)
+      object[nobjects++] = i;
+    if(bits & 2)
+      object[nobjects++] = i + 1;
+  }
+#endif // __AVX__ / __SSE2__
+  for(/**/; i < n; ++i){
+    const double r(rho[i]);
+    x[i] = r * cosphi[i];
+    y[i] = r * sinphi[i];
+    if((bgrho[i] - r >= thresh[i]) && (r >= rmin[i]) && (r <= rmax[i]))
+      object[nobjects++] = i;
+  }
+  return nobjects;
+}
+
+
+/**
+   Exponentially weighted update of a running mean and variance, with
+   the variance kept above the sensor noise floor.
+*/
+static void learn(double alpha, double r, double & mean, double & var)
+{
+  const double dr(r - mean);
+  mean += alpha * dr;
+  var = maxval((1 - alpha) * (var + alpha * sqr(dr)), sqr(bg_sigma_min));
+}
+
+
+void Scanalyzer::
+SetBackgroundBeam(int index, double rho, double sigma)
+{
+  _bgrho[index] = rho;
+  _bgvar[index] = sqr(maxval(sigma, bg_sigma_min));
+  _bgweight[index] = 1;
+  _candweight[index] = 0;
+  _bgx[index] = rho * _cosphi[index];
+  _bgy[index] = rho * _sinphi[index];
+  _bgthresh[index] = bg_nsigma * sqrt(_bgvar[index]);
+}
+
+
+void Scanalyzer::
+UpdateBackground()
+{
+  for(int i(0); i < scansize; ++i){
+    const double r(_analysis.rho[i]);
+    if(_bgweight[i] <= 0){
+      SetBackgroundBeam(i, r, bg_sigma_min);
+      continue;
+    }
+    
+    if(absval(r - _bgrho[i]) <= _bgthresh[i]){
+      learn(_bg_alpha, r, _bgrho[i], _bgvar[i]);
+      _bgweight[i] += _bg_alpha * (1 - _bgweight[i]);
+      _candweight[i] *= 1 - _bg_alpha;
+      _bgx[i] = _bgrho[i] * _cosphi[i];
+      _bgy[i] = _bgrho[i] * _sinphi[i];
+      _bgthresh[i] = bg_nsigma * sqrt(_bgvar[i]);
+      continue;
+    }
+    if(_bghold[i])
+      continue;
+    
+    // Something new on this beam: grow a candidate that replaces the
+    // background once it has been seen more consistently.
+    const double alpha(r > _bgrho[i] ? _bg_alpha_far : _bg_alpha);
+    _bgweight[i] *= 1 - alpha;
+    if((_candweight[i] > 0)
+       && (absval(r - _candrho[i]) <= bg_nsigma * sqrt(_candvar[i]))){
+      learn(alpha, r, _candrho[i], _candvar[i]);
+      _candweight[i] += alpha * (1 - _candweight[i]);
+    }
+    else{
+      _candrho[i] = r;
+      _candvar[i] = sqr(bg_sigma_min);
+      _candweight[i] = alpha;
+    }
+    if(_candweight[i] > _bgweight[i]){
+      swap(_bgrho[i], _candrho[i]);
+      swap(_bgvar[i], _candvar[i]);
+      swap(_bgweight[i], _candweight[i]);
+      _bgx[i] = _bgrho[i] * _cosphi[i];
+      _bgy[i] = _bgrho[i] * _sinphi[i];
+      _bgthresh[i] = bg_nsigma * sqrt(_bgvar[i]);
+    }
+  }
+  memset(_bghold, 0, scansize * sizeof(bool));
+}
+
+
+void Scanalyzer::
+SetBackgroundLearning(double alpha, double alpha_far)
+{
+  _bg_alpha = alpha;
+  _bg_alpha_far = alpha_far;
+}
+
+
+void Scanalyzer::
+HoldBackground(const Scanalysis & analysis, int label)
+{
+  // The hold applies to the next scan, by which time the object may
+  // have moved by a few beams.
+  for(int i(0); i < scansize; ++i)
+    if((Scanalysis::OBJECT == analysis.category[i])
+       && (label == analysis.label[i])){
+      const int lo(maxval(0, i - bg_hold_margin));
+      const int hi(minval(scansize - 1, i + bg_hold_margin));
+      for(int j(lo); j <= hi; ++j)
+	_bghold[j] = true;
+    }
 }
 
 
 bool Scanalyzer::
-Update(std::ostream * dbg)
+Update(std::ostream * dbg, unsigned int usec_timeout)
 {
   if(0 == _sick_poster)
     return false;		// restarting (probably)
   
-  if(_sick_poster->current_t0 <= _analysis.t0)
-    return false;
-  
   struct sick_scan_s scan;
-  int result = sick_poster_getscan(_sick_poster, & scan);
+  int result = sick_poster_nextscan(_sick_poster, & scan, & _sick_count,
+				    usec_timeout);
+  if(-3 == result)
+    return false;		// nothing new yet
   if(0 != result){
     if(0 != dbg)
       (* dbg) << "ERROR in  Scanalyzer::Update():\n"
-	      << "  sick_poster_getscan returned " << result << "\n";
+	      << "  sick_poster_nextscan returned " << result << "\n";
     return false;
   }
   
+  Analyze(scan);
+  return true;
+}
+
+
+bool Scanalyzer::
+WaitScan(unsigned int usec_timeout) const
+{
+  if(0 != _sick_poster){
+    const int result(sick_poster_waitscan(_sick_poster, _sick_count,
+					  usec_timeout));
+    if(0 == result)
+      return true;
+    if(-3 == result)
+      return false;		// timed out
+  }
+  usleep(usec_timeout);
+  return false;
+}
+
+
+void Scanalyzer::
+Analyze(const struct sick_scan_s & scan)
+{
   _analysis.t0 = scan.t0;
   _analysis.t1 = scan.t1;
+  _stamp = scan.t0;
   
-  double rprev(_rhomax);
-  for(int i(0); i < scansize; ++i){
-    double r(scan.rho[i] * 0.001);
-    
-    // replace single infinity readings by the mean of its two
-    // neighbors.
-    if((r >= _rhomax)
-       && (rprev < _rhomax)
-       && (i < 360)){
-      const double rnext(scan.rho[i + 1] * 0.001);
-      if(rnext < _rhomax){
-	r = (rprev + rnext) / 2;
-	if(0 != dbg)
-	  (* dbg) << "DBG Scanalyzer::Update(): replaced " << i
-		  << " by mean of neighbors.\n";
-      }
-    }
-    
-    // store the possibly filtered value
-    _analysis.x[i] = r * _cosphi[i];
-    _analysis.y[i] = r * _sinphi[i];
-    _analysis.rho[i] = r;
-    
-    // classify reading and update background map
+  double raw[scansize];
+  convert_mm(scansize, scan.rho, raw);
+  patch_infinity(scansize, raw, _rhomax, _analysis.rho);
+  for(int i(0); i < scansize; ++i)
+    if(raw[i] != _analysis.rho[i])
+      TRACE1(TRACE_VERBOSE,
+	     "Scanalyzer::Update(): replaced %ld by mean of neighbors\n", i);
+  
+  int object[scansize];
+  const int nobjects(classify(scansize, _analysis.rho, _cosphi, _sinphi,
+			      _zone_rmin, _zone_rmax,
+			      _bgrho, _bgthresh,
+			      _analysis.x, _analysis.y, object));
+  for(int i(0); i < scansize; ++i)
     _analysis.category[i] = Scanalysis::BACKGROUND;
-    if(r > _analysis.bgrho[i]){
-      _bgx[i] = _analysis.x[i];
-      _bgy[i] = _analysis.y[i];
-      _analysis.bgrho[i] = r;
-    }
-    else if((_analysis.bgrho[i] - r >= _cluster_thresh)
-	    && _valid_zone->Contains(_analysis.x[i], _analysis.y[i]))
-      _analysis.category[i] = Scanalysis::OBJECT;
-    
-    rprev = r;
-  }
+  for(int j(0); j < nobjects; ++j)
+    _analysis.category[object[j]] = Scanalysis::OBJECT;
+  UpdateBackground();
+  memcpy(_analysis.bgrho, _bgrho, scansize * sizeof(double));
   
-  Cluster(dbg);
+  Cluster();
   Extract();
-  return true;
 }
 
 
@@ -265,68 +720,65 @@ GetScanalysis()
 
 
 void Scanalyzer::
-Cluster(ostream * dbg)
+SwapScanalysis(Scanalysis & buffer)
+{
+  _analysis.Swap(buffer);
+}
+
+
+void Scanalyzer::
+Cluster()
 {
-  if(0 != dbg)
-    (*dbg) << "DEBUG Scanalyzer::Cluster():\n";
-  
   _analysis.startindex.clear();
   _analysis.endindex.clear();
+  _lines->Begin(_analysis);
   int label;
   int oldi;
   double rprev(-1);
   for(int i(0); i < scansize; ++i){    
     // skip BG and INFTY
-    if(0 != dbg)
-      (*dbg) << "**************************************************\n"
-	     << "  i = " << i << ": Skipping background:";
     oldi = i;
     bool skipped_bg(false);
     for(/**/; (i < scansize)
 	      && (Scanalysis::BACKGROUND == _analysis.category[i]); ++i){
-      if(0 != dbg)
-	(*dbg) << " " << i;
       _analysis.label[i] = -1;
       skipped_bg = true;
+      FeedLine(i);
     }
-    if(0 != dbg)
-      (*dbg) << "\n";
     if(i >= scansize)
       break;
+    FeedLine(i);
     
     const double r(_analysis.rho[i]);
     if(rprev < 0){
-      if(0 != dbg)
-	(*dbg) << "  i = " << i <<  ": First cluster.\n";
+      TRACE1(TRACE_VERBOSE, "Scanalyzer::Cluster(): %ld first cluster\n", i);
       label = 0;
       _analysis.startindex.push_back(i);
     }
     else if(skipped_bg){
-      if(0 != dbg)
-	(*dbg) << "  i = " << i <<  ": Skipped BG after " << label << ".\n";
+      TRACE2(TRACE_VERBOSE,
+	     "Scanalyzer::Cluster(): %ld skipped BG after %ld\n", i, label);
       ++label;
       _analysis.startindex.push_back(i);
       _analysis.endindex.push_back(oldi - 1);
     }
     else if(sfl::absval(r - rprev) > _cluster_thresh){
-      if(0 != dbg)
-	(*dbg) << "  i = " << i << ": Threshold exceeded after "
-	       << label << "\n";
+      TRACE2(TRACE_VERBOSE,
+	     "Scanalyzer::Cluster(): %ld threshold exceeded after %ld\n",
+	     i, label);
       ++label;
       _analysis.startindex.push_back(i);
       _analysis.endindex.push_back(i - 1);
     }
     
-    if(0 != dbg)
-      (*dbg) << "  i = " << i <<  ": label = " << label << "\n";
     _analysis.label[i] = label;
     
     rprev = r;
   }
+  _lines->End();
 
   if(_analysis.startindex.size() == 0){
-    if(0 != dbg)
-      (*dbg) << "  No clusters found (initialization or empty environment).\n";
+    TRACE0(TRACE_INFO, "Scanalyzer::Cluster(): no clusters found\n");
     return;
   }
   
@@ -337,13 +789,23 @@ Cluster(ostream * dbg)
     exit(EXIT_FAILURE);
   }
   
-  if(0 != dbg){
-    (*dbg) << "  ------------------------------------------------\n"
-	   << "  label\tstartindex\tendindex\n";
-    for(size_t i(0); i < _analysis.startindex.size(); ++i)
-      (*dbg) << "  " << i << "\t" << _analysis.startindex[i]
-	     << "\t" << _analysis.endindex[i] << "\n";
-  }
+  for(size_t i(0); i < _analysis.startindex.size(); ++i)
+    TRACE3(TRACE_VERBOSE, "Scanalyzer::Cluster(): label %ld from %ld to %ld\n",
+	   i, _analysis.startindex[i], _analysis.endindex[i]);
+}
+
+
+/**
+   Beams beyond _rhomax (after patch_infinity()) did not hit
+   anything, and end the current line segment.
+*/
+void Scanalyzer::
+FeedLine(int index)
+{
+  if(_analysis.rho[index] < _rhomax)
+    _lines->Add(index);
+  else
+    _lines->Break();
 }
 
 
@@ -396,6 +858,11 @@ Draw() const
   }
   glEnd();
   
+  // line segments
+  glColor3d(0, 0.7, 0.7);
+  for(size_t i(0); i < segment.size(); ++i)
+    segment[i]->Draw();
+  
   if(circle.size() <= 0)
     return;
   
@@ -438,18 +905,38 @@ Draw() const
 void Scanalyzer::
 Extract()
 {
-  for(size_t i(0); i < _analysis.circle.size(); ++i)
-    delete _analysis.circle[i];
   _analysis.circle.clear();
   
+  // Beams further than inlier_thresh from the fitted circle are
+  // ignored, and no fit makes more than fit_budget passes over its
+  // cluster.
+  static const double inlier_thresh(0.02);
+  static const int fit_budget(24);
+  const vector<const LineSegment *> & segment(_analysis.segment);
+  size_t iseg(0);
   for(size_t i(0); i < _analysis.startindex.size(); ++i){
-    CircleLSQ * circle(CircleLSQ::Create(_analysis,
-					 _analysis.startindex[i],
-					 _analysis.endindex[i],
-					 i));
+    const int start(_analysis.startindex[i]);
+    const int end(_analysis.endindex[i]);
+    
+    // Flat clusters (walls, fences, boards) are not worth a circle
+    // fit. Clusters and segments are both in scan order, so a single
+    // sweep finds the segment that could contain each cluster.
+    while((iseg < segment.size()) && (segment[iseg]->endindex < start))
+      ++iseg;
+    const bool flat((iseg < segment.size())
+		    && (segment[iseg]->startindex <= start)
+		    && (segment[iseg]->endindex >= end)
+		    && (segment[iseg]->Length() >= flat_min_length));
+    
+    CircleLSQ & slot(_analysis.circle_pool[i]);
     // Can be 0, the important thing is to have a correspondence
     // between _analysis.circle[] and its other vectors!
-    _analysis.circle.push_back(circle);
+    if(( ! flat)
+       && CircleLSQ::FitRobust(_analysis, start, end, i, inlier_thresh,
+			       fit_budget, slot))
+      _analysis.circle.push_back(& slot);
+    else
+      _analysis.circle.push_back(0);
   }
 }
 
@@ -459,21 +946,57 @@ LoadBackground(std::string fname)
 {
   ifstream is(fname.c_str());
   for(int i(0); i < scansize; ++i){
-    double r;
-    if( ! (is >> r))
+    string line;
+    if( ! getline(is, line))
+      return false;
+    istringstream ls(line);
+    double r, sigma;
+    if( ! (ls >> r))
       return false;
-    _analysis.bgrho[i] = r;
-    _bgx[i] = r * _cosphi[i];
-    _bgy[i] = r * _sinphi[i];
+    if( ! (ls >> sigma))
+      sigma = bg_sigma_min;	// plain bgmap
+    SetBackgroundBeam(i, r, sigma);
   }
   return true;
 }
 
 
+bool Scanalyzer::
+SaveBackground(std::string fname) const
+{
+  ofstream os(fname.c_str());
+  for(int i(0); i < scansize; ++i)
+    if( ! (os << _bgrho[i] << " " << sqrt(_bgvar[i]) << "\n"))
+      return false;
+  return true;
+}
+
+
+int Scanalyzer::
+GetBackground(double * x, double * y) const
+{
+  int count(0);
+  for(int i(0); i < scansize; ++i)
+    if((_bgrho[i] > 0) && (_bgrho[i] < _rhomax)){
+      x[count] = _bgx[i];
+      y[count] = _bgy[i];
+      ++count;
+    }
+  return count;
+}
+
+
+double Scanalyzer::
+GetRhomax() const
+{
+  return _rhomax;
+}
+
+
 const Timestamp & Scanalyzer::
 GetCurrentStamp() const
 {
-  return _analysis.t0;
+  return _stamp;
 }
 
 
@@ -490,13 +1013,14 @@ RestartSick() const
   FILE * old_sick_dbg = _sick_poster->dbg;
   that->_sick_poster->dbg = stderr;
   
-  bool ok(false);
+  bool ok(true);
   if(0 != sick_poster_abort(_sick_poster)){
     cerr << "Scanalyzer::RestartSick(): serial_poster_abort() failed.\n";
     ok = false;
   }
 
-  if(ok && (0 != serial_close(_sick_poster->fd))){
+  if(ok && (0 <= _sick_poster->fd)
+     && (0 != serial_close(_sick_poster->fd))){
     cerr << "Scanalyzer::RestartSick(): serial_close() failed.\n";
     ok = false;
   }
@@ -510,6 +1034,30 @@ RestartSick() const
 }
 
 
+bool Scanalyzer::
+Record(const std::string & fname)
+{
+  struct sick_log_s * log(0);
+  if( ! fname.empty()){
+    log = sick_log_create(fname.c_str(), stderr);
+    if(0 == log){
+      cerr << "Scanalyzer::Record(): sick_log_create(" << fname
+	   << ") failed.\n";
+      return false;
+    }
+  }
+  
+  // Once the poster hands back the old log it won't touch it again.
+  if(0 != _sick_poster)
+    sick_poster_record(_sick_poster, log);
+  if(0 != _record_log)
+    sick_log_close(_record_log);
+  _record_log = log;
+  
+  return true;
+}
+
+
 void Scanalyzer::
 GetSickStats(double & tmin_sec, double & tmean_sec,
 	     double & tmax_sec) const
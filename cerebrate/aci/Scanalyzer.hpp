@@ -30,10 +30,14 @@
 
 
 class CircleLSQ;
+class LineSegment;
+class LineExtractor;
 class Viewport;
+struct sick_scan_s;
 
 namespace sfl {
   class Polygon;
+  class Frame;
 }
 
 
@@ -51,20 +55,62 @@ public:
   Scanalysis & operator = (const Scanalysis & original);
   ~Scanalysis();
   
+  /** Exchange contents with other in constant time, without allocating. */
+  void Swap(Scanalysis & other);
+  
+  /**
+     Move points, circles and segments from the given frame to its
+     enclosing frame. The ranges stay as measured.
+  */
+  void TransformTo(const sfl::Frame & frame);
+  
+  /**
+     Time at which the given beam was measured. The scanner sweeps
+     from the last index towards the first, and the sweep is taken to
+     span t0 to t1.
+  */
+  Timestamp GetBeamTime(int index) const;
+  
   void Draw() const;
 
   static const int scansize = 361;
   
-  double x[scansize], y[scansize], rho[scansize], bgrho[scansize];
-  category_t category[scansize];
-  int label[scansize];
+  // The arrays are allocated by the constructor, and the vectors
+  // reserve one entry per beam, so that neither copying nor Swap()
+  // needs the heap afterwards.
+  double * x, * y, * rho, * bgrho;
+  category_t * category;
+  int * label;
   std::vector<size_t> startindex;
   std::vector<size_t> endindex;
-  std::vector<CircleLSQ *> circle;
+  std::vector<const CircleLSQ *> circle;
+  
+  /** Storage of the circles: circle[i] is 0 or circle_pool + i. */
+  CircleLSQ * circle_pool;
+  
+  /**
+     Line segments over all beams (background included) in scan
+     order, pointing into segment_pool.
+  */
+  std::vector<const LineSegment *> segment;
+  LineSegment * segment_pool;
   Timestamp t0, t1;
+  
+private:
+  void Allocate();
 };
 
 
+/**
+   Clusters and classifies the scans of a SICK laser scanner. A
+   usec_cycle of zero puts the scanner into continuous output mode,
+   otherwise the poster thread is a periodic task (see periodic.h)
+   that requests a scan every usec_cycle microseconds.
+   
+   Instead of a scanner, a Scanalyzer can also run from a scan log
+   recorded with Record(), see sick_poster_new_replay() for the
+   meaning of replay_speed.
+*/
 class Scanalyzer
 {
 public:
@@ -77,14 +123,105 @@ public:
 	     const std::string & comport,
 	     unsigned long baudrate,
 	     unsigned int usec_cycle);
+  Scanalyzer(double cluster_thresh, double rhomax,
+	     const std::string & bgmap_filename,
+	     const std::string & replay_filename,
+	     double replay_speed);
   ~Scanalyzer();
   
-  /** \returns true if new data has arrived */
-  bool Update(std::ostream * dbg);
+  /**
+     Analyze the next scan, waiting at most usec_timeout for it to
+     arrive. The default of zero just checks whether the poster has
+     published a new scan since the last call.
+     
+     \returns true if new data has arrived
+  */
+  bool Update(std::ostream * dbg, unsigned int usec_timeout = 0);
+  
+  /**
+     Wait at most usec_timeout for a scan that Update() has not
+     analyzed yet, without taking it. Without a working poster, this
+     just sleeps for usec_timeout, so that callers can pace themselves
+     on it either way.
+     
+     \returns true if a new scan is waiting
+  */
+  bool WaitScan(unsigned int usec_timeout) const;
+  
+  /**
+     Analyze a scan that does not come from the poster, e.g. one read
+     straight out of a log with sick_log_get(), which is much faster
+     than a replay when the timing does not matter.
+  */
+  void Analyze(const struct sick_scan_s & scan);
   const Scanalysis & GetScanalysis() const;
+  
+  /**
+     Hand the latest analysis to the caller in exchange for buffer,
+     which gets overwritten by the next Update(). Unlike copying
+     GetScanalysis(), this only exchanges pointers.
+  */
+  void SwapScanalysis(Scanalysis & buffer);
   const Timestamp & GetCurrentStamp() const;
+  
+  /** Ranges of at least this are beams without echo. */
+  double GetRhomax() const;
+  
+  /**
+     Read the background as one line per beam, holding the mean range
+     optionally followed by its standard deviation. The plain range
+     files written by older versions are accepted as well.
+  */
   bool LoadBackground(std::string fname);
+  
+  /** Write the background in the format read by LoadBackground(). */
+  bool SaveBackground(std::string fname) const;
+  
+  /**
+     Write the background points closer than rhomax to x and y (each
+     of size scansize) in scan order.
+     
+     \return The number of points.
+  */
+  int GetBackground(double * x, double * y) const;
+  
+  /**
+     Set how fast the per-beam background adapts: alpha is the
+     learning rate of each scan that matches it, and the weight given
+     to a differing reading, which replaces the background after it
+     outweighs it. Readings farther than the background use alpha_far
+     instead, so that removed props are forgotten more quickly than
+     new ones get absorbed.
+  */
+  void SetBackgroundLearning(double alpha, double alpha_far);
+  
+  /**
+     Keep the next scan's beams that carry the given label in
+     analysis, and a few on either side, from growing a candidate, so
+     that the robot and tracked objects don't become background when
+     they stand still for a while. Readings that match the background
+     are still learned.
+  */
+  void HoldBackground(const Scanalysis & analysis, int label);
+  
+  /**
+     Replace the zone in which objects are detected by the convex hull
+     of the given polygon.
+  */
+  void SetValidZone(const sfl::Polygon & zone);
+  
+  /**
+     Read the corners of the valid zone as whitespace separated "x y"
+     pairs (in metres, scanner frame) and pass them to SetValidZone().
+  */
+  bool LoadValidZone(const std::string & fname);
   bool RestartSick() const;
+  
+  /**
+     Append all scans to a binary log from now on. An empty filename
+     stops recording.
+  */
+  bool Record(const std::string & fname);
   void GetSickStats(double & tmin_sec, double & tmean_sec,
 		    double & tmax_sec) const;
   
@@ -94,20 +231,44 @@ public:
 private:
   bool InitSick(FILE * sick_dbg);
   void Init(double cluster_thresh, double rhomax);
-  void Cluster(std::ostream * dbg);
+  void Cluster();
+  void FeedLine(int index);
   void Extract();
+  void SetBackgroundBeam(int index, double rho, double sigma);
+  void UpdateBackground();
   
   static const int scansize = Scanalysis::scansize;
   
   const std::string _comport;
   const unsigned long _baudrate;
   const unsigned int _usec_cycle;
+  const std::string _replay_fname;
+  const double _replay_speed;
+  struct sick_log_s * _replay_log;
+  struct sick_log_s * _record_log;
   struct sick_poster_s * _sick_poster;
+  unsigned int _sick_count;
   const double _cluster_thresh, _rhomax;
   const double _cosphi[scansize], _sinphi[scansize];
-  double _bgx[scansize], _bgy[scansize];
+  double _bgrho[scansize], _bgx[scansize], _bgy[scansize];
+  
+  /**
+     Per-beam background model: the mean range is in _bgrho (and
+     copied to each Scanalysis), and a candidate collects readings that do not
+     match it. Objects are beams at least _bgthresh in front of the
+     mean.
+  */
+  double _bgvar[scansize], _bgweight[scansize], _bgthresh[scansize];
+  double _candrho[scansize], _candvar[scansize], _candweight[scansize];
+  bool _bghold[scansize];
+  double _bg_alpha, _bg_alpha_far;
   Scanalysis _analysis;
+  Timestamp _stamp;
   std::auto_ptr<sfl::Polygon> _valid_zone;
+  std::auto_ptr<LineExtractor> _lines;
+  
+  /** Range interval of each beam that lies within the valid zone. */
+  double _zone_rmin[scansize], _zone_rmax[scansize];
 };
 
 #endif // SCANALYZER_HPP
@@ -0,0 +1,343 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "Tracker.hpp"
+#include "Scanalyzer.hpp"
+#include "CircleLSQ.hpp"
+#include "gfx/wrap_gl.hpp"
+#include <sfl/numeric.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+
+using namespace std;
+using namespace sfl;
+
+
+Track::
+Track():
+  id(-1), x(0), y(0), vx(0), vy(0), label(-1), hits(0), misses(0),
+  confirmed(false)
+{
+  memset(P, 0, sizeof(P));
+}
+
+
+void Track::
+Predict(double dt, double & px, double & py) const
+{
+  px = x + dt * vx;
+  py = y + dt * vy;
+}
+
+
+void Track::
+Predict(const Timestamp & t, double & px, double & py) const
+{
+  Predict((t - stamp).ConvertToSeconds(), px, py);
+}
+
+
+Tracker::
+Tracker(size_t capacity, double gate, double sigma_accel,
+	double sigma_meas, int confirm_hits, int max_misses):
+  _gate(gate),
+  _qq(sqr(sigma_accel)),
+  _rr(sqr(sigma_meas)),
+  _confirm_hits(confirm_hits),
+  _max_misses(max_misses),
+  _track(capacity),
+  _mx(Scanalysis::scansize),
+  _my(Scanalysis::scansize),
+  _mlabel(Scanalysis::scansize),
+  _massoc(Scanalysis::scansize),
+  _stamp(Timestamp::First()),
+  _next_id(0)
+{
+  _pair.reserve(capacity * Scanalysis::scansize);
+}
+
+
+void Tracker::
+Clear()
+{
+  for(size_t it(0); it < _track.size(); ++it)
+    _track[it].id = -1;
+  _stamp = Timestamp::First();
+}
+
+
+bool Tracker::
+PairLess(const pair_t & lhs, const pair_t & rhs)
+{
+  return lhs.d2 < rhs.d2;
+}
+
+
+void Tracker::
+Update(const Scanalysis & scanalysis)
+{
+  double dt(0);
+  if(Timestamp::First() != _stamp)
+    dt = (scanalysis.t0 - _stamp).ConvertToSeconds();
+  _stamp = scanalysis.t0;
+  
+  // one measurement per cluster
+  size_t nmeas(0);
+  for(size_t ic(0); ic < scanalysis.startindex.size(); ++ic){
+    static const double max_radius(0.5);
+    const CircleLSQ * circle(ic < scanalysis.circle.size()
+			     ? scanalysis.circle[ic] : 0);
+    if((0 != circle) && finite(circle->xc) && finite(circle->yc)
+       && (circle->radius < max_radius)){
+      _mx[nmeas] = circle->xc;
+      _my[nmeas] = circle->yc;
+    }
+    else{
+      double sx(0), sy(0);
+      for(size_t ip(scanalysis.startindex[ic]);
+	  ip <= scanalysis.endindex[ic]; ++ip){
+	sx += scanalysis.x[ip];
+	sy += scanalysis.y[ip];
+      }
+      const double np(scanalysis.endindex[ic] - scanalysis.startindex[ic] + 1);
+      _mx[nmeas] = sx / np;
+      _my[nmeas] = sy / np;
+    }
+    _mlabel[nmeas] = ic;
+    _massoc[nmeas] = false;
+    ++nmeas;
+  }
+  
+  // predict and collect gated pairs
+  _pair.clear();
+  for(size_t it(0); it < _track.size(); ++it){
+    Track & track(_track[it]);
+    if(track.id < 0)
+      continue;
+    Predict(track, dt);
+    track.stamp = _stamp;
+    track.label = -1;
+    for(size_t im(0); im < nmeas; ++im){
+      pair_t pp;
+      if(Distance(track, _mx[im], _my[im], pp.d2)){
+	pp.track = it;
+	pp.meas = im;
+	_pair.push_back(pp);
+      }
+    }
+  }
+  
+  // global nearest neighbour, greedily by increasing distance
+  sort(_pair.begin(), _pair.end(), PairLess);
+  for(size_t ip(0); ip < _pair.size(); ++ip){
+    Track & track(_track[_pair[ip].track]);
+    const size_t im(_pair[ip].meas);
+    if((track.label >= 0) || _massoc[im])
+      continue;
+    Correct(track, _mx[im], _my[im]);
+    track.label = _mlabel[im];
+    _massoc[im] = true;
+  }
+  
+  // bookkeeping, then births
+  for(size_t it(0); it < _track.size(); ++it){
+    Track & track(_track[it]);
+    if(track.id < 0)
+      continue;
+    if(track.label >= 0){
+      ++track.hits;
+      track.misses = 0;
+      if(track.hits >= _confirm_hits)
+	track.confirmed = true;
+    }
+    else if(( ! track.confirmed) || (++track.misses > _max_misses))
+      track.id = -1;
+  }
+  for(size_t im(0); im < nmeas; ++im)
+    if( ! _massoc[im])
+      Birth(_mx[im], _my[im], _mlabel[im], _stamp);
+}
+
+
+/**
+   Constant-velocity prediction with white noise acceleration of
+   spectral density _qq.
+*/
+void Tracker::
+Predict(Track & track, double dt) const
+{
+  if(dt <= 0)
+    return;
+  track.x += dt * track.vx;
+  track.y += dt * track.vy;
+  
+  // P = F P F^T, with F = [I dt*I; 0 I]
+  double (& P)[4][4] = track.P;
+  for(int k(0); k < 4; ++k){
+    P[0][k] += dt * P[2][k];
+    P[1][k] += dt * P[3][k];
+  }
+  for(int k(0); k < 4; ++k){
+    P[k][0] += dt * P[k][2];
+    P[k][1] += dt * P[k][3];
+  }
+  
+  const double q3(_qq * dt * dt * dt / 3);
+  const double q2(_qq * dt * dt / 2);
+  const double q1(_qq * dt);
+  P[0][0] += q3;  P[0][2] += q2;  P[2][0] += q2;  P[2][2] += q1;
+  P[1][1] += q3;  P[1][3] += q2;  P[3][1] += q2;  P[3][3] += q1;
+}
+
+
+bool Tracker::
+Distance(const Track & track, double mx, double my, double & d2) const
+{
+  const double s00(track.P[0][0] + _rr);
+  const double s01(track.P[0][1]);
+  const double s11(track.P[1][1] + _rr);
+  const double det(s00 * s11 - sqr(s01));
+  if(det <= 0)
+    return false;
+  const double ex(mx - track.x);
+  const double ey(my - track.y);
+  d2 = (s11 * ex * ex - 2 * s01 * ex * ey + s00 * ey * ey) / det;
+  return d2 <= _gate;
+}
+
+
+void Tracker::
+Correct(Track & track, double mx, double my) const
+{
+  double (& P)[4][4] = track.P;
+  const double s00(P[0][0] + _rr);
+  const double s01(P[0][1]);
+  const double s11(P[1][1] + _rr);
+  const double det(s00 * s11 - sqr(s01));
+  if(det <= 0)
+    return;
+  const double i00(s11 / det);
+  const double i01(- s01 / det);
+  const double i11(s00 / det);
+  
+  // K = P H^T S^-1, where P H^T are the first two columns of P
+  double K[4][2];
+  for(int k(0); k < 4; ++k){
+    K[k][0] = P[k][0] * i00 + P[k][1] * i01;
+    K[k][1] = P[k][0] * i01 + P[k][1] * i11;
+  }
+  
+  const double ex(mx - track.x);
+  const double ey(my - track.y);
+  track.x  += K[0][0] * ex + K[0][1] * ey;
+  track.y  += K[1][0] * ex + K[1][1] * ey;
+  track.vx += K[2][0] * ex + K[2][1] * ey;
+  track.vy += K[3][0] * ex + K[3][1] * ey;
+  
+  // P -= K H P, where H P are the first two rows of P
+  double HP[2][4];
+  memcpy(HP, P, sizeof(HP));
+  for(int k(0); k < 4; ++k)
+    for(int l(0); l < 4; ++l)
+      P[k][l] -= K[k][0] * HP[0][l] + K[k][1] * HP[1][l];
+}
+
+
+void Tracker::
+Birth(double mx, double my, int label, const Timestamp & stamp)
+{
+  static const double sigma_v0(1.5); // brisk walking speed
+  for(size_t it(0); it < _track.size(); ++it){
+    Track & track(_track[it]);
+    if(track.id >= 0)
+      continue;
+    track.id = _next_id++;
+    track.x = mx;
+    track.y = my;
+    track.vx = 0;
+    track.vy = 0;
+    memset(track.P, 0, sizeof(track.P));
+    track.P[0][0] = _rr;
+    track.P[1][1] = _rr;
+    track.P[2][2] = sqr(sigma_v0);
+    track.P[3][3] = sqr(sigma_v0);
+    track.stamp = stamp;
+    track.label = label;
+    track.hits = 1;
+    track.misses = 0;
+    track.confirmed = track.hits >= _confirm_hits;
+    return;
+  }
+}
+
+
+size_t Tracker::
+GetCapacity() const
+{
+  return _track.size();
+}
+
+
+const Track * Tracker::
+GetTrack(size_t slot) const
+{
+  if((slot >= _track.size()) || (_track[slot].id < 0))
+    return 0;
+  return & _track[slot];
+}
+
+
+const Track * Tracker::
+FindTrack(int id) const
+{
+  if(id < 0)
+    return 0;
+  for(size_t it(0); it < _track.size(); ++it)
+    if((_track[it].id == id) && _track[it].confirmed)
+      return & _track[it];
+  return 0;
+}
+
+
+void Tracker::
+Draw() const
+{
+  static const double lookahead(1);
+  glLineWidth(1);
+  glBegin(GL_LINES);
+  for(size_t it(0); it < _track.size(); ++it){
+    const Track & track(_track[it]);
+    if((track.id < 0) || ( ! track.confirmed))
+      continue;
+    glColor3d(1, 1, 0);
+    glVertex2d(track.x - 0.05, track.y);
+    glVertex2d(track.x + 0.05, track.y);
+    glVertex2d(track.x, track.y - 0.05);
+    glVertex2d(track.x, track.y + 0.05);
+    glColor3d(0.5, 0.5, 0);
+    glVertex2d(track.x, track.y);
+    glVertex2d(track.x + lookahead * track.vx,
+	       track.y + lookahead * track.vy);
+  }
+  glEnd();
+}
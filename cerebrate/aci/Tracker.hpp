@@ -0,0 +1,126 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifndef TRACKER_HPP
+#define TRACKER_HPP
+
+
+#include <util/Timestamp.hpp>
+#include <vector>
+
+
+class Scanalysis;
+
+
+/**
+   Constant-velocity Kalman filter on the position of one object, in
+   the map frame. The state is (x, y, vx, vy) with covariance P.
+*/
+class Track
+{
+public:
+  Track();
+  
+  /** Extrapolate the position by dt seconds from stamp. */
+  void Predict(double dt, double & px, double & py) const;
+  
+  /** Extrapolate the position to the given time. */
+  void Predict(const Timestamp & t, double & px, double & py) const;
+  
+  /** Unique identifier, -1 for an unused slot. */
+  int id;
+  double x, y, vx, vy;
+  double P[4][4];
+  
+  /** Time of the scan that the state refers to. */
+  Timestamp stamp;
+  
+  /** Cluster label associated in the last scan, -1 if missed. */
+  int label;
+  int hits, misses;
+  bool confirmed;
+};
+
+
+/**
+   Keeps a fixed number of Track slots up to date with the clusters
+   of each Scanalysis. Clusters are reduced to their fitted circle
+   center, or their centroid if the fit is missing or too large, and
+   associated with the predicted tracks by gated global nearest
+   neighbour on the Mahalanobis distance. Unassociated clusters start
+   tentative tracks, which get confirmed after confirm_hits
+   associations and are dropped on their first miss. Confirmed tracks
+   survive up to max_misses consecutive misses.
+   
+   No memory is allocated after construction.
+*/
+class Tracker
+{
+public:
+  /**
+     \param capacity Maximum number of tracks.
+     \param gate Squared Mahalanobis distance for association, 9.21
+     is the 99% quantile of two degrees of freedom.
+     \param sigma_accel Standard deviation of the unmodelled
+     acceleration (m/s^2).
+     \param sigma_meas Standard deviation of cluster positions (m).
+  */
+  Tracker(size_t capacity, double gate, double sigma_accel,
+	  double sigma_meas, int confirm_hits, int max_misses);
+  
+  void Update(const Scanalysis & scanalysis);
+  void Clear();
+  
+  /** \return The number of slots, used or not. */
+  size_t GetCapacity() const;
+  
+  /** \return The track in the given slot, 0 if unused. */
+  const Track * GetTrack(size_t slot) const;
+  
+  /** \return The confirmed track with the given id, or 0. */
+  const Track * FindTrack(int id) const;
+  
+  void Draw() const;
+  
+private:
+  typedef struct {
+    double d2;
+    size_t track, meas;
+  } pair_t;
+  
+  static bool PairLess(const pair_t & lhs, const pair_t & rhs);
+  void Predict(Track & track, double dt) const;
+  void Correct(Track & track, double mx, double my) const;
+  bool Distance(const Track & track, double mx, double my, double & d2) const;
+  void Birth(double mx, double my, int label, const Timestamp & stamp);
+  
+  const double _gate, _qq, _rr;
+  const int _confirm_hits, _max_misses;
+  std::vector<Track> _track;
+  std::vector<double> _mx, _my;
+  std::vector<int> _mlabel;
+  std::vector<bool> _massoc;
+  std::vector<pair_t> _pair;
+  Timestamp _stamp;
+  int _next_id;
+};
+
+#endif // TRACKER_HPP
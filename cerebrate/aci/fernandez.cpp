@@ -25,11 +25,14 @@
 #include <drivers/FModIPDCMOT.hpp>
 #include <drivers/FModTCP.hpp>
 #include <drivers/util.h>
+#include <drivers/trace.h>
+#include <drivers/periodic.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <vector>
 #include <pthread.h>
+#include <getopt.h>
 
 
 using namespace std;
@@ -37,6 +40,7 @@ using namespace std;
 
 void * run_glthread(void * nothing_at_all);
 void * run_cmdthread(void * nothing_at_all);
+void * run_ctlthread(void * nothing_at_all);
 void parse_options(int argc, char ** argv);
 void init_glut(int * argc, char ** argv,
 	       int width, int height);
@@ -54,6 +58,7 @@ GUIHandler * get_gui_handler();
 typedef Subwindow::logical_bbox_t bb_t;
 
 static const unsigned int timer_delay(200);
+static const unsigned int control_usec_timeout(200000);
 static const double zoom(1);
 
 enum { ALL = 0, ZOOM, STATUS, LIGHTSHOW, GUI, N_VIEWPORTS };
@@ -63,14 +68,29 @@ Viewport * viewport[N_VIEWPORTS];
 auto_ptr<Cactus> fernandez;
 pthread_t glthread(0);
 pthread_t cmdthread(0);
+pthread_t ctlthread(0);
 bool please_exit(false);
 
+/** Serializes Cactus::Update() in ctlthread and drawing in glthread. */
+pthread_mutex_t cactus_mutex = PTHREAD_MUTEX_INITIALIZER;
+struct periodic_s control;
+
+struct arg_s {
+  arg_s(): priority(0), cpu(-1), mlock(false) { }
+  int priority, cpu;
+  bool mlock;
+};
+
+static arg_s arg;
+
 
 int main(int argc,
 	 char ** argv)
 {
   parse_options(argc, argv);
   set_cleanup(cleanup);
+  trace_start(stderr);
+  periodic_realtime(arg.priority, arg.cpu, arg.mlock, stderr);
   
   viewport[ALL] = new Viewport("all",
 			       bb_t(0, -8, 8, 8),
@@ -127,6 +147,13 @@ int main(int argc,
     exit(EXIT_FAILURE);
   }
 
+  periodic_init( & control, "control", 0);
+  if(0 != pthread_create( & ctlthread, 0, run_ctlthread, 0)){
+    ctlthread = 0;
+    perror("ERROR creating ctlthread");
+    exit(EXIT_FAILURE);
+  }
+
   if(0 != pthread_create( & glthread, 0, run_glthread, 0)){
     glthread = 0;
     perror("ERROR creating glthread");
@@ -149,11 +176,31 @@ int main(int argc,
 }
 
 
+static void unlock_cactus(void *)
+{
+  pthread_mutex_unlock( & cactus_mutex);
+}
+
+
 void * run_cmdthread(void *)
 {
-  do{
-    cout << "fernandez> ";
-  }while(fernandez->Command(cin, cout, & cout));
+  // Wait for a whole line without holding the Cactus, then run it
+  // under the lock so that it does not race ctlthread or drawing.
+  // cleanup() may cancel this thread in the middle of a command.
+  bool running(true);
+  string line;
+  while(running){
+    cout << "fernandez> " << flush;
+    if( ! getline(cin, line))
+      break;
+    if(string::npos == line.find_first_not_of(" \t"))
+      continue;
+    istringstream is(line);
+    pthread_mutex_lock( & cactus_mutex);
+    pthread_cleanup_push(unlock_cactus, 0);
+    running = fernandez->Command(is, cout, & cout);
+    pthread_cleanup_pop(1);
+  }
 
   please_exit = true;
   while(true)
@@ -163,6 +210,32 @@ void * run_cmdthread(void *)
 }
 
 
+/**
+   Runs Cactus::Update() for each new scan, sleeping on the scanner
+   instead of polling it, but at least every control_usec_timeout so
+   that motion control goes on without scans. The control task paces
+   itself, so its histogram shows how long the cycles take.
+*/
+void * run_ctlthread(void *)
+{
+  periodic_start( & control, stderr);
+  while( ! please_exit){
+    if(step || continuous){
+      fernandez->WaitScan(control_usec_timeout);
+      if(step)
+	step = false;
+      pthread_mutex_lock( & cactus_mutex);
+      fernandez->Update();
+      pthread_mutex_unlock( & cactus_mutex);
+    }
+    else
+      usleep(control_usec_timeout);
+    periodic_wait( & control);
+  }
+  return 0;
+}
+
+
 void init_glut(int * argc, char ** argv,
 	       int width, int height)
 {
@@ -198,6 +271,17 @@ void * run_glthread(void * nothing_at_all)
 
 void cleanup()
 {
+  // Let ctlthread finish its cycle rather than cancelling it, it
+  // might hold cactus_mutex.
+  please_exit = true;
+  if(0 != ctlthread){
+    cerr << "DBG: joining ctlthread...";
+    if(0 != pthread_join(ctlthread, 0))
+      perror("WARNING joining ctlthread");
+    else
+      cerr << "OK\n";
+  }
+  
   if(0 != fernandez.get())
     fernandez->SetQd(0, 0);
   
@@ -225,6 +309,8 @@ void cleanup()
   
   for(int i(0); i < N_VIEWPORTS; ++i)
     delete viewport[i];
+  
+  trace_stop();
 }
 
 
@@ -236,6 +322,7 @@ void reshape(int width, int height)
 
 void draw()
 {
+  pthread_mutex_lock( & cactus_mutex);
   glClear(GL_COLOR_BUFFER_BIT);
   
   viewport[ALL]->PushProjection();
@@ -258,6 +345,8 @@ void draw()
   get_gui_handler()->Draw();
   viewport[GUI]->PopProjection();
   
+  pthread_mutex_unlock( & cactus_mutex);
+  
   glFlush();
   glutSwapBuffers();
 }
@@ -285,17 +374,13 @@ void keyboard(unsigned char key, int x, int y)
 
 void timer(int handle)
 {
-  if(step || continuous){
-    if(step)
-      step = false;
-    fernandez->Update();
-    double x, y, theta;
-    fernandez->GetPose(x, y, theta);
-    const bb_t nbb(x - zoom, y - zoom, x + zoom, y + zoom);
-    viewport[ZOOM]->Remap(nbb);
-  }
-  
+  pthread_mutex_lock( & cactus_mutex);
+  double x, y, theta;
+  fernandez->GetPose(x, y, theta);
+  const bb_t nbb(x - zoom, y - zoom, x + zoom, y + zoom);
+  viewport[ZOOM]->Remap(nbb);
   Subwindow::DispatchUpdate();
+  pthread_mutex_unlock( & cactus_mutex);
   
   glutSetWindow(handle);
   glutPostRedisplay();
@@ -305,21 +390,64 @@ void timer(int handle)
 }
 
 
+// Clicks and drags end up in CMhandler, which sets goals, targets
+// and the state of the Cactus that the control thread is updating.
 void mouse(int button, int state, int x, int y)
 {
+  pthread_mutex_lock( & cactus_mutex);
   Subwindow::DispatchClick(button, state,
 			   Subwindow::screen_point_t(x, y));
+  pthread_mutex_unlock( & cactus_mutex);
 }
 
 
 void motion(int x, int y)
 {
+  pthread_mutex_lock( & cactus_mutex);
   Subwindow::DispatchDrag(Subwindow::screen_point_t(x, y));
+  pthread_mutex_unlock( & cactus_mutex);
+}
+
+
+static void usage_message(ostream & os)
+{
+  os << "fernandez [-hm] [-p priority] [-c cpu]\n"
+     << "  -p --priority prio    run the periodic tasks under SCHED_FIFO\n"
+     << "  -c --cpu      cpu     pin the periodic tasks to a processor\n"
+     << "  -m --mlock            lock all memory with mlockall()\n"
+     << "  -h --help             print usage message\n";
 }
 
 
 void parse_options(int argc, char ** argv)
 {
+  const struct option longopts[] = {
+    {"priority", required_argument, 0, 'p'},
+    {"cpu",      required_argument, 0, 'c'},
+    {"mlock",    no_argument,       0, 'm'},
+    {"help",     no_argument,       0, 'h'},
+    {0,          0,                 0, 0}
+  };
+  const char *shortopts("p:c:mh");
+  int ch;
+  while(-1 != (ch = getopt_long(argc, argv, shortopts, longopts, 0))){
+    bool ok(true);
+    switch(ch){
+    case 'p': ok = ! (istringstream(optarg) >> arg.priority).fail(); break;
+    case 'c': ok = ! (istringstream(optarg) >> arg.cpu).fail(); break;
+    case 'm': arg.mlock = true; break;
+    case 'h':
+      usage_message(cout);
+      exit(EXIT_SUCCESS);
+    case '?':
+    default:
+      ok = false;
+    }
+    if( ! ok){
+      usage_message(cerr);
+      exit(EXIT_FAILURE);
+    }
+  }
 }
 
 
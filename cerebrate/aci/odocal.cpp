@@ -0,0 +1,708 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+/**
+   Offline calibration of the wheel odometry. It takes an encoder log
+   written by Odometry::Record() and a scan log written by
+   Scanalyzer::Record() during the same run, and estimates the left
+   and right wheel radii and the wheelbase in a batch least-squares
+   fit, which Odometry::LoadCalibration() then reads.
+   
+   The robot circle is picked out of each scan. The sightings get cut
+   into windows of a few seconds. For given parameters, each window is
+   dead-reckoned from the encoders and aligned to its sightings by the
+   best rigid transform, so neither the scanner pose nor the start
+   pose of the robot has to be known. Gauss-Newton with
+   Levenberg-Marquardt damping then minimizes the remaining
+   residuals, with Huber weights against stray sightings. Each
+   iteration streams once through the memory-mapped encoder log, and
+   only the sightings are kept in memory.
+   
+   Without logs, it synthesizes a run with known parameters and
+   checks that they are recovered.
+*/
+
+
+#include "Scanalyzer.hpp"
+#include "CircleLSQ.hpp"
+#include "Odometry.hpp"
+#include <drivers/enclog.h>
+#include <drivers/sicklog.h>
+#include <util/Timestamp.hpp>
+#include <sfl/numeric.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <unistd.h>
+
+
+using namespace std;
+using namespace sfl;
+
+
+struct arg_s {
+  arg_s(): wheelradius(0.088), wheelbase(0.345), robot_radius(0.14),
+	   radius_tolerance(0.03), window_sec(10), huber(0.05) { }
+  string enc_fname, scan_fname, bg_fname, zone_fname, out_fname;
+  double wheelradius, wheelbase, robot_radius, radius_tolerance;
+  double window_sec, huber;
+};
+
+
+/** Where the robot circle was seen, in the scanner frame. */
+struct sighting_s {
+  double t, x, y;
+};
+
+
+/** A stretch of consecutive sightings that gets aligned as a whole. */
+struct window_s {
+  size_t first, last;		// sightings [first, last)
+  unsigned long record;		// last encoder record before first
+};
+
+
+static arg_s arg;
+
+
+/** Sightings further apart than this start a new window. */
+static const double max_gap(1);
+
+/** Windows need this many sightings and metres of travel. */
+static const size_t min_sightings(20);
+static const double min_travel(0.5);
+
+/**
+   The motor threads sample every 100ms, and Odometry only logs
+   samples that show motion. Longer intervals between records mean
+   the robot stood still, and only moved during the last one.
+*/
+static const double max_record_interval(0.15);
+
+
+static void usage_message(ostream & os)
+{
+  os << "odocal [-h] -e encoders -s scans [-g background] [-z zone]\n"
+     << "       [-o output] [-r radius] [-b wheelbase] [-R robot]\n"
+     << "       [-T tolerance] [-w sec] [-H metres]\n"
+     << "  -e --encoders  filename  log written by Odometry::Record()\n"
+     << "  -s --scans     filename  log written by Scanalyzer::Record()\n"
+     << "  -g --background filename background for the Scanalyzer\n"
+     << "  -z --zone      filename  valid zone for the Scanalyzer\n"
+     << "  -o --output    filename  write \"left right wheelbase\"\n"
+     << "  -r --radius    metres    nominal wheel radius (default "
+     << arg.wheelradius << ")\n"
+     << "  -b --wheelbase metres    nominal wheelbase (default "
+     << arg.wheelbase << ")\n"
+     << "  -R --robot     metres    radius of the robot (default "
+     << arg.robot_radius << ")\n"
+     << "  -T --tolerance metres    on the robot radius (default "
+     << arg.radius_tolerance << ")\n"
+     << "  -w --window    sec       duration of windows (default "
+     << arg.window_sec << ")\n"
+     << "  -H --huber     metres    Huber threshold (default "
+     << arg.huber << ")\n"
+     << "  -h --help                print usage message\n"
+     << "Without -e and -s, a synthetic run gets calibrated.\n";
+}
+
+
+static void parse_args(int argc, char ** argv)
+{
+  const struct option longopts[] = {
+    {"encoders",   required_argument, 0, 'e'},
+    {"scans",      required_argument, 0, 's'},
+    {"background", required_argument, 0, 'g'},
+    {"zone",       required_argument, 0, 'z'},
+    {"output",     required_argument, 0, 'o'},
+    {"radius",     required_argument, 0, 'r'},
+    {"wheelbase",  required_argument, 0, 'b'},
+    {"robot",      required_argument, 0, 'R'},
+    {"tolerance",  required_argument, 0, 'T'},
+    {"window",     required_argument, 0, 'w'},
+    {"huber",      required_argument, 0, 'H'},
+    {"help",       no_argument,       0, 'h'},
+    {0,            0,                 0, 0}
+  };
+  const char *shortopts("e:s:g:z:o:r:b:R:T:w:H:h");
+  int ch;
+  while(-1 != (ch = getopt_long(argc, argv, shortopts, longopts, 0))){
+    bool ok(true);
+    switch(ch){
+    case 'e': arg.enc_fname = optarg; break;
+    case 's': arg.scan_fname = optarg; break;
+    case 'g': arg.bg_fname = optarg; break;
+    case 'z': arg.zone_fname = optarg; break;
+    case 'o': arg.out_fname = optarg; break;
+    case 'r': ok = ! (istringstream(optarg) >> arg.wheelradius).fail(); break;
+    case 'b': ok = ! (istringstream(optarg) >> arg.wheelbase).fail(); break;
+    case 'R': ok = ! (istringstream(optarg) >> arg.robot_radius).fail(); break;
+    case 'T':
+      ok = ! (istringstream(optarg) >> arg.radius_tolerance).fail();
+      break;
+    case 'w': ok = ! (istringstream(optarg) >> arg.window_sec).fail(); break;
+    case 'H': ok = ! (istringstream(optarg) >> arg.huber).fail(); break;
+    case 'h':
+      usage_message(cout);
+      exit(EXIT_SUCCESS);
+    case '?':
+    default:
+      ok = false;
+    }
+    if( ! ok){
+      usage_message(cerr);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if(arg.enc_fname.empty() != arg.scan_fname.empty()){
+    usage_message(cerr);
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+static double seconds(uint32_t sec, uint32_t usec)
+{
+  return sec + 1e-6 * usec;
+}
+
+
+static double seconds(const Timestamp & t)
+{
+  return (* t).tv_sec + 1e-6 * (* t).tv_usec;
+}
+
+
+/** Inverse of a 3x3 matrix by cofactors, false if it is singular. */
+static bool invert3(const double A[3][3], double Ainv[3][3])
+{
+  const double det(A[0][0] * (A[1][1] * A[2][2] - A[1][2] * A[2][1])
+		   - A[0][1] * (A[1][0] * A[2][2] - A[1][2] * A[2][0])
+		   + A[0][2] * (A[1][0] * A[2][1] - A[1][1] * A[2][0]));
+  if(absval(det) < 1e-300)
+    return false;
+  for(int i(0); i < 3; ++i){
+    const int i1((i + 1) % 3), i2((i + 2) % 3);
+    for(int j(0); j < 3; ++j){
+      const int j1((j + 1) % 3), j2((j + 2) % 3);
+      Ainv[j][i] = (A[i1][j1] * A[i2][j2] - A[i1][j2] * A[i2][j1]) / det;
+    }
+  }
+  return true;
+}
+
+
+/**
+   Run the scans through a Scanalyzer and keep one robot-sized circle
+   per scan: the one closest to the previous sighting if that was
+   recent and near, otherwise only if it is the only candidate.
+*/
+static bool extract(vector<sighting_s> & sighting)
+{
+  struct sick_log_s * log(sick_log_open(arg.scan_fname.c_str(), stderr));
+  if(0 == log)
+    return false;
+  
+  // The replay poster of this Scanalyzer never gets asked for a scan,
+  // they are read straight from the log instead.
+  Scanalyzer scanalyzer(0.05, 8, arg.bg_fname, arg.scan_fname, 0);
+  if(( ! arg.zone_fname.empty())
+     && ( ! scanalyzer.LoadValidZone(arg.zone_fname))){
+    cerr << "could not read the valid zone from " << arg.zone_fname << "\n";
+    sick_log_close(log);
+    return false;
+  }
+  sighting.reserve(log->rec.count);
+  Scanalysis scan;
+  struct sick_scan_s raw;
+  for(unsigned long ir(0); 0 == sick_log_get(log, ir, & raw); ++ir){
+    scanalyzer.Analyze(raw);
+    scanalyzer.SwapScanalysis(scan);
+    const CircleLSQ * best(0);
+    double best_d2(sqr(0.5));
+    size_t ncandidates(0);
+    for(size_t i(0); i < scan.circle.size(); ++i){
+      const CircleLSQ * circle(scan.circle[i]);
+      if((0 == circle)
+	 || (absval(circle->radius - arg.robot_radius)
+	     > arg.radius_tolerance))
+	continue;
+      ++ncandidates;
+      if(sighting.empty()
+	 || (seconds(scan.t0) - sighting.back().t > max_gap)){
+	best = circle;
+	continue;
+      }
+      const double d2(sqr(circle->xc - sighting.back().x)
+		      + sqr(circle->yc - sighting.back().y));
+      if(d2 < best_d2){
+	best = circle;
+	best_d2 = d2;
+      }
+    }
+    if((0 == best) || (sighting.empty() && (ncandidates > 1)))
+      continue;
+    
+    const int label(best->label);
+    sighting_s ss;
+    ss.t = 0.5 * (seconds(scan.GetBeamTime(scan.startindex[label]))
+		  + seconds(scan.GetBeamTime(scan.endindex[label])));
+    ss.x = best->xc;
+    ss.y = best->yc;
+    sighting.push_back(ss);
+  }
+  sick_log_close(log);
+  return true;
+}
+
+
+/**
+   Dead-reckon through a window with parameters p = (left radius,
+   right radius, wheelbase), giving the position at each sighting,
+   and the distance travelled.
+*/
+static double reckon(const struct enc_log_s * log, const window_s & window,
+		     const vector<sighting_s> & sighting, const double p[3],
+		     vector<double> & px, vector<double> & py)
+{
+  px.resize(window.last - window.first);
+  py.resize(window.last - window.first);
+  
+  Frame pose(0, 0, 0);
+  double travel(0);
+  unsigned long ir(window.record);
+  const struct enc_record_s * rec(log->record + ir);
+  double trec(seconds(rec->t_sec, rec->t_usec));
+  for(size_t is(window.first); is < window.last; ++is){
+    const double ts(sighting[is].t);
+    double xs(pose.X()), ys(pose.Y());
+    while(ir + 1 < log->rec.count){
+      const struct enc_record_s * next(log->record + ir + 1);
+      const double tnext(seconds(next->t_sec, next->t_usec));
+      if(tnext < trec)
+	break;			// corrupt ordering, stop reckoning
+      double dl, dr;
+      Odometry::Enc2Rad(next->left - rec->left, next->right - rec->right,
+			dl, dr);
+      double dx, dy, dtheta, q[3][3];
+      Odometry::Step(dl * p[0], dr * p[1], p[2], dx, dy, dtheta, q);
+      const double tstart(maxval(trec, tnext - max_record_interval));
+      if(tnext > ts){
+	// The sighting falls into this step: interpolate.
+	if(ts > tstart){
+	  const double alpha((ts - tstart) / (tnext - tstart));
+	  double ix(alpha * dx), iy(alpha * dy);
+	  pose.RotateTo(ix, iy);
+	  xs += ix;
+	  ys += iy;
+	}
+	break;
+      }
+      pose.RotateTo(dx, dy);
+      pose.Add(dx, dy, dtheta);
+      travel += 0.5 * absval(dl * p[0] + dr * p[1]);
+      xs = pose.X();
+      ys = pose.Y();
+      ir++;
+      rec = next;
+      trec = tnext;
+    }
+    px[is - window.first] = xs;
+    py[is - window.first] = ys;
+  }
+  return travel;
+}
+
+
+/**
+   Align the dead-reckoned positions to the sightings by the weighted
+   best rigid transform and write the residuals (x and y interleaved).
+   
+   \return The weighted sum of squared residuals.
+*/
+static double align(const window_s & window,
+		    const vector<sighting_s> & sighting,
+		    const vector<double> & weight,
+		    const vector<double> & px, const vector<double> & py,
+		    vector<double> & res)
+{
+  const size_t n(window.last - window.first);
+  double sw(0), mpx(0), mpy(0), mqx(0), mqy(0);
+  for(size_t i(0); i < n; ++i){
+    const double w(weight[window.first + i]);
+    sw += w;
+    mpx += w * px[i];
+    mpy += w * py[i];
+    mqx += w * sighting[window.first + i].x;
+    mqy += w * sighting[window.first + i].y;
+  }
+  mpx /= sw;
+  mpy /= sw;
+  mqx /= sw;
+  mqy /= sw;
+  
+  double a(0), b(0);
+  for(size_t i(0); i < n; ++i){
+    const double w(weight[window.first + i]);
+    const double ux(px[i] - mpx), uy(py[i] - mpy);
+    const double vx(sighting[window.first + i].x - mqx);
+    const double vy(sighting[window.first + i].y - mqy);
+    a += w * (ux * vx + uy * vy);
+    b += w * (ux * vy - uy * vx);
+  }
+  const double theta(atan2(b, a));
+  const double cc(cos(theta)), ss(sin(theta));
+  
+  res.resize(2 * n);
+  double cost(0);
+  for(size_t i(0); i < n; ++i){
+    const double ux(px[i] - mpx), uy(py[i] - mpy);
+    res[2 * i]     = cc * ux - ss * uy + mqx - sighting[window.first + i].x;
+    res[2 * i + 1] = ss * ux + cc * uy + mqy - sighting[window.first + i].y;
+    cost += weight[window.first + i] * (sqr(res[2 * i]) + sqr(res[2 * i + 1]));
+  }
+  return cost;
+}
+
+
+/** Cut the sightings into windows, see max_gap and arg.window_sec. */
+static void cut(const struct enc_log_s * log,
+		const vector<sighting_s> & sighting,
+		vector<window_s> & window)
+{
+  window.clear();
+  size_t first(0);
+  for(size_t is(1); is <= sighting.size(); ++is){
+    if((is < sighting.size())
+       && (sighting[is].t - sighting[is - 1].t <= max_gap)
+       && (sighting[is].t - sighting[first].t < arg.window_sec))
+      continue;
+    
+    struct timeval tv;
+    tv.tv_sec = (long) sighting[first].t;
+    tv.tv_usec = (long) ((sighting[first].t - tv.tv_sec) * 1e6);
+    unsigned long record(enc_log_find(log, & tv));
+    if(record > 0)
+      --record;
+    if((is - first >= min_sightings) && (record + 1 < log->rec.count)){
+      window_s ww;
+      ww.first = first;
+      ww.last = is;
+      ww.record = record;
+      window.push_back(ww);
+    }
+    first = is;
+  }
+}
+
+
+/**
+   Gauss-Newton with Levenberg-Marquardt damping over the three
+   parameters, the window alignment being redone for each evaluation.
+   
+   \return false if there is nothing to fit.
+*/
+static bool calibrate(const struct enc_log_s * log,
+		      const vector<sighting_s> & sighting,
+		      vector<window_s> & window,
+		      double p[3], double sigma[3], double & rms)
+{
+  vector<double> weight(sighting.size(), 1);
+  vector<double> px, py, res, res_h;
+  
+  // Drop windows where the robot hardly moved: they only constrain
+  // the alignment.
+  vector<window_s> moving;
+  for(size_t iw(0); iw < window.size(); ++iw)
+    if(reckon(log, window[iw], sighting, p, px, py) >= min_travel)
+      moving.push_back(window[iw]);
+  window.swap(moving);
+  if(window.empty())
+    return false;
+  
+  size_t nres(0);
+  for(size_t iw(0); iw < window.size(); ++iw)
+    nres += 2 * (window[iw].last - window[iw].first);
+  
+  double lambda(1e-3);
+  double H[3][3], g[3], cost(0);
+  for(int iter(0); iter < 50; ++iter){
+    // Linearize, weights held fixed.
+    memset(H, 0, sizeof(H));
+    memset(g, 0, sizeof(g));
+    cost = 0;
+    for(size_t iw(0); iw < window.size(); ++iw){
+      const window_s & ww(window[iw]);
+      reckon(log, ww, sighting, p, px, py);
+      cost += align(ww, sighting, weight, px, py, res);
+      vector<double> J[3];
+      for(int k(0); k < 3; ++k){
+	double ph[3] = { p[0], p[1], p[2] };
+	const double h(1e-6 * p[k]);
+	ph[k] += h;
+	reckon(log, ww, sighting, ph, px, py);
+	align(ww, sighting, weight, px, py, res_h);
+	J[k].resize(res.size());
+	for(size_t i(0); i < res.size(); ++i)
+	  J[k][i] = (res_h[i] - res[i]) / h;
+      }
+      for(size_t i(0); i < res.size(); ++i){
+	const double w(weight[ww.first + i / 2]);
+	for(int k(0); k < 3; ++k){
+	  g[k] += w * J[k][i] * res[i];
+	  for(int l(0); l < 3; ++l)
+	    H[k][l] += w * J[k][i] * J[l][i];
+	}
+      }
+    }
+    
+    // Damped step, retried with more damping until the cost drops.
+    bool accepted(false);
+    double step(0);
+    for(int attempt(0); (attempt < 10) && ( ! accepted); ++attempt){
+      double A[3][3], Ainv[3][3], delta[3];
+      for(int k(0); k < 3; ++k){
+	for(int l(0); l < 3; ++l)
+	  A[k][l] = H[k][l];
+	A[k][k] *= 1 + lambda;
+      }
+      if( ! invert3(A, Ainv))
+	return false;
+      for(int k(0); k < 3; ++k)
+	delta[k] = - (Ainv[k][0] * g[0] + Ainv[k][1] * g[1]
+		      + Ainv[k][2] * g[2]);
+      double pt[3];
+      for(int k(0); k < 3; ++k)
+	pt[k] = p[k] + delta[k];
+      double cost_t(0);
+      for(size_t iw(0); iw < window.size(); ++iw){
+	reckon(log, window[iw], sighting, pt, px, py);
+	cost_t += align(window[iw], sighting, weight, px, py, res);
+      }
+      if(cost_t <= cost){
+	step = 0;
+	for(int k(0); k < 3; ++k){
+	  step = maxval(step, absval(delta[k] / p[k]));
+	  p[k] = pt[k];
+	}
+	lambda = maxval(1e-9, 0.1 * lambda);
+	accepted = true;
+      }
+      else
+	lambda *= 10;
+    }
+    
+    // Huber weights from the residuals at the new parameters.
+    double sum2(0);
+    for(size_t iw(0); iw < window.size(); ++iw){
+      const window_s & ww(window[iw]);
+      reckon(log, ww, sighting, p, px, py);
+      align(ww, sighting, weight, px, py, res);
+      for(size_t i(ww.first); i < ww.last; ++i){
+	const double d2(sqr(res[2 * (i - ww.first)])
+			+ sqr(res[2 * (i - ww.first) + 1]));
+	const double d(sqrt(d2));
+	weight[i] = (d <= arg.huber) ? 1 : arg.huber / d;
+	sum2 += d2;
+      }
+    }
+    rms = sqrt(sum2 / (nres / 2));
+    if(( ! accepted) || (step < 1e-9))
+      break;
+  }
+  
+  // Covariance from the last linearization, the variance of unit
+  // weight counting three parameters per window for the alignment.
+  double Hinv[3][3];
+  if( ! invert3(H, Hinv))
+    return false;
+  const double dof(nres - 3.0 - 3.0 * window.size());
+  const double s2((dof > 0) ? cost / dof : 0);
+  for(int k(0); k < 3; ++k)
+    sigma[k] = sqrt(s2 * Hinv[k][k]);
+  return true;
+}
+
+
+/**
+   Write the logs of a synthetic run of the given duration: the robot
+   steers towards a point wandering about the default valid zone of
+   the Scanalyzer,
+   with wheel radii and wheelbase off from the nominal ones by about
+   a percent, which get written to truth. The encoders are sampled
+   every 100ms, the scanner sees the robot and a wall at 6m with a
+   few millimetres of noise.
+*/
+static bool synthesize(double duration, double truth[3])
+{
+  truth[0] = arg.wheelradius * 1.008;
+  truth[1] = arg.wheelradius * 0.994;
+  truth[2] = arg.wheelbase * 1.015;
+  
+  unlink(arg.enc_fname.c_str());
+  unlink(arg.scan_fname.c_str());
+  struct enc_log_s * elog(enc_log_create(arg.enc_fname.c_str(), stderr));
+  struct sick_log_s * slog(sick_log_create(arg.scan_fname.c_str(), stderr));
+  if((0 == elog) || (0 == slog))
+    return false;
+  
+  static const double dt(0.001);
+  static const double enc_period(0.1);
+  static const double scan_period(1.0 / 75);
+  const double t0(1000);
+  double x(1.8), y(1.4), theta(0), ql(0), qr(0);
+  double next_enc(t0), next_scan(t0);
+  int32_t last_l(0), last_r(0);
+  bool ok(true);
+  for(double t(t0); ok && (t < t0 + duration); t += dt){
+    const double ts(t - t0);
+    const double gx(1.8 + 0.9 * sin(0.21 * ts) + 0.3 * sin(0.67 * ts));
+    const double gy(1.4 + 1.4 * sin(0.13 * ts) + 0.3 * cos(0.91 * ts));
+    const double heading(mod2pi(atan2(gy - y, gx - x) - theta));
+    const double omega(maxval(-1.5, minval(2.0 * heading, 1.5)));
+    const double v(0.3 * (1 - 0.5 * absval(heading) / M_PI));
+    const double wl((v - 0.5 * omega * truth[2]) / truth[0]);
+    const double wr((v + 0.5 * omega * truth[2]) / truth[1]);
+    ql += wl * dt;
+    qr += wr * dt;
+    const double ds(0.5 * (wl * truth[0] + wr * truth[1]) * dt);
+    const double dtheta((wr * truth[1] - wl * truth[0]) * dt / truth[2]);
+    x += ds * cos(theta + 0.5 * dtheta);
+    y += ds * sin(theta + 0.5 * dtheta);
+    theta = mod2pi(theta + dtheta);
+    
+    if(t >= next_enc){
+      next_enc += enc_period;
+      int32_t el, er;
+      Odometry::Rad2Enc(ql, qr, el, er);
+      if((el != last_l) || (er != last_r)){
+	struct timeval tv;
+	tv.tv_sec = (long) t;
+	tv.tv_usec = (long) ((t - tv.tv_sec) * 1e6);
+	ok = ok && (0 == enc_log_append(elog, & tv, el, er));
+	last_l = el;
+	last_r = er;
+      }
+    }
+    
+    // Render the scan at the middle of its sweep.
+    if(t >= next_scan + 0.5 * scan_period){
+      struct sick_scan_s scan;
+      memset(& scan, 0, sizeof(scan));
+      scan.t0.tv_sec = (long) next_scan;
+      scan.t0.tv_usec = (long) ((next_scan - scan.t0.tv_sec) * 1e6);
+      const double end(next_scan + scan_period);
+      scan.t1.tv_sec = (long) end;
+      scan.t1.tv_usec = (long) ((end - scan.t1.tv_sec) * 1e6);
+      next_scan = end;
+      for(int i(0); i < Scanalysis::scansize; ++i){
+	const double phi(M_PI / 2 - (M_PI * i / Scanalysis::scansize));
+	double rho(6);
+	const double b(x * cos(phi) + y * sin(phi));
+	const double disc(sqr(b) - sqr(x) - sqr(y) + sqr(arg.robot_radius));
+	if((disc >= 0) && (b - sqrt(disc) > 0))
+	  rho = b - sqrt(disc);
+	rho += 0.001 * (rand() % 11 - 5);
+	scan.rho[i] = (uint16_t) (1000 * rho);
+      }
+      ok = ok && (0 == sick_log_append(slog, & scan));
+    }
+  }
+  
+  enc_log_close(elog);
+  sick_log_close(slog);
+  return ok;
+}
+
+
+int main(int argc,
+	 char ** argv)
+{
+  parse_args(argc, argv);
+  const bool synthetic(arg.enc_fname.empty());
+  double truth[3];
+  if(synthetic){
+    arg.enc_fname = "/tmp/odocal.enc";
+    arg.scan_fname = "/tmp/odocal.scan";
+    if( ! synthesize(300, truth)){
+      cerr << "could not write the synthetic logs\n";
+      return EXIT_FAILURE;
+    }
+  }
+  
+  const Timestamp t_start(Timestamp::Now());
+  vector<sighting_s> sighting;
+  if( ! extract(sighting))
+    return EXIT_FAILURE;
+  const Timestamp t_extract(Timestamp::Now());
+  
+  struct enc_log_s * log(enc_log_open(arg.enc_fname.c_str(), stderr));
+  if(0 == log)
+    return EXIT_FAILURE;
+  vector<window_s> window;
+  cut(log, sighting, window);
+  double p[3] = { arg.wheelradius, arg.wheelradius, arg.wheelbase };
+  double sigma[3] = { 0, 0, 0 }, rms(0);
+  const bool ok(calibrate(log, sighting, window, p, sigma, rms));
+  const Timestamp t_end(Timestamp::Now());
+  const unsigned long nrecords(log->rec.count);
+  enc_log_close(log);
+  if( ! ok){
+    cerr << "nothing to calibrate: " << sighting.size() << " sightings, "
+	 << window.size() << " windows with motion\n";
+    return EXIT_FAILURE;
+  }
+  
+  cout << sighting.size() << " sightings in " << window.size()
+       << " windows, " << nrecords << " encoder records\n"
+       << "extraction " << (t_extract - t_start).ConvertToSeconds()
+       << " s, fit " << (t_end - t_extract).ConvertToSeconds() << " s\n"
+       << "left radius  " << p[0] << " +- " << sigma[0] << "\n"
+       << "right radius " << p[1] << " +- " << sigma[1] << "\n"
+       << "wheelbase    " << p[2] << " +- " << sigma[2] << "\n"
+       << "residual rms " << rms << " m\n";
+  
+  if( ! arg.out_fname.empty()){
+    ofstream os(arg.out_fname.c_str());
+    os.precision(9);
+    os << p[0] << " " << p[1] << " " << p[2] << "\n";
+    if( ! os){
+      cerr << "could not write " << arg.out_fname << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+  
+  if(synthetic){
+    cout << "truth        " << truth[0] << " " << truth[1] << " "
+	 << truth[2] << "\n";
+    for(int k(0); k < 3; ++k)
+      if(absval(p[k] - truth[k]) > 1e-3 * truth[k]){
+	cerr << "parameter " << k << " off by "
+	     << 100 * absval(p[k] - truth[k]) / truth[k] << "%\n";
+	return EXIT_FAILURE;
+      }
+  }
+  return EXIT_SUCCESS;
+}
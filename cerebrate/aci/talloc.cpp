@@ -0,0 +1,240 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "Scanalyzer.hpp"
+#include "Localizer.hpp"
+#include "Odometry.hpp"
+#include "MotionManager.hpp"
+#include "Behavior.hpp"
+#include <drivers/sicklog.h>
+#include <drivers/FModIPDCMOT.hpp>
+#include <drivers/fmod_util.h>
+#include <util/Timestamp.hpp>
+#include <iostream>
+#include <sstream>
+#include <new>
+#include <cmath>
+#include <cstring>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+
+using namespace std;
+
+
+// Every C++ heap allocation of the process goes through here. The C
+// drivers do not allocate per scan, so this covers the whole cycle.
+static volatile unsigned long nalloc(0);
+
+void * operator new(size_t size) throw(std::bad_alloc)
+{
+  ++nalloc;
+  void * ptr(malloc(size > 0 ? size : 1));
+  if(0 == ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void * operator new[](size_t size) throw(std::bad_alloc)
+{
+  return operator new(size);
+}
+
+void operator delete(void * ptr) throw()
+{
+  free(ptr);
+}
+
+void operator delete[](void * ptr) throw()
+{
+  free(ptr);
+}
+
+
+/**
+   Write nscans synthetic scans to a log: a wall at 3m, with a visitor
+   walking past and a cactus rocking back and forth.
+*/
+static bool synthesize(const char * fname, unsigned long nscans)
+{
+  unlink(fname);
+  struct sick_log_s * log(sick_log_create(fname, stderr));
+  if(0 == log)
+    return false;
+  for(unsigned long k(0); k < nscans; ++k){
+    struct sick_scan_s scan;
+    memset(& scan, 0, sizeof(scan));
+    scan.t0.tv_sec = 1000 + k / 75;
+    scan.t0.tv_usec = (k % 75) * 13333;
+    scan.t1 = scan.t0;
+    const double vx(0.5 + fmod(0.01 * k, 3));
+    for(int i(0); i < 361; ++i){
+      const double phi(M_PI / 2 - (M_PI * i / 361));
+      double rho(3 + 0.001 * (rand() % 11 - 5));
+      const double cx[2] = { vx, 1.5 + 0.2 * sin(0.05 * k) };
+      const double cy[2] = { 1, -0.5 };
+      const double cr[2] = { 0.15, 0.14 };
+      for(int j(0); j < 2; ++j){
+	const double b(cx[j] * cos(phi) + cy[j] * sin(phi));
+	const double disc(b * b - cx[j] * cx[j] - cy[j] * cy[j]
+			  + cr[j] * cr[j]);
+	if((disc >= 0) && (b - sqrt(disc) > 0) && (b - sqrt(disc) < rho))
+	  rho = b - sqrt(disc);
+      }
+      scan.rho[i] = (uint16_t) (1000 * rho);
+    }
+    if(0 != sick_log_append(log, & scan)){
+      sick_log_close(log);
+      return false;
+    }
+  }
+  sick_log_close(log);
+  return true;
+}
+
+
+/**
+   Answers the register requests of one FModIPDCMOT on the other end
+   of a socket pair, like a motor turning at a constant speed, until
+   the motor closes its end.
+*/
+static void * fake_motor(void * arg)
+{
+  const int fd(* reinterpret_cast<int *>(arg));
+  static const int32_t speed(200);
+  int32_t position(0);
+  uint8_t packet[16];
+  uint16_t crc;
+  while(7 == recv(fd, packet, 7, MSG_WAITALL)){
+    const uint16_t len((packet[4] << 8) | packet[5]);
+    if((len < 1) || (len > 8)
+       || (len + 1 != recv(fd, packet + 7, len + 1, MSG_WAITALL)))
+      break;
+    if(0x21 == packet[1]){
+      // read request: answer with four bytes, big endian
+      int32_t val(0);
+      if(0x26 == packet[6])
+	val = (position += speed);
+      else if(0x28 == packet[6])
+	val = speed;
+      packet[5] = 5;
+      for(int i(0); i < 4; ++i)
+	packet[7 + i] = (val >> (24 - 8 * i)) & 0xFF;
+      fmod_crc(packet, 11, & crc, 0);
+      memcpy(packet + 11, & crc, 2);
+      if(13 != send(fd, packet, 13, 0))
+	break;
+    }
+    else{
+      // write request: acknowledge
+      fmod_crc(packet, 6, & crc, 0);
+      memcpy(packet + 6, & crc, 2);
+      if(8 != send(fd, packet, 8, 0))
+	break;
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+
+/** Gives access to the protected constructor. */
+class FakeMotor
+  : public FModIPDCMOT
+{
+public:
+  FakeMotor(int fd): FModIPDCMOT(fmod_new(fd), 10000, 1000) {}
+};
+
+
+int main(int argc,
+	 char ** argv)
+{
+  string logname("/tmp/talloc.log");
+  const unsigned long nwarmup(100);
+  const unsigned long nscans(500);
+  if(argc > 1)
+    logname = argv[1];
+  else if( ! synthesize(logname.c_str(), nwarmup + nscans)){
+    cerr << "could not write " << logname << "\n";
+    return 1;
+  }
+  
+  // Each motor talks to a fake_motor() thread over a socket pair.
+  int sv[2][2];
+  pthread_t responder[2];
+  for(int i(0); i < 2; ++i)
+    if((0 != socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]))
+       || (0 != pthread_create(& responder[i], 0, fake_motor, & sv[i][1]))){
+      cerr << "could not set up the fake motors\n";
+      return 1;
+    }
+  
+  unsigned long count(0), steady(0), total(0);
+  {
+    // The same stages as Cactus::Update(), with a replayed scanner
+    // and fake motors. The grid and the background map get set up
+    // during the warmup, so that matching runs in the steady state.
+    FakeMotor left(sv[0][0]), right(sv[1][0]);
+    Odometry odometry(left, right, 0.4, 0.1);
+    MotionManager motion_manager(odometry, left, right, 0.4);
+    Scanalyzer scanalyzer(0.05, 8, "", logname, 0);
+    Localizer localizer(odometry, motion_manager, scanalyzer);
+    Behavior behavior(0, 0, 2, 1);
+    localizer.CreateGrid(-4, -4, 160, 160, 0.05);
+    odometry.Init(Timestamp::Now(), 1.5, -0.5, 0, & motion_manager);
+    const string bgname(logname + ".bg");
+    
+    Timestamp idle(Timestamp::Now());
+    while((Timestamp::Now() - idle).ConvertToSeconds() < 1){
+      odometry.Update();
+      if( ! localizer.Update()){
+	usleep(1000);
+	continue;
+      }
+      idle = Timestamp::Now();
+      behavior.Update(localizer.GetTracker(), odometry.GetCurrentPose(), 0.8);
+      motion_manager.Update();
+      ++count;
+      if(nwarmup / 2 == count)
+	if(( ! localizer.SaveBackground(bgname))
+	   || ( ! localizer.LoadBackground(bgname)))
+	  cerr << "could not rebuild the background map\n";
+      if(nwarmup == count)
+	steady = nalloc;
+    }
+    if(count > nwarmup)
+      total = nalloc - steady;
+    unlink(bgname.c_str());
+  }
+  for(int i(0); i < 2; ++i)
+    pthread_join(responder[i], 0);
+  
+  cout << count << " scans, " << total << " allocations after the first "
+       << nwarmup << "\n";
+  if(count <= nwarmup){
+    cerr << "not enough scans in " << logname << "\n";
+    return 1;
+  }
+  return (0 == total) ? 0 : 1;
+}
@@ -0,0 +1,301 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "CircleLSQ.hpp"
+#include "Scanalyzer.hpp"
+#include <drivers/sicklog.h>
+#include <sfl/numeric.hpp>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <cmath>
+#include <stdlib.h>
+#include <sys/time.h>
+
+
+using namespace std;
+
+
+/**
+   Fill an analysis from a scan: points closer than rhomax are
+   objects, and clusters are split where the range jumps by more than
+   thresh, similar to what Scanalyzer does without a background.
+*/
+static void analyze(const struct sick_scan_s & scan, double rhomax,
+		    double thresh, Scanalysis & analysis)
+{
+  const int scansize(Scanalysis::scansize);
+  analysis.startindex.clear();
+  analysis.endindex.clear();
+  int last(-1);
+  for(int i(0); i < scansize; ++i){
+    const double phi(M_PI / 2 - (M_PI * i / scansize));
+    const double r(0.001 * scan.rho[i]);
+    analysis.rho[i] = r;
+    analysis.x[i] = r * cos(phi);
+    analysis.y[i] = r * sin(phi);
+    if(r >= rhomax){
+      analysis.category[i] = Scanalysis::BACKGROUND;
+      continue;
+    }
+    analysis.category[i] = Scanalysis::OBJECT;
+    if((last < 0) || (last != i - 1)
+       || (sfl::absval(r - analysis.rho[last]) > thresh)){
+      if(last >= 0)
+	analysis.endindex.push_back(last);
+      analysis.startindex.push_back(i);
+    }
+    last = i;
+  }
+  if(last >= 0)
+    analysis.endindex.push_back(last);
+}
+
+
+/**
+   Synthetic scans for when no log is given: a wall at 6m with a few
+   cacti of 5 to 15cm radius wandering in front of it, and one in
+   fifty beams a stray reflection.
+*/
+static void synthesize(int index, struct sick_scan_s & scan)
+{
+  const int scansize(Scanalysis::scansize);
+  for(int i(0); i < scansize; ++i){
+    const double phi(M_PI / 2 - (M_PI * i / scansize));
+    double rho(6 / sfl::maxval(0.2, cos(phi)));
+    for(int j(0); j < 6; ++j){
+      const double xc(1 + 0.7 * j + 0.3 * sin(0.01 * index + j));
+      const double yc(-2 + 0.8 * j + 0.3 * cos(0.013 * index + j));
+      const double rr(0.05 + 0.02 * j);
+      // ray-circle intersection
+      const double b(xc * cos(phi) + yc * sin(phi));
+      const double disc(sfl::sqr(b) - sfl::sqr(xc) - sfl::sqr(yc)
+			+ sfl::sqr(rr));
+      if((disc >= 0) && (b - sqrt(disc) > 0) && (b - sqrt(disc) < rho))
+	rho = b - sqrt(disc);
+    }
+    if(0 == rand() % 50)
+      rho -= 0.05 + 0.001 * (rand() % 100);
+    scan.rho[i] = (uint16_t) sfl::minval(8191.0,
+					1000 * rho + (rand() % 11) - 5);
+  }
+}
+
+
+static double usec_since(const struct timeval & t0)
+{
+  struct timeval t1;
+  gettimeofday(& t1, 0);
+  return 1e6 * (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec);
+}
+
+
+/** The original fit: nine passes over each cluster with pow(). */
+static CircleLSQ * fit_pow(const Scanalysis & analysis, int start, int end,
+			   int label)
+{
+  CircleLSQ::Moments mm;
+  mm.Sx   = CircleLSQ::CalculateSxn(1, analysis, start, end);
+  mm.Sx2  = CircleLSQ::CalculateSxn(2, analysis, start, end);
+  mm.Sx3  = CircleLSQ::CalculateSxn(3, analysis, start, end);
+  mm.Sy   = CircleLSQ::CalculateSym(1, analysis, start, end);
+  mm.Sy2  = CircleLSQ::CalculateSym(2, analysis, start, end);
+  mm.Sy3  = CircleLSQ::CalculateSym(3, analysis, start, end);
+  mm.Sxy  = CircleLSQ::CalculateSxnym(1, 1, analysis, start, end);
+  mm.Sx2y = CircleLSQ::CalculateSxnym(2, 1, analysis, start, end);
+  mm.Sxy2 = CircleLSQ::CalculateSxnym(1, 2, analysis, start, end);
+  return CircleLSQ::Create(mm, analysis, start, end, label);
+}
+
+
+static CircleLSQ * fit_onepass(const Scanalysis & analysis, int start,
+			       int end, int label)
+{
+  return CircleLSQ::Create(analysis, start, end, label);
+}
+
+
+/**
+   Fit all clusters of all scans with the given method, which is
+   0 for pow(), 1 for one-pass moments, 2 for prefix sums, and 3 for
+   the robust fit.
+   \return Microseconds per scan.
+*/
+static double bench(int method, const vector<Scanalysis *> & scans,
+		    int nrounds, vector<CircleLSQ *> & result)
+{
+  CircleLSQ::Moments prefix[Scanalysis::scansize + 1];
+  for(size_t i(0); i < result.size(); ++i)
+    delete result[i];
+  result.clear();
+  
+  struct timeval t0;
+  gettimeofday(& t0, 0);
+  for(int round(0); round < nrounds; ++round)
+    for(size_t is(0); is < scans.size(); ++is){
+      const Scanalysis & analysis(* scans[is]);
+      if(2 == method)
+	CircleLSQ::CalculatePrefix(analysis, prefix);
+      for(size_t ic(0); ic < analysis.startindex.size(); ++ic){
+	const int start(analysis.startindex[ic]);
+	const int end(analysis.endindex[ic]);
+	CircleLSQ * circle;
+	if(0 == method)
+	  circle = fit_pow(analysis, start, end, ic);
+	else if(1 == method)
+	  circle = fit_onepass(analysis, start, end, ic);
+	else if(2 == method)
+	  circle = CircleLSQ::Create(prefix[end + 1] - prefix[start],
+				     analysis, start, end, ic);
+	else
+	  circle = CircleLSQ::CreateRobust(analysis, start, end, ic,
+					   0.02, 24);
+	if(0 == round)
+	  result.push_back(circle);
+	else
+	  delete circle;
+      }
+    }
+  return usec_since(t0) / (nrounds * (double) scans.size());
+}
+
+
+/**
+   \return The largest deviation of centers and radii from the
+   reference, relative to the radius of the reference circle.
+*/
+static double compare(const vector<CircleLSQ *> & ref,
+		      const vector<CircleLSQ *> & other, int & nmismatch)
+{
+  double maxdev(0);
+  nmismatch = 0;
+  for(size_t i(0); i < ref.size(); ++i){
+    if((0 == ref[i]) != (0 == other[i])){
+      ++nmismatch;
+      continue;
+    }
+    if((0 == ref[i]) || (ref[i]->radius <= 0) || (ref[i]->radius > 1))
+      continue;			// only compare plausible fits
+    const double dev(sfl::maxval(sfl::maxval(sfl::absval(ref[i]->xc
+							 - other[i]->xc),
+					     sfl::absval(ref[i]->yc
+							 - other[i]->yc)),
+				 sfl::absval(ref[i]->radius
+					     - other[i]->radius)));
+    if(dev / ref[i]->radius > maxdev)
+      maxdev = dev / ref[i]->radius;
+  }
+  return maxdev;
+}
+
+
+/**
+   \return The number of fits that Localizer would accept as cactus,
+   with a maximum residual of 2cm and a radius below 20cm.
+*/
+static int count_good(const vector<CircleLSQ *> & fits)
+{
+  int count(0);
+  for(size_t i(0); i < fits.size(); ++i)
+    if((0 != fits[i]) && (fits[i]->ninliers >= 3)
+       && (fits[i]->maxdist <= 0.02) && (fits[i]->radius < 0.2))
+      ++count;
+  return count;
+}
+
+
+int main(int argc,
+	 char ** argv)
+{
+  string logname;
+  int nrounds(20);
+  double rhomax(7.9);
+  double thresh(0.1);
+  if(argc > 1)
+    logname = argv[1];
+  if(argc > 2)
+    istringstream(argv[2]) >> nrounds;
+  if(nrounds < 1){
+    cerr << "usage: " << argv[0] << " [logfile|- [rounds]]\n"
+	 << "  Compares the cost of fitting circles to all clusters of\n"
+	 << "  recorded scans (or synthetic ones if no log is given).\n";
+    return 1;
+  }
+  
+  vector<Scanalysis *> scans;
+  struct sick_scan_s scan;
+  if(( ! logname.empty()) && ("-" != logname)){
+    struct sick_log_s * log(sick_log_open(logname.c_str(), stderr));
+    if(0 == log){
+      cerr << "could not open " << logname << "\n";
+      return 1;
+    }
+    for(unsigned long i(0); i < log->rec.count; ++i)
+      if(0 == sick_log_get(log, i, & scan)){
+	scans.push_back(new Scanalysis());
+	analyze(scan, rhomax, thresh, * scans.back());
+      }
+    sick_log_close(log);
+  }
+  else{
+    srand(42);
+    for(int i(0); i < 1000; ++i){
+      synthesize(i, scan);
+      scans.push_back(new Scanalysis());
+      analyze(scan, rhomax, thresh, * scans.back());
+    }
+  }
+  if(scans.empty()){
+    cerr << "no scans\n";
+    return 1;
+  }
+  
+  size_t nclusters(0);
+  for(size_t i(0); i < scans.size(); ++i)
+    nclusters += scans[i]->startindex.size();
+  
+  vector<CircleLSQ *> ref, onepass, prefix, robust;
+  const double tref(bench(0, scans, nrounds, ref));
+  const double tone(bench(1, scans, nrounds, onepass));
+  const double tpre(bench(2, scans, nrounds, prefix));
+  const double trob(bench(3, scans, nrounds, robust));
+  
+  int mone, mpre;
+  const double done(compare(ref, onepass, mone));
+  const double dpre(compare(ref, prefix, mpre));
+  
+  cout << scans.size() << " scans with " << nclusters << " clusters\n"
+       << "microseconds per scan:\n"
+       << "  pow()    " << tref << "\n"
+       << "  onepass  " << tone << "  speedup " << tref / tone << "\n"
+       << "  prefix   " << tpre << "  speedup " << tref / tpre << "\n"
+       << "  robust   " << trob << "\n"
+       << "largest deviation from pow() relative to radius:\n"
+       << "  onepass  " << done << "  (" << mone << " mismatches)\n"
+       << "  prefix   " << dpre << "  (" << mpre << " mismatches)\n"
+       << "acceptable cactus fits:\n"
+       << "  onepass  " << count_good(onepass) << "\n"
+       << "  robust   " << count_good(robust) << "\n";
+  
+  for(size_t i(0); i < scans.size(); ++i)
+    delete scans[i];
+  return ((0 == mone) && (0 == mpre)) ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "PoseHistory.hpp"
+#include "Odometry.hpp"
+#include <sfl/numeric.hpp>
+#include <iostream>
+#include <cmath>
+#include <stdlib.h>
+
+
+using namespace std;
+using namespace sfl;
+
+
+static double gauss()
+{
+  const double u1((rand() + 1.0) / (RAND_MAX + 2.0));
+  const double u2((rand() + 1.0) / (RAND_MAX + 2.0));
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+
+static Timestamp simtime(double seconds)
+{
+  const long sec(static_cast<long>(floor(seconds)));
+  return Timestamp(1000000 + sec,
+		   static_cast<long>((seconds - sec) * 1e6));
+}
+
+
+static double planar_distance(const Frame & a, const Frame & b)
+{
+  return sqrt(sqr(a.X() - b.X()) + sqr(a.Y() - b.Y()));
+}
+
+
+int main(int argc,
+	 char ** argv)
+{
+  // The robot drives along a slalom for ten minutes. Its wheels
+  // slip as modelled by Odometry::Step(), and the scanner sees it
+  // five times per second, with a 100ms delay, two centimetres of
+  // noise, and one sighting in fifty half a metre off. The heading
+  // gets observed every two seconds.
+  static const double wheelbase(0.5);
+  static const double wheel_sigma(0.02);
+  static const double odo_period(0.1);
+  static const double obs_period(0.2);
+  static const double obs_latency(0.1);
+  static const double obs_sigma(0.02);
+  static const double obs_sigma_theta(0.05);
+  static const double duration(600);
+  const double obs_cov[3][3] = {
+    { sqr(obs_sigma), 0, 0 },
+    { 0, sqr(obs_sigma), 0 },
+    { 0, 0, sqr(obs_sigma_theta) } };
+  
+  srand(42);
+  PoseHistory history(4096, 256);
+  Frame truth;
+  const double init_cov[3][3] = {
+    { sqr(0.05), 0, 0 }, { 0, sqr(0.05), 0 }, { 0, 0, sqr(0.2) } };
+  history.Init(simtime(0), Pose(0, 0, 0, init_cov));
+  
+  // true poses of the last second, for the delayed sightings
+  static const int ndelay(static_cast<int>(obs_latency / odo_period + 0.5));
+  Frame past[16];
+  
+  double sum_ekf(0), sum_obs(0), max_jump(0), max_obs_jump(0);
+  int nobs(0), noutliers(0), nrejected(0), nfalse(0);
+  Frame prev_obs;
+  bool have_prev(false);
+  int step(0);
+  for(double t(0); t < duration; t += odo_period, ++step){
+    const double v(0.3);
+    const double omega(0.6 * sin(0.5 * t));
+    const double dl((v - 0.5 * omega * wheelbase) * odo_period);
+    const double dr((v + 0.5 * omega * wheelbase) * odo_period);
+    double dx, dy, dtheta, q[3][3];
+    Odometry::Step(dl, dr, wheelbase, dx, dy, dtheta, q);
+    double ux(dx), uy(dy);
+    truth.RotateTo(ux, uy);
+    truth.Add(ux, uy, dtheta);
+    past[step % 16] = truth;
+    
+    const double ml(dl + wheel_sigma * sqrt(absval(dl)) * gauss());
+    const double mr(dr + wheel_sigma * sqrt(absval(dr)) * gauss());
+    Odometry::Step(ml, mr, wheelbase, dx, dy, dtheta, q);
+    history.Append(simtime(t + odo_period), dx, dy, dtheta, q);
+    
+    if((step < ndelay) || (0 != step % static_cast<int>(obs_period
+							 / odo_period)))
+      continue;
+    const Frame & seen(past[(step - ndelay) % 16]);
+    const bool outlier(0 == rand() % 50);
+    double ox(seen.X() + obs_sigma * gauss());
+    double oy(seen.Y() + obs_sigma * gauss());
+    if(outlier){
+      const double phi(2 * M_PI * rand() / RAND_MAX);
+      ox += 0.5 * cos(phi);
+      oy += 0.5 * sin(phi);
+      ++noutliers;
+    }
+    const bool known_theta(0 == step % static_cast<int>(2 / odo_period));
+    const double otheta(seen.Theta() + obs_sigma_theta * gauss());
+    
+    const Frame before(history.GetCurrent().global);
+    const bool accepted(history.Correct(simtime(t + odo_period
+						 - obs_latency),
+					PoseHistory::observation(ox, oy,
+								 known_theta,
+								 otheta,
+								 obs_cov)));
+    if( ! accepted){
+      if(outlier)
+	++nrejected;
+      else
+	++nfalse;
+      continue;
+    }
+    if(outlier)
+      continue;
+    
+    const Frame & after(history.GetCurrent().global);
+    const double jump(planar_distance(before, after));
+    if((t > 10) && (jump > max_jump))
+      max_jump = jump;
+    const Frame obs(ox, oy, 0);
+    if(have_prev){
+      // what overwriting the pose with each sighting would jump
+      const double moved(v * obs_period);
+      const double obs_jump(absval(planar_distance(prev_obs, obs) - moved));
+      if(obs_jump > max_obs_jump)
+	max_obs_jump = obs_jump;
+    }
+    prev_obs = obs;
+    have_prev = true;
+    if(t > 10){
+      sum_ekf += sqr(planar_distance(after, truth));
+      sum_obs += sqr(planar_distance(obs, seen));
+      ++nobs;
+    }
+  }
+  
+  const double rms_ekf(sqrt(sum_ekf / nobs));
+  const double rms_obs(sqrt(sum_obs / nobs));
+  cout << "position error rms: filter " << rms_ekf
+       << " m, sightings " << rms_obs << " m\n"
+       << "largest correction: filter " << max_jump
+       << " m, overwriting " << max_obs_jump << " m\n"
+       << nrejected << " of " << noutliers << " stray sightings rejected, "
+       << nfalse << " good ones\n";
+  if(rms_ekf >= rms_obs)
+    return 1;
+  if(nrejected < noutliers)
+    return 1;
+  // the gate is the 99% quantile
+  if(nfalse * 50 > nobs)
+    return 1;
+  return 0;
+}
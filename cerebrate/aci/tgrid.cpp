@@ -0,0 +1,140 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "OccupancyGrid.hpp"
+#include "ScanMatcher.hpp"
+#include "Scanalyzer.hpp"
+#include <sfl/numeric.hpp>
+#include <sfl/Frame.hpp>
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <stdlib.h>
+#include <sys/time.h>
+
+
+using namespace std;
+
+
+/**
+   Scan of a room with walls at x = 4, y = -3 and y = 5, taken from
+   the origin with up to 1cm of noise. Beams that leave through the
+   open side have no echo.
+*/
+static void synthesize(Scanalysis & analysis)
+{
+  for(int i(0); i < Scanalysis::scansize; ++i){
+    const double phi(M_PI / 2 - (M_PI * i / Scanalysis::scansize));
+    const double cp(cos(phi)), sp(sin(phi));
+    double rho(8.191);
+    if(cp > 1e-3)
+      rho = sfl::minval(rho, 4 / cp);
+    if(sp < -1e-3)
+      rho = sfl::minval(rho, -3 / sp);
+    if(sp > 1e-3)
+      rho = sfl::minval(rho, 5 / sp);
+    if(rho < 8)
+      rho += 0.01 * ((rand() % 201) - 100) / 100.0;
+    analysis.rho[i] = rho;
+    analysis.x[i] = rho * cp;
+    analysis.y[i] = rho * sp;
+  }
+}
+
+
+static double usec_since(const struct timeval & t0)
+{
+  struct timeval t1;
+  gettimeofday(& t1, 0);
+  return 1e6 * (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec);
+}
+
+
+int main(int argc,
+	 char ** argv)
+{
+  string fname("tgrid.map");
+  if(argc > 1)
+    fname = argv[1];
+  
+  srand(42);
+  static const int nscans(100);
+  OccupancyGrid grid(-1, -4, 126, 226, 0.04);
+  Scanalysis analysis;
+  const sfl::Frame origin;
+  struct timeval t0;
+  gettimeofday(& t0, 0);
+  for(int i(0); i < nscans; ++i){
+    synthesize(analysis);
+    grid.Update(analysis, origin, 8);
+  }
+  const double tupdate(usec_since(t0) / nscans);
+  gettimeofday(& t0, 0);
+  grid.UpdateDistance(1);
+  const double tdist(usec_since(t0));
+  
+  int ix, iy;
+  grid.GetIndex(4, 1, ix, iy);
+  const bool wall(grid.GetLogOdds(ix, iy) > 0);
+  grid.GetIndex(2, 1, ix, iy);
+  const bool free(grid.GetLogOdds(ix, iy) < 0);
+  const double dist(grid.GetDistance()[iy * grid.GetNX() + ix]);
+  
+  if( ! grid.Save(fname)){
+    cerr << "could not save " << fname << "\n";
+    return 1;
+  }
+  gettimeofday(& t0, 0);
+  OccupancyGrid * loaded(OccupancyGrid::Load(fname));
+  const double tload(usec_since(t0));
+  if(0 == loaded){
+    cerr << "could not load " << fname << "\n";
+    return 1;
+  }
+  const int ncells(grid.GetNX() * grid.GetNY());
+  const bool same((loaded->GetNX() == grid.GetNX())
+		  && (0 == memcmp(loaded->GetDistance(), grid.GetDistance(),
+				  ncells * sizeof(float))));
+  
+  // the distance field as a map for the scan matcher
+  ScanMatcher matcher(0.04, 0.2, 10, 50);
+  matcher.SetMap(* loaded);
+  sfl::Frame pose(0.05, -0.03, 0.02);
+  synthesize(analysis);
+  const bool matched(matcher.Match(analysis, pose));
+  delete loaded;
+  
+  cout << ncells << " cells\n"
+       << "  update   " << tupdate << " microseconds per scan\n"
+       << "  distance " << tdist << " microseconds\n"
+       << "  load     " << tload << " microseconds\n"
+       << "wall cell occupied: " << (wall ? "yes" : "NO") << "\n"
+       << "room cell free: " << (free ? "yes" : "NO")
+       << ", " << dist << " m from the wall\n"
+       << "reloaded grid identical: " << (same ? "yes" : "NO") << "\n"
+       << "match from (0.05, -0.03, 0.02): (" << pose.X() << ", "
+       << pose.Y() << ", " << pose.Theta() << ")\n";
+  
+  return (wall && free && same && matched
+	  && (sfl::absval(pose.X()) < 0.02) && (sfl::absval(pose.Y()) < 0.02)
+	  && (sfl::absval(pose.Theta()) < 0.01)) ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "LineSegment.hpp"
+#include "Scanalyzer.hpp"
+#include <sfl/numeric.hpp>
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <stdlib.h>
+#include <sys/time.h>
+
+
+using namespace std;
+
+
+/**
+   Synthetic room: a wall at x = 4, a side wall at y = -3 that makes
+   a corner with it, a board at 45 degrees, and a cylinder of 14cm
+   radius. The board and the cylinder cut the wall into pieces.
+   Ranges get up to 1cm of noise.
+*/
+static void synthesize(int index, Scanalysis & analysis)
+{
+  const int scansize(Scanalysis::scansize);
+  const double xc(2 + 0.5 * sin(0.02 * index));
+  const double yc(1.5);
+  const double rr(0.14);
+  for(int i(0); i < scansize; ++i){
+    const double phi(M_PI / 2 - (M_PI * i / scansize));
+    const double cp(cos(phi)), sp(sin(phi));
+    double rho(8);
+    if(cp > 1e-3)
+      rho = sfl::minval(rho, 4 / cp);
+    if(sp < -1e-3)
+      rho = sfl::minval(rho, -3 / sp);
+    // board from (2, -1) to (3, 0), on the line x - y = 3
+    if(cp - sp > 1e-3){
+      const double t(3 / (cp - sp));
+      if((t * cp >= 2) && (t * cp <= 3))
+	rho = sfl::minval(rho, t);
+    }
+    const double b(xc * cp + yc * sp);
+    const double disc(sfl::sqr(b) - sfl::sqr(xc) - sfl::sqr(yc)
+		      + sfl::sqr(rr));
+    if((disc >= 0) && (b - sqrt(disc) > 0))
+      rho = sfl::minval(rho, b - sqrt(disc));
+    rho += 0.01 * ((rand() % 201) - 100) / 100.0;
+    analysis.rho[i] = rho;
+    analysis.x[i] = rho * cp;
+    analysis.y[i] = rho * sp;
+    analysis.category[i] = Scanalysis::BACKGROUND;
+  }
+}
+
+
+int main(int argc,
+	 char ** argv)
+{
+  int nscans(1000);
+  if(argc > 1)
+    istringstream(argv[1]) >> nscans;
+  if(nscans < 1){
+    cerr << "usage: " << argv[0] << " [scans]\n"
+	 << "  Extracts line segments from synthetic scans of a room and\n"
+	 << "  checks the wall at x = 4.\n";
+    return 1;
+  }
+  
+  srand(42);
+  Scanalysis analysis;
+  LineExtractor extractor(0.02, 0.2, 5, 0.1, 0.015);
+  double usec(0), maxdalpha(0), maxdr(0), sigma_r(0);
+  int nsegments(0), nwall(0), nfound(0), ncylinder(0);
+  for(int is(0); is < nscans; ++is){
+    synthesize(is, analysis);
+    
+    struct timeval t0, t1;
+    gettimeofday(& t0, 0);
+    extractor.Begin(analysis);
+    for(int i(0); i < Scanalysis::scansize; ++i)
+      if(analysis.rho[i] < 7.9)
+	extractor.Add(i);
+      else
+	extractor.Break();
+    extractor.End();
+    gettimeofday(& t1, 0);
+    usec += 1e6 * (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec);
+    
+    nsegments += analysis.segment.size();
+    bool found(false);
+    for(size_t k(0); k < analysis.segment.size(); ++k){
+      const LineSegment & seg(* analysis.segment[k]);
+      const double mx(0.5 * (seg.line.X0() + seg.line.X1()));
+      const double my(0.5 * (seg.line.Y0() + seg.line.Y1()));
+      if(sfl::sqr(mx - 2) + sfl::sqr(my - 1.5) < sfl::sqr(0.6)
+	 && (seg.Length() > 0.25))
+	++ncylinder;		// the cylinder was taken for a wall
+      if((seg.Length() < 2) || (sfl::absval(seg.alpha) > 0.2))
+	continue;
+      ++nwall;
+      found = true;
+      maxdalpha = sfl::maxval(maxdalpha, sfl::absval(seg.alpha));
+      maxdr = sfl::maxval(maxdr, sfl::absval(seg.r - 4));
+      sigma_r += sqrt(seg.cov[1][1]);
+    }
+    if(found)
+      ++nfound;
+  }
+  
+  cout << nscans << " scans, " << (double) nsegments / nscans
+       << " segments per scan, " << usec / nscans
+       << " microseconds per scan\n"
+       << "wall at x = 4 found in " << nfound << " scans, "
+       << nwall << " pieces:\n"
+       << "  largest angle error " << maxdalpha << " rad\n"
+       << "  largest offset error " << maxdr << " m\n"
+       << "  mean offset sigma " << (nwall > 0 ? sigma_r / nwall : 0)
+       << " m\n"
+       << "long segments on the cylinder: " << ncylinder << "\n";
+  
+  return ((nfound == nscans) && (0 == ncylinder)) ? 0 : 1;
+}
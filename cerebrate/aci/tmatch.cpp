@@ -0,0 +1,139 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "ScanMatcher.hpp"
+#include "Scanalyzer.hpp"
+#include <sfl/numeric.hpp>
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <stdlib.h>
+#include <sys/time.h>
+
+
+using namespace std;
+
+
+/**
+   Scan of a room with walls at x = 4 and y = -3 and y = 5, and a
+   pillar, taken by a scanner at (sx, sy, stheta) in the room
+   frame. Ranges get up to 1cm of noise, and one in twenty beams hits
+   a person standing close to the scanner.
+*/
+static void synthesize(double sx, double sy, double stheta,
+		       Scanalysis & analysis)
+{
+  for(int i(0); i < Scanalysis::scansize; ++i){
+    const double phi(stheta + M_PI / 2
+		     - (M_PI * i / Scanalysis::scansize));
+    const double cp(cos(phi)), sp(sin(phi));
+    double rho(8.191);
+    if(cp > 1e-3)
+      rho = sfl::minval(rho, (4 - sx) / cp);
+    if(sp < -1e-3)
+      rho = sfl::minval(rho, (-3 - sy) / sp);
+    if(sp > 1e-3)
+      rho = sfl::minval(rho, (5 - sy) / sp);
+    const double xc(2 - sx), yc(1 - sy), rr(0.3);
+    const double b(xc * cp + yc * sp);
+    const double disc(sfl::sqr(b) - sfl::sqr(xc) - sfl::sqr(yc)
+		      + sfl::sqr(rr));
+    if((disc >= 0) && (b - sqrt(disc) > 0))
+      rho = sfl::minval(rho, b - sqrt(disc));
+    if(0 == rand() % 20)
+      rho = sfl::minval(rho, 0.5 + 0.01 * (rand() % 100));
+    rho += 0.01 * ((rand() % 201) - 100) / 100.0;
+    const double local(M_PI / 2 - (M_PI * i / Scanalysis::scansize));
+    analysis.rho[i] = rho;
+    analysis.x[i] = rho * cos(local);
+    analysis.y[i] = rho * sin(local);
+  }
+}
+
+
+int main(int argc,
+	 char ** argv)
+{
+  int nscans(1000);
+  if(argc > 1)
+    istringstream(argv[1]) >> nscans;
+  if(nscans < 1){
+    cerr << "usage: " << argv[0] << " [scans]\n"
+	 << "  Matches synthetic scans from a displaced scanner against\n"
+	 << "  the map taken at the origin.\n";
+    return 1;
+  }
+  
+  srand(42);
+  Scanalysis analysis;
+  synthesize(0, 0, 0, analysis);
+  double mx[Scanalysis::scansize], my[Scanalysis::scansize];
+  int nmap(0);
+  for(int i(0); i < Scanalysis::scansize; ++i)
+    if(analysis.rho[i] < 7.9){
+      mx[nmap] = analysis.x[i];
+      my[nmap] = analysis.y[i];
+      ++nmap;
+    }
+  
+  ScanMatcher matcher(0.02, 0.2, 10, 50);
+  struct timeval t0, t1;
+  gettimeofday(& t0, 0);
+  if( ! matcher.SetMap(nmap, mx, my, 0.2)){
+    cerr << "SetMap() failed\n";
+    return 1;
+  }
+  gettimeofday(& t1, 0);
+  const double usec_map(1e6 * (t1.tv_sec - t0.tv_sec)
+			+ (t1.tv_usec - t0.tv_usec));
+  
+  // The scanner gets bumped by up to 10cm and 3 degrees, and is
+  // tracked from its previous estimate.
+  double usec(0), maxdxy(0), maxdth(0);
+  int nfail(0);
+  sfl::Frame pose;
+  for(int is(0); is < nscans; ++is){
+    const double sx(0.1 * sin(0.01 * is));
+    const double sy(0.05 * cos(0.013 * is));
+    const double st(0.05 * sin(0.007 * is));
+    synthesize(sx, sy, st, analysis);
+    gettimeofday(& t0, 0);
+    const bool ok(matcher.Match(analysis, pose));
+    gettimeofday(& t1, 0);
+    usec += 1e6 * (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec);
+    if( ! ok){
+      ++nfail;
+      continue;
+    }
+    maxdxy = sfl::maxval(maxdxy, sqrt(sfl::sqr(pose.X() - sx)
+				      + sfl::sqr(pose.Y() - sy)));
+    maxdth = sfl::maxval(maxdth, sfl::absval(pose.Theta() - st));
+  }
+  
+  cout << "map of " << nmap << " points built in " << usec_map
+       << " microseconds\n"
+       << nscans << " scans, " << usec / nscans
+       << " microseconds per match, " << nfail << " failures\n"
+       << "largest position error " << maxdxy << " m\n"
+       << "largest heading error " << maxdth << " rad\n";
+  
+  return ((0 == nfail) && (maxdxy < 0.02) && (maxdth < 0.01)) ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "PoseHistory.hpp"
+#include "Odometry.hpp"
+#include <sfl/numeric.hpp>
+#include <iostream>
+#include <fstream>
+#include <new>
+#include <cmath>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+using namespace std;
+
+
+static volatile unsigned long nalloc(0);
+
+void * operator new(size_t size) throw(std::bad_alloc)
+{
+  ++nalloc;
+  void * ptr(malloc(size > 0 ? size : 1));
+  if(0 == ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void * operator new[](size_t size) throw(std::bad_alloc)
+{
+  return operator new(size);
+}
+
+void operator delete(void * ptr) throw()
+{
+  free(ptr);
+}
+
+void operator delete[](void * ptr) throw()
+{
+  free(ptr);
+}
+
+
+/** Resident set size in kilobytes. */
+static long rss_kb()
+{
+  ifstream statm("/proc/self/statm");
+  long size, resident;
+  if( ! (statm >> size >> resident))
+    return -1;
+  return resident * (getpagesize() / 1024);
+}
+
+
+static Timestamp simtime(double seconds)
+{
+  const long sec(static_cast<long>(floor(seconds)));
+  return Timestamp(1000000 + sec,
+		   static_cast<long>((seconds - sec) * 1e6));
+}
+
+
+/**
+   The robot drives around a circle of 1m radius at 0.3m/s, seen
+   through odometry that overestimates distances by 1%, and observed
+   without noise.
+*/
+static sfl::Frame truth(double seconds)
+{
+  static const double omega(0.3);
+  const double phi(omega * seconds);
+  return sfl::Frame(cos(phi), sin(phi), sfl::mod2pi(phi + M_PI / 2));
+}
+
+
+int main(int argc,
+	 char ** argv)
+{
+  // Same capacities and rates as Odometry and Cactus: the encoders
+  // come in at 10Hz and the robot gets matched every two seconds,
+  // except for a quarter of an hour of every sixth hour during which
+  // it stays out of sight.
+  static const double odo_period(0.1);
+  static const double match_period(2);
+  static const double match_latency(0.25);
+  static const int nhours(24);
+  static const double wheelbase(0.5);
+  static const double obs_sigma(0.02);
+  static const double obs_sigma_theta(0.05);
+  const double obs_cov[3][3] = {
+    { sfl::sqr(obs_sigma), 0, 0 },
+    { 0, sfl::sqr(obs_sigma), 0 },
+    { 0, 0, sfl::sqr(obs_sigma_theta) } };
+  PoseHistory history(4096, 256);
+  history.Init(simtime(0), sfl::Pose(truth(0)));
+  
+  unsigned long total(0);
+  double maxerr(0);
+  double t(0);
+  double next_match(match_period);
+  cout << "hour  max recent  ancient  rss[kB]  correct mean/max [us]\n";
+  for(int hour(0); hour < nhours; ++hour){
+    const unsigned long hour_alloc(nalloc);
+    double tcorrect(0), tmax(0);
+    int ncorrect(0);
+    size_t maxrecent(0);
+    const double hour_end(3600.0 * (hour + 1));
+    const double blind_end(3600.0 * hour + 900);
+    double err(0);
+    for(/**/; t < hour_end; t += odo_period){
+      static const double dl(1.01 * (0.3 - 0.15 * wheelbase) * odo_period);
+      static const double dr(1.01 * (0.3 + 0.15 * wheelbase) * odo_period);
+      double dx, dy, dtheta, q[3][3];
+      Odometry::Step(dl, dr, wheelbase, dx, dy, dtheta, q);
+      history.Append(simtime(t + odo_period), dx, dy, dtheta, q);
+      if(history.GetNRecent() > maxrecent)
+	maxrecent = history.GetNRecent();
+      if(t + odo_period < next_match)
+	continue;
+      next_match += match_period;
+      if((0 == hour % 6) && (t < blind_end))
+	continue;
+      const double tobs(t - match_latency);
+      const sfl::Frame obs(truth(tobs));
+      const Timestamp t0(Timestamp::Now());
+      history.Correct(simtime(tobs),
+		      PoseHistory::observation(obs.X(), obs.Y(),
+					       true, obs.Theta(), obs_cov));
+      const double dt((Timestamp::Now() - t0).ConvertToSeconds());
+      tcorrect += dt;
+      if(dt > tmax)
+	tmax = dt;
+      ++ncorrect;
+      const sfl::Frame & pose(history.GetCurrent().global);
+      const sfl::Frame now(truth(t + odo_period));
+      err = sqrt(sfl::sqr(pose.X() - now.X()) + sfl::sqr(pose.Y() - now.Y()));
+    }
+    // Only the latest error of each hour counts, the filter takes a
+    // few matches to catch up after a blind spell.
+    if(err > maxerr)
+      maxerr = err;
+    if(hour > 0)
+      total += nalloc - hour_alloc;
+    cout << hour << "\t" << maxrecent
+	 << "\t" << history.GetNAncient()
+	 << "\t" << rss_kb()
+	 << "\t" << 1e6 * tcorrect / ncorrect << " / " << 1e6 * tmax << "\n";
+  }
+  cout << total << " allocations after the first hour\n"
+       << "largest error at the end of an hour " << maxerr << " m\n";
+  return ((0 == total) && (maxerr < 0.04)) ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "Tracker.hpp"
+#include "Scanalyzer.hpp"
+#include <sfl/numeric.hpp>
+#include <iostream>
+#include <cmath>
+#include <stdlib.h>
+
+
+using namespace std;
+using namespace sfl;
+
+
+static double gauss()
+{
+  const double u1((rand() + 1.0) / (RAND_MAX + 2.0));
+  const double u2((rand() + 1.0) / (RAND_MAX + 2.0));
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+
+static Timestamp simtime(double seconds)
+{
+  const long sec(static_cast<long>(floor(seconds)));
+  return Timestamp(1000000 + sec,
+		   static_cast<long>((seconds - sec) * 1e6));
+}
+
+
+/** Append a single-beam cluster at (x, y), return its label. */
+static int detect(Scanalysis & scan, double x, double y)
+{
+  const size_t index(scan.startindex.size());
+  scan.x[index] = x;
+  scan.y[index] = y;
+  scan.startindex.push_back(index);
+  scan.endindex.push_back(index);
+  return static_cast<int>(index);
+}
+
+
+/** The track associated with the given cluster, or 0. */
+static const Track * associated(const Tracker & tracker, int label)
+{
+  for(size_t is(0); is < tracker.GetCapacity(); ++is){
+    const Track * track(tracker.GetTrack(is));
+    if((0 != track) && (label == track->label))
+      return track;
+  }
+  return 0;
+}
+
+
+int main(int argc,
+	 char ** argv)
+{
+  // Two people walk across the scene at ten scans per second, seen
+  // with five centimetres of noise. A third one stands still and
+  // leaves after three seconds, and at t=2s the first one is seen
+  // once a metre and a half off. Clutter pops up for two scans at
+  // a time. Same parameters as the Localizer.
+  static const double period(0.1);
+  static const double duration(10);
+  static const double sigma(0.05);
+  static const double leave(3);
+  static const double glitch(2);
+  static const int confirm_hits(3);
+  static const int max_misses(15);
+  
+  Tracker tracker(32, 9.21, 2, sigma, confirm_hits, max_misses);
+  Scanalysis scan;
+  
+  const double avx(0.5), avy(0.2), bvx(-0.3), bvy(0.4);
+  int aid(-1), bid(-1), cid(-1);
+  int nswitch(0), nglitch(0), nconfirm_early(0), nclutter(0);
+  int cgone(-1);
+  double sum_verr(0), sum_avx(0), sum_avy(0), sum_bvx(0), sum_bvy(0);
+  int nverr(0);
+  const int nsteps(static_cast<int>(duration / period + 0.5));
+  for(int step(0); step < nsteps; ++step){
+    const double t(step * period);
+    scan.startindex.clear();
+    scan.endindex.clear();
+    scan.t0 = simtime(t);
+    scan.t1 = scan.t0;
+    
+    const bool aglitch(step == static_cast<int>(glitch / period + 0.5));
+    const int alabel(detect(scan,
+			    2 + avx * t + gauss() * sigma
+			    + (aglitch ? 1.5 : 0),
+			    -1 + avy * t + gauss() * sigma));
+    const int blabel(detect(scan,
+			    5 + bvx * t + gauss() * sigma,
+			    -2 + bvy * t + gauss() * sigma));
+    const bool chere(t < leave);
+    const int clabel(chere
+		     ? detect(scan, 6 + gauss() * sigma, 3 + gauss() * sigma)
+		     : -1);
+    const bool clutter(2 > step % 10);
+    const int nlabel(clutter
+		     ? detect(scan, -3 + 0.5 * (step / 10), 4)
+		     : -1);
+    
+    tracker.Update(scan);
+    
+    // association and id stability of the walkers
+    const Track * ta(associated(tracker, alabel));
+    const Track * tb(associated(tracker, blabel));
+    if(aglitch){
+      if((0 != ta) && (ta->id == aid))
+	++nglitch;
+    }
+    else if((0 != ta) && (aid >= 0) && (ta->id != aid))
+      ++nswitch;
+    if((0 != tb) && (bid >= 0) && (tb->id != bid))
+      ++nswitch;
+    if(0 == step){
+      aid = ta->id;
+      bid = tb->id;
+      cid = associated(tracker, clabel)->id;
+    }
+    
+    // confirmation after confirm_hits scans
+    if(step < confirm_hits - 1){
+      if((0 != tracker.FindTrack(aid)) || (0 != tracker.FindTrack(cid)))
+	++nconfirm_early;
+    }
+    else if((0 == tracker.FindTrack(bid)) || (chere
+					      && (0 == tracker.FindTrack(cid))))
+      ++nconfirm_early;
+    
+    // clutter never lives long enough to get confirmed
+    if(clutter){
+      const Track * tn(associated(tracker, nlabel));
+      if((0 != tn) && tn->confirmed)
+	++nclutter;
+    }
+    
+    // deletion of the one who left
+    if(( ! chere) && (cgone < 0) && (0 == tracker.FindTrack(cid)))
+      cgone = step - static_cast<int>(leave / period + 0.5) + 1;
+    
+    // velocity estimates once settled
+    if((t > 5) && (0 != ta) && (0 != tb)){
+      sum_verr += sqr(ta->vx - avx) + sqr(ta->vy - avy);
+      sum_verr += sqr(tb->vx - bvx) + sqr(tb->vy - bvy);
+      sum_avx += ta->vx;
+      sum_avy += ta->vy;
+      sum_bvx += tb->vx;
+      sum_bvy += tb->vy;
+      ++nverr;
+    }
+  }
+  
+  // The filter follows people who change their minds, so single
+  // estimates are noisy, but they must not be biased.
+  const double rms_verr(sqrt(sum_verr / (2 * nverr)));
+  const double bias(max(sqrt(sqr(sum_avx / nverr - avx)
+			     + sqr(sum_avy / nverr - avy)),
+			sqrt(sqr(sum_bvx / nverr - bvx)
+			     + sqr(sum_bvy / nverr - bvy))));
+  cout << "velocity error rms: " << rms_verr << " m/s, bias "
+       << bias << " m/s\n"
+       << nswitch << " id switches, " << nglitch << " glitches associated, "
+       << nconfirm_early << " confirmation errors, "
+       << nclutter << " clutter tracks confirmed\n"
+       << "track deleted after " << cgone << " missed scans\n";
+  if((bias > 0.05) || (rms_verr > 1))
+    return 1;
+  if((0 != nswitch) || (0 != nglitch) || (0 != nconfirm_early)
+     || (0 != nclutter))
+    return 1;
+  if(max_misses + 1 != cgone)
+    return 1;
+  return 0;
+}
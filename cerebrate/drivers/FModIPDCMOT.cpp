@@ -22,6 +22,7 @@
 #include <drivers/fmod_util.h>
 #include <drivers/fmod_ipdcmot.h>
 #include <drivers/util.h>
+#include <drivers/periodic.h>
 #include <sfl/numeric.hpp>
 #include <pthread.h>
 #include <errno.h>
@@ -36,9 +37,26 @@ struct FModIPDCMOT_wrap_s {
   bool stop;
   bool ok;
   pthread_t * thread;
+  struct periodic_s periodic;
+  
+  /** Written by the motor thread only, see push_sample(). */
+  FModIPDCMOT::sample_s sample[FModIPDCMOT::nsamples];
+  volatile uint32_t nsamples;
 };
 
 
+/** Midpoint between sending a request at t0 and its reply at t1. */
+static void stamp_midpoint(const struct timeval & t0,
+			   const struct timeval & t1,
+			   struct timeval & mid)
+{
+  long usec((t1.tv_sec - t0.tv_sec) * 1000000L + t1.tv_usec - t0.tv_usec);
+  usec = t0.tv_usec + usec / 2;
+  mid.tv_sec = t0.tv_sec + usec / 1000000L;
+  mid.tv_usec = usec % 1000000L;
+}
+
+
 FModIPDCMOT::
 FModIPDCMOT(struct fmod_s * fs, unsigned int usec_cycle,
 	    int32_t speed_increment):
@@ -52,6 +70,13 @@ FModIPDCMOT(struct fmod_s * fs, unsigned int usec_cycle,
   _wrap->stop = false;
   _wrap->ok = false;
   _wrap->thread = new pthread_t();
+  char name[32];
+  snprintf(name, sizeof(name), "ipdcmot fd %d", fs->fd);
+  periodic_init( & _wrap->periodic, name, usec_cycle);
+  _wrap->nsamples = 0;
+  timerclear( & _real_speed_stamp);
+  timerclear( & _position_stamp);
+  timerclear( & _command_stamp);
 
   ForceSpeed(0);
   StartThread();
@@ -64,6 +89,7 @@ FModIPDCMOT::
   fmod_ipdcmot_wmode(_wrap->fs, FMOD_IPDCMOT_BRAKE);
 
   StopThread();
+  periodic_fini( & _wrap->periodic);
   
   tcp_close(_wrap->fs->fd);
   fmod_delete(_wrap->fs);
@@ -147,24 +173,99 @@ GetCommand()
 }
 
 
+const struct timeval & FModIPDCMOT::
+GetPositionStamp()
+  const
+{
+  return _position_stamp;
+}
+
+
+const struct timeval & FModIPDCMOT::
+GetRealSpeedStamp()
+  const
+{
+  return _real_speed_stamp;
+}
+
+
+const struct timeval & FModIPDCMOT::
+GetCommandStamp()
+  const
+{
+  return _command_stamp;
+}
+
+
 bool FModIPDCMOT::
 UpdateRealSpeed()
 {
-  return (FMOD_OK == fmod_ipdcmot_rspeed(_wrap->fs, & _real_speed));
+  struct timeval t0, t1;
+  gettimeofday( & t0, 0);
+  const int result(fmod_ipdcmot_rspeed(_wrap->fs, & _real_speed));
+  gettimeofday( & t1, 0);
+  stamp_midpoint(t0, t1, _real_speed_stamp);
+  return (FMOD_OK == result);
 }
 
 
 bool FModIPDCMOT::
 UpdatePosition()
 {
-  return (FMOD_OK == fmod_ipdcmot_rpos(_wrap->fs, & _position));
+  struct timeval t0, t1;
+  gettimeofday( & t0, 0);
+  const int result(fmod_ipdcmot_rpos(_wrap->fs, & _position));
+  gettimeofday( & t1, 0);
+  stamp_midpoint(t0, t1, _position_stamp);
+  return (FMOD_OK == result);
 }
 
 
 bool FModIPDCMOT::
 UpdateCommand()
 {
-  return (FMOD_OK == fmod_ipdcmot_rcom(_wrap->fs, & _command));
+  struct timeval t0, t1;
+  gettimeofday( & t0, 0);
+  const int result(fmod_ipdcmot_rcom(_wrap->fs, & _command));
+  gettimeofday( & t1, 0);
+  stamp_midpoint(t0, t1, _command_stamp);
+  return (FMOD_OK == result);
+}
+
+
+uint32_t FModIPDCMOT::
+GetNSamples()
+  const
+{
+  return _wrap->nsamples;
+}
+
+
+size_t FModIPDCMOT::
+ReadSamples(uint32_t & index, sample_s * samples, size_t max)
+  const
+{
+  const uint32_t head(_wrap->nsamples);
+  __sync_synchronize();
+  if(head - index > nsamples)
+    index = head - nsamples;
+  size_t count(head - index);
+  if(count > max)
+    count = max;
+  for(size_t ii(0); ii < count; ++ii)
+    samples[ii] = _wrap->sample[(index + ii) % nsamples];
+  __sync_synchronize();
+  
+  // The writer might have lapped us while copying: sample number n
+  // is gone as soon as it starts on n + nsamples.
+  const uint32_t oldest(_wrap->nsamples - nsamples + 1);
+  size_t skip(0);
+  while((skip < count) && (static_cast<int32_t>(index + skip - oldest) < 0))
+    ++skip;
+  for(size_t ii(skip); ii < count; ++ii)
+    samples[ii - skip] = samples[ii];
+  index += count;
+  return count - skip;
 }
 
 
@@ -184,16 +285,32 @@ GetRunning()
 }
 
 
+static void push_sample(struct FModIPDCMOT_wrap_s * wrap)
+{
+  FModIPDCMOT::sample_s &
+    sample(wrap->sample[wrap->nsamples % FModIPDCMOT::nsamples]);
+  sample.stamp = wrap->that->GetPositionStamp();
+  sample.position = wrap->that->GetPosition();
+  sample.speed = wrap->that->GetRealSpeed();
+  __sync_synchronize();
+  ++wrap->nsamples;
+}
+
+
 extern "C" {
   static void * thread_run(struct FModIPDCMOT_wrap_s * wrap)
   {
     wrap->stop = false;
+    periodic_start( & wrap->periodic, stderr);
     while( ! wrap->stop){
       wrap->ok = wrap->that->UpdateCurrentWantedSpeed();
       wrap->ok = wrap->that->UpdatePosition();
-      wrap->ok = wrap->that->UpdateCommand();
+      const bool have_position(wrap->ok);
       wrap->ok &= wrap->that->UpdateRealSpeed();
-      usleep(wrap->usec_cycle);
+      if(have_position)
+	push_sample(wrap);
+      wrap->ok &= wrap->that->UpdateCommand();
+      periodic_wait( & wrap->periodic);
     }
     wrap->stop = false;
     return wrap;
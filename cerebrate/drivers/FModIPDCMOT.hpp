@@ -23,6 +23,8 @@
 
 
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
 
 
 class FModIPDCMOT
@@ -33,6 +35,20 @@ protected:
   
 public:
   static const int32_t max_command = 0x00007FFF;
+  
+  /**
+     One reading of the encoder, stamped halfway between sending the
+     request and receiving the response. The speed is read right
+     after the position.
+  */
+  struct sample_s {
+    struct timeval stamp;
+    int32_t position;
+    int32_t speed;
+  };
+  
+  /** Number of samples kept, older ones get overwritten. */
+  static const uint32_t nsamples = 64;
 
   ~FModIPDCMOT();
   
@@ -51,6 +67,24 @@ public:
   int32_t GetWantedSpeed() const;
   int32_t GetPosition() const;
   int32_t GetCommand() const;
+  
+  /** Midpoints of the requests behind GetPosition() etc. */
+  const struct timeval & GetPositionStamp() const;
+  const struct timeval & GetRealSpeedStamp() const;
+  const struct timeval & GetCommandStamp() const;
+  
+  /** Number of samples taken so far, the index of the next one. */
+  uint32_t GetNSamples() const;
+  
+  /**
+     Copy the samples from index on into samples, at most max of
+     them, and advance index past them. Samples that the motor thread
+     has already overwritten are skipped. Lock-free, but for a single
+     reader.
+     
+     \return The number of samples copied.
+  */
+  size_t ReadSamples(uint32_t & index, sample_s * samples, size_t max) const;
 
   bool UpdateCurrentWantedSpeed();
   bool UpdateRealSpeed();
@@ -69,6 +103,9 @@ private:
   int32_t _position;
   int32_t _command;
   int32_t _speed_increment;
+  struct timeval _real_speed_stamp;
+  struct timeval _position_stamp;
+  struct timeval _command_stamp;
 };
 
 #endif // FMOD_IPDCMOT_HPP
@@ -22,6 +22,7 @@
 #include <drivers/fmod_util.h>
 #include <drivers/fmod_tcp.h>
 #include <drivers/util.h>
+#include <drivers/periodic.h>
 #include <pthread.h>
 #include <errno.h>
 #include <iostream>
@@ -36,6 +37,7 @@ struct FModTCP_wrap_s {
   bool stop;
   bool ok;
   pthread_t * thread;
+  struct periodic_s periodic;
   FILE * dbg;
 };
 
@@ -52,6 +54,9 @@ FModTCP(struct fmod_s * fs, unsigned int usec_cycle, unsigned int max_errcount)
   _wrap->stop = false;
   _wrap->ok = false;
   _wrap->thread = new pthread_t();
+  char name[32];
+  snprintf(name, sizeof(name), "fmod tcp fd %d", fs->fd);
+  periodic_init( & _wrap->periodic, name, usec_cycle);
   _wrap->dbg = _dbg;
 
   fmod_tcp_wio(_wrap->fs, 0, 0, 0);
@@ -66,6 +71,7 @@ FModTCP::
   fmod_tcp_wio(_wrap->fs, 0, 0, 0);
   
   StopThread();
+  periodic_fini( & _wrap->periodic);
   
   tcp_close(_wrap->fs->fd);
   fmod_delete(_wrap->fs);
@@ -144,6 +150,7 @@ extern "C" {
   {
     wrap->errcount = 0;
     wrap->stop = false;
+    periodic_start( & wrap->periodic, wrap->dbg);
     while( ! wrap->stop){
       uint8_t io;
       if(FMOD_OK != fmod_tcp_rio(wrap->fs, 0, & io, wrap->dbg))
@@ -159,7 +166,7 @@ extern "C" {
 	if(wrap->errcount > wrap->max_errcount)
 	  wrap->ok = false;
       }
-      usleep(wrap->usec_cycle);
+      periodic_wait( & wrap->periodic);
     }
     wrap->stop = false;
     return wrap;
@@ -19,7 +19,9 @@
 
 
 #include <drivers/sick.h>
+#include <drivers/sicklog.h>
 #include <drivers/util.h>
+#include <drivers/trace.h>
 #include <util/Timestamp.hpp>
 #include <iostream>
 #include <fstream>
@@ -54,7 +56,11 @@ int main(int argc,
     }
   }
   
+  trace_start(stderr);
+  
   struct sick_poster_s * sp(0);
+  struct sick_log_s * log(0);
+  unsigned int sp_count(0);
   int fd(serial_open(comport.c_str(), baudrate));
   if(fd < 0){
     cerr << "ERROR: serial_open() returned " << fd << "\n";
@@ -71,25 +77,21 @@ int main(int argc,
     switch (eingabe){
       
     case 'b':
-      cout << "input new baudrate (9600 / 38400 / 500000): ";
+      cout << "input new baudrate (9600 / 19200 / 38400 / 500000): ";
       if( ! (cin >> baudrate)){
 	cerr << "ERROR: couldn't read baudrate.\n";
 	break;
       }
-      if( ! ((baudrate == 9600L)
-	     || (baudrate == 38400L)
-	     || (baudrate == 500000L))){
-	cout << "wrong baudrate, you stupid! setting baudrate to 9600...\n";
-	baudrate = 9600L;
-      }
-      if(baudrate == 500000L)
-	baudrate = 921600L;
-      if(serial_close(fd) != 0)
-	cout << "WARNING: serial_close() failed.\n";
-      fd = serial_open(comport.c_str(), baudrate);
-      if(fd < 0){
-	cerr << "ERROR: serial_open() returned " << fd << "\n";
-	return 1;
+      {
+	unsigned long have;
+	result = sick_negotiate(fd, baudrate, & have, stdout);
+	if(result < 0)
+	  cout << "WARNING: sick_negotiate() returned " << result << "\n";
+	else{
+	  if(result > 0)
+	    cout << "WARNING: scanner stays at " << have << " baud\n";
+	  baudrate = have;
+	}
       }
       break;
       
@@ -138,9 +140,13 @@ int main(int argc,
       }
       break;
       
+    case 'o':
     case 'p':
       if(0 == sp){
-	sp = sick_poster_new(fd, 1000, stderr);
+	if('o' == eingabe)
+	  sp = sick_poster_new_stream(fd, stderr);
+	else
+	  sp = sick_poster_new(fd, 1000, stderr);
 	if(0 == sp){
 	  cout << "ERROR: sick_poster_new() failed.\n";
 	  break;
@@ -151,26 +157,56 @@ int main(int argc,
 	}
       }
       struct sick_scan_s scan;
-      if(0 != sick_poster_getscan(sp, & scan)){
-	cout << "ERROR: sick_poster_getscan() failed.\n";
+      result = sick_poster_nextscan(sp, & scan, & sp_count, 1000000);
+      if(0 != result){
+	cout << "ERROR: sick_poster_nextscan() returned " << result << "\n";
 	break;
       }
+      cout << "scan #" << sp_count << " ";
       cout << "stamps: (" << Timestamp(scan.t0)
 	   << ", " << Timestamp(scan.t1) << ")";
       for(int i(0); i < 361; ++i)
 	cout << " " << i << "\t" << scan.rho[i] << "\n";
       break;
       
+    case 'r':
+      {
+	string fname;
+	if( ! (cin >> fname)){
+	  cout << "error reading filename, won't record\n";
+	  break;
+	}
+	if(0 == sp){
+	  cout << "start a poster first\n";
+	  break;
+	}
+	struct sick_log_s * newlog(0);
+	if("-" != fname){
+	  newlog = sick_log_create(fname.c_str(), stderr);
+	  if(0 == newlog){
+	    cout << "error opening \"" << fname << "\", won't record.\n";
+	    break;
+	  }
+	}
+	sick_poster_record(sp, newlog);
+	if(0 != log)
+	  sick_log_close(log);
+	log = newlog;
+      }
+      break;
+      
     case 'h':
       cout << "\n\nSICK Configuration Program\n"
 	   << "--------------------------\n"
 	   << "  e            exit\n"
 	   << "  h            help (this menu)\n\n"
-	   << "  b            change baudrate\n"
+	   << "  b            change scanner and serial baudrate\n"
 	   << "  c            change comport\n"
 	   << "  s            check sick status\n"
 	   << "  m <filename> make single scan\n"
-	   << "  p            poster baby!\n";
+	   << "  p            poster baby!\n"
+	   << "  o            streaming poster\n"
+	   << "  r <filename> record poster scans (- to stop)\n";
     }
     
     cout << "[" << comport << ":" << baudrate << "baud]> ";
@@ -182,9 +218,12 @@ int main(int argc,
       cout << "WARNING: sick_poster_stop() failed.\n";
     sick_poster_delete(sp);
   }
+  if(0 != log)
+    sick_log_close(log);
   
   if(serial_close(fd) != 0)
     cout << "WARNING: serial_close() failed.\n";
   
+  trace_stop();
   return 0;
 }
@@ -0,0 +1,80 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "enclog.h"
+#include <stdlib.h>
+
+
+struct enc_log_s * enc_log_create(const char * fname, FILE * dbg)
+{
+  struct enc_log_s * log = calloc(1, sizeof(* log));
+  if(0 == log)
+    return 0;
+  if(0 != rec_log_create(& log->rec, fname, ENC_LOG_MAGIC,
+			 sizeof(struct enc_record_s), dbg)){
+    free(log);
+    return 0;
+  }
+  return log;
+}
+
+
+struct enc_log_s * enc_log_open(const char * fname, FILE * dbg)
+{
+  struct enc_log_s * log = calloc(1, sizeof(* log));
+  if(0 == log)
+    return 0;
+  if(0 != rec_log_open(& log->rec, fname, ENC_LOG_MAGIC,
+		       sizeof(struct enc_record_s), dbg)){
+    free(log);
+    return 0;
+  }
+  log->record = log->rec.record;
+  return log;
+}
+
+
+void enc_log_close(struct enc_log_s * log)
+{
+  rec_log_close(& log->rec);
+  free(log);
+}
+
+
+int enc_log_append(struct enc_log_s * log, const struct timeval * t,
+		   double left, double right)
+{
+  struct enc_record_s rec;
+  
+  rec.t_sec = t->tv_sec;
+  rec.t_usec = t->tv_usec;
+  rec.left = left;
+  rec.right = right;
+  
+  return rec_log_append(& log->rec, & rec);
+}
+
+
+unsigned long enc_log_find(const struct enc_log_s * log,
+			   const struct timeval * t)
+{
+  return rec_log_find(& log->rec, t);
+}
@@ -0,0 +1,84 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifndef ENCLOG_H
+#define ENCLOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include "reclog.h"
+  
+  
+  /** The file starts with these eight bytes. */
+#define ENC_LOG_MAGIC "ENCLOG01"
+  
+  
+  /**
+     On-disk record of the two wheel encoders at one moment, in host
+     byte order. The positions are in encoder ticks, fractional where
+     one wheel got interpolated to the sample time of the other.
+  */
+  struct enc_record_s {
+    uint32_t t_sec, t_usec;
+    double left, right;
+  };
+  
+#define ENC_LOG_HEADER REC_LOG_HEADER
+  
+  
+  /**
+     Binary encoder log: a reclog.h file with enc_record_s as its
+     record layout. When opened for reading, record points at the
+     first one, and the number of records is rec.count.
+  */
+  struct enc_log_s {
+    struct rec_log_s rec;
+    const struct enc_record_s * record;
+  };
+  
+  
+  /** Open a log for appending, see rec_log_create(). */
+  struct enc_log_s * enc_log_create(const char * fname, FILE * dbg);
+  
+  /** Open a log for reading, see rec_log_open(). */
+  struct enc_log_s * enc_log_open(const char * fname, FILE * dbg);
+  
+  void enc_log_close(struct enc_log_s * log);
+  
+  /** \return 0 on success, -1 if the log is read-only, -2 on errors. */
+  int enc_log_append(struct enc_log_s * log, const struct timeval * t,
+		     double left, double right);
+  
+  /**
+     \return The index of the first record not before the given time,
+     which is log->rec.count if there is none.
+  */
+  unsigned long enc_log_find(const struct enc_log_s * log,
+			     const struct timeval * t);
+  
+  
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // ENCLOG_H
@@ -20,6 +20,7 @@
 
 #include "util.h"
 #include "fmod_util.h"
+#include "trace.h"
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
@@ -29,8 +30,48 @@
 #include <netinet/in.h>
 
 
-//#define FMOD_UTIL_DEBUG_CRC
-#undef FMOD_UTIL_DEBUG_CRC
+uint32_t fmod_sum16(const uint8_t * packet,
+		    uint16_t nwords)
+{
+  static const uint64_t mask = 0x00FF00FF00FF00FFULL;
+  uint32_t hi = 0, lo = 0;
+  
+  // Add up the even and the odd bytes separately, eight at a time,
+  // in 16 bit lanes of a 64 bit word. A lane can take 257 bytes
+  // before it overflows, so fold them every 256 rounds.
+  while(nwords >= 4){
+    uint64_t even = 0, odd = 0, x;
+    int nrounds = nwords / 4;
+    if(nrounds > 256)
+      nrounds = 256;
+    nwords -= 4 * nrounds;
+    while(nrounds-- > 0){
+      memcpy(& x, packet, 8);
+      even += x & mask;
+      odd += (x >> 8) & mask;
+      packet += 8;
+    }
+    even = (even & 0xFFFF) + ((even >> 16) & 0xFFFF)
+      + ((even >> 32) & 0xFFFF) + (even >> 48);
+    odd = (odd & 0xFFFF) + ((odd >> 16) & 0xFFFF)
+      + ((odd >> 32) & 0xFFFF) + (odd >> 48);
+    if(htons(1) == 1){
+      hi += odd;
+      lo += even;
+    }
+    else{
+      hi += even;
+      lo += odd;
+    }
+  }
+  while(nwords-- > 0){
+    hi += packet[0];
+    lo += packet[1];
+    packet += 2;
+  }
+  
+  return (hi << 8) + lo;
+}
 
 
 void fmod_crc(uint8_t * packet,
@@ -38,57 +79,21 @@ void fmod_crc(uint8_t * packet,
 	      uint16_t * crc,
 	      FILE * dbg)
 {
-  uint32_t acc = 0;
-  uint16_t crc0, crc1, i;
-  
-#ifndef FMOD_UTIL_DEBUG_CRC
-  dbg = 0;
-#endif // FMOD_UTIL_DEBUG_CRC
+  uint32_t acc;
+  uint16_t crc0, crc1;
   
-  if(dbg == 0){
-    for(i = 0; i < len / 2; ++i)
-      acc += ntohs(((uint16_t *) packet)[i]) ^ 0x0000FFFF;
-    if(len % 2 != 0)
-      acc += (packet[len - 1] << 8) ^ 0x0000FFFF;
-    crc0 = acc >> 16;
-    crc1 = acc & 0x0000FFFF;
-    acc = crc0 + crc1;
-    if(acc & 0xFFFF0000)
-      ++acc;
-    * crc = htons(acc & 0x0000FFFF);
-  }
-  else{
-    fprintf(dbg, "DEBUG fmod_crc():\n  msg:\n    ");
-    for(i = 0; i < len; ++i)
-      fprintf(dbg, "%02X ", packet[i]);
-    fprintf(dbg, "\n  acc:\n");
-    
-    for(i = 0; i < len / 2; ++i){
-      crc0 = ntohs(((uint16_t *) packet)[i]);
-      acc += crc0 ^ 0x0000FFFF;
-      fprintf(dbg, "    0x%04X -> 0x%08X\n", crc0, acc);
-    }
-    if(len % 2 != 0){
-      //crc0 = ntohs(packet[len - 1] << 8);
-      crc0 = packet[len - 1] << 8;
-      acc += crc0 ^ 0x0000FFFF;
-      fprintf(dbg, "    0x%04X -> 0x%08X\n", crc0, acc);
-    }
-    
-    crc0 = acc >> 16;
-    crc1 = acc & 0x0000FFFF;
-    acc = crc0 + crc1;
-    fprintf(dbg, "  res:\n    0x%04X + 0x%04X = 0x%08X", crc0, crc1, acc);
-    if(acc & 0xFFFF0000){
-      ++acc;
-      fprintf(dbg, " (carry)\n");
-    }
-    else
-      fprintf(dbg, " (no carry)\n");
-    
-    * crc = htons(acc & 0x0000FFFF);
-    fprintf(dbg, "    crc = 0x%04X\n", * crc);
-  }
+  TRACE_HEX(TRACE_VERBOSE, "fmod_crc", packet, len);
+  // Each word contributes its complement 0xFFFF - w.
+  acc = (len / 2) * 0x0000FFFFU - fmod_sum16(packet, len / 2);
+  if(len % 2 != 0)
+    acc += (packet[len - 1] << 8) ^ 0x0000FFFF;
+  crc0 = acc >> 16;
+  crc1 = acc & 0x0000FFFF;
+  acc = crc0 + crc1;
+  if(acc & 0xFFFF0000)
+    ++acc;
+  * crc = htons(acc & 0x0000FFFF);
+  TRACE1(TRACE_VERBOSE, "fmod_crc(): crc = 0x%04lX\n", * crc);
 }
 
 
@@ -177,19 +182,6 @@ int fmod_rreg(struct fmod_s * s,
   // END SYNC
   //////////////////////////////////////////////////
   
-//   fmod_crc(packet, 7 + len, & crc, dbg);
-//   received_crc = ntohs((packet[7 + len] << 8) | (packet[8 + len]));
-//   if(crc != received_crc){
-//       {
-// 	if(dbg != 0)
-// 	  fprintf(dbg,
-// 		  "DEBUG fmod_rreg():\n"
-// 		  "  calculated crc = 0x%04X\n"
-// 		  "  received crc   = 0x%04X\n",
-// 		  crc, received_crc);
-// 	return FMOD_ECRC;
-//       }
-//   }
   if(FMOD_OK != fmod_ckcrc(packet, len + 7, dbg))
     return FMOD_ECRC;
   
@@ -257,19 +249,6 @@ int fmod_wreg(struct fmod_s * s,
   // END SYNC
   //////////////////////////////////////////////////
   
-//   fmod_crc(packet, 6, & crc, dbg);
-//   received_crc = ntohs((packet[6] << 8) | (packet[7]));
-//   if(crc != received_crc){
-//       {
-// 	if(dbg != 0)
-// 	  fprintf(dbg,
-// 		  "DEBUG fmod_wreg():\n"
-// 		  "  calculated crc = 0x%04X\n"
-// 		  "  received crc   = 0x%04X\n",
-// 		  crc, received_crc);
-// 	return FMOD_ECRC;
-//       }
-//   }
   if(FMOD_OK != fmod_ckcrc(packet, 6, dbg))
     return FMOD_ECRC;
   
@@ -363,21 +342,7 @@ int fmod_rreg32(struct fmod_s * s,
     | (((uint32_t) val8[2]) <<  8)
     |  ((uint32_t) val8[3]);
   
-  if(dbg != 0)
-    fprintf(dbg,
-	    "DEBUG fmod_rreg32():\n"
-	    "  val8[] = 0x%02X%02X%02X%02X\n"
-	    "         = 0x%08X\n"
-	    "         + 0x%08X\n"
-	    "         + 0x%08X\n"
-	    "         + 0x%08X\n"
-	    "  val    = 0x%08X\n",
-	    val8[0], val8[1], val8[2], val8[3],
-	    ((uint32_t) val8[0]) << 24,
-	    ((uint32_t) val8[1]) << 16,
-	    ((uint32_t) val8[2]) <<  8,
-	    ((uint32_t) val8[3]),
-	    * val);
+  TRACE2(TRACE_VERBOSE, "fmod_rreg32(): reg 0x%02lX val %ld\n", reg, * val);
   
   return FMOD_OK;
 }
@@ -75,6 +75,12 @@ extern "C" {
   int fmod_wreg32(struct fmod_s * s, uint16_t trid, uint8_t reg,
 		  const int32_t val, FILE * dbg);
 
+  /**
+     The sum of nwords big-endian 16 bit words, computed eight bytes
+     at a time. This is the kernel of fmod_crc().
+  */
+  uint32_t fmod_sum16(const uint8_t * packet, uint16_t nwords);
+  
   void fmod_crc(uint8_t * packet, uint16_t len, uint16_t * crc, FILE * dbg);
   int fmod_ckcrc(uint8_t * packet, uint16_t len, FILE * dbg);
   
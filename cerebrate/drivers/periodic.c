@@ -0,0 +1,296 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifdef LINUX
+# define _GNU_SOURCE		/* pthread_setaffinity_np() */
+#endif // LINUX
+#include "periodic.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct periodic_s * registry = 0;
+static int rt_priority = 0;
+static int rt_cpu = -1;
+
+
+/** \return a - b in microseconds. */
+static long long ts_usec(const struct timespec * a, const struct timespec * b)
+{
+  return (a->tv_sec - b->tv_sec) * 1000000LL
+    + (a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+
+static long long ts_to_usec(const struct timespec * ts)
+{
+  return ts->tv_sec * 1000000LL + ts->tv_nsec / 1000;
+}
+
+
+static void ts_add(struct timespec * ts, const struct timespec * dt,
+		   unsigned long long times)
+{
+  unsigned long long nsec = ts->tv_nsec + dt->tv_nsec * times;
+  ts->tv_sec += dt->tv_sec * times + nsec / 1000000000ULL;
+  ts->tv_nsec = nsec % 1000000000ULL;
+}
+
+
+static void sleep_until(const struct timespec * release)
+{
+#ifdef LINUX
+  while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, release, 0))
+    ;
+#else // LINUX
+  struct timespec now, dt;
+  long long usec;
+  clock_gettime(CLOCK_MONOTONIC, & now);
+  usec = ts_usec(release, & now);
+  if(0 < usec){
+    dt.tv_sec = usec / 1000000;
+    dt.tv_nsec = (usec % 1000000) * 1000;
+    nanosleep(& dt, 0);
+  }
+#endif // LINUX
+}
+
+
+static int jitter_bin(long long usec)
+{
+  int bin = 0;
+  if(usec < 0)
+    usec = -usec;
+  while((0 < usec) && (bin < PERIODIC_NBINS - 1)){
+    usec >>= 1;
+    ++bin;
+  }
+  return bin;
+}
+
+
+int periodic_realtime(int priority, int cpu, int lock_memory, FILE * dbg)
+{
+  rt_priority = priority;
+  rt_cpu = cpu;
+  if(lock_memory && (0 != mlockall(MCL_CURRENT | MCL_FUTURE))){
+    if(0 != dbg)
+      fprintf(dbg, "WARNING in periodic_realtime(): mlockall(): %s\n",
+	      strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+
+void periodic_init(struct periodic_s * task, const char * name,
+		   unsigned long usec_period)
+{
+  memset(task, 0, sizeof(* task));
+  strncpy(task->name, name, sizeof(task->name) - 1);
+  task->period.tv_sec = usec_period / 1000000;
+  task->period.tv_nsec = (usec_period % 1000000) * 1000;
+  
+  pthread_mutex_lock(& registry_mutex);
+  task->registry_next = registry;
+  registry = task;
+  pthread_mutex_unlock(& registry_mutex);
+}
+
+
+void periodic_fini(struct periodic_s * task)
+{
+  struct periodic_s ** pp;
+  pthread_mutex_lock(& registry_mutex);
+  for(pp = & registry; 0 != * pp; pp = & (* pp)->registry_next)
+    if(task == * pp){
+      * pp = task->registry_next;
+      break;
+    }
+  pthread_mutex_unlock(& registry_mutex);
+}
+
+
+int periodic_start(struct periodic_s * task, FILE * dbg)
+{
+  int status = 0;
+  int err;
+  
+  if(0 < rt_priority){
+    struct sched_param param;
+    long long msec = ts_to_usec(& task->period) / 1000;
+    param.sched_priority = rt_priority;
+    for(; 1 < msec; msec >>= 1)
+      if(param.sched_priority > sched_get_priority_min(SCHED_FIFO))
+	--param.sched_priority;
+    err = pthread_setschedparam(pthread_self(), SCHED_FIFO, & param);
+    if(0 != err){
+      status = -1;
+      if(0 != dbg)
+	fprintf(dbg, "WARNING in periodic_start(%s): SCHED_FIFO %d: %s\n",
+		task->name, param.sched_priority, strerror(err));
+    }
+  }
+  
+#ifdef LINUX
+  if(0 <= rt_cpu){
+    cpu_set_t set;
+    CPU_ZERO(& set);
+    CPU_SET(rt_cpu, & set);
+    err = pthread_setaffinity_np(pthread_self(), sizeof(set), & set);
+    if(0 != err){
+      status = -1;
+      if(0 != dbg)
+	fprintf(dbg, "WARNING in periodic_start(%s): cpu %d: %s\n",
+		task->name, rt_cpu, strerror(err));
+    }
+  }
+#endif // LINUX
+  
+  clock_gettime(CLOCK_MONOTONIC, & task->release);
+  task->wakeup = task->release;
+  return status;
+}
+
+
+unsigned long periodic_wait(struct periodic_s * task)
+{
+  const long long usec_period = ts_to_usec(& task->period);
+  struct timespec now;
+  unsigned long long skip;
+  unsigned long missed = 0;
+  long long jitter, latency;
+  
+  clock_gettime(CLOCK_MONOTONIC, & now);
+  if(0 < usec_period){
+    ts_add(& task->release, & task->period, 1);
+    latency = ts_usec(& now, & task->release);
+    if(0 <= latency){
+      // Overran the deadline. Run the next cycle right away, but
+      // drop any releases that went by in the meantime.
+      skip = latency / usec_period;
+      ts_add(& task->release, & task->period, skip);
+      ++task->overruns;
+      task->skipped += skip;
+      missed = 1 + skip;
+    }
+    else{
+      sleep_until(& task->release);
+      clock_gettime(CLOCK_MONOTONIC, & now);
+    }
+  }
+  
+  latency = ts_usec(& now, & task->release);
+  jitter = ts_usec(& now, & task->wakeup) - usec_period;
+  task->wakeup = now;
+  if((0 == task->count) || (jitter < task->jitter_usec_min))
+    task->jitter_usec_min = jitter;
+  if((0 == task->count) || (jitter > task->jitter_usec_max))
+    task->jitter_usec_max = jitter;
+  if((0 < usec_period) && (latency > task->latency_usec_max))
+    task->latency_usec_max = latency;
+  ++task->histogram[jitter_bin(jitter)];
+  ++task->count;
+  
+  return missed;
+}
+
+
+/**
+   Append to the size bytes at buf, from offset len on, like
+   snprintf(). \return The length of the whole text, even if it got
+   cut off.
+*/
+static size_t append(char * buf, size_t size, size_t len,
+		     const char * fmt, ...)
+{
+  va_list ap;
+  int n;
+  
+  va_start(ap, fmt);
+  if(len < size)
+    n = vsnprintf(buf + len, size - len, fmt, ap);
+  else
+    n = vsnprintf(0, 0, fmt, ap);
+  va_end(ap);
+  return (0 < n) ? len + n : len;
+}
+
+
+static size_t format_task(const struct periodic_s * task,
+			  char * buf, size_t size, size_t len)
+{
+  int bin;
+  
+  len = append(buf, size, len, "%s: period %lld usec, %lu cycles,"
+	       " %lu overruns, %lu skipped\n"
+	       "  jitter %ld ... %ld usec, max latency %ld usec\n",
+	       task->name, ts_to_usec(& task->period),
+	       task->count, task->overruns, task->skipped,
+	       task->jitter_usec_min, task->jitter_usec_max,
+	       task->latency_usec_max);
+  for(bin = 0; bin < PERIODIC_NBINS; ++bin)
+    if(0 != task->histogram[bin]){
+      if(0 == bin)
+	len = append(buf, size, len, "    |jitter| < 1 usec");
+      else if(PERIODIC_NBINS - 1 == bin)
+	len = append(buf, size, len, "    |jitter| >= %ld usec",
+		     1L << (bin - 1));
+      else
+	len = append(buf, size, len, "    |jitter| < %ld usec", 1L << bin);
+      len = append(buf, size, len, ": %lu\n", task->histogram[bin]);
+    }
+  return len;
+}
+
+
+size_t periodic_sprint(char * buf, size_t size)
+{
+  struct periodic_s * task;
+  size_t len = 0;
+  
+  if(0 < size)
+    buf[0] = '\0';
+  pthread_mutex_lock(& registry_mutex);
+  for(task = registry; 0 != task; task = task->registry_next)
+    len = format_task(task, buf, size, len);
+  pthread_mutex_unlock(& registry_mutex);
+  return len;
+}
+
+
+void periodic_report(FILE * fp)
+{
+  struct periodic_s * task;
+  char buf[2048];
+  
+  pthread_mutex_lock(& registry_mutex);
+  for(task = registry; 0 != task; task = task->registry_next){
+    format_task(task, buf, sizeof(buf), 0);
+    fputs(buf, fp);
+  }
+  pthread_mutex_unlock(& registry_mutex);
+}
@@ -0,0 +1,126 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifndef PERIODIC_H
+#define PERIODIC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdio.h>
+#include <time.h>
+  
+  
+  /**
+     Number of period-jitter histogram bins. Bin 0 counts periods
+     within a microsecond of nominal, bin k the ones off by
+     [2^(k-1), 2^k) microseconds, and the last bin everything beyond.
+  */
+#define PERIODIC_NBINS 20
+  
+  
+  /**
+     A periodic task: a thread that does some work and then calls
+     periodic_wait(), which sleeps on CLOCK_MONOTONIC until the next
+     absolute release time. Unlike sleeping for a fixed delay after
+     the work, the releases stay on a fixed grid no matter how long
+     the work takes, and don't drift when the wall clock gets set.
+     
+     If the work runs past the next release, that is counted as an
+     overrun, and releases that passed entirely are skipped instead
+     of being made up for in a burst.
+     
+     A period of zero means the task paces itself (e.g. on blocking
+     reads), in which case periodic_wait() returns right away and the
+     histogram shows how long each cycle took.
+     
+     All fields are written by the task's own thread only, so
+     periodic_report() gives approximate figures while it runs.
+  */
+  struct periodic_s {
+    char name[32];
+    struct timespec period, release, wakeup;
+    unsigned long count, overruns, skipped;
+    long jitter_usec_min, jitter_usec_max, latency_usec_max;
+    unsigned long histogram[PERIODIC_NBINS];
+    struct periodic_s * registry_next;
+  };
+  
+  
+  /**
+     Enable real-time scheduling for all tasks that call
+     periodic_start() from now on. Each gets SCHED_FIFO with the given
+     priority, lowered by one for each doubling of its period above a
+     millisecond, so that faster tasks preempt slower ones
+     (rate-monotonic). A non-negative cpu pins the tasks to that
+     processor, and lock_memory calls mlockall() right away, so call
+     this before allocating much. A zero priority leaves the
+     scheduling alone.
+     
+     \return 0 on success, -1 if mlockall() failed (usually for lack
+     of privileges).
+  */
+  int periodic_realtime(int priority, int cpu, int lock_memory, FILE * dbg);
+  
+  /** Register a task with the given period (in microseconds). */
+  void periodic_init(struct periodic_s * task, const char * name,
+		     unsigned long usec_period);
+  
+  /** Unregister a task, its thread must have stopped using it. */
+  void periodic_fini(struct periodic_s * task);
+  
+  /**
+     Called by the task's thread before its first cycle. Applies the
+     periodic_realtime() settings to the calling thread and makes the
+     present moment the first release.
+     
+     \return 0 on success, -1 if a real-time setting was refused, in
+     which case the task runs anyway, just with normal scheduling.
+  */
+  int periodic_start(struct periodic_s * task, FILE * dbg);
+  
+  /**
+     Sleep until the next release, and update the statistics.
+     
+     \return The number of releases that passed during the previous
+     cycle, i.e. 0 if the deadline was met.
+  */
+  unsigned long periodic_wait(struct periodic_s * task);
+  
+  /** Print the statistics of all registered tasks. */
+  void periodic_report(FILE * fp);
+  
+  /**
+     Write the same report as periodic_report() to buf, cutting it off
+     after size - 1 characters like snprintf().
+     
+     \return The length of the whole report, so that a buffer of one
+     more character will hold it.
+  */
+  size_t periodic_sprint(char * buf, size_t size);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // PERIODIC_H
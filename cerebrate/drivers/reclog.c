@@ -0,0 +1,208 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "reclog.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+
+static void rec_log_header(uint8_t header[REC_LOG_HEADER],
+			   const char * magic, size_t size)
+{
+  uint32_t size32 = size;
+  memset(header, 0, REC_LOG_HEADER);
+  memcpy(header, magic, 8);
+  memcpy(header + 8, & size32, 4);
+}
+
+
+int rec_log_create(struct rec_log_s * log,
+		   const char * fname,
+		   const char * magic,
+		   size_t size,
+		   FILE * dbg)
+{
+  uint8_t want[REC_LOG_HEADER], have[REC_LOG_HEADER];
+  struct stat st;
+  int fd;
+  
+  fd = open(fname, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if(fd < 0){
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in rec_log_create(): open(%s): %s\n",
+	      fname, strerror(errno));
+    return -1;
+  }
+  if(0 != fstat(fd, & st)){
+    close(fd);
+    return -1;
+  }
+  
+  rec_log_header(want, magic, size);
+  if(0 == st.st_size){
+    if(REC_LOG_HEADER != write(fd, want, REC_LOG_HEADER)){
+      if(0 != dbg)
+	fprintf(dbg, "ERROR in rec_log_create(): write(): %s\n",
+		strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+  else if((REC_LOG_HEADER != pread(fd, have, REC_LOG_HEADER, 0))
+	  || (0 != memcmp(want, have, REC_LOG_HEADER))){
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in rec_log_create(): bad header in %s\n", fname);
+    close(fd);
+    return -1;
+  }
+  else{
+    // Drop a partial last record left by a crash, otherwise all the
+    // records we append would be misaligned.
+    off_t tail = (st.st_size - REC_LOG_HEADER) % size;
+    if((0 != tail) && (0 != ftruncate(fd, st.st_size - tail))){
+      if(0 != dbg)
+	fprintf(dbg, "ERROR in rec_log_create(): ftruncate(): %s\n",
+		strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+  
+  memset(log, 0, sizeof(* log));
+  log->fd = fd;
+  log->writing = 1;
+  log->size = size;
+  log->dbg = dbg;
+  return 0;
+}
+
+
+int rec_log_open(struct rec_log_s * log,
+		 const char * fname,
+		 const char * magic,
+		 size_t size,
+		 FILE * dbg)
+{
+  uint8_t want[REC_LOG_HEADER];
+  struct stat st;
+  int fd;
+  
+  fd = open(fname, O_RDONLY);
+  if(fd < 0){
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in rec_log_open(): open(%s): %s\n",
+	      fname, strerror(errno));
+    return -1;
+  }
+  if((0 != fstat(fd, & st)) || (REC_LOG_HEADER > st.st_size)){
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in rec_log_open(): %s is too short\n", fname);
+    close(fd);
+    return -1;
+  }
+  
+  memset(log, 0, sizeof(* log));
+  log->fd = fd;
+  log->size = size;
+  log->dbg = dbg;
+  log->mapsize = st.st_size;
+  log->map = mmap(0, log->mapsize, PROT_READ, MAP_SHARED, fd, 0);
+  if(MAP_FAILED == log->map){
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in rec_log_open(): mmap(): %s\n", strerror(errno));
+    log->map = 0;
+    rec_log_close(log);
+    return -1;
+  }
+  
+  rec_log_header(want, magic, size);
+  if(0 != memcmp(want, log->map, REC_LOG_HEADER)){
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in rec_log_open(): bad header in %s\n", fname);
+    rec_log_close(log);
+    return -1;
+  }
+  
+  log->record = (const uint8_t *) log->map + REC_LOG_HEADER;
+  log->count = (log->mapsize - REC_LOG_HEADER) / size;
+  
+  return 0;
+}
+
+
+void rec_log_close(struct rec_log_s * log)
+{
+  if(0 != log->map)
+    munmap(log->map, log->mapsize);
+  close(log->fd);
+  log->map = 0;
+  log->record = 0;
+  log->count = 0;
+  log->fd = -1;
+}
+
+
+int rec_log_append(struct rec_log_s * log,
+		   const void * record)
+{
+  if( ! log->writing)
+    return -1;
+  
+  // O_APPEND makes this atomic with respect to other writers, and a
+  // short write at worst leaves a partial record at the end.
+  if((ssize_t) log->size != write(log->fd, record, log->size)){
+    if(0 != log->dbg)
+      fprintf(log->dbg, "ERROR in rec_log_append(): write(): %s\n",
+	      strerror(errno));
+    return -2;
+  }
+  ++log->count;
+  
+  return 0;
+}
+
+
+unsigned long rec_log_find(const struct rec_log_s * log,
+			   const struct timeval * t)
+{
+  unsigned long lo = 0, hi = log->count, mid;
+  uint32_t stamp[2];
+  
+  if(0 == log->record)
+    return log->count;
+  while(lo < hi){
+    mid = lo + (hi - lo) / 2;
+    memcpy(stamp, (const uint8_t *) log->record + mid * log->size,
+	   sizeof(stamp));
+    if((stamp[0] < (uint32_t) t->tv_sec)
+       || ((stamp[0] == (uint32_t) t->tv_sec)
+	   && (stamp[1] < (uint32_t) t->tv_usec)))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
@@ -0,0 +1,102 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifndef RECLOG_H
+#define RECLOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+  
+  
+  /**
+     Size of the file header: eight bytes of magic followed by the
+     record size, so that files written with a different layout get
+     rejected.
+  */
+#define REC_LOG_HEADER 16
+  
+  
+  /**
+     Binary log of fixed-size records, shared by sicklog.h and
+     enclog.h. All records have the same size and follow the header,
+     so the file is its own index: record i sits at REC_LOG_HEADER +
+     i * size. Every record starts with two uint32_t, the seconds and
+     microseconds of its time stamp, and records are appended in time
+     order, so they can be searched by bisection.
+     
+     Opened for writing by rec_log_create(), where each
+     rec_log_append() is a single write(), or for reading by
+     rec_log_open(), which maps the whole file into memory.
+  */
+  struct rec_log_s {
+    int fd;
+    int writing;
+    void * map;
+    size_t mapsize;
+    const void * record;
+    size_t size;
+    unsigned long count;
+    FILE * dbg;
+  };
+  
+  
+  /**
+     Open a log of records of the given size for appending, creating
+     it if needed. An existing file has to have a matching header,
+     and a partial last record (e.g. after a crash) gets cut off.
+     \return 0 on success, -1 on errors.
+  */
+  int rec_log_create(struct rec_log_s * log, const char * fname,
+		     const char * magic, size_t size, FILE * dbg);
+  
+  /**
+     Open a log for reading, by mapping it into memory. A partial last
+     record gets ignored.
+     \return 0 on success, -1 on errors.
+  */
+  int rec_log_open(struct rec_log_s * log, const char * fname,
+		   const char * magic, size_t size, FILE * dbg);
+  
+  /** Unmap and close, but leave the rec_log_s itself to the caller. */
+  void rec_log_close(struct rec_log_s * log);
+  
+  /** \return 0 on success, -1 if the log is read-only, -2 on errors. */
+  int rec_log_append(struct rec_log_s * log, const void * record);
+  
+  /**
+     \return The index of the first record stamped not before t,
+     which is log->count if there is none.
+  */
+  unsigned long rec_log_find(const struct rec_log_s * log,
+			     const struct timeval * t);
+  
+  
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // RECLOG_H
@@ -25,10 +25,15 @@
 
 
 #include "sick.h"
+#include "sicklog.h"
 #include "util.h"
+#include "trace.h"
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <termios.h>
+#include <unistd.h>
+#include <poll.h>
 
 
 #define GetBytesAsInt(a,b) (256*(b) + (a))
@@ -40,6 +45,86 @@
 #define OPMODE_19200      0x41
 #define OPMODE_9600       0x42
 #define OPMODE_500000     0x48
+#define REPLY_SCAN        0xB0
+#define REPLY_OPMODE      0xA0
+
+/** Length field of a 361-value scan telegram: reply, count, data, status. */
+#define SCAN_LENGTH       726
+
+/** How long sick_recv() waits for a complete telegram. */
+#define SICK_RECV_USEC    2000000
+
+
+/** One step of the SICK CRC register, without the data word. */
+#define SICK_CRC_STEP(crc) ((uint16_t) (((crc) << 1) ^ (0x8005 & -((crc) >> 15))))
+
+
+/**
+   Slice-by-8 tables. sick_crc_table[k][b] is the contribution of a
+   byte b to the register eight bytes later, for a byte at offset
+   k - 1 within a block of eight (k = 0 is the last byte of the
+   previous block, which still shows up as the high byte of the
+   first data word). sick_crc_table[9] advances the register itself
+   by eight steps based on its high byte; the low byte simply gets
+   shifted out of the way without feedback.
+*/
+static uint16_t sick_crc_table[10][256];
+
+
+static void sick_crc_init_table(void)
+{
+  int ii, jj, kk;
+  uint16_t crc;
+  
+  for(ii = 0; ii < 256; ++ii){
+    for(kk = 0; kk < 9; ++kk){
+      // high byte of the word at offset kk, low byte of the word at
+      // offset kk - 1
+      crc = (8 > kk) ? ii << 8 : 0;
+      for(jj = kk; jj < 7; ++jj)
+	crc = SICK_CRC_STEP(crc);
+      if(0 < kk)
+	crc ^= ii << (8 - kk);
+      sick_crc_table[kk][ii] = crc;
+    }
+    crc = ii << 8;
+    for(jj = 0; jj < 8; ++jj)
+      crc = SICK_CRC_STEP(crc);
+    sick_crc_table[9][ii] = crc;
+  }
+}
+
+
+uint16_t sick_crc16(const uint8_t * tgram,
+		   int tlen)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  uint16_t crc = 0;
+  uint16_t prev = 0;
+  
+  pthread_once(& once, sick_crc_init_table);
+  
+  // The register only advances by one bit per byte, so the plain
+  // loop is one long dependency chain. The tables let us advance by
+  // eight bytes with independent lookups.
+  while(tlen >= 8){
+    crc = (crc << 8) ^ sick_crc_table[9][crc >> 8]
+      ^ sick_crc_table[0][prev]
+      ^ sick_crc_table[1][tgram[0]] ^ sick_crc_table[2][tgram[1]]
+      ^ sick_crc_table[3][tgram[2]] ^ sick_crc_table[4][tgram[3]]
+      ^ sick_crc_table[5][tgram[4]] ^ sick_crc_table[6][tgram[5]]
+      ^ sick_crc_table[7][tgram[6]] ^ sick_crc_table[8][tgram[7]];
+    prev = tgram[7];
+    tgram += 8;
+    tlen -= 8;
+  }
+  while(tlen--){
+    crc = SICK_CRC_STEP(crc) ^ (prev << 8) ^ * tgram;
+    prev = * tgram++;
+  }
+  
+  return crc;
+}
 
 
 void sick_crc(uint8_t * tgram,
@@ -49,42 +134,8 @@ void sick_crc(uint8_t * tgram,
 {
   uint16_t uCrc16;
   
-  uCrc16 = 0;
-  crc[0] = 0;
-  if(0 == dbg)
-    while(tlen--){
-      crc[1] = crc[0];
-      crc[0] = * tgram++;
-      if(uCrc16 & 0x8000){
-	uCrc16 = (uCrc16 & 0x7FFF) << 1;
-	uCrc16 ^= 0x8005;
-      }
-      else
-	uCrc16 <<= 1;
-      uCrc16 ^= ((uint16_t) crc[0]) | ((uint16_t) crc[1] << 8);
-    }
-  else{
-    int counter = 0;
-    fprintf(dbg, "DEBUG sick_crc():\n ");
-    while(tlen--){
-      crc[1] = crc[0];
-      crc[0] = * tgram++;
-      fprintf(dbg, " %02X", crc[0]);
-      if(counter % 4 == 3)
-	fprintf(dbg, "  ");
-      if(counter % 16 == 15)
-	fprintf(dbg, "\n ");
-      counter++;
-      if(uCrc16 & 0x8000){
-	uCrc16 = (uCrc16 & 0x7FFF) << 1;
-	uCrc16 ^= 0x8005;
-      }
-      else
-	uCrc16 <<= 1;
-      uCrc16 ^= ((uint16_t) crc[0]) | ((uint16_t) crc[1] << 8);
-    }
-    fprintf(dbg, "\n");
-  }
+  TRACE_HEX(TRACE_VERBOSE, "sick_crc", tgram, tlen);
+  uCrc16 = sick_crc16(tgram, tlen);
   
   crc[0] = uCrc16 & 0xFF;
   crc[1] = (uCrc16 >> 8) & 0xFF;
@@ -165,13 +216,201 @@ int sick_rack(int fd,
 }
 
 
+void sick_parser_init(struct sick_parser_s * pp,
+		      uint8_t hadr,
+		      int strict)
+{
+  memset(pp, 0, sizeof(* pp));
+  pp->hadr = hadr;
+  pp->strict = strict;
+  pp->want = 4;
+}
+
+
+/**
+   Throw away the first skip bytes of the buffer and then everything
+   up to the next STX. Counts as one resync.
+*/
+static void sick_parser_drop(struct sick_parser_s * pp,
+			     int skip)
+{
+  const uint8_t * stx;
+  if(skip < pp->len){
+    stx = memchr(pp->buf + skip, STX, pp->len - skip);
+    if(0 == stx)
+      skip = pp->len;
+    else
+      skip = stx - pp->buf;
+  }
+  else
+    skip = pp->len;
+  
+  pp->len -= skip;
+  pp->skipped += skip;
+  ++pp->resyncs;
+  if(0 < pp->len){
+    memmove(pp->buf, pp->buf + skip, pp->len);
+    pp->t0 = pp->tfeed;
+  }
+}
+
+
+/**
+   Run the state machine over the buffered bytes: hunt for STX, check
+   HADR and the length, and finally the CRC. Leaves pp->want at the
+   number of bytes that the current state needs.
+   
+   \return 1 if a telegram is ready, -1 if a telegram had to be
+   discarded because of its CRC in strict mode, 0 otherwise.
+*/
+static int sick_parser_scan(struct sick_parser_s * pp)
+{
+  int length;
+  
+  for(;;){
+    pp->want = 4;
+    if(0 == pp->len)
+      return 0;
+    if(STX != pp->buf[0]){
+      sick_parser_drop(pp, 0);
+      continue;
+    }
+    if(2 > pp->len)
+      return 0;
+    if(pp->hadr != pp->buf[1]){
+      sick_parser_drop(pp, 1);
+      continue;
+    }
+    if(4 > pp->len)
+      return 0;
+    length = 6 + GetBytesAsInt(pp->buf[2], pp->buf[3]);
+    if(SICK_MAXTGRAM < length){
+      sick_parser_drop(pp, 1);
+      continue;
+    }
+    pp->want = length;
+    if(length > pp->len)
+      return 0;
+    if(sick_chkcrc(pp->buf, length - 2, pp->buf + length - 2, 0) != 0){
+      ++pp->crc_errors;
+      sick_parser_drop(pp, 1);
+      if(pp->strict)
+	return -1;
+      continue;
+    }
+    ++pp->frames;
+    pp->ready = 1;
+    return 1;
+  }
+}
+
+
+int sick_parser_feed(struct sick_parser_s * pp,
+		     const uint8_t * data,
+		     int n)
+{
+  int room;
+  
+  gettimeofday(& pp->tfeed, 0);
+  if(pp->ready){
+    pp->len -= pp->want;
+    memmove(pp->buf, pp->buf + pp->want, pp->len);
+    pp->ready = 0;
+    pp->t0 = pp->tfeed;
+  }
+  if(0 == pp->len)
+    pp->t0 = pp->tfeed;
+  
+  room = SICK_MAXTGRAM - pp->len;
+  if(n > room){
+    pp->skipped += n - room;
+    n = room;
+  }
+  memcpy(pp->buf + pp->len, data, n);
+  pp->len += n;
+  
+  return sick_parser_scan(pp);
+}
+
+
+int sick_parser_read(struct sick_parser_s * pp,
+		     int fd,
+		     FILE * dbg)
+{
+  uint8_t tmp[SICK_MAXTGRAM];
+  int want;
+  ssize_t n;
+  
+  if(pp->ready){
+    // Something might be left over behind the previous telegram.
+    int result = sick_parser_feed(pp, pp->buf, 0);
+    if(0 != result)
+      return result;
+  }
+  
+  want = pp->want - pp->len;
+  if(0 >= want)
+    want = 1;
+  n = read(fd, tmp, want);
+  if(n < 0){
+    if((EAGAIN == errno) || (EINTR == errno))
+      return 0;
+    if(0 != dbg)
+      fprintf(dbg, "DEBUG sick_parser_read(): read(): %s\n", strerror(errno));
+    return -2;
+  }
+  if(0 == n)
+    return 0;
+  TRACE_HEX(TRACE_VERBOSE, "sick_parser_read", tmp, n);
+  
+  return sick_parser_feed(pp, tmp, n);
+}
+
+
+int sick_parser_recv(struct sick_parser_s * pp,
+		     int fd,
+		     unsigned int usec_timeout,
+		     FILE * dbg)
+{
+  struct timeval deadline, dt;
+  int result, ready;
+  
+  if(0 < usec_timeout){
+    gettimeofday(& deadline, 0);
+    dt.tv_sec = usec_timeout / 1000000;
+    dt.tv_usec = usec_timeout % 1000000;
+    timeradd(& deadline, & dt, & deadline);
+  }
+  
+  for(;;){
+    result = sick_parser_read(pp, fd, dbg);
+    if(1 == result)
+      return 0;
+    if(-1 == result)
+      return -3;
+    if(0 > result)
+      return -1;
+    
+    // Only sleep if the read came back empty, otherwise there might
+    // be more bytes waiting for us already.
+    if(pp->want > pp->len){
+      ready = buffer_wait(fd, POLLIN, (0 < usec_timeout) ? & deadline : 0);
+      if(0 > ready)
+	return -1;
+      if(0 == ready)
+	return -2;
+    }
+  }
+}
+
+
 int sick_recv(int fd,
 	      uint8_t * tgram,
 	      int * tlen,
 	      FILE * dbg)
 {
+  struct sick_parser_s pp;
   int result;
-  int length;
   
   if(7 > * tlen){
     if(0 != dbg)
@@ -179,51 +418,76 @@ int sick_recv(int fd,
     return -1;
   }
   
-  // header
-  result = buffer_read(fd, tgram, 4, dbg);
-  if(result != 0){
+  sick_parser_init(& pp, 0x80, 1);
+  result = sick_parser_recv(& pp, fd, SICK_RECV_USEC, dbg);
+  if(0 != pp.skipped)
     if(0 != dbg)
-      fprintf(dbg, "DEBUG sick_recv(): buffer_read() returned %d.\n", result);
-    return -2;
+      fprintf(dbg, "DEBUG sick_recv(): skipped %lu bytes.\n", pp.skipped);
+  if(-3 == result){
+    if(0 != dbg)
+      fprintf(dbg, "DEBUG sick_recv(): sick_chkcrc() failed.\n");
+    return -7;
   }
-  if(0x02 != tgram[0]){
+  if(-2 == result){
     if(0 != dbg)
-      fprintf(dbg, "DEBUG sick_recv(): Expected STX (0x02) but got 0x%02X.\n",
-	      tgram[0]);
+      fprintf(dbg, "DEBUG sick_recv(): timeout.\n");
     return -3;
   }
-  if(0x80 != tgram[1]){
+  if(0 != result){
     if(0 != dbg)
-      fprintf(dbg, "DEBUG sick_recv(): Expected HADR (0x80) but got 0x%02X.\n",
-	      tgram[1]);
-    return -4;
+      fprintf(dbg, "DEBUG sick_recv(): read error.\n");
+    return -2;
   }
-  length = 6 + tgram[2] + (((int) tgram[3]) << 8);
-  if(length > * tlen){
+  
+  if(pp.want > * tlen){
     if(0 != dbg)
       fprintf(dbg,
 	      "DEBUG sick_recv(): tgram buffer too small.\n"
 	      "  need: %d\n"
 	      "  have: %d\n",
-	      length, * tlen);
+	      pp.want, * tlen);
     return -5;
   }
-  * tlen = length;
+  * tlen = pp.want;
+  memcpy(tgram, pp.buf, pp.want);
   
-  // answer, data, and crc
-  result = buffer_read(fd, tgram + 4, length - 4, dbg);
-  if(result != 0){
+  return 0;
+}
+
+
+/**
+   Decode the distance values of a 0xB0 scan telegram. The first
+   value in the telegram is the rightmost beam, which we store at
+   index 360.
+*/
+static int sick_unpack(const uint8_t * tgram,
+		       int tlen,
+		       uint16_t scan[361],
+		       FILE * dbg)
+{
+  int foo, bar;
+  
+  if(REPLY_SCAN != tgram[4]){
     if(0 != dbg)
-      fprintf(dbg, "DEBUG sick_recv(): buffer_read() returned %d.\n", result);
-    return -6;
+      fprintf(dbg,
+	      "ERROR in sick_unpack(): Reply mismatch.\n"
+	      "  want: 0x%02X\n"
+	      "  have: 0x%02X\n",
+	      REPLY_SCAN, tgram[4]);
+    return -1;
   }
-  
-  if(sick_chkcrc(tgram, length - 2, tgram + length - 2, dbg) != 0){
+  if((SCAN_LENGTH + 6 > tlen)
+     || (361 != (GetBytesAsInt(tgram[5], tgram[6]) & 0x3fff))){
     if(0 != dbg)
-      fprintf(dbg, "DEBUG sick_recv(): sick_chkcrc() failed.\n");
-    return -7;
+      fprintf(dbg, "ERROR in sick_unpack(): Not a 361 value scan.\n");
+    return -2;
   }
   
+  for(foo = 7, bar = 360; foo < 729; foo += 2, --bar)
+    scan[bar] = GetBytesAsInt(tgram[foo], tgram[foo + 1]) & 0x1fff;
+  TRACE3(TRACE_VERBOSE, "sick_unpack(): scan %lu %lu ... %lu\n",
+	 scan[0], scan[180], scan[360]);
+  
   return 0;
 }
 
@@ -345,7 +609,7 @@ int sick_rscan(int fd,
 	       uint16_t scan[361],
 	       FILE * dbg)
 {
-  int result, foo, bar;
+  int result;
 
   int tlen = 1024;
   uint8_t tgram[1024] = { 0x30, 0x01 };
@@ -360,25 +624,220 @@ int sick_rscan(int fd,
   result = sick_recv(fd, tgram, & tlen, dbg);
   if(result != 0)
     return -3;
-  if(0xB0 != tgram[4]){
+  if(0 != sick_unpack(tgram, tlen, scan, dbg))
+    return -4;
+  
+  return 0;
+}
+
+
+int sick_setmode(int fd,
+		 uint8_t mode,
+		 FILE * dbg)
+{
+  int result;
+  int tlen = 16;
+  uint8_t tgram[16] = { CMD_CHANGE_OPMODE, 0 };
+  tgram[1] = mode;
+  
+  result = sick_send(fd, tgram, 2, dbg);
+  if(result != 0)
+    return -1;
+  
+  if(sick_rack(fd, dbg) != 0)
+    return -2;
+  
+  result = sick_recv(fd, tgram, & tlen, dbg);
+  if(result != 0)
+    return -3;
+  if(REPLY_OPMODE != tgram[4]){
     if(0 != dbg)
       fprintf(dbg,
-	      "ERROR in sick_rscan(): Reply mismatch.\n"
-	      "  want: 0xB0\n"
+	      "ERROR in sick_setmode(): Reply mismatch.\n"
+	      "  want: 0x%02X\n"
 	      "  have: 0x%02X\n",
-	      tgram[4]);
+	      REPLY_OPMODE, tgram[4]);
     return -4;
   }
+  if(0x00 != tgram[5]){
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in sick_setmode(): Mode 0x%02X refused (0x%02X).\n",
+	      mode, tgram[5]);
+    return -5;
+  }
   
-  if(dbg != 0)
-    fprintf(dbg, "scan:");
-  for(foo = 7, bar = 360; foo < 729; foo += 2, --bar){
-    scan[bar] = GetBytesAsInt(tgram[foo], tgram[foo + 1]) & 0x1fff;
-    if(dbg != 0)
-      fprintf(dbg, " %d", scan[bar]);
+  return 0;
+}
+
+
+/**
+   Check whether the scanner answers at the current line rate. We
+   first blindly switch it out of continuous output mode, because
+   otherwise the status request gets drowned in scan telegrams, and
+   then wait a limited time for the ACK of a status request. The
+   replies themselves are not interesting and simply get flushed.
+*/
+static int sick_probe(int fd,
+		      FILE * dbg)
+{
+  uint8_t tgram[2] = { CMD_CHANGE_OPMODE, SICK_OPMODE_ON_REQUEST };
+  uint8_t ack;
+  int result;
+  
+  tcflush(fd, TCIOFLUSH);
+  if(sick_send(fd, tgram, 2, dbg) != 0)
+    return -1;
+  usleep(100000);
+  tcflush(fd, TCIFLUSH);
+  
+  tgram[0] = 0x31;
+  if(sick_send(fd, tgram, 1, dbg) != 0)
+    return -1;
+  result = buffer_read_timeout(fd, & ack, 1, 200000, dbg);
+  usleep(300000);
+  tcflush(fd, TCIFLUSH);
+  if(result != 0)
+    return -2;
+  if(0x06 != ack){
+    if(0 != dbg)
+      fprintf(dbg, "DEBUG sick_probe(): Expected ACK (0x06) but got 0x%02X.\n",
+	      ack);
+    return -3;
+  }
+  
+  return 0;
+}
+
+
+/**
+   Find the rate at which the scanner currently talks, trying first
+   first and then the rates the scanner knows about.
+   
+   \return the detected rate, or 0 if nobody answered.
+*/
+static unsigned long sick_detect(int fd,
+				 unsigned long first,
+				 FILE * dbg)
+{
+  static const unsigned long candidate[] = { 500000L, 38400L, 19200L, 9600L };
+  int i;
+  
+  if((0 == serial_setbaud(fd, first)) && (0 == sick_probe(fd, dbg)))
+    return first;
+  for(i = 0; i < 4; ++i)
+    if((first != candidate[i])
+       && (0 == serial_setbaud(fd, candidate[i]))
+       && (0 == sick_probe(fd, dbg)))
+      return candidate[i];
+  
+  return 0;
+}
+
+
+int sick_setbaud(int fd,
+		 unsigned long baud,
+		 FILE * dbg)
+{
+  uint8_t mode;
+  int result;
+  
+  switch(baud){
+  case 9600L:   mode = OPMODE_9600;   break;
+  case 19200L:  mode = OPMODE_19200;  break;
+  case 38400L:  mode = OPMODE_38400;  break;
+  case 500000L: mode = OPMODE_500000; break;
+  default:
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in sick_setbaud(): %lu baud not supported.\n",
+	      baud);
+    return -1;
+  }
+  
+  // The reply still comes at the old rate.
+  result = sick_setmode(fd, mode, dbg);
+  if(result != 0){
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in sick_setbaud(): sick_setmode() returned %d.\n",
+	      result);
+    return -2;
+  }
+  
+  if(serial_setbaud(fd, baud) != 0)
+    return -3;
+  
+  if(sick_probe(fd, dbg) != 0){
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in sick_setbaud(): No answer at %lu baud.\n", baud);
+    return -4;
   }
-  if(dbg != 0)
-    fprintf(dbg, "\n");
+  
+  return 0;
+}
+
+
+int sick_negotiate(int fd,
+		   unsigned long want,
+		   unsigned long * have,
+		   FILE * dbg)
+{
+  unsigned long current = sick_detect(fd, want, dbg);
+  if(0 == current){
+    if(0 != dbg)
+      fprintf(dbg, "ERROR in sick_negotiate(): Scanner does not answer.\n");
+    * have = 0;
+    return -1;
+  }
+  
+  if(current != want){
+    if(0 == sick_setbaud(fd, want, dbg))
+      current = want;
+    else{
+      // The scanner may or may not have switched, so look for it again.
+      current = sick_detect(fd, current, dbg);
+      if(0 == current){
+	if(0 != dbg)
+	  fprintf(dbg, "ERROR in sick_negotiate(): Lost the scanner.\n");
+	* have = 0;
+	return -2;
+      }
+    }
+  }
+  
+  if(0 != dbg)
+    fprintf(dbg, "sick_negotiate(): talking at %lu baud.\n", current);
+  * have = current;
+  return (current == want) ? 0 : 1;
+}
+
+
+int sick_rstream(struct sick_parser_s * pp,
+		 int fd,
+		 uint16_t scan[361],
+		 struct timeval * t0,
+		 unsigned int usec_timeout,
+		 FILE * dbg)
+{
+  int result = sick_parser_recv(pp, fd, usec_timeout, dbg);
+  if(0 != result){
+    if(0 != dbg)
+      fprintf(dbg, "DEBUG sick_rstream(): sick_parser_recv() returned %d.\n",
+	      result);
+    return -1;
+  }
+  * t0 = pp->t0;
+  
+  if(SCAN_LENGTH + 6 != pp->want){
+    if(0 != dbg)
+      fprintf(dbg,
+	      "DEBUG sick_rstream(): Length mismatch.\n"
+	      "  want: %d\n"
+	      "  have: %d\n",
+	      SCAN_LENGTH + 6, pp->want);
+    return -3;
+  }
+  
+  if(0 != sick_unpack(pp->buf, pp->want, scan, dbg))
+    return -5;
   
   return 0;
 }
@@ -388,6 +847,7 @@ struct sick_poster_s * sick_poster_new(int fd,
 				       unsigned int usec_cycle,
 				       FILE * dbg)
 {
+  char name[32];
   struct sick_poster_s * sp = calloc(1, sizeof(* sp));
   if(0 == sp)
     return 0;
@@ -396,21 +856,241 @@ struct sick_poster_s * sick_poster_new(int fd,
   sp->usec_cycle = usec_cycle;
   sp->dirty = 1;
   sp->dbg = dbg;
+  
+  if(0 != pthread_mutex_init(& sp->notify_mutex, 0)){
+    free(sp);
+    return 0;
+  }
+  if(0 != pthread_cond_init(& sp->notify_cond, 0)){
+    pthread_mutex_destroy(& sp->notify_mutex);
+    free(sp);
+    return 0;
+  }
+  if(0 != pthread_mutex_init(& sp->record_mutex, 0)){
+    pthread_cond_destroy(& sp->notify_cond);
+    pthread_mutex_destroy(& sp->notify_mutex);
+    free(sp);
+    return 0;
+  }
+  
+  if(0 > fd)
+    snprintf(name, sizeof(name), "sick replay");
+  else
+    snprintf(name, sizeof(name), "sick fd %d", fd);
+  periodic_init(& sp->periodic, name, usec_cycle);
+  
+  return sp;
+}
+
 
+struct sick_poster_s * sick_poster_new_stream(int fd,
+					      FILE * dbg)
+{
+  struct sick_poster_s * sp = sick_poster_new(fd, 0, dbg);
+  if(0 != sp)
+    sp->streaming = 1;
   return sp;
 }
 
 
+struct sick_poster_s * sick_poster_new_replay(struct sick_log_s * log,
+					      double speed,
+					      FILE * dbg)
+{
+  struct sick_poster_s * sp = sick_poster_new(-1, 0, dbg);
+  if(0 != sp){
+    sp->replay_log = log;
+    sp->replay_speed = speed;
+  }
+  return sp;
+}
+
+
+struct sick_log_s * sick_poster_record(struct sick_poster_s * sp,
+				       struct sick_log_s * log)
+{
+  struct sick_log_s * old;
+  pthread_mutex_lock(& sp->record_mutex);
+  old = sp->record_log;
+  sp->record_log = log;
+  pthread_mutex_unlock(& sp->record_mutex);
+  return old;
+}
+
+
 void sick_poster_delete(struct sick_poster_s * sp)
 {
   if(0 != sp->running)
     sick_poster_stop(sp);
   if(0 != sp->thread)
     free(sp->thread);
+  periodic_fini(& sp->periodic);
+  pthread_mutex_destroy(& sp->record_mutex);
+  pthread_cond_destroy(& sp->notify_cond);
+  pthread_mutex_destroy(& sp->notify_mutex);
   free(sp);
 }
 
 
+static void sick_poster_notify(struct sick_poster_s * sp)
+{
+  pthread_mutex_lock(& sp->notify_mutex);
+  pthread_cond_broadcast(& sp->notify_cond);
+  pthread_mutex_unlock(& sp->notify_mutex);
+}
+
+
+/**
+   Lock-free copy of the most recently published scan. The slot
+   sequence counter is odd while the poster writes into the slot, and
+   changes whenever the slot gets reused, in which case we simply
+   retry with the then current slot.
+*/
+static unsigned int sick_poster_copy(const struct sick_poster_s * sp,
+				     struct sick_scan_s * scan)
+{
+  unsigned int seq, count;
+  int slot;
+  
+  for(;;){
+    slot = sp->current;
+    seq = sp->slot_seq[slot];
+    __sync_synchronize();
+    if(seq & 1)
+      continue;
+    memcpy(scan, (const void *) & sp->scan[slot], sizeof(* scan));
+    count = sp->slot_count[slot];
+    __sync_synchronize();
+    if(seq == sp->slot_seq[slot])
+      return count;
+  }
+}
+
+
+/**
+   Acquire one scan in request mode: send the request, wait for the
+   reply, and stamp the scan with the time around the round trip.
+*/
+static const char * sick_poster_request(struct sick_poster_s * sp,
+					struct sick_scan_s * scan)
+{
+  if(0 != gettimeofday(& scan->t0, 0))
+    return "read t0 failed";
+  if(0 != sick_rscan(sp->fd, scan->rho, 0 /* sp->dbg */))
+    return "rscan failed";
+  if(0 != gettimeofday(& scan->t1, 0))
+    return "read t1 failed";
+  return 0;
+}
+
+
+/**
+   Acquire one scan in continuous output mode. The scanner sends
+   telegrams at its own pace, so a gap of several nominal periods
+   between two good frames means we lost some. The nominal period is
+   the smallest interval seen so far, and frames that we received but
+   had to throw away are accounted for as corrupted, not dropped.
+*/
+static const char * sick_poster_stream(struct sick_poster_s * sp,
+				       struct sick_scan_s * scan)
+{
+  struct timeval dt;
+  long usec, missed;
+  unsigned long crc_errors;
+  int result;
+  
+  crc_errors = sp->parser.crc_errors;
+  result = sick_rstream(& sp->parser, sp->fd, scan->rho, & scan->t0,
+			SICK_RECV_USEC, 0 /* sp->dbg */);
+  crc_errors = sp->parser.crc_errors - crc_errors;
+  sp->corrupt_count += crc_errors;
+  sp->corrupt_pending += crc_errors;
+  if(0 != result){
+    if(-1 == result)
+      return "rstream timeout or read error";
+    ++sp->corrupt_count;
+    ++sp->corrupt_pending;
+    return "rstream failed";
+  }
+  if(0 != gettimeofday(& scan->t1, 0))
+    return "read t1 failed";
+  
+  ++sp->frame_count;
+  if(1 < sp->frame_count){
+    timersub(& scan->t0, & sp->last_t0, & dt);
+    usec = dt.tv_sec * 1000000 + dt.tv_usec;
+    if((usec < sp->frame_usec_min) || (sp->frame_usec_min <= 0))
+      sp->frame_usec_min = usec;
+    if(0 < sp->frame_usec_min){
+      missed = (usec + sp->frame_usec_min / 2) / sp->frame_usec_min - 1;
+      missed -= sp->corrupt_pending;
+      if(0 < missed)
+	sp->drop_count += missed;
+    }
+  }
+  sp->last_t0 = scan->t0;
+  sp->corrupt_pending = 0;
+  return 0;
+}
+
+
+static void sick_poster_unlock(void * mutex)
+{
+  pthread_mutex_unlock(mutex);
+}
+
+
+/**
+   Fetch the next scan from the replay log. In real-time mode we sleep
+   until its turn comes, otherwise we wait until the readers have
+   picked up the previous one, so that none get lost.
+*/
+static const char * sick_poster_replay(struct sick_poster_s * sp,
+				       struct sick_scan_s * scan)
+{
+  struct timeval now, dt;
+  double sec;
+  
+  if(0 != sick_log_get(sp->replay_log, sp->replay_index, scan)){
+    usleep(10000);
+    return "end of replay log";
+  }
+  
+  if(0 == sp->replay_index){
+    gettimeofday(& sp->replay_wall0, 0);
+    sp->replay_log0 = scan->t0;
+  }
+  ++sp->replay_index;
+  
+  if(0 < sp->replay_speed){
+    timersub(& scan->t1, & scan->t0, & dt);
+    timersub(& scan->t0, & sp->replay_log0, & scan->t0);
+    sec = (scan->t0.tv_sec + scan->t0.tv_usec * 1e-6) / sp->replay_speed;
+    scan->t0.tv_sec = (long) sec;
+    scan->t0.tv_usec = (long) ((sec - scan->t0.tv_sec) * 1e6);
+    timeradd(& scan->t0, & sp->replay_wall0, & scan->t0);
+    timeradd(& scan->t0, & dt, & scan->t1);
+    
+    gettimeofday(& now, 0);
+    if(timercmp(& now, & scan->t1, <)){
+      timersub(& scan->t1, & now, & dt);
+      usleep(dt.tv_sec * 1000000 + dt.tv_usec);
+    }
+  }
+  else{
+    // sick_poster_abort() may cancel us inside pthread_cond_wait(),
+    // which returns with the mutex held.
+    pthread_mutex_lock(& sp->notify_mutex);
+    pthread_cleanup_push(sick_poster_unlock, & sp->notify_mutex);
+    while((sp->consumed != sp->count) && (0 != sp->running))
+      pthread_cond_wait(& sp->notify_cond, & sp->notify_mutex);
+    pthread_cleanup_pop(1);
+  }
+  
+  return 0;
+}
+
+
 static void * sick_poster_run(struct sick_poster_s * sp)
 {
   static const char * msg;
@@ -421,39 +1101,49 @@ static void * sick_poster_run(struct sick_poster_s * sp)
   sp->tc_msec_max = -1;
   sp->tc_msec_sum = 0;
   sp->tc_count = 0;
+  sp->frame_count = 0;
+  sp->corrupt_count = 0;
+  sp->corrupt_pending = 0;
+  sp->drop_count = 0;
+  sick_parser_init(& sp->parser, 0x80, 0);
+  sp->frame_usec_min = 0;
+  sp->replay_index = 0;
   
+  if(0 != sp->streaming){
+    // If this fails the scanner might still be streaming from an
+    // earlier session, so we go on and let the receive errors speak.
+    int result = sick_setmode(sp->fd, SICK_OPMODE_CONTINUOUS, sp->dbg);
+    if((0 != result) && (0 != sp->dbg))
+      fprintf(sp->dbg,
+	      "sick_poster_run(): sick_setmode() returned %d.\n", result);
+  }
+  
+  periodic_start(& sp->periodic, sp->dbg);
   sp->running = 1;
   while(sp->running){
-    msg = "no message";
     struct sick_scan_s * dirtyscan = & sp->scan[sp->dirty];
-    if(0 != gettimeofday(& dirtyscan->t0, 0)){
+    ++sp->slot_seq[sp->dirty];
+    __sync_synchronize();
+    if(0 != sp->replay_log)
+      msg = sick_poster_replay(sp, dirtyscan);
+    else if(0 != sp->streaming)
+      msg = sick_poster_stream(sp, dirtyscan);
+    else
+      msg = sick_poster_request(sp, dirtyscan);
+    if(0 != msg)
       ++sp->error_count;
-      msg = "read t0 failed";
-    }
     else{
-      if(0 != sick_rscan(sp->fd, dirtyscan->rho, 0 /* sp->dbg */)){
-	++sp->error_count;
-	msg = "rscan failed";
-      }
-      else{
-	if(0 != gettimeofday(& dirtyscan->t1, 0)){
-	  ++sp->error_count;
-	  msg = "read t1 failed";
-	}
-	else{
-	  struct timeval dt;
-	  long msec;
-	  timersub(& dirtyscan->t1, & dirtyscan->t0, & dt);
-	  msec = dt.tv_sec * 1000 + dt.tv_usec / 1000;
-	  if((msec < sp->tc_msec_min) || (sp->tc_msec_min < 0))
-	    sp->tc_msec_min = msec;
-	  if((msec > sp->tc_msec_max) || (sp->tc_msec_max < 0))
-	    sp->tc_msec_max = msec;
-	  sp->tc_msec_sum += msec;
-	  ++sp->tc_count;
-	  sp->error_count = 0;
-	}
-      }
+      struct timeval dt;
+      long msec;
+      timersub(& dirtyscan->t1, & dirtyscan->t0, & dt);
+      msec = dt.tv_sec * 1000 + dt.tv_usec / 1000;
+      if((msec < sp->tc_msec_min) || (sp->tc_msec_min < 0))
+	sp->tc_msec_min = msec;
+      if((msec > sp->tc_msec_max) || (sp->tc_msec_max < 0))
+	sp->tc_msec_max = msec;
+      sp->tc_msec_sum += msec;
+      ++sp->tc_count;
+      sp->error_count = 0;
     }
     
     if(0 != sp->dbg){
@@ -467,13 +1157,49 @@ static void * sick_poster_run(struct sick_poster_s * sp)
 		" %ld / %ld / %ld / %f\n",
 		sp->tc_count, sp->tc_msec_min, sp->tc_msec_max,
 		sp->tc_msec_sum / ((double) sp->tc_count));
+      if(0 != sp->streaming)
+	fprintf(sp->dbg,
+		"sick_poster_run(): frames (good/corrupt/dropped):"
+		" %lu / %lu / %lu, resyncs %lu, skipped %lu bytes\n",
+		sp->frame_count, sp->corrupt_count, sp->drop_count,
+		sp->parser.resyncs, sp->parser.skipped);
+    }
+    
+    if(0 == sp->error_count){
+      sp->slot_count[sp->dirty] = sp->count + 1;
+      __sync_synchronize();
+      ++sp->slot_seq[sp->dirty];
+      __sync_synchronize();
+      sp->current = sp->dirty;
+      __sync_synchronize();
+      ++sp->count;
+      sick_poster_notify(sp);
+      // write() is a cancellation point, see sick_poster_abort().
+      pthread_mutex_lock(& sp->record_mutex);
+      pthread_cleanup_push(sick_poster_unlock, & sp->record_mutex);
+      if((0 != sp->record_log)
+	 && (0 != sick_log_append(sp->record_log, dirtyscan))
+	 && (0 != sp->dbg))
+	fprintf(sp->dbg, "sick_poster_run(): sick_log_append() failed.\n");
+      pthread_cleanup_pop(1);
+      sp->dirty = (sp->dirty + 1) % 3;
+    }
+    else{
+      __sync_synchronize();
+      ++sp->slot_seq[sp->dirty];
     }
     
-    sp->current = sp->dirty;
-    sp->current_t0 = dirtyscan->t0;
-    sp->dirty = (sp->dirty + 1) % 3;
-    if(0 < sp->usec_cycle)
-      usleep(sp->usec_cycle);
+    periodic_wait(& sp->periodic);
+  }
+  
+  if(0 != sp->streaming){
+    // Back to request mode. The ACK and reply get mixed up with the
+    // tail of the stream, so don't bother parsing them and just
+    // flush whatever is left on the line.
+    uint8_t tgram[2] = { CMD_CHANGE_OPMODE, SICK_OPMODE_ON_REQUEST };
+    sick_send(sp->fd, tgram, 2, sp->dbg);
+    usleep(50000);
+    tcflush(sp->fd, TCIFLUSH);
   }
   sp->running = 1;
   
@@ -508,6 +1234,7 @@ int sick_poster_start(struct sick_poster_s * sp)
 int sick_poster_stop(struct sick_poster_s * sp)
 {
   sp->running = 0;
+  sick_poster_notify(sp);
   usleep(100000);
   while(0 == sp->running){
     if(0 != sp->dbg)
@@ -545,6 +1272,7 @@ int sick_poster_abort(struct sick_poster_s * sp)
     return -2;
   }
   sp->running = 0;
+  sick_poster_notify(sp);
   
   return 0;
 }
@@ -553,9 +1281,6 @@ int sick_poster_abort(struct sick_poster_s * sp)
 int sick_poster_getscan(const struct sick_poster_s * sp,
 			struct sick_scan_s * scan)
 {
-  struct sick_scan_s * current_scan = & sp->scan[sp->current];
-  int i;
-  
   if(0 == sp->running){
     if(0 != sp->dbg)
       fprintf(sp->dbg, "sick_poster_getscan(): Poster not running.\n");
@@ -569,10 +1294,79 @@ int sick_poster_getscan(const struct sick_poster_s * sp,
     return -2;
   }
   
-  for(i = 0; i < 361; ++i)
-    scan->rho[i] = current_scan->rho[i];
-  scan->t0 = current_scan->t0;
-  scan->t1 = current_scan->t1;
+  sick_poster_copy(sp, scan);
+  
+  return 0;
+}
+
+
+/** Sleep until there is a scan more recent than count, or timeout. */
+static void sick_poster_sleep(struct sick_poster_s * sp,
+			      unsigned int count,
+			      unsigned int usec_timeout)
+{
+  if((sp->count == count) && (0 < usec_timeout)){
+    struct timeval now;
+    struct timespec deadline;
+    gettimeofday(& now, 0);
+    now.tv_usec += usec_timeout;
+    deadline.tv_sec = now.tv_sec + now.tv_usec / 1000000;
+    deadline.tv_nsec = (now.tv_usec % 1000000) * 1000;
+    
+    pthread_mutex_lock(& sp->notify_mutex);
+    while((sp->count == count) && (0 != sp->running))
+      if(ETIMEDOUT == pthread_cond_timedwait(& sp->notify_cond,
+					     & sp->notify_mutex,
+					     & deadline))
+	break;
+    pthread_mutex_unlock(& sp->notify_mutex);
+  }
+}
+
+
+int sick_poster_waitscan(struct sick_poster_s * sp,
+			 unsigned int count,
+			 unsigned int usec_timeout)
+{
+  sick_poster_sleep(sp, count, usec_timeout);
+  if(0 == sp->running)
+    return -1;
+  if(sp->count == count)
+    return -3;
+  if(0 != sp->error_count)
+    return -2;
+  return 0;
+}
+
+
+int sick_poster_nextscan(struct sick_poster_s * sp,
+			 struct sick_scan_s * scan,
+			 unsigned int * count,
+			 unsigned int usec_timeout)
+{
+  sick_poster_sleep(sp, * count, usec_timeout);
+  
+  if(0 == sp->running){
+    if(0 != sp->dbg)
+      fprintf(sp->dbg, "sick_poster_nextscan(): Poster not running.\n");
+    return -1;
+  }
+  
+  if(sp->count == * count)
+    return -3;
+  
+  if(0 != sp->error_count){
+    if(0 != sp->dbg)
+      fprintf(sp->dbg, "sick_poster_nextscan(): error_count = %d.\n",
+	      sp->error_count);
+    return -2;
+  }
+  
+  * count = sick_poster_copy(sp, scan);
+  if((0 != sp->replay_log) && (sp->consumed != * count)){
+    sp->consumed = * count;
+    sick_poster_notify(sp);
+  }
   
   return 0;
 }
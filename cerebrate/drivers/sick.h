@@ -33,30 +33,131 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdio.h>
+#include "periodic.h"
 #include <pthread.h>
 #include <sys/time.h>
   
 
+#define SICK_OPMODE_CONTINUOUS 0x24
+#define SICK_OPMODE_ON_REQUEST 0x25
+  
+  
+#define SICK_MAXTGRAM 1024
+  
+  
+  /**
+     Incremental telegram parser. Bytes can arrive in arbitrary
+     chunks, the parser hunts for STX and the expected address byte
+     (0x80 for telegrams from the scanner, 0x00 for telegrams to it),
+     checks the length and the CRC, and resynchronizes on the next STX
+     after any mismatch. The want field tells how many bytes the
+     current telegram needs, so reading want - len bytes never eats
+     into the next one.
+     
+     In strict mode, a CRC failure is reported to the caller instead
+     of silently hunting for the next telegram, which makes sense for
+     request/response exchanges.
+  */
+  struct sick_parser_s {
+    uint8_t buf[SICK_MAXTGRAM];
+    int len, want, ready, strict;
+    uint8_t hadr;
+    struct timeval t0, tfeed;
+    unsigned long frames, resyncs, crc_errors, skipped;
+  };
+  
+  
   struct sick_scan_s {
     struct timeval t0, t1;
     uint16_t rho[361];
   };
   
+  struct sick_log_s;
+  
+  /**
+     Triple-buffered scan poster. The poster thread writes into the
+     dirty slot and then publishes it by updating current and
+     count. Readers never lock: each slot carries a sequence counter
+     which is odd while the slot is being written, so a reader simply
+     retries its copy if the counter changed underneath it. The mutex
+     and condition variable are only used to put readers to sleep in
+     sick_poster_nextscan(), the data path itself is lock-free.
+     
+     In streaming mode the scanner is switched to continuous output
+     and the poster simply parses telegrams as they arrive. The
+     frame_count, corrupt_count, and drop_count fields together with
+     the parser counters tell you how healthy the stream is.
+     
+     A replay poster reads scans from a log instead of a scanner (fd
+     is -1), and any poster can append its scans to a log, see
+     sicklog.h for the file format.
+     
+     The poster thread is a periodic task (see periodic.h) with
+     usec_cycle as its period, so a request-mode poster asks for
+     scans at a fixed rate instead of sleeping usec_cycle after each.
+  */
   struct sick_poster_s {
     int fd;
     unsigned int usec_cycle;
     struct sick_scan_s scan[3];
-    int current, dirty, running;
+    volatile unsigned int slot_seq[3];
+    volatile unsigned int slot_count[3];
+    volatile int current;
+    volatile unsigned int count;
+    int dirty, running;
     unsigned int error_count;
     pthread_t * thread;
+    pthread_mutex_t notify_mutex;
+    pthread_cond_t notify_cond;
     FILE * dbg;
     long tc_msec_min, tc_msec_max, tc_msec_sum, tc_count;
-    struct timeval current_t0;
+    int streaming;
+    unsigned long frame_count, corrupt_count, drop_count;
+    unsigned int corrupt_pending;
+    long frame_usec_min;
+    struct timeval last_t0;
+    struct sick_parser_s parser;
+    struct sick_log_s * record_log;
+    pthread_mutex_t record_mutex;
+    struct sick_log_s * replay_log;
+    double replay_speed;
+    unsigned long replay_index;
+    struct timeval replay_wall0, replay_log0;
+    volatile unsigned int consumed;
+    struct periodic_s periodic;
   };
 
 
   struct sick_poster_s * sick_poster_new(int fd, unsigned int usec_cycle,
 					 FILE * dbg);
+  
+  /** Create a poster that uses continuous output mode. */
+  struct sick_poster_s * sick_poster_new_stream(int fd, FILE * dbg);
+  
+  /**
+     Create a poster that replays scans from a log opened with
+     sick_log_open(). With a positive speed, scans are published at
+     speed times their recorded rate and restamped to the present,
+     which keeps watchdogs happy. Otherwise each scan is published as
+     soon as the previous one has been picked up by
+     sick_poster_nextscan(), with its original stamps, which is what
+     you want for offline profiling. The log is not closed by
+     sick_poster_delete().
+  */
+  struct sick_poster_s * sick_poster_new_replay(struct sick_log_s * log,
+						double speed, FILE * dbg);
+  
+  /**
+     Append every scan that the poster publishes to a log opened with
+     sick_log_create(). Pass a null log to stop recording. The swap
+     happens under record_mutex, so once this returns the poster is
+     done with the previous log and the caller can close it.
+     
+     \return The previous log, null if there was none.
+  */
+  struct sick_log_s * sick_poster_record(struct sick_poster_s * sp,
+					 struct sick_log_s * log);
+  
   void sick_poster_delete(struct sick_poster_s * sp);
   int sick_poster_start(struct sick_poster_s * sp);
   int sick_poster_stop(struct sick_poster_s * sp);
@@ -64,15 +165,108 @@ extern "C" {
   int sick_poster_getscan(const struct sick_poster_s * sp,
 			  struct sick_scan_s * scan);
   
+  /**
+     Wait for a scan that is more recent than the one identified by
+     (* count), copy it into scan, and update (* count). Pass 0 as
+     usec_timeout to just check without sleeping.
+     
+     \return 0 on success, -1 if the poster is not running, -2 if the
+     poster has pending errors, and -3 on timeout.
+  */
+  int sick_poster_nextscan(struct sick_poster_s * sp,
+			   struct sick_scan_s * scan,
+			   unsigned int * count,
+			   unsigned int usec_timeout);
+  
+  /**
+     Like sick_poster_nextscan(), but only wait for the scan without
+     copying it, so that a consumer can sleep on the scanner outside
+     of its own locks and fetch the scan afterwards.
+  */
+  int sick_poster_waitscan(struct sick_poster_s * sp,
+			   unsigned int count,
+			   unsigned int usec_timeout);
+  
+  /**
+     The SICK CRC16 of tlen bytes, without any debug output. The
+     low byte goes first on the wire.
+  */
+  uint16_t sick_crc16(const uint8_t * tgram, int tlen);
+  
   void sick_crc(uint8_t * tgram, int tlen, uint8_t crc[2], FILE * dbg);
   int sick_chkcrc(uint8_t * tgram, int tlen, uint8_t crc[2], FILE * dbg);
   
   int sick_send(int fd, uint8_t * op_and_data, int odlen, FILE * dbg);
   int sick_rack(int fd, FILE * dbg);
+  
+  void sick_parser_init(struct sick_parser_s * pp, uint8_t hadr, int strict);
+  
+  /**
+     Append n bytes and run the parser.
+     
+     \return 1 if a telegram is ready in pp->buf with pp->want bytes,
+     -1 if one was discarded because of its CRC in strict mode, and 0
+     if more bytes are needed.
+  */
+  int sick_parser_feed(struct sick_parser_s * pp, const uint8_t * data,
+		       int n);
+  
+  /**
+     Non-blocking read of at most the bytes the parser wants, followed
+     by sick_parser_feed(). Returns like sick_parser_feed(), or -2 on
+     read errors.
+  */
+  int sick_parser_read(struct sick_parser_s * pp, int fd, FILE * dbg);
+  
+  /**
+     Sleep in poll() and feed the parser until a telegram is ready.
+     Pass 0 as usec_timeout to wait forever.
+     
+     \return 0 on success, -1 on read errors, -2 on timeout, -3 on CRC
+     failure in strict mode.
+  */
+  int sick_parser_recv(struct sick_parser_s * pp, int fd,
+		       unsigned int usec_timeout, FILE * dbg);
+  
+  /**
+     Receive a telegram from the scanner, skipping any line noise in
+     front of it. Gives up after two seconds.
+  */
   int sick_recv(int fd, uint8_t * tgram, int * tlen, FILE * dbg);
   
   int sick_dumpstatus(int fd, FILE * out);
   int sick_rscan(int fd, uint16_t scan[361], FILE * dbg);
+  
+  /** Switch the operating mode, e.g. to SICK_OPMODE_CONTINUOUS. */
+  int sick_setmode(int fd, uint8_t mode, FILE * dbg);
+  
+  /**
+     Switch the scanner and the serial line to baud, which has to be
+     one of 9600, 19200, 38400, or 500000. The scanner has to be
+     talking at the current line rate.
+  */
+  int sick_setbaud(int fd, unsigned long baud, FILE * dbg);
+  
+  /**
+     Find out at which rate the scanner talks, and try to switch both
+     sides to want. If that fails, the line is left at the rate at
+     which the scanner was found. The rate in use is stored in
+     (* have).
+     
+     \return 0 if want is in use, 1 if we fell back to another rate,
+     and negative if the scanner doesn't answer.
+  */
+  int sick_negotiate(int fd, unsigned long want, unsigned long * have,
+		     FILE * dbg);
+  
+  /**
+     Receive the next scan telegram in continuous output mode. The
+     parser keeps its state between calls, and t0 is the time at
+     which the telegram header arrived.
+  */
+  int sick_rstream(struct sick_parser_s * pp, int fd, uint16_t scan[361],
+		   struct timeval * t0, unsigned int usec_timeout,
+		   FILE * dbg);
 
   
 #ifdef __cplusplus
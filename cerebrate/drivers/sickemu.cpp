@@ -0,0 +1,606 @@
+/*
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+/**
+   SICK LMS emulator on a pseudo terminal. It speaks the subset of the
+   telegram protocol that sick.c uses (scan requests, status requests,
+   operating mode and baudrate changes, continuous output) and serves
+   synthetic or recorded scans, optionally with line noise, CRC errors
+   and stalls. Point csick or the Scanalyzer at the printed slave
+   device (or at the -l symlink) instead of a real scanner.
+
+   The emulator checks the line speed that the host configured on the
+   slave side, and ignores requests that arrive at the wrong rate,
+   which exercises baudrate detection just like the real thing. Output
+   is written no faster than the emulated baudrate allows, with a 16
+   byte FIFO's worth of slack, so that a 732 byte scan telegram takes
+   as long to arrive as it would over a real line.
+
+   A stall silences the scanner for a while. In request mode the host
+   has to retry, in continuous mode it just sees a gap in the stream.
+   With -R, a stall ends in a reset instead, back to request mode at
+   the power-on baudrate, which a streaming host has to notice and
+   recover from by renegotiating. After a stall in request mode and
+   after a reset, the emulator reports how long after the stall the
+   host's first request arrived.
+*/
+
+
+#include <drivers/sick.h>
+#include <drivers/sicklog.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+
+using namespace std;
+
+
+#define STX               0x02
+#define ACK               0x06
+#define NACK              0x15
+#define CMD_CHANGE_OPMODE 0x20
+#define CMD_REQUEST_SCAN  0x30
+#define CMD_STATUS        0x31
+
+
+struct arg_s {
+  arg_s(): rate(75), baud(9600), noise(0), crcerr(0), stall(0),
+	   reset(0), stall_msec(1000), seed(0), verbose(false) { }
+  string link_fname, log_fname;
+  double rate;
+  unsigned long baud;
+  double noise, crcerr, stall, reset;
+  unsigned int stall_msec, seed;
+  bool verbose;
+};
+
+
+struct emu_s {
+  emu_s(): master(-1), slave(-1), continuous(false), baud(9600),
+	   log(0), log_index(0), phase(0), stalled(false),
+	   stall_pending(false), reset_pending(false), scans(0),
+	   requests(0), ignored(0), overruns(0) { }
+  int master, slave;
+  bool continuous;
+  unsigned long baud;
+  struct sick_log_s * log;
+  unsigned long log_index;
+  double phase;
+  string outq;
+  struct timeval line_free, tx_next, next_frame, stall_end;
+  bool stalled, stall_pending, reset_pending;
+  unsigned long scans, requests, ignored, overruns;
+};
+
+
+static arg_s arg;
+static emu_s emu;
+static volatile bool done(false);
+
+
+static void usage_message(ostream & os)
+{
+  os << "sickemu [-hv] [-l link] [-f log] [-r rate] [-b baud] [-n prob]\n"
+     << "        [-c prob] [-s prob] [-R prob] [-t msec] [-S seed]\n"
+     << "  -l --link    filename   symlink to the slave device\n"
+     << "  -f --file    filename   serve recorded scans (looped)\n"
+     << "  -r --rate    hz         continuous output rate (default "
+     << arg.rate << ")\n"
+     << "  -b --baud    baud       power-on baudrate (default "
+     << arg.baud << ")\n"
+     << "  -n --noise   prob       chance of garbage before a telegram\n"
+     << "  -c --crc     prob       chance of a corrupted telegram\n"
+     << "  -s --stall   prob       chance of a stall after a telegram\n"
+     << "  -R --reset   prob       chance that a stall ends in a reset\n"
+     << "  -t --stall-msec msec    stall duration (default "
+     << arg.stall_msec << ")\n"
+     << "  -S --seed    seed       seed for the noise generator\n"
+     << "  -h --help               print usage message\n"
+     << "  -v --verbose            print every telegram\n";
+}
+
+
+static void parse_args(int argc, char ** argv)
+{
+  const struct option longopts[] = {
+    {"link",       required_argument, 0, 'l'},
+    {"file",       required_argument, 0, 'f'},
+    {"rate",       required_argument, 0, 'r'},
+    {"baud",       required_argument, 0, 'b'},
+    {"noise",      required_argument, 0, 'n'},
+    {"crc",        required_argument, 0, 'c'},
+    {"stall",      required_argument, 0, 's'},
+    {"reset",      required_argument, 0, 'R'},
+    {"stall-msec", required_argument, 0, 't'},
+    {"seed",       required_argument, 0, 'S'},
+    {"help",       no_argument,       0, 'h'},
+    {"verbose",    no_argument,       0, 'v'},
+    {0,            0,                 0, 0}
+  };
+  const char *shortopts("l:f:r:b:n:c:s:R:t:S:hv");
+  int ch;
+  while(-1 != (ch = getopt_long(argc, argv, shortopts, longopts, 0))){
+    bool ok(true);
+    switch(ch){
+    case 'l': arg.link_fname = optarg; break;
+    case 'f': arg.log_fname = optarg; break;
+    case 'r': ok = ! (istringstream(optarg) >> arg.rate).fail(); break;
+    case 'b': ok = ! (istringstream(optarg) >> arg.baud).fail(); break;
+    case 'n': ok = ! (istringstream(optarg) >> arg.noise).fail(); break;
+    case 'c': ok = ! (istringstream(optarg) >> arg.crcerr).fail(); break;
+    case 's': ok = ! (istringstream(optarg) >> arg.stall).fail(); break;
+    case 'R': ok = ! (istringstream(optarg) >> arg.reset).fail(); break;
+    case 't':
+      ok = ! (istringstream(optarg) >> arg.stall_msec).fail();
+      break;
+    case 'S': ok = ! (istringstream(optarg) >> arg.seed).fail(); break;
+    case 'v': arg.verbose = true; break;
+    case 'h':
+      usage_message(cout);
+      exit(EXIT_SUCCESS);
+    case '?':
+    default:
+      ok = false;
+    }
+    if( ! ok){
+      usage_message(cerr);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+
+static void handle(int signum)
+{
+  done = true;
+}
+
+
+static double stamp(const struct timeval & tt)
+{
+  return tt.tv_sec + 1e-6 * tt.tv_usec;
+}
+
+
+static double now()
+{
+  struct timeval tt;
+  gettimeofday(& tt, 0);
+  return stamp(tt);
+}
+
+
+static void set_stamp(struct timeval & tt, double sec)
+{
+  tt.tv_sec = (long) sec;
+  tt.tv_usec = (long) ((sec - tt.tv_sec) * 1e6);
+}
+
+
+static bool chance(double prob)
+{
+  return (0 < prob) && (rand() < prob * RAND_MAX);
+}
+
+
+static speed_t baud_speed(unsigned long baud)
+{
+  switch(baud){
+  case 9600L:  return B9600;
+  case 19200L: return B19200;
+  case 38400L: return B38400;
+#ifdef B500000
+  case 500000L: return B500000;
+#endif // B500000
+  }
+  return B0;
+}
+
+
+/**
+   The slave side of a pty shares its termios with the master, so we
+   can see at which rate the host thinks it is talking to us.
+*/
+static bool line_ok()
+{
+  struct termios tio;
+  if(0 != tcgetattr(emu.master, & tio))
+    return true;
+  return cfgetispeed(& tio) == baud_speed(emu.baud);
+}
+
+
+/**
+   Queue a telegram from the scanner to the host, possibly preceded
+   by some garbage or with a flipped bit. The line stays busy for as
+   long as it takes to transmit the bytes at the emulated rate.
+*/
+static void send_tgram(const uint8_t * op_and_data, int odlen)
+{
+  if(chance(arg.noise)){
+    const int nn(1 + rand() % 20);
+    for(int ii(0); ii < nn; ++ii)
+      emu.outq += (char) (rand() & 0xFF);
+  }
+
+  string tgram(odlen + 6, 0);
+  tgram[0] = STX;
+  tgram[1] = 0x80;
+  tgram[2] = odlen & 0xFF;
+  tgram[3] = (odlen >> 8) & 0xFF;
+  memcpy(& tgram[4], op_and_data, odlen);
+  const uint16_t crc(sick_crc16((const uint8_t *) tgram.data(), odlen + 4));
+  tgram[odlen + 4] = crc & 0xFF;
+  tgram[odlen + 5] = (crc >> 8) & 0xFF;
+  if(chance(arg.crcerr))
+    tgram[4 + rand() % (odlen + 2)] ^= 1 << (rand() % 8);
+  emu.outq += tgram;
+
+  double tfree(stamp(emu.line_free));
+  const double tnow(now());
+  if(tfree < tnow)
+    tfree = tnow;
+  set_stamp(emu.line_free, tfree + 10.0 * (odlen + 6) / emu.baud);
+
+  if(arg.verbose)
+    cerr << "sickemu: sent reply 0x" << hex << (int) op_and_data[0] << dec
+	 << " (" << odlen + 6 << " bytes)\n";
+
+  if(chance(arg.stall))
+    emu.stall_pending = true;
+}
+
+
+/**
+   Synthetic scene: a 4m x 5m room with the scanner in the middle of
+   one wall, and a 20cm pole going back and forth in front of it.
+*/
+static void synthetic_scan(uint16_t rho[361])
+{
+  emu.phase += 0.02;
+  const double px(1.5 + 0.8 * sin(emu.phase));
+  const double py(0.5 * cos(0.7 * emu.phase));
+  const double pr(0.1);
+  for(int ii(0); ii < 361; ++ii){
+    const double phi(M_PI / 2 - M_PI * ii / 361);
+    const double cx(cos(phi)), cy(sin(phi));
+    double rr(8.191);
+    if(cx > 1e-6)
+      rr = min(rr, 4.0 / cx);
+    if(fabs(cy) > 1e-6)
+      rr = min(rr, 2.5 / fabs(cy));
+    const double bb(px * cx + py * cy);
+    const double dd(bb * bb - (px * px + py * py - pr * pr));
+    if((dd >= 0) && (bb - sqrt(dd) > 0))
+      rr = min(rr, bb - sqrt(dd));
+    rho[ii] = (uint16_t) (rr * 1000);
+  }
+}
+
+
+static void send_scan()
+{
+  struct sick_scan_s scan;
+  if(0 != emu.log){
+    if(0 != sick_log_get(emu.log, emu.log_index, & scan)){
+      emu.log_index = 0;
+      sick_log_get(emu.log, 0, & scan);
+    }
+    ++emu.log_index;
+  }
+  else
+    synthetic_scan(scan.rho);
+
+  // reply, count with unit bits set to mm, values from right to left,
+  // status
+  uint8_t data[726];
+  data[0] = 0xB0;
+  data[1] = 361 & 0xFF;
+  data[2] = ((361 >> 8) & 0x3F) | 0x40;
+  for(int ii(0); ii < 361; ++ii){
+    const uint16_t rr(scan.rho[360 - ii] & 0x1FFF);
+    data[3 + 2 * ii] = rr & 0xFF;
+    data[4 + 2 * ii] = (rr >> 8) & 0xFF;
+  }
+  data[725] = 0x10;
+  send_tgram(data, 726);
+  ++emu.scans;
+}
+
+
+static void send_status()
+{
+  uint8_t data[154];
+  memset(data, 0, sizeof(data));
+  data[0] = 0xB1;
+  data[8] = emu.continuous ? 0x24 : 0x25;
+  data[60] = 0x00;
+  data[66] = 13333 & 0xFF;
+  data[67] = (13333 >> 8) & 0xFF;
+  data[107] = 180;
+  data[109] = 50;
+  switch(emu.baud){
+  case 500000L: data[116] = 0x01; break;
+  case 38400L:  data[116] = 0x19; break;
+  case 19200L:  data[116] = 0x33; break;
+  default:      data[116] = 0x67;
+  }
+  data[122] = 0x01;
+  memcpy(data + 124, "EMU1.0", 6);
+  data[153] = 0x10;
+  send_tgram(data, 154);
+}
+
+
+/**
+   React to a telegram from the host. Baudrate changes take effect
+   after the reply has gone out, just like on the real device.
+*/
+static void handle_request(const uint8_t * tgram, int tlen)
+{
+  ++emu.requests;
+  if(emu.stalled){
+    // Requests are ignored while stalling, so this is how long it
+    // took the host to get going again.
+    cerr << "sickemu: first request " << now() - stamp(emu.stall_end)
+	 << "s after stall\n";
+    emu.stalled = false;
+  }
+
+  emu.outq += (char) ACK;
+  if(arg.verbose)
+    cerr << "sickemu: request 0x" << hex << (int) tgram[4] << dec << "\n";
+
+  switch(tgram[4]){
+  case CMD_REQUEST_SCAN:
+    send_scan();
+    break;
+  case CMD_STATUS:
+    send_status();
+    break;
+  case CMD_CHANGE_OPMODE:
+    {
+      uint8_t reply[3] = { 0xA0, 0x00, 0x10 };
+      unsigned long baud(emu.baud);
+      bool continuous(emu.continuous);
+      switch((5 < tlen) ? tgram[5] : 0){
+      case SICK_OPMODE_CONTINUOUS: continuous = true;   break;
+      case SICK_OPMODE_ON_REQUEST: continuous = false;  break;
+      case 0x40:                   baud = 38400L;       break;
+      case 0x41:                   baud = 19200L;       break;
+      case 0x42:                   baud = 9600L;        break;
+      case 0x48:                   baud = 500000L;      break;
+      default:                     reply[1] = 0x01;
+      }
+      if(B0 == baud_speed(baud))
+	reply[1] = 0x01;
+      send_tgram(reply, 3);
+      if(0x00 == reply[1]){
+	if(baud != emu.baud)
+	  cerr << "sickemu: switching to " << baud << " baud\n";
+	emu.baud = baud;
+	if(continuous && ( ! emu.continuous))
+	  emu.next_frame = emu.line_free;
+	emu.continuous = continuous;
+      }
+    }
+    break;
+  default:
+    emu.outq.resize(emu.outq.size() - 1);
+    emu.outq += (char) NACK;
+  }
+}
+
+
+static void print_stats()
+{
+  cerr << "sickemu: " << emu.requests << " requests, " << emu.ignored
+       << " bytes ignored, " << emu.scans << " scans, " << emu.overruns
+       << " overruns\n";
+}
+
+
+int main(int argc,
+	 char ** argv)
+{
+  parse_args(argc, argv);
+  srand(arg.seed);
+  emu.baud = arg.baud;
+  if(B0 == baud_speed(emu.baud)){
+    cerr << "ERROR: " << emu.baud << " baud not supported.\n";
+    return 1;
+  }
+
+  if( ! arg.log_fname.empty()){
+    emu.log = sick_log_open(arg.log_fname.c_str(), stderr);
+    if((0 == emu.log) || (0 == emu.log->rec.count)){
+      cerr << "ERROR: no scans in \"" << arg.log_fname << "\".\n";
+      return 1;
+    }
+  }
+
+  emu.master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if((emu.master < 0) || (0 != grantpt(emu.master))
+     || (0 != unlockpt(emu.master))){
+    cerr << "ERROR: posix_openpt(): " << strerror(errno) << "\n";
+    return 1;
+  }
+  const string slave_fname(ptsname(emu.master));
+
+  // Keep the slave open ourselves, so that the master does not hang
+  // up between host sessions. We never read from it.
+  emu.slave = open(slave_fname.c_str(), O_RDWR | O_NOCTTY);
+  if(emu.slave < 0){
+    cerr << "ERROR: open(" << slave_fname << "): " << strerror(errno) << "\n";
+    return 1;
+  }
+  struct termios tio;
+  tcgetattr(emu.slave, & tio);
+  cfmakeraw(& tio);
+  cfsetispeed(& tio, baud_speed(emu.baud));
+  cfsetospeed(& tio, baud_speed(emu.baud));
+  tcsetattr(emu.slave, TCSANOW, & tio);
+
+  if( ! arg.link_fname.empty()){
+    unlink(arg.link_fname.c_str());
+    if(0 != symlink(slave_fname.c_str(), arg.link_fname.c_str())){
+      cerr << "ERROR: symlink(" << arg.link_fname << "): "
+	   << strerror(errno) << "\n";
+      return 1;
+    }
+  }
+  cout << slave_fname << "\n" << flush;
+
+  signal(SIGINT, handle);
+  signal(SIGTERM, handle);
+
+  struct sick_parser_s parser;
+  sick_parser_init(& parser, 0x00, 1);
+  gettimeofday(& emu.line_free, 0);
+  emu.tx_next = emu.line_free;
+  emu.next_frame = emu.line_free;
+
+  while( ! done){
+    double tnow(now());
+
+    if(emu.stall_pending){
+      emu.stall_pending = false;
+      emu.stalled = true;
+      emu.reset_pending = chance(arg.reset);
+      set_stamp(emu.stall_end, tnow + 1e-3 * arg.stall_msec);
+      cerr << "sickemu: stalling for " << arg.stall_msec << "ms\n";
+    }
+    const bool stalling(emu.stalled && (tnow < stamp(emu.stall_end)));
+    if(emu.stalled && ( ! stalling) && emu.reset_pending){
+      // Like a power cycle: whatever was in the pipe is lost, and the
+      // host has to find us again.
+      emu.reset_pending = false;
+      emu.outq.clear();
+      emu.continuous = false;
+      emu.baud = arg.baud;
+      cerr << "sickemu: stall over, reset to request mode at " << emu.baud
+	   << " baud\n";
+    }
+    if(emu.stalled && ( ! stalling) && emu.continuous){
+      // nothing to wait for, the host just has to pick up the stream
+      cerr << "sickemu: stall over, streaming again\n";
+      emu.stalled = false;
+    }
+
+    if(emu.continuous && ( ! stalling)
+       && (tnow >= stamp(emu.next_frame))){
+      // Do not pile up frames that the host does not pick up.
+      if(emu.outq.size() > 2 * 732)
+	++emu.overruns;
+      else
+	send_scan();
+      double next(stamp(emu.next_frame) + 1.0 / arg.rate);
+      if(next < stamp(emu.line_free))
+	next = stamp(emu.line_free);
+      if(next < tnow - 1)
+	next = tnow;
+      set_stamp(emu.next_frame, next);
+    }
+
+    // How many bytes the line could have shifted out by now.
+    const double bytetime(10.0 / emu.baud);
+    double tx(stamp(emu.tx_next));
+    if(tx < tnow - 16 * bytetime)
+      tx = tnow - 16 * bytetime;
+    size_t due(0);
+    if(( ! stalling) && ( ! emu.outq.empty()))
+      due = min(emu.outq.size(), (size_t) ((tnow - tx) / bytetime));
+
+    double timeout(1);
+    if(emu.continuous)
+      timeout = stamp(emu.next_frame) - tnow;
+    if(( ! stalling) && ( ! emu.outq.empty()) && (0 == due))
+      timeout = min(timeout, tx + bytetime - tnow);
+    if(stalling)
+      timeout = stamp(emu.stall_end) - tnow;
+
+    struct pollfd pfd;
+    pfd.fd = emu.master;
+    pfd.events = POLLIN;
+    if(0 < due)
+      pfd.events |= POLLOUT;
+    const int msec(timeout > 0 ? (int) ceil(timeout * 1e3) : 0);
+    if(0 > poll(& pfd, 1, msec)){
+      if(EINTR == errno)
+	continue;
+      cerr << "ERROR: poll(): " << strerror(errno) << "\n";
+      break;
+    }
+
+    if(pfd.revents & POLLOUT){
+      const ssize_t nn(write(emu.master, emu.outq.data(), due));
+      if(nn > 0){
+	emu.outq.erase(0, nn);
+	set_stamp(emu.tx_next, tx + nn * bytetime);
+      }
+    }
+
+    if(pfd.revents & POLLIN){
+      uint8_t buf[SICK_MAXTGRAM];
+      const ssize_t nn(read(emu.master, buf, sizeof(buf)));
+      if(nn <= 0)
+	continue;
+      if(stalling){
+	emu.ignored += nn;
+	continue;
+      }
+      if( ! line_ok()){
+	// wrong rate on the host side, that would be garbage
+	emu.ignored += nn;
+	continue;
+      }
+      for(ssize_t ii(0); ii < nn; ++ii){
+	const int result(sick_parser_feed(& parser, buf + ii, 1));
+	if(1 == result)
+	  handle_request(parser.buf, parser.want);
+	else if(-1 == result)
+	  emu.outq += (char) NACK;
+      }
+    }
+  }
+
+  print_stats();
+  if( ! arg.link_fname.empty())
+    unlink(arg.link_fname.c_str());
+  if(0 != emu.log)
+    sick_log_close(emu.log);
+  close(emu.slave);
+  close(emu.master);
+
+  return 0;
+}
@@ -0,0 +1,105 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "sicklog.h"
+#include <string.h>
+#include <stdlib.h>
+
+
+struct sick_log_s * sick_log_create(const char * fname,
+				    FILE * dbg)
+{
+  struct sick_log_s * log = calloc(1, sizeof(* log));
+  if(0 == log)
+    return 0;
+  if(0 != rec_log_create(& log->rec, fname, SICK_LOG_MAGIC,
+			 sizeof(struct sick_record_s), dbg)){
+    free(log);
+    return 0;
+  }
+  return log;
+}
+
+
+struct sick_log_s * sick_log_open(const char * fname,
+				  FILE * dbg)
+{
+  struct sick_log_s * log = calloc(1, sizeof(* log));
+  if(0 == log)
+    return 0;
+  if(0 != rec_log_open(& log->rec, fname, SICK_LOG_MAGIC,
+		       sizeof(struct sick_record_s), dbg)){
+    free(log);
+    return 0;
+  }
+  log->record = log->rec.record;
+  return log;
+}
+
+
+void sick_log_close(struct sick_log_s * log)
+{
+  rec_log_close(& log->rec);
+  free(log);
+}
+
+
+int sick_log_append(struct sick_log_s * log,
+		    const struct sick_scan_s * scan)
+{
+  struct sick_record_s rec;
+  
+  rec.t0_sec = scan->t0.tv_sec;
+  rec.t0_usec = scan->t0.tv_usec;
+  rec.t1_sec = scan->t1.tv_sec;
+  rec.t1_usec = scan->t1.tv_usec;
+  memcpy(rec.rho, scan->rho, sizeof(rec.rho));
+  rec.pad = 0;
+  
+  return rec_log_append(& log->rec, & rec);
+}
+
+
+int sick_log_get(const struct sick_log_s * log,
+		 unsigned long index,
+		 struct sick_scan_s * scan)
+{
+  const struct sick_record_s * rec;
+  
+  if((0 == log->record) || (index >= log->rec.count))
+    return -1;
+  
+  rec = log->record + index;
+  scan->t0.tv_sec = rec->t0_sec;
+  scan->t0.tv_usec = rec->t0_usec;
+  scan->t1.tv_sec = rec->t1_sec;
+  scan->t1.tv_usec = rec->t1_usec;
+  memcpy(scan->rho, rec->rho, sizeof(scan->rho));
+  
+  return 0;
+}
+
+
+unsigned long sick_log_find(const struct sick_log_s * log,
+			    const struct timeval * t0)
+{
+  return rec_log_find(& log->rec, t0);
+}
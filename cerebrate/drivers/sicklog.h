@@ -0,0 +1,89 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+#ifndef SICKLOG_H
+#define SICKLOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include "sick.h"
+#include "reclog.h"
+#include <stddef.h>
+  
+  
+  /** The file starts with these eight bytes. */
+#define SICK_LOG_MAGIC "SICKLOG1"
+  
+  
+  /**
+     On-disk scan record, in host byte order. The poster appends them
+     in the order of t0, which leads the record as reclog.h expects.
+  */
+  struct sick_record_s {
+    uint32_t t0_sec, t0_usec, t1_sec, t1_usec;
+    uint16_t rho[361];
+    uint16_t pad;
+  };
+  
+#define SICK_LOG_HEADER REC_LOG_HEADER
+  
+  
+  /**
+     Binary scan log: a reclog.h file with sick_record_s as its record
+     layout. When opened for reading, record points at the first one,
+     and the number of records is rec.count.
+  */
+  struct sick_log_s {
+    struct rec_log_s rec;
+    const struct sick_record_s * record;
+  };
+  
+  
+  /** Open a log for appending, see rec_log_create(). */
+  struct sick_log_s * sick_log_create(const char * fname, FILE * dbg);
+  
+  /** Open a log for reading, see rec_log_open(). */
+  struct sick_log_s * sick_log_open(const char * fname, FILE * dbg);
+  
+  void sick_log_close(struct sick_log_s * log);
+  
+  /** \return 0 on success, -1 if the log is read-only, -2 on errors. */
+  int sick_log_append(struct sick_log_s * log,
+		      const struct sick_scan_s * scan);
+  
+  /** \return 0 on success, -1 if index is out of range. */
+  int sick_log_get(const struct sick_log_s * log, unsigned long index,
+		   struct sick_scan_s * scan);
+  
+  /**
+     \return The index of the first record with t0 not before the
+     given time, which is log->rec.count if there is none.
+  */
+  unsigned long sick_log_find(const struct sick_log_s * log,
+			      const struct timeval * t0);
+  
+  
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // SICKLOG_H
@@ -0,0 +1,170 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "sick.h"
+#include "fmod_util.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+
+using namespace std;
+
+
+/**
+   The original bit-by-bit SICK CRC, kept as a reference.
+*/
+static uint16_t ref_sick_crc(const uint8_t * tgram, int tlen)
+{
+  uint16_t uCrc16 = 0;
+  uint8_t crc[2] = { 0, 0 };
+  while(tlen--){
+    crc[1] = crc[0];
+    crc[0] = * tgram++;
+    if(uCrc16 & 0x8000){
+      uCrc16 = (uCrc16 & 0x7FFF) << 1;
+      uCrc16 ^= 0x8005;
+    }
+    else
+      uCrc16 <<= 1;
+    uCrc16 ^= ((uint16_t) crc[0]) | ((uint16_t) crc[1] << 8);
+  }
+  return uCrc16;
+}
+
+
+/**
+   The original word-by-word fmod checksum, kept as a reference.
+*/
+static uint16_t ref_fmod_crc(const uint8_t * packet, uint16_t len)
+{
+  uint32_t acc = 0;
+  uint16_t crc0, crc1, i;
+  for(i = 0; i < len / 2; ++i)
+    acc += ntohs((packet[2 * i + 1] << 8) | packet[2 * i]) ^ 0x0000FFFF;
+  if(len % 2 != 0)
+    acc += (packet[len - 1] << 8) ^ 0x0000FFFF;
+  crc0 = acc >> 16;
+  crc1 = acc & 0x0000FFFF;
+  acc = crc0 + crc1;
+  if(acc & 0xFFFF0000)
+    ++acc;
+  return htons(acc & 0x0000FFFF);
+}
+
+
+static uint16_t new_sick_crc(uint8_t * tgram, int tlen)
+{
+  return sick_crc16(tgram, tlen);
+}
+
+
+static uint16_t new_fmod_crc(uint8_t * packet, uint16_t len)
+{
+  uint16_t crc;
+  fmod_crc(packet, len, & crc, 0);
+  return crc;
+}
+
+
+static double usec_since(const struct timeval & t0)
+{
+  struct timeval t1;
+  gettimeofday(& t1, 0);
+  return 1e6 * (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec);
+}
+
+
+template<typename kernel_t>
+static double bench(kernel_t kernel, uint8_t * buf, int len, int nrounds,
+		    unsigned int & sink)
+{
+  struct timeval t0;
+  gettimeofday(& t0, 0);
+  for(int i(0); i < nrounds; ++i)
+    sink += kernel(buf + (i & 7), len);
+  return len * (double) nrounds / usec_since(t0);
+}
+
+
+int main(int argc,
+	 char ** argv)
+{
+  int len(730);
+  int nrounds(200000);
+  if(argc > 1)
+    istringstream(argv[1]) >> len;
+  if(argc > 2)
+    istringstream(argv[2]) >> nrounds;
+  if((len < 1) || (len > 65535) || (nrounds < 1)){
+    cerr << "usage: " << argv[0] << " [length [rounds]]\n";
+    return 1;
+  }
+  
+  // Buffers get an offset of up to 7 bytes to exercise misalignment.
+  vector<uint8_t> buf(65535 + 8);
+  srand(42);
+  
+  int nfail(0);
+  for(int round(0); round < 20; ++round){
+    for(size_t i(0); i < buf.size(); ++i)
+      buf[i] = (0 == round) ? 0xFF : (rand() & 0xFF);
+    for(int ll(0); ll <= 4200; ++ll){
+      const int off(ll & 7);
+      if(ref_sick_crc(& buf[off], ll) != new_sick_crc(& buf[off], ll)){
+	if(0 == nfail)
+	  cout << "sick_crc mismatch at length " << ll << "\n";
+	++nfail;
+      }
+      if(ref_fmod_crc(& buf[off], ll) != new_fmod_crc(& buf[off], ll)){
+	if(0 == nfail)
+	  cout << "fmod_crc mismatch at length " << ll << "\n";
+	++nfail;
+      }
+    }
+    if(ref_fmod_crc(& buf[0], 65535) != new_fmod_crc(& buf[0], 65535)){
+      cout << "fmod_crc mismatch at length 65535\n";
+      ++nfail;
+    }
+  }
+  if(0 != nfail){
+    cout << nfail << " mismatches\n";
+    return 1;
+  }
+  cout << "reference and new kernels agree\n";
+  
+  unsigned int sink(0);
+  double const sref(bench(ref_sick_crc, & buf[0], len, nrounds, sink));
+  double const snew(bench(new_sick_crc, & buf[0], len, nrounds, sink));
+  double const fref(bench(ref_fmod_crc, & buf[0], len, nrounds, sink));
+  double const fnew(bench(new_fmod_crc, & buf[0], len, nrounds, sink));
+  cout << "throughput in MB/s for " << len << " byte buffers"
+       << " (checksum 0x" << hex << sink << dec << "):\n"
+       << "  sick_crc  reference " << sref << "  new " << snew
+       << "  speedup " << snew / sref << "\n"
+       << "  fmod_crc  reference " << fref << "  new " << fnew
+       << "  speedup " << fnew / fref << "\n";
+  
+  return 0;
+}
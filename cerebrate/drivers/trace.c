@@ -0,0 +1,186 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#include "trace.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+
+/*
+  Bounded multi-producer ring after Vyukov: slot i is free for ticket
+  t when its seq equals t, and holds the record of ticket t when its
+  seq is t + 1. Producers claim tickets with a compare-and-swap on
+  head, the single consumer advances tail.
+*/
+static struct trace_record_s ring[TRACE_RING_SIZE];
+static volatile unsigned long head = 0;
+static unsigned long tail = 0;
+static volatile unsigned long dropped = 0;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static pthread_t drain_thread;
+static volatile int drain_running = 0;
+static FILE * drain_sink = 0;
+
+
+static void ring_init(void)
+{
+  unsigned long ii;
+  for(ii = 0; ii < TRACE_RING_SIZE; ++ii)
+    ring[ii].seq = ii;
+}
+
+
+static struct trace_record_s * claim(void)
+{
+  unsigned long pos;
+  struct trace_record_s * rec;
+  pthread_once(& ring_once, ring_init);
+  for(;;){
+    pos = head;
+    rec = & ring[pos & (TRACE_RING_SIZE - 1)];
+    if(rec->seq != pos){
+      if(rec->seq < pos){	/* still holds an unwritten record */
+	__sync_fetch_and_add(& dropped, 1);
+	return 0;
+      }
+      continue;			/* another producer got there first */
+    }
+    if(__sync_bool_compare_and_swap(& head, pos, pos + 1))
+      break;
+  }
+  gettimeofday(& rec->stamp, 0);
+  return rec;
+}
+
+
+static void publish(struct trace_record_s * rec)
+{
+  __sync_synchronize();
+  rec->seq = rec->seq + 1;
+}
+
+
+void trace_post(const char * fmt, long a0, long a1, long a2, long a3)
+{
+  struct trace_record_s * rec = claim();
+  if(0 == rec)
+    return;
+  rec->fmt = fmt;
+  rec->arg[0] = a0;
+  rec->arg[1] = a1;
+  rec->arg[2] = a2;
+  rec->arg[3] = a3;
+  rec->nhex = -1;
+  publish(rec);
+}
+
+
+void trace_hex(const char * what, const uint8_t * buffer, long nbytes)
+{
+  long offset;
+  for(offset = 0; offset < nbytes; offset += 16){
+    struct trace_record_s * rec = claim();
+    if(0 == rec)
+      return;
+    rec->fmt = what;
+    rec->arg[0] = offset;
+    rec->arg[1] = nbytes;
+    rec->nhex = (nbytes - offset > 16) ? 16 : (int) (nbytes - offset);
+    memcpy(rec->hex, buffer + offset, rec->nhex);
+    publish(rec);
+  }
+}
+
+
+/** \return The number of records written. */
+static int drain(FILE * sink)
+{
+  int count = 0;
+  for(;;){
+    struct trace_record_s * rec = & ring[tail & (TRACE_RING_SIZE - 1)];
+    int ii;
+    if(rec->seq != tail + 1)
+      break;
+    __sync_synchronize();
+    fprintf(sink, "%ld.%06ld ",
+	    (long) rec->stamp.tv_sec, (long) rec->stamp.tv_usec);
+    if(rec->nhex < 0)
+      fprintf(sink, rec->fmt,
+	      rec->arg[0], rec->arg[1], rec->arg[2], rec->arg[3]);
+    else{
+      fprintf(sink, "%s [%ld/%ld]:", rec->fmt, rec->arg[0], rec->arg[1]);
+      for(ii = 0; ii < rec->nhex; ++ii)
+	fprintf(sink, (ii % 4 == 0) ? "  %02X" : " %02X", rec->hex[ii]);
+      fprintf(sink, "\n");
+    }
+    __sync_synchronize();
+    rec->seq = tail + TRACE_RING_SIZE;
+    ++tail;
+    ++count;
+  }
+  return count;
+}
+
+
+static void * drain_run(void * arg)
+{
+  struct timespec nap = { 0, 10000000 };
+  while(drain_running)
+    if(0 == drain(drain_sink)){
+      fflush(drain_sink);
+      nanosleep(& nap, 0);
+    }
+  drain(drain_sink);
+  fflush(drain_sink);
+  return arg;
+}
+
+
+int trace_start(FILE * sink)
+{
+  if((TRACE_OFF == TRACE_LEVEL) || drain_running)
+    return 0;
+  pthread_once(& ring_once, ring_init);
+  drain_sink = sink;
+  drain_running = 1;
+  if(0 != pthread_create(& drain_thread, 0, drain_run, 0)){
+    drain_running = 0;
+    return -1;
+  }
+  return 0;
+}
+
+
+void trace_stop(void)
+{
+  if( ! drain_running)
+    return;
+  drain_running = 0;
+  pthread_join(drain_thread, 0);
+}
+
+
+unsigned long trace_dropped(void)
+{
+  return dropped;
+}
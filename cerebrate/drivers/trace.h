@@ -0,0 +1,123 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+  
+  
+  /**
+     \file trace.h Tracing with compile-time levels.
+     
+     Trace points are macros that compile to nothing unless their
+     level is at most TRACE_LEVEL, which is TRACE_OFF unless set with
+     configure --enable-trace=LEVEL. Enabled trace points do not
+     format anything: they copy the format string pointer, up to four
+     integer arguments (or sixteen bytes of a buffer) and a timestamp
+     into a lock-free ring. A background thread started by
+     trace_start() formats and writes the records, so tracing changes
+     the timing of the traced thread as little as possible. When the
+     ring is full, records are dropped and counted.
+     
+     Format strings must be literals, and all conversions must be for
+     long arguments (%ld, %lu, %lX ...).
+  */
+  
+#define TRACE_OFF     0
+#define TRACE_ERROR   1
+#define TRACE_INFO    2
+#define TRACE_VERBOSE 3
+  
+#ifndef TRACE_LEVEL
+# define TRACE_LEVEL TRACE_OFF
+#endif // TRACE_LEVEL
+  
+  /** Number of records in the ring, a power of two. */
+#define TRACE_RING_SIZE 4096
+  
+#define TRACE_ENABLED(level) ((level) <= TRACE_LEVEL)
+  
+#define TRACE0(level, fmt)						\
+  do { if(TRACE_ENABLED(level)) trace_post((fmt), 0, 0, 0, 0); } while(0)
+#define TRACE1(level, fmt, a0)						\
+  do { if(TRACE_ENABLED(level))						\
+      trace_post((fmt), (long) (a0), 0, 0, 0); } while(0)
+#define TRACE2(level, fmt, a0, a1)					\
+  do { if(TRACE_ENABLED(level))						\
+      trace_post((fmt), (long) (a0), (long) (a1), 0, 0); } while(0)
+#define TRACE3(level, fmt, a0, a1, a2)					\
+  do { if(TRACE_ENABLED(level))						\
+      trace_post((fmt), (long) (a0), (long) (a1), (long) (a2), 0); }	\
+  while(0)
+#define TRACE4(level, fmt, a0, a1, a2, a3)				\
+  do { if(TRACE_ENABLED(level))						\
+      trace_post((fmt), (long) (a0), (long) (a1), (long) (a2),		\
+		 (long) (a3)); } while(0)
+  
+  /** Hex dump of a buffer, labelled with what (a literal). */
+#define TRACE_HEX(level, what, buffer, nbytes)				\
+  do { if(TRACE_ENABLED(level))						\
+      trace_hex((what), (buffer), (nbytes)); } while(0)
+  
+  
+  struct trace_record_s {
+    volatile unsigned long seq;
+    struct timeval stamp;
+    const char * fmt;
+    long arg[4];
+    int nhex;			/* bytes in hex[], or -1 for fmt/arg */
+    uint8_t hex[16];
+  };
+  
+  
+  /**
+     Start the thread that writes records to sink, which has to stay
+     open until trace_stop(). Does nothing if TRACE_LEVEL is TRACE_OFF.
+     
+     \return 0 on success, -1 if the thread could not be created.
+  */
+  int trace_start(FILE * sink);
+  
+  /** Write the remaining records and stop the thread. */
+  void trace_stop(void);
+  
+  /** \return The number of records dropped because the ring was full. */
+  unsigned long trace_dropped(void);
+  
+  /** Use the TRACEn() macros instead. */
+  void trace_post(const char * fmt, long a0, long a1, long a2, long a3);
+  
+  /** Use the TRACE_HEX() macro instead. */
+  void trace_hex(const char * what, const uint8_t * buffer, long nbytes);
+  
+  
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // TRACE_H
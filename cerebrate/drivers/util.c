@@ -19,6 +19,7 @@
 
 
 #include "util.h"
+#include "trace.h"
 #include <termios.h>
 #include <stdio.h>
 #include <fcntl.h>
@@ -28,6 +29,120 @@
 #include <sys/socket.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+#ifdef LINUX
+# include <sys/ioctl.h>
+# include <linux/serial.h>
+#endif // LINUX
+
+
+/**
+   Map a baudrate to a termios speed constant. The high-speed
+   constants are not POSIX, so they are only used where the system
+   headers provide them.
+*/
+static int serial_speed(unsigned long baud,
+			speed_t * speed)
+{
+  switch(baud){
+  case 50L    : * speed = B50;     break;
+  case 75L    : * speed = B75;     break;
+  case 110L   : * speed = B110;    break;
+  case 134L   : * speed = B134;    break;
+  case 150L   : * speed = B150;    break;
+  case 200L   : * speed = B200;    break;
+  case 300L   : * speed = B300;    break;
+  case 600L   : * speed = B600;    break;
+  case 1200L  : * speed = B1200;   break;
+  case 1800L  : * speed = B1800;   break;
+  case 2400L  : * speed = B2400;   break;
+  case 4800L  : * speed = B4800;   break;
+  case 9600L  : * speed = B9600;   break;
+  case 19200L : * speed = B19200;  break;
+  case 38400L : * speed = B38400;  break;
+  case 57600L : * speed = B57600;  break;
+  case 115200L: * speed = B115200; break;
+  case 230400L: * speed = B230400; break;
+#ifdef B460800
+  case 460800L: * speed = B460800; break;
+#endif // B460800
+#ifdef B500000
+  case 500000L: * speed = B500000; break;
+#endif // B500000
+#ifdef B576000
+  case 576000L: * speed = B576000; break;
+#endif // B576000
+#ifdef B921600
+  case 921600L: * speed = B921600; break;
+#endif // B921600
+  default:
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+   Fallback for rates without a termios constant: ask the UART driver
+   to replace 38400 by baud_base / custom_divisor, like "setserial
+   spd_cust" does. Refuses if the achievable rate is off by more than
+   two percent.
+*/
+static int serial_custom(int fd,
+			 unsigned long baud,
+			 speed_t * speed)
+{
+#ifdef LINUX
+  struct serial_struct ss;
+  unsigned long actual;
+  if(ioctl(fd, TIOCGSERIAL, & ss) < 0)
+    return -1;
+  if((0 >= ss.baud_base) || (0 == baud))
+    return -2;
+  ss.custom_divisor = (ss.baud_base + baud / 2) / baud;
+  if(0 >= ss.custom_divisor)
+    return -3;
+  actual = ss.baud_base / ss.custom_divisor;
+  if((actual * 50 < baud * 49) || (actual * 50 > baud * 51))
+    return -4;
+  ss.flags = (ss.flags & ~ASYNC_SPD_MASK) | ASYNC_SPD_CUST;
+  if(ioctl(fd, TIOCSSERIAL, & ss) < 0)
+    return -5;
+  * speed = B38400;
+  return 0;
+#else // LINUX
+  return -1;
+#endif // LINUX
+}
+
+
+/**
+   Set the speed fields of tio, undoing any custom divisor left over
+   from an earlier high-speed configuration.
+*/
+static int serial_tio_speed(int fd,
+			    struct termios * tio,
+			    unsigned long baud)
+{
+  speed_t speed;
+  if(0 == serial_speed(baud, & speed)){
+#ifdef LINUX
+    struct serial_struct ss;
+    if((ioctl(fd, TIOCGSERIAL, & ss) == 0)
+       && (ASYNC_SPD_CUST == (ss.flags & ASYNC_SPD_MASK))){
+      ss.flags &= ~ASYNC_SPD_MASK;
+      ioctl(fd, TIOCSSERIAL, & ss);
+    }
+#endif // LINUX
+  }
+  else if(0 != serial_custom(fd, baud, & speed))
+    return -1;
+  if((cfsetispeed(tio, speed) < 0) || (cfsetospeed(tio, speed) < 0))
+    return -2;
+  return 0;
+}
 
 
 int serial_open(const char * device,
@@ -50,31 +165,13 @@ int serial_open(const char * device,
     return -2;
   }
   
-  switch(baud){
-  case 50L    : tio.c_cflag = B50;     break;
-  case 75L    : tio.c_cflag = B75;     break;
-  case 110L   : tio.c_cflag = B110;    break;
-  case 134L   : tio.c_cflag = B134;    break;
-  case 150L   : tio.c_cflag = B150;    break;
-  case 200L   : tio.c_cflag = B200;    break;
-  case 300L   : tio.c_cflag = B300;    break;
-  case 600L   : tio.c_cflag = B600;    break;
-  case 1200L  : tio.c_cflag = B1200;   break;
-  case 1800L  : tio.c_cflag = B1800;   break;
-  case 2400L  : tio.c_cflag = B2400;   break;
-  case 4800L  : tio.c_cflag = B4800;   break;
-  case 9600L  : tio.c_cflag = B9600;   break;
-  case 19200L : tio.c_cflag = B19200;  break;
-  case 38400L : tio.c_cflag = B38400;  break;
-  case 57600L : tio.c_cflag = B57600;  break;
-  case 115200L: tio.c_cflag = B115200; break;
-  case 230400L: tio.c_cflag = B230400; break;
-  default:
+  tio.c_cflag = CS8 | CLOCAL | CREAD ;
+  tio.c_iflag = IGNPAR;
+  if(serial_tio_speed(fd, & tio, baud) != 0){
     fprintf(stderr, "serial_open: baudrate %lu not supported\n", baud);
+    close(fd);
     return -5;
   }
-  tio.c_cflag |= CS8 | CLOCAL | CREAD ;
-  tio.c_iflag = IGNPAR;
   
   if(tcflush(fd, TCIOFLUSH) < 0){
     perror("serial_open: tcflush");
@@ -92,6 +189,40 @@ int serial_open(const char * device,
 }
 
 
+int serial_setbaud(int fd,
+		   unsigned long baud)
+{
+  struct termios tio;
+  
+  if(tcdrain(fd) < 0){
+    perror("serial_setbaud: tcdrain");
+    return -1;
+  }
+  
+  if(tcgetattr(fd, &tio) < 0){
+    perror("serial_setbaud: tcgetattr");
+    return -2;
+  }
+  
+  if(serial_tio_speed(fd, & tio, baud) != 0){
+    fprintf(stderr, "serial_setbaud: baudrate %lu not supported\n", baud);
+    return -3;
+  }
+  
+  if(tcflush(fd, TCIOFLUSH) < 0){
+    perror("serial_setbaud: tcflush");
+    return -4;
+  }
+  
+  if(tcsetattr(fd, TCSANOW, &tio) < 0){
+    perror("serial_setbaud: tcsetattr");
+    return -5;
+  }
+  
+  return 0;
+}
+
+
 int serial_close(int filedescriptor)
 {
   if(tcdrain(filedescriptor) < 0){
@@ -113,28 +244,58 @@ int serial_close(int filedescriptor)
 }
 
 
+int buffer_wait(int fd,
+		short events,
+		const struct timeval * deadline)
+{
+  struct pollfd pfd;
+  int msec = -1;
+  int result;
+  
+  for(;;){
+    if(0 != deadline){
+      struct timeval now, dt;
+      gettimeofday(& now, 0);
+      if(timercmp(& now, deadline, >=))
+	return 0;
+      timersub(deadline, & now, & dt);
+      msec = dt.tv_sec * 1000 + (dt.tv_usec + 999) / 1000;
+    }
+    
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    result = poll(& pfd, 1, msec);
+    if(result > 0){
+      if(pfd.revents & (POLLERR | POLLNVAL))
+	return -1;
+      return 1;
+    }
+    if(0 == result)
+      return 0;
+    if(EINTR != errno){
+      perror("buffer_wait: poll");
+      return -1;
+    }
+  }
+}
+
+
 int buffer_write(int fd,
 		 const uint8_t * buffer,
 		 ssize_t n_bytes,
 		 FILE * dbg)
 {
-  if(dbg != 0){
-    ssize_t i;
-    fprintf(dbg, "DEBUG buffer_write():\n ");
-    for(i = 0; i < n_bytes; ++i){
-      fprintf(dbg, " %02X", buffer[i]);
-      if(i % 4 == 3)
-	fprintf(dbg, "  ");
-      if(i % 16 == 15)
-	fprintf(dbg, "\n ");
-    }
-    fprintf(dbg, "\n");
-  }
+  TRACE_HEX(TRACE_VERBOSE, "buffer_write", buffer, n_bytes);
   
   while(n_bytes > 0){
-    ssize_t n;
-    while((n = write(fd, buffer, n_bytes)) == 0);
+    ssize_t n = write(fd, buffer, n_bytes);
     if(n < 0){
+      if((EAGAIN == errno) || (EINTR == errno)){
+	if(buffer_wait(fd, POLLOUT, 0) < 0)
+	  return -1;
+	continue;
+      }
       perror("buffer_write: write");
       return -1;
     }
@@ -147,42 +308,81 @@ int buffer_write(int fd,
 }
 
 
-int buffer_read(int fd,
-		uint8_t * buffer,
-		ssize_t n_bytes,
-		FILE * dbg)
+/**
+   Common implementation of buffer_read() and buffer_read_timeout().
+   Sleeps in poll() instead of spinning on read(). A read that returns
+   nothing although poll() said there was data means end of file.
+*/
+static int buffer_read_until(int fd,
+			     uint8_t * buffer,
+			     ssize_t n_bytes,
+			     const struct timeval * deadline,
+			     const char * what,
+			     FILE * dbg)
 {
   ssize_t remain = n_bytes;
-  uint8_t * bp = buffer;  
+  uint8_t * bp = buffer;
+  int ready = 0;
+  
   while(remain > 0){
-    ssize_t n;
-    while((n = read(fd, bp, remain)) == 0);
+    ssize_t n = read(fd, bp, remain);
     if(n < 0){
-      perror("buffer_read: read");
+      if((EAGAIN != errno) && (EINTR != errno)){
+	fprintf(stderr, "%s: read: %s\n", what, strerror(errno));
+	return -1;
+      }
+      n = 0;
+    }
+    else if((0 == n) && ready){
+      fprintf(stderr, "%s: end of file\n", what);
       return -1;
     }
     
+    if(0 == n){
+      ready = buffer_wait(fd, POLLIN, deadline);
+      if(ready < 0)
+	return -1;
+      if(0 == ready)
+	return -2;
+      continue;
+    }
+    
+    ready = 0;
     remain -= n;
     bp     += n;
   }
   
-  if(dbg != 0){
-    ssize_t i;
-    fprintf(dbg, "DEBUG buffer_read():\n ");
-    for(i = 0; i < n_bytes; ++i){
-      fprintf(dbg, " %02X", buffer[i]);
-      if(i % 4 == 3)
-	fprintf(dbg, "  ");
-      if(i % 16 == 15)
-	fprintf(dbg, "\n ");
-    }
-    fprintf(dbg, "\n");
-  }
+  TRACE_HEX(TRACE_VERBOSE, what, buffer, n_bytes);
   
   return 0;
 }
 
 
+int buffer_read(int fd,
+		uint8_t * buffer,
+		ssize_t n_bytes,
+		FILE * dbg)
+{
+  return buffer_read_until(fd, buffer, n_bytes, 0, "buffer_read", dbg);
+}
+
+
+int buffer_read_timeout(int fd,
+			uint8_t * buffer,
+			ssize_t n_bytes,
+			unsigned int usec_timeout,
+			FILE * dbg)
+{
+  struct timeval deadline, dt;
+  gettimeofday(& deadline, 0);
+  dt.tv_sec = usec_timeout / 1000000;
+  dt.tv_usec = usec_timeout % 1000000;
+  timeradd(& deadline, & dt, & deadline);
+  return buffer_read_until(fd, buffer, n_bytes, & deadline,
+			   "buffer_read_timeout", dbg);
+}
+
+
 int tcp_open(uint32_t portnum,
 	     const char * server)
 {
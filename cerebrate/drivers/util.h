@@ -28,18 +28,42 @@ extern "C" {
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <sys/time.h>
   
   
   int serial_open(const char * device, unsigned long baud);
   int serial_close(int fd);
+  
+  /**
+     Change the baudrate of an open serial device. Rates above 230400
+     use the B460800 ... B921600 constants where available, and fall
+     back to a custom UART divisor on Linux.
+  */
+  int serial_setbaud(int fd, unsigned long baud);
 
   int tcp_open(uint32_t portnum, const char * server);
   int tcp_close(int fd);
 
+  /**
+     Sleep until fd is ready for events (POLLIN or POLLOUT), or until
+     the deadline passes. Pass a null deadline to wait forever.
+     
+     \return 1 if ready, 0 on timeout, -1 on errors.
+  */
+  int buffer_wait(int fd, short events, const struct timeval * deadline);
+  
   int buffer_write(int fd, const uint8_t * buffer, ssize_t n_bytes,
 		   FILE * dbg);
   int buffer_read(int fd, uint8_t * buffer, ssize_t n_bytes, FILE * dbg);
   
+  /**
+     Like buffer_read(), but gives up after usec_timeout.
+     
+     \return 0 on success, -1 on read errors, -2 on timeout.
+  */
+  int buffer_read_timeout(int fd, uint8_t * buffer, ssize_t n_bytes,
+			  unsigned int usec_timeout, FILE * dbg);
+  
   /**
      Set the function for cleaning up after your program. Also sets up
      signal handlers for SIGINT, SIGHUP, and SIGTERM to call that ceanup
@@ -0,0 +1,200 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+#include "Pose.hpp"
+#include "numeric.hpp"
+#include <cmath>
+
+
+namespace sfl {
+
+  Pose::
+  Pose()
+  {
+    for(int i(0); i < 3; ++i)
+      for(int j(0); j < 3; ++j)
+	_cov[i][j] = 0;
+  }
+
+
+  Pose::
+  Pose(const Frame & frame):
+    Frame(frame)
+  {
+    for(int i(0); i < 3; ++i)
+      for(int j(0); j < 3; ++j)
+	_cov[i][j] = 0;
+  }
+
+
+  Pose::
+  Pose(double x,
+       double y,
+       double theta,
+       const double cov[3][3]):
+    Frame(x, y, theta)
+  {
+    SetCovariance(cov);
+  }
+
+
+  void Pose::
+  SetCovariance(const double cov[3][3])
+  {
+    for(int i(0); i < 3; ++i)
+      for(int j(0); j < 3; ++j)
+	_cov[i][j] = cov[i][j];
+  }
+
+
+  double Pose::
+  Cov(int row,
+      int column) const
+  {
+    return _cov[row][column];
+  }
+
+
+  void Pose::
+  Compose(double dx,
+	  double dy,
+	  double dtheta,
+	  const double q[3][3])
+  {
+    const double c(_costheta);
+    const double s(_sintheta);
+    
+    // Jacobians with respect to the pose (F) and to the step (G)
+    const double F[3][3] = {
+      { 1, 0, - s * dx - c * dy },
+      { 0, 1,   c * dx - s * dy },
+      { 0, 0, 1 } };
+    const double G[3][3] = {
+      { c, -s, 0 },
+      { s,  c, 0 },
+      { 0,  0, 1 } };
+    
+    double FP[3][3], GQ[3][3];
+    for(int i(0); i < 3; ++i)
+      for(int j(0); j < 3; ++j){
+	FP[i][j] = 0;
+	GQ[i][j] = 0;
+	for(int k(0); k < 3; ++k){
+	  FP[i][j] += F[i][k] * _cov[k][j];
+	  GQ[i][j] += G[i][k] * q[k][j];
+	}
+      }
+    for(int i(0); i < 3; ++i)
+      for(int j(0); j < 3; ++j){
+	double sum(0);
+	for(int k(0); k < 3; ++k)
+	  sum += FP[i][k] * F[j][k] + GQ[i][k] * G[j][k];
+	_cov[i][j] = sum;
+      }
+    
+    Set(_x + c * dx - s * dy, _y + s * dx + c * dy, _theta + dtheta);
+  }
+
+
+  void Pose::
+  Compose(const Pose & step)
+  {
+    Compose(step._x, step._y, step._theta, step._cov);
+  }
+
+
+  bool Pose::
+  Fuse(double x,
+       double y,
+       bool known_theta,
+       double theta,
+       const double cov[3][3],
+       double gate)
+  {
+    const int m(known_theta ? 3 : 2);
+    const double innov[3] = { x - _x, y - _y, mod2pi(theta - _theta) };
+    
+    // innovation covariance S and its inverse, by cofactors
+    double S[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 1 } };
+    for(int i(0); i < m; ++i)
+      for(int j(0); j < m; ++j)
+	S[i][j] = _cov[i][j] + cov[i][j];
+    const double det(S[0][0] * (S[1][1] * S[2][2] - S[1][2] * S[2][1])
+		     - S[0][1] * (S[1][0] * S[2][2] - S[1][2] * S[2][0])
+		     + S[0][2] * (S[1][0] * S[2][1] - S[1][1] * S[2][0]));
+    if(absval(det) < 1e-18)
+      return false;
+    double Sinv[3][3];
+    for(int i(0); i < 3; ++i)
+      for(int j(0); j < 3; ++j){
+	const int i1((j + 1) % 3), i2((j + 2) % 3);
+	const int j1((i + 1) % 3), j2((i + 2) % 3);
+	Sinv[i][j] = (S[i1][j1] * S[i2][j2] - S[i1][j2] * S[i2][j1]) / det;
+      }
+    
+    double d2(0);
+    for(int i(0); i < m; ++i)
+      for(int j(0); j < m; ++j)
+	d2 += innov[i] * Sinv[i][j] * innov[j];
+    if(d2 > gate)
+      return false;
+    
+    // gain K = P H' S^-1, then P -= K H P
+    double K[3][3];
+    for(int i(0); i < 3; ++i)
+      for(int j(0); j < m; ++j){
+	K[i][j] = 0;
+	for(int k(0); k < m; ++k)
+	  K[i][j] += _cov[i][k] * Sinv[k][j];
+      }
+    double dstate[3] = { 0, 0, 0 };
+    double P[3][3];
+    for(int i(0); i < 3; ++i){
+      for(int k(0); k < m; ++k)
+	dstate[i] += K[i][k] * innov[k];
+      for(int j(0); j < 3; ++j){
+	P[i][j] = _cov[i][j];
+	for(int k(0); k < m; ++k)
+	  P[i][j] -= K[i][k] * _cov[k][j];
+      }
+    }
+    for(int i(0); i < 3; ++i)
+      for(int j(0); j < 3; ++j)
+	_cov[i][j] = 0.5 * (P[i][j] + P[j][i]);
+    
+    Set(_x + dstate[0], _y + dstate[1], _theta + dstate[2]);
+    return true;
+  }
+
+
+  void Pose::
+  GetEllipse(double & major,
+	     double & minor,
+	     double & angle) const
+  {
+    const double mean(0.5 * (_cov[0][0] + _cov[1][1]));
+    const double half(0.5 * (_cov[0][0] - _cov[1][1]));
+    const double root(sqrt(sqr(half) + sqr(_cov[0][1])));
+    major = sqrt(mean + root);
+    minor = (mean > root) ? sqrt(mean - root) : 0;
+    angle = 0.5 * atan2(2 * _cov[0][1], _cov[0][0] - _cov[1][1]);
+  }
+
+}
@@ -0,0 +1,112 @@
+/* 
+ * Copyright (C) 2005 Roland Philippsen <roland dot philippsen at gmx dot net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+
+#ifndef SUNFLOWER_POSE_HPP
+#define SUNFLOWER_POSE_HPP
+
+
+#include <sfl/Frame.hpp>
+
+
+namespace sfl {
+
+
+  /**
+     Coordinate frame with the covariance of (x, y, theta), along
+     with the prediction and correction steps of an extended Kalman
+     filter. Everything works on fixed size arrays, nothing is
+     allocated.
+  */
+  class Pose
+    : public Frame
+  {
+  public:
+    /**
+       Default Pose at (0, 0, 0) with zero covariance.
+    */
+    Pose();
+
+    /**
+       Pose at frame with zero covariance.
+    */
+    Pose(const Frame & frame);
+
+    /**
+       Pose at (x, y, theta) with covariance cov.
+    */
+    Pose(double x,
+	 double y,
+	 double theta,
+	 const double cov[3][3]);
+
+    void SetCovariance(const double cov[3][3]);
+
+    /**
+       \return Element (row, column) of the covariance, in the order
+       x, y, theta.
+    */
+    double Cov(int row, int column) const;
+
+    /**
+       Prediction step: move by (dx, dy, dtheta), expressed in this
+       frame, whose own covariance is q (also in this frame).
+    */
+    void Compose(double dx,
+		 double dy,
+		 double dtheta,
+		 const double q[3][3]);
+
+    /**
+       Like Compose(double, double, double, const double[3][3]), with
+       the step and its covariance taken from step.
+    */
+    void Compose(const Pose & step);
+
+    /**
+       Correction step with a measurement of the position, and of
+       the heading if known_theta. Only the position block of cov is
+       used unless known_theta. If the squared Mahalanobis distance of
+       the innovation exceeds gate, the measurement is rejected and
+       the Pose left alone.
+
+       \return false if the measurement was rejected.
+    */
+    bool Fuse(double x,
+	      double y,
+	      bool known_theta,
+	      double theta,
+	      const double cov[3][3],
+	      double gate);
+
+    /**
+       Axes and orientation of the one-sigma ellipse of the position.
+    */
+    void GetEllipse(double & major,
+		    double & minor,
+		    double & angle) const;
+
+
+  protected:
+    double _cov[3][3];
+  };
+
+}
+
+#endif // SUNFLOWER_POSE_HPP